@@ -191,6 +191,66 @@ hosttest: clean
 testclean:
 	$(RM) -r $(TEST_BUILD_DIR)
 
+#==============================================================================#
+# Host microbenchmarks (requires all dependencies installed):
+#
+# Each bench binary prints one JSON line per benchmark to stdout:
+#   {"bench":"<name>","iterations":N,"ns_per_op":X,"allocs_per_op":Y}
+# Redirect the output to a file to compare results between commits.
+
+BENCH_SRC_DIR = src/bench
+BENCH_BUILD_DIR = src/bench/bin
+BENCH_FIXTURE_DIR = $(BENCH_SRC_DIR)/fixtures
+BENCH_SUPPORT_SRCS = $(BENCH_SRC_DIR)/bench_support.c
+BENCH_SRCS = $(filter-out $(BENCH_SUPPORT_SRCS),$(wildcard $(BENCH_SRC_DIR)/bench_*.c))
+BENCH_BINS = $(patsubst $(BENCH_SRC_DIR)/%.c,$(BENCH_BUILD_DIR)/%,$(BENCH_SRCS))
+BENCH_HDRS = $(wildcard src/*.h) $(wildcard src/platform/*.h) $(wildcard $(BENCH_SRC_DIR)/*.h)
+
+$(BENCH_BUILD_DIR)/%: $(BENCH_SRC_DIR)/%.c $(BENCH_SUPPORT_SRCS) $(TEST_BACKEND_SRCS) $(BENCH_HDRS)
+	@mkdir -p $(dir $@)
+	$(CC) $(CFLAGS) -Isrc -DBENCH_FIXTURE_DIR="\"$(BENCH_FIXTURE_DIR)\"" $< $(BENCH_SUPPORT_SRCS) $(TEST_BACKEND_SRCS) $(LDLIBS) -o $@
+
+.PHONY: benchrun
+benchrun: $(BENCH_BINS)
+	@for bench_bin in $(BENCH_BINS); do \
+	  $$bench_bin || exit 1; \
+	done
+
+.PHONY: bench
+bench: clean
+	@$(MAKE) \
+	  OECORE_SDK_VERSION=host \
+	  APPTYPE=host \
+	  FINAL=y \
+	  benchrun
+
+#==============================================================================#
+# Host tools (requires all dependencies installed):
+#
+# ws_loadgen drives a running backend with N WebSocket clients and prints a
+# latency/jitter summary, see src/tools/ws_loadgen.c for the options.
+# shm_reader prints the samples published with the backend option -m.
+
+TOOLS_SRC_DIR = src/tools
+TOOLS_BUILD_DIR = src/tools/bin
+TOOLS_SRCS = $(wildcard $(TOOLS_SRC_DIR)/*.c)
+TOOLS_BINS = $(patsubst $(TOOLS_SRC_DIR)/%.c,$(TOOLS_BUILD_DIR)/%,$(TOOLS_SRCS))
+TOOLS_HDRS = $(wildcard src/*.h) $(wildcard src/platform/*.h)
+
+$(TOOLS_BUILD_DIR)/%: $(TOOLS_SRC_DIR)/%.c $(TEST_BACKEND_SRCS) $(TOOLS_HDRS)
+	@mkdir -p $(dir $@)
+	$(CC) $(CFLAGS) -Isrc $< $(TEST_BACKEND_SRCS) $(LDLIBS) -o $@
+
+.PHONY: toolsbuild
+toolsbuild: $(TOOLS_BINS)
+
+.PHONY: tools
+tools:
+	@$(MAKE) \
+	  OECORE_SDK_VERSION=host \
+	  APPTYPE=host \
+	  toolsbuild
+
 #==============================================================================#
 # NOTE: Build for legacy 32-bit products for testing (not release):
 
@@ -0,0 +1,385 @@
+/* alerts.c
+ *
+ * Server-side threshold alerts evaluated at sample time.
+ *
+ * - Rules are per session and stored in per_session_data::alert_rules.
+ * - Each rule is a small state machine:
+ *     OK     -> FIRING   when "metric op value" holds continuously for for_ms
+ *     FIRING -> OK       when the metric is back past value by the hysteresis
+ *                        margin continuously for clear_ms
+ * - Only transitions are pushed to the client, as
+ *     { "event": { "type": "alert", "state": "firing" | "resolved", ... } }
+ *   so a dashboard can watch many devices without streaming every frame.
+ * - While any rule exists the sampler keeps running, even without stats_stream.
+ */
+#include <math.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <glib.h>
+
+#include "alerts.h"
+#include "json_out.h"
+#include "ws_server.h"
+
+/* Default hysteresis as a fraction of |value| when the client sets none */
+#define ALERT_DEFAULT_HYSTERESIS_FRACTION 0.05
+/* Upper bound for for_ms / clear_ms (1 hour) */
+#define ALERT_MAX_DURATION_MS 3600000
+
+static const char *const alert_metric_names[ALERT_METRIC_COUNT] = {
+  "cpu", "cpu_core_max", "mem_used_percent", "mem_available_kb", "load1", "load5", "load15",
+};
+
+static const char *const alert_op_names[ALERT_OP_COUNT] = { ">", ">=", "<", "<=" };
+
+/* Sessions that currently hold at least one rule */
+static GList *alert_sessions = NULL;
+/* Next rule id, shared by all sessions so ids are unique in logs */
+static unsigned int next_rule_id = 1;
+
+/******************************************************************************/
+
+static bool
+metric_value(enum alert_metric metric, const struct sys_stats *stats, double *out)
+{
+  switch (metric) {
+  case ALERT_METRIC_CPU:
+    *out = stats->cpu_usage;
+    return true;
+  case ALERT_METRIC_CPU_CORE_MAX: {
+    double max = 0.0;
+    for (size_t i = 0; i < stats->cpu_per_core_count; i++) {
+      if (stats->cpu_per_core_usage[i] > max) {
+        max = stats->cpu_per_core_usage[i];
+      }
+    }
+    *out = max;
+    return stats->cpu_per_core_count > 0;
+  }
+  case ALERT_METRIC_MEM_USED_PERCENT:
+    if (stats->mem_total_kb <= 0) {
+      return false;
+    }
+    *out = (double)(stats->mem_total_kb - stats->mem_available_kb) * 100.0 / (double)stats->mem_total_kb;
+    return true;
+  case ALERT_METRIC_MEM_AVAILABLE_KB:
+    *out = (double)stats->mem_available_kb;
+    return stats->mem_total_kb > 0;
+  case ALERT_METRIC_LOAD1:
+    *out = stats->load1;
+    return true;
+  case ALERT_METRIC_LOAD5:
+    *out = stats->load5;
+    return true;
+  case ALERT_METRIC_LOAD15:
+    *out = stats->load15;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* True when the firing condition holds */
+static bool
+condition_holds(const struct alert_rule *rule, double v)
+{
+  switch (rule->op) {
+  case ALERT_OP_GT:
+    return v > rule->value;
+  case ALERT_OP_GE:
+    return v >= rule->value;
+  case ALERT_OP_LT:
+    return v < rule->value;
+  case ALERT_OP_LE:
+    return v <= rule->value;
+  default:
+    return false;
+  }
+}
+
+/* True when the metric is back on the safe side of value by the hysteresis margin */
+static bool
+clear_condition_holds(const struct alert_rule *rule, double v)
+{
+  if (rule->op == ALERT_OP_GT || rule->op == ALERT_OP_GE) {
+    return v < rule->value - rule->hysteresis || (rule->hysteresis <= 0.0 && !condition_holds(rule, v));
+  }
+
+  return v > rule->value + rule->hysteresis || (rule->hysteresis <= 0.0 && !condition_holds(rule, v));
+}
+
+/******************************************************************************/
+
+static void
+send_rule_message(struct per_session_data *pss, const struct alert_rule *rule, const char *state, double observed)
+{
+  char json[MAX_SMALL_CONTROL_MESSAGE_LENGTH * 4];
+  bool truncated = false;
+  size_t len = build_alert_json(json, sizeof(json), rule, state, observed, &truncated);
+
+  if (len > 0 && !truncated) {
+    ws_server_queue_json(pss, json, len);
+  }
+}
+
+static void
+session_rules_changed(struct per_session_data *pss)
+{
+  bool listed = g_list_find(alert_sessions, pss) != NULL;
+  bool has_rules = pss->alert_rules && pss->alert_rules->len > 0;
+
+  if (has_rules && !listed) {
+    alert_sessions = g_list_prepend(alert_sessions, pss);
+  } else if (!has_rules && listed) {
+    alert_sessions = g_list_remove(alert_sessions, pss);
+  }
+}
+
+static int
+lookup_name(const char *name, const char *const *names, int count)
+{
+  for (int i = 0; i < count; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/* Parse a non-negative duration field, absent = default_ms */
+static bool
+parse_duration(json_t *spec, const char *key, uint64_t default_ms, uint64_t *out)
+{
+  json_t *v = json_object_get(spec, key);
+
+  if (!v) {
+    *out = default_ms;
+    return true;
+  }
+  if (!json_is_integer(v) || json_integer_value(v) < 0 || json_integer_value(v) > ALERT_MAX_DURATION_MS) {
+    return false;
+  }
+  *out = (uint64_t)json_integer_value(v);
+
+  return true;
+}
+
+bool
+alerts_parse_rule(json_t *spec, struct alert_rule *rule, const char **error_message)
+{
+  json_t *metric = json_object_get(spec, "metric");
+  json_t *op = json_object_get(spec, "op");
+  json_t *value = json_object_get(spec, "value");
+  json_t *hysteresis = json_object_get(spec, "hysteresis");
+  int idx;
+
+  memset(rule, 0, sizeof(*rule));
+  if (!json_is_string(metric) ||
+      (idx = lookup_name(json_string_value(metric), alert_metric_names, ALERT_METRIC_COUNT)) < 0) {
+    *error_message = "Unknown alert metric";
+    return false;
+  }
+  rule->metric = (enum alert_metric)idx;
+  if (!json_is_string(op) || (idx = lookup_name(json_string_value(op), alert_op_names, ALERT_OP_COUNT)) < 0) {
+    *error_message = "op must be one of >, >=, <, <=";
+    return false;
+  }
+  rule->op = (enum alert_op)idx;
+  if (!json_is_number(value) || !isfinite(json_number_value(value))) {
+    *error_message = "value must be a number";
+    return false;
+  }
+  rule->value = json_number_value(value);
+  if (!parse_duration(spec, "for_ms", 0, &rule->for_ms) ||
+      !parse_duration(spec, "clear_ms", rule->for_ms, &rule->clear_ms)) {
+    *error_message = "for_ms and clear_ms must be integers in [0, 3600000]";
+    return false;
+  }
+  if (hysteresis) {
+    if (!json_is_number(hysteresis) || !(json_number_value(hysteresis) >= 0.0)) {
+      *error_message = "hysteresis must be a non-negative number";
+      return false;
+    }
+    rule->hysteresis = json_number_value(hysteresis);
+  } else {
+    rule->hysteresis = fabs(rule->value) * ALERT_DEFAULT_HYSTERESIS_FRACTION;
+  }
+
+  return true;
+}
+
+bool
+alerts_rule_matches(const struct alert_rule *rule, const struct sys_stats *stats, double *observed)
+{
+  double v = 0.0;
+
+  if (!rule || !stats || !metric_value(rule->metric, stats, &v)) {
+    return false;
+  }
+  if (observed) {
+    *observed = v;
+  }
+
+  return condition_holds(rule, v);
+}
+
+static void
+add_rule(struct per_session_data *pss, json_t *spec)
+{
+  struct alert_rule rule;
+  const char *error_message = NULL;
+
+  if (!alerts_parse_rule(spec, &rule, &error_message)) {
+    ws_server_send_error(pss, "invalid_alert_request", error_message);
+    return;
+  }
+
+  if (!pss->alert_rules) {
+    pss->alert_rules = g_array_sized_new(FALSE, FALSE, sizeof(struct alert_rule), MAX_ALERT_RULES_PER_SESSION);
+  }
+  if (pss->alert_rules->len >= MAX_ALERT_RULES_PER_SESSION) {
+    ws_server_send_error(pss, "alert_limit", "Too many alert rules for this connection");
+    return;
+  }
+
+  rule.id = next_rule_id++;
+  g_array_append_val(pss->alert_rules, rule);
+  session_rules_changed(pss);
+  syslog(LOG_INFO,
+         "Client added alert %u: %s %s %g for %llu ms",
+         rule.id,
+         alert_metric_names[rule.metric],
+         alert_op_names[rule.op],
+         rule.value,
+         (unsigned long long)rule.for_ms);
+
+  /* Acknowledge with the effective rule (defaults filled in) */
+  send_rule_message(pss, &rule, NULL, 0.0);
+}
+
+static void
+remove_rule(struct per_session_data *pss, json_int_t id)
+{
+  if (pss->alert_rules) {
+    for (guint i = 0; i < pss->alert_rules->len; i++) {
+      if ((json_int_t)g_array_index(pss->alert_rules, struct alert_rule, i).id == id) {
+        g_array_remove_index(pss->alert_rules, i);
+        session_rules_changed(pss);
+        return;
+      }
+    }
+  }
+  ws_server_send_error(pss, "alert_not_found", "No alert rule with this id");
+}
+
+bool
+alerts_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root)
+{
+  json_t *spec = json_object_get(root, "alert");
+  (void)wsi;
+
+  if (!spec) {
+    return false;
+  }
+  if (!json_is_object(spec)) {
+    ws_server_send_error(pss, "invalid_alert_request", "alert must be an object");
+    return true;
+  }
+
+  json_t *remove = json_object_get(spec, "remove");
+  if (remove) {
+    if (!json_is_integer(remove)) {
+      ws_server_send_error(pss, "invalid_alert_request", "remove must be an alert id");
+      return true;
+    }
+    remove_rule(pss, json_integer_value(remove));
+    return true;
+  }
+  if (json_is_true(json_object_get(spec, "clear"))) {
+    alerts_session_closed(pss);
+    return true;
+  }
+
+  add_rule(pss, spec);
+  return true;
+}
+
+/******************************************************************************/
+
+void
+alerts_evaluate(const struct sys_stats *stats)
+{
+  if (!stats) {
+    return;
+  }
+
+  for (GList *l = alert_sessions; l; l = l->next) {
+    struct per_session_data *pss = l->data;
+
+    for (guint i = 0; i < pss->alert_rules->len; i++) {
+      struct alert_rule *rule = &g_array_index(pss->alert_rules, struct alert_rule, i);
+      double v = 0.0;
+
+      if (!metric_value(rule->metric, stats, &v)) {
+        continue;
+      }
+
+      /* Condition that would move the rule to the other state */
+      bool transition = rule->firing ? clear_condition_holds(rule, v) : condition_holds(rule, v);
+      if (!transition) {
+        rule->since_mono_ms = 0;
+        continue;
+      }
+      if (rule->since_mono_ms == 0) {
+        rule->since_mono_ms = stats->monotonic_ms;
+      }
+      if (stats->monotonic_ms - rule->since_mono_ms < (rule->firing ? rule->clear_ms : rule->for_ms)) {
+        continue;
+      }
+
+      rule->firing = !rule->firing;
+      rule->since_mono_ms = 0;
+      syslog(LOG_INFO,
+             "Alert %u %s: %s = %g",
+             rule->id,
+             rule->firing ? "firing" : "resolved",
+             alert_metric_names[rule->metric],
+             v);
+      send_rule_message(pss, rule, rule->firing ? "firing" : "resolved", v);
+    }
+  }
+}
+
+bool
+alerts_active(void)
+{
+  return alert_sessions != NULL;
+}
+
+void
+alerts_session_closed(struct per_session_data *pss)
+{
+  if (!pss) {
+    return;
+  }
+
+  alert_sessions = g_list_remove(alert_sessions, pss);
+  if (pss->alert_rules) {
+    g_array_free(pss->alert_rules, TRUE);
+    pss->alert_rules = NULL;
+  }
+}
+
+const char *
+alerts_metric_name(const struct alert_rule *rule)
+{
+  return rule && rule->metric < ALERT_METRIC_COUNT ? alert_metric_names[rule->metric] : "";
+}
+
+const char *
+alerts_op_name(const struct alert_rule *rule)
+{
+  return rule && rule->op < ALERT_OP_COUNT ? alert_op_names[rule->op] : "";
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <jansson.h>
+#include <libwebsockets.h>
+
+#include "session.h"
+#include "stats.h"
+
+/* Maximum number of alert rules per WebSocket session */
+#define MAX_ALERT_RULES_PER_SESSION 8
+
+enum alert_metric {
+  ALERT_METRIC_CPU = 0,
+  ALERT_METRIC_CPU_CORE_MAX,
+  ALERT_METRIC_MEM_USED_PERCENT,
+  ALERT_METRIC_MEM_AVAILABLE_KB,
+  ALERT_METRIC_LOAD1,
+  ALERT_METRIC_LOAD5,
+  ALERT_METRIC_LOAD15,
+  ALERT_METRIC_COUNT
+};
+
+enum alert_op { ALERT_OP_GT = 0, ALERT_OP_GE, ALERT_OP_LT, ALERT_OP_LE, ALERT_OP_COUNT };
+
+/* One alert rule and its evaluation state */
+struct alert_rule {
+  unsigned int id;
+  enum alert_metric metric;
+  enum alert_op op;
+  double value;
+  double hysteresis;
+  uint64_t for_ms;
+  uint64_t clear_ms;
+  bool firing;
+  /* Monotonic time the pending transition condition started holding (0 = not holding) */
+  uint64_t since_mono_ms;
+};
+
+/* Handle alert rule control messages.
+ *
+ * Request formats:
+ *   { "alert": { "metric": "cpu", "op": ">", "value": 90, "for_ms": 10000 } }
+ *     Optional: "hysteresis" (metric units), "clear_ms" (default for_ms).
+ *   { "alert": { "remove": <id> } }
+ *   { "alert": { "clear": true } }
+ *
+ * Returns true if the command was recognized (successfully or not).
+ */
+bool alerts_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root);
+
+/* Parse one rule specification:
+ *   { "metric": ..., "op": ..., "value": ..., "for_ms"?, "hysteresis"?, "clear_ms"? }
+ *
+ * The id and evaluation state of *rule are zeroed. On failure returns false
+ * and points *error_message at a static client-facing message.
+ */
+bool alerts_parse_rule(json_t *spec, struct alert_rule *rule, const char **error_message);
+
+/* Return true when the firing condition of rule holds for stats (ignoring
+ * for_ms). observed (optional) receives the metric value.
+ */
+bool alerts_rule_matches(const struct alert_rule *rule, const struct sys_stats *stats, double *observed);
+
+/* Evaluate all rules of all sessions against one fresh sample.
+ *
+ * Called once per sample tick. Pushes an alert event to a session only on a
+ * firing or resolved transition.
+ */
+void alerts_evaluate(const struct sys_stats *stats);
+
+/* Return true while at least one session has an alert rule. */
+bool alerts_active(void);
+
+/* Drop all rules of a session (on disconnect). */
+void alerts_session_closed(struct per_session_data *pss);
+
+/* Return the protocol names of a rule's metric and comparison operator. */
+const char *alerts_metric_name(const struct alert_rule *rule);
+const char *alerts_op_name(const struct alert_rule *rule);
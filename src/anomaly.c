@@ -0,0 +1,216 @@
+/* anomaly.c
+ *
+ * Online anomaly detection on sampled metrics.
+ *
+ * - Each metric keeps an exponentially weighted mean and variance, so memory
+ *   is constant and no raw history is stored.
+ * - A sample deviates when |value - mean| > k * sigma. A deviation that
+ *   persists for ANOMALY_SUSTAIN_MS opens an anomaly, and a recovery that
+ *   persists as long closes it; each transition produces one event.
+ * - Deviating samples update the baseline with a reduced weight, so a short
+ *   incident does not become the new normal while a lasting level shift
+ *   is still absorbed eventually.
+ * - System metrics and session monitors are evaluated from the sampling timer,
+ *   where the monitored processes are read. Sessions that monitor without
+ *   streaming are read for detection alone. Channel monitors are not
+ *   evaluated: they run at their own cadence, and the baselines are per
+ *   session.
+ */
+#include <math.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "anomaly.h"
+#include "json_out.h"
+#include "session.h"
+#include "ws_server.h"
+
+/* Weight reduction applied to samples that deviate beyond k sigma */
+#define ANOMALY_OUTLIER_WEIGHT 0.1
+
+enum system_metric { SYSTEM_METRIC_CPU = 0, SYSTEM_METRIC_MEM_USED_PERCENT, SYSTEM_METRIC_LOAD1, SYSTEM_METRIC_COUNT };
+
+static const char *const system_metric_names[SYSTEM_METRIC_COUNT] = { "cpu", "mem_used_percent", "load1" };
+
+/* Standard deviation floors, in metric units */
+static const double system_metric_min_sigma[SYSTEM_METRIC_COUNT] = { 2.0, 0.5, 0.1 };
+
+static double k_sigma = 0.0;
+static struct anomaly_detector system_detectors[SYSTEM_METRIC_COUNT];
+
+/******************************************************************************/
+
+void
+anomaly_configure(double k)
+{
+  k_sigma = k > 0.0 ? k : 0.0;
+  for (size_t i = 0; i < SYSTEM_METRIC_COUNT; i++) {
+    anomaly_detector_reset(&system_detectors[i]);
+  }
+}
+
+bool
+anomaly_enabled(void)
+{
+  return k_sigma > 0.0;
+}
+
+double
+anomaly_get_k_sigma(void)
+{
+  return k_sigma;
+}
+
+void
+anomaly_detector_reset(struct anomaly_detector *d)
+{
+  if (d) {
+    memset(d, 0, sizeof(*d));
+  }
+}
+
+enum anomaly_transition
+anomaly_detector_update(struct anomaly_detector *d, double value, double min_sigma, uint64_t now_mono_ms)
+{
+  enum anomaly_transition transition = ANOMALY_TRANSITION_NONE;
+  double alpha = ANOMALY_EWMA_ALPHA;
+
+  if (!d || !isfinite(value)) {
+    return ANOMALY_TRANSITION_NONE;
+  }
+
+  d->samples++;
+  if (d->samples <= ANOMALY_WARMUP_SAMPLES) {
+    /* Cumulative mean while warming up, so the first sample does not dominate */
+    if (1.0 / (double)d->samples > alpha) {
+      alpha = 1.0 / (double)d->samples;
+    }
+    d->last_z = 0.0;
+  } else {
+    double sigma = sqrt(d->var);
+    if (sigma < min_sigma) {
+      sigma = min_sigma;
+    }
+    d->last_z = (value - d->mean) / sigma;
+
+    bool deviating = fabs(d->last_z) > k_sigma;
+    if (deviating) {
+      alpha *= ANOMALY_OUTLIER_WEIGHT;
+    }
+
+    /* Time the condition that would flip the current state */
+    if (deviating != d->anomalous) {
+      if (d->since_mono_ms == 0) {
+        d->since_mono_ms = now_mono_ms;
+      }
+      if (now_mono_ms - d->since_mono_ms >= ANOMALY_SUSTAIN_MS) {
+        d->anomalous = deviating;
+        d->since_mono_ms = 0;
+        transition = deviating ? ANOMALY_TRANSITION_STARTED : ANOMALY_TRANSITION_ENDED;
+      }
+    } else {
+      d->since_mono_ms = 0;
+    }
+  }
+
+  /* West's incremental EWMA mean/variance update */
+  double diff = value - d->mean;
+  double incr = alpha * diff;
+  d->mean += incr;
+  d->var = (1.0 - alpha) * (d->var + diff * incr);
+
+  return transition;
+}
+
+/******************************************************************************/
+
+/* Build and deliver one anomaly event, to pss or to everyone when pss is NULL */
+static void
+send_event(struct per_session_data *pss,
+           const char *metric,
+           const char *process,
+           enum anomaly_transition transition,
+           double value,
+           const struct anomaly_detector *d)
+{
+  char json[512];
+  bool truncated = false;
+  const char *state = transition == ANOMALY_TRANSITION_STARTED ? "started" : "ended";
+  size_t len = build_anomaly_event_json(
+      json, sizeof(json), metric, process, state, value, d->mean, sqrt(d->var), d->last_z, k_sigma, &truncated);
+
+  syslog(transition == ANOMALY_TRANSITION_STARTED ? LOG_WARNING : LOG_INFO,
+         "Anomaly %s: %s%s%s = %g (mean %g, z %.1f)",
+         state,
+         process ? process : "",
+         process ? " " : "",
+         metric,
+         value,
+         d->mean,
+         d->last_z);
+
+  if (len == 0 || truncated) {
+    return;
+  }
+  if (pss) {
+    ws_server_queue_json(pss, json, len);
+  } else {
+    ws_server_broadcast_json(json, len);
+  }
+}
+
+void
+anomaly_evaluate_system(const struct sys_stats *stats)
+{
+  double values[SYSTEM_METRIC_COUNT];
+
+  if (!anomaly_enabled() || !stats || stats->mem_total_kb <= 0) {
+    return;
+  }
+
+  values[SYSTEM_METRIC_CPU] = stats->cpu_usage;
+  values[SYSTEM_METRIC_MEM_USED_PERCENT] =
+      (double)(stats->mem_total_kb - stats->mem_available_kb) * 100.0 / (double)stats->mem_total_kb;
+  values[SYSTEM_METRIC_LOAD1] = stats->load1;
+
+  for (size_t i = 0; i < SYSTEM_METRIC_COUNT; i++) {
+    enum anomaly_transition t =
+        anomaly_detector_update(&system_detectors[i], values[i], system_metric_min_sigma[i], stats->monotonic_ms);
+    if (t != ANOMALY_TRANSITION_NONE) {
+      send_event(NULL, system_metric_names[i], NULL, t, values[i], &system_detectors[i]);
+    }
+  }
+}
+
+void
+anomaly_evaluate_process(struct per_session_data *pss, double cpu, long rss_kb, uint64_t now_mono_ms)
+{
+  enum anomaly_transition t;
+
+  if (!anomaly_enabled() || !pss) {
+    return;
+  }
+
+  t = anomaly_detector_update(&pss->proc_cpu_anomaly, cpu, 2.0, now_mono_ms);
+  if (t != ANOMALY_TRANSITION_NONE) {
+    send_event(pss, "cpu", pss->proc_name, t, cpu, &pss->proc_cpu_anomaly);
+  }
+
+  /* RSS floor: 1 MiB or 1% of the baseline, whichever is larger */
+  double rss_min_sigma = fmax(1024.0, fabs(pss->proc_rss_anomaly.mean) * 0.01);
+  t = anomaly_detector_update(&pss->proc_rss_anomaly, (double)rss_kb, rss_min_sigma, now_mono_ms);
+  if (t != ANOMALY_TRANSITION_NONE) {
+    send_event(pss, "rss_kb", pss->proc_name, t, (double)rss_kb, &pss->proc_rss_anomaly);
+  }
+}
+
+void
+anomaly_reset_process(struct per_session_data *pss)
+{
+  if (!pss) {
+    return;
+  }
+
+  anomaly_detector_reset(&pss->proc_cpu_anomaly);
+  anomaly_detector_reset(&pss->proc_rss_anomaly);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stats.h"
+
+struct per_session_data;
+
+/* EWMA smoothing factor for mean and variance.
+ *
+ * 0.02 weighs roughly the last 50 samples (25 s at the 500 ms sampling rate),
+ * so slow drifts are absorbed into the baseline while short spikes are not.
+ */
+#define ANOMALY_EWMA_ALPHA 0.02
+
+/* Samples used to establish a baseline before any detection happens */
+#define ANOMALY_WARMUP_SAMPLES 60
+
+/* Time a deviation (or its recovery) must persist before an event is sent */
+#define ANOMALY_SUSTAIN_MS 5000
+
+/* Constant-memory online estimate of one metric's normal range */
+struct anomaly_detector {
+  /* Exponentially weighted mean and variance */
+  double mean;
+  double var;
+  uint64_t samples;
+  /* True while an anomaly event is open for this metric */
+  bool anomalous;
+  /* Monotonic time the pending state change started holding (0 = not holding) */
+  uint64_t since_mono_ms;
+  /* Deviation of the last sample in units of sigma */
+  double last_z;
+};
+
+/* Result of feeding one sample into a detector */
+enum anomaly_transition {
+  ANOMALY_TRANSITION_NONE = 0,
+  ANOMALY_TRANSITION_STARTED,
+  ANOMALY_TRANSITION_ENDED,
+};
+
+/* Enable detection with a k-sigma threshold, 0 disables it. */
+void anomaly_configure(double k_sigma);
+
+/* True when anomaly detection is enabled */
+bool anomaly_enabled(void);
+
+/* Configured k-sigma threshold (0 when disabled) */
+double anomaly_get_k_sigma(void);
+
+/* Forget the baseline of one detector. */
+void anomaly_detector_reset(struct anomaly_detector *d);
+
+/* Feed one sample.
+ *
+ * min_sigma is a floor for the standard deviation so that flat metrics
+ * (e.g. an idle core at 0%) do not turn tiny changes into anomalies.
+ */
+enum anomaly_transition anomaly_detector_update(struct anomaly_detector *d,
+                                                double value,
+                                                double min_sigma,
+                                                uint64_t now_mono_ms);
+
+/* Evaluate system-wide metrics (cpu, mem_used_percent, load1) once per sample.
+ *
+ * Transitions are broadcast to all clients as
+ *   { "event": { "type": "anomaly", "scope": "system", ... } }
+ */
+void anomaly_evaluate_system(const struct sys_stats *stats);
+
+/* Evaluate the process monitored by one session (cpu, rss_kb).
+ *
+ * Transitions are sent to that session only, with "scope": "process".
+ */
+void anomaly_evaluate_process(struct per_session_data *pss, double cpu, long rss_kb, uint64_t now_mono_ms);
+
+/* Forget the process baselines of one session (monitor target changed). */
+void anomaly_reset_process(struct per_session_data *pss);
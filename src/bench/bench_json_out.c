@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "bench_support.h"
+#include "json_out.h"
+#include "procfs.h"
+#include "ws_limits.h"
+
+/* Inputs for one build_stats_json() configuration */
+struct stats_json_ctx {
+  struct sys_stats stats;
+  struct per_session_data *pss;
+  char out[MAX_WS_MESSAGE_LENGTH];
+  size_t cores;
+};
+
+/* Output buffer for one build_process_list_json() call */
+struct list_json_ctx {
+  char out[MAX_LIST_JSON_LENGTH];
+};
+
+static void
+bench_build_stats_json(void *ctx)
+{
+  struct stats_json_ctx *c = ctx;
+  bool truncated = false;
+
+  size_t len = build_stats_json(c->out,
+                                sizeof(c->out),
+                                &c->stats,
+                                c->stats.monotonic_ms,
+                                (long)c->cores,
+                                3,
+                                MAX_WS_CONNECTED_CLIENTS,
+                                c->pss,
+                                &truncated);
+  if (len == 0 || truncated) {
+    fprintf(stderr, "build_stats_json failed for %zu cores\n", c->cores);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void
+bench_build_process_list_json(void *ctx)
+{
+  struct list_json_ctx *c = ctx;
+  bool truncated = false;
+
+  build_process_list_json(c->out, sizeof(c->out), &truncated);
+}
+
+/* Fill a representative snapshot with the given number of per-core samples */
+static void
+fill_stats(struct sys_stats *stats, size_t cores)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->cpu_usage = 5.42;
+  stats->cpu_per_core_count = cores;
+  for (size_t i = 0; i < cores; i++) {
+    stats->cpu_per_core_usage[i] = 1.0 + (double)(i % 97) * 0.731;
+  }
+  stats->mem_total_kb = 981716;
+  stats->mem_available_kb = 531704;
+  stats->uptime_s = 4689109.52;
+  stats->load1 = 0.28;
+  stats->load5 = 0.34;
+  stats->load15 = 0.26;
+  stats->timestamp_ms = 1766089635269ULL;
+  stats->monotonic_ms = 4689109526ULL;
+  stats->delta_ms = 500;
+}
+
+int
+main(void)
+{
+  static const size_t core_counts[] = { 4, 16, MAX_CPU_CORE_SAMPLES };
+  static struct stats_json_ctx stats_ctx;
+  static struct list_json_ctx list_ctx;
+  char name[64];
+
+  /* Per-session state is only read for the optional "proc" object */
+  stats_ctx.pss = g_malloc0(sizeof(*stats_ctx.pss));
+
+  /* List the fixture PIDs instead of the host /proc, so runs compare across machines */
+  gchar *fixture_root = g_canonicalize_filename(BENCH_FIXTURE_DIR, NULL);
+  if (!procfs_set_root(fixture_root)) {
+    fprintf(stderr, "Fixture root too long: %s\n", fixture_root);
+    return EXIT_FAILURE;
+  }
+  g_free(fixture_root);
+
+  for (size_t i = 0; i < G_N_ELEMENTS(core_counts); i++) {
+    stats_ctx.cores = core_counts[i];
+    fill_stats(&stats_ctx.stats, core_counts[i]);
+    snprintf(name, sizeof(name), "build_stats_json/%zu_cores", core_counts[i]);
+    bench_run(name, 1, bench_build_stats_json, &stats_ctx);
+  }
+  bench_run("build_process_list_json", 1, bench_build_process_list_json, &list_ctx);
+
+  g_free(stats_ctx.pss);
+
+  return EXIT_SUCCESS;
+}
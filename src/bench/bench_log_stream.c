@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "bench_support.h"
+#include "log_stream.h"
+#include "session.h"
+
+/* Fixture log contents and the session that receives the queued lines */
+struct log_lines_ctx {
+  char *data;
+  size_t len;
+  size_t line_count;
+  struct per_session_data *pss;
+};
+
+/* Release the messages queued by one benchmark call */
+static void
+drain_queue(struct per_session_data *pss)
+{
+  if (!pss->pending_tx_queue) {
+    return;
+  }
+  while (!g_queue_is_empty(pss->pending_tx_queue)) {
+    g_free(g_queue_pop_head(pss->pending_tx_queue));
+  }
+}
+
+static void
+bench_read_new_lines(void *ctx)
+{
+  struct log_lines_ctx *c = ctx;
+  FILE *f = fmemopen(c->data, c->len, "r");
+
+  if (!f) {
+    exit(EXIT_FAILURE);
+  }
+  log_stream_read_lines_to_session(f, c->pss, "info");
+  fclose(f);
+  drain_queue(c->pss);
+}
+
+int
+main(void)
+{
+  struct log_lines_ctx ctx;
+
+  ctx.data = bench_load_fixture("var/log/info.log", &ctx.len);
+  ctx.line_count = 0;
+  for (size_t i = 0; i < ctx.len; i++) {
+    if (ctx.data[i] == '\n') {
+      ctx.line_count++;
+    }
+  }
+  /* wsi stays NULL so no libwebsockets context is needed */
+  ctx.pss = g_malloc0(sizeof(*ctx.pss));
+
+  bench_run("read_new_lines", ctx.line_count, bench_read_new_lines, &ctx);
+
+  drain_queue(ctx.pss);
+  if (ctx.pss->pending_tx_queue) {
+    g_queue_free(ctx.pss->pending_tx_queue);
+  }
+  g_free(ctx.pss);
+  g_free(ctx.data);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "bench_support.h"
+#include "proc.h"
+
+/* Raw fixture contents for one /proc/<pid> file */
+struct fixture_ctx {
+  char *data;
+  size_t len;
+};
+
+static void
+bench_parse_proc_stat_times(void *ctx)
+{
+  struct fixture_ctx *c = ctx;
+  unsigned long long utime = 0;
+  unsigned long long stime = 0;
+
+  if (!proc_parse_stat_times(c->data, &utime, &stime)) {
+    fprintf(stderr, "Failed to parse /proc/<pid>/stat fixture\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void
+bench_parse_smaps_rollup(void *ctx)
+{
+  struct fixture_ctx *c = ctx;
+  long pss_kb = 0;
+  long uss_kb = 0;
+  FILE *f = fmemopen(c->data, c->len, "r");
+
+  if (!f) {
+    exit(EXIT_FAILURE);
+  }
+  proc_parse_smaps_rollup(f, &pss_kb, &uss_kb);
+  fclose(f);
+}
+
+int
+main(void)
+{
+  struct fixture_ctx stat_ctx;
+  struct fixture_ctx smaps_ctx;
+
+  stat_ctx.data = bench_load_fixture("proc/4242/stat", &stat_ctx.len);
+  smaps_ctx.data = bench_load_fixture("proc/4242/smaps_rollup", &smaps_ctx.len);
+
+  bench_run("parse_proc_stat_times", 1, bench_parse_proc_stat_times, &stat_ctx);
+  bench_run("proc_parse_smaps_rollup", 1, bench_parse_smaps_rollup, &smaps_ctx);
+
+  g_free(stat_ctx.data);
+  g_free(smaps_ctx.data);
+
+  return EXIT_SUCCESS;
+}
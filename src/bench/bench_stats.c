@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "bench_support.h"
+#include "procfs.h"
+#include "stats.h"
+
+/* Fixture lines split into the "cpu" / "cpuN" rows the parser accepts */
+struct cpu_line_ctx {
+  gchar **lines;
+  size_t count;
+};
+
+/* Raw /proc/meminfo fixture contents */
+struct meminfo_ctx {
+  char *data;
+  size_t len;
+  struct sys_stats stats;
+};
+
+static void
+bench_parse_cpu_stat_line(void *ctx)
+{
+  struct cpu_line_ctx *c = ctx;
+  char label[16];
+  unsigned long long idle_time = 0;
+  unsigned long long total_time = 0;
+
+  for (size_t i = 0; i < c->count; i++) {
+    if (!stats_parse_cpu_stat_line(c->lines[i], label, sizeof(label), &idle_time, &total_time)) {
+      fprintf(stderr, "Failed to parse fixture line: %s\n", c->lines[i]);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void
+bench_parse_meminfo(void *ctx)
+{
+  struct meminfo_ctx *c = ctx;
+  FILE *f = fmemopen(c->data, c->len, "r");
+
+  if (!f) {
+    exit(EXIT_FAILURE);
+  }
+  stats_parse_meminfo(f, &c->stats);
+  fclose(f);
+}
+
+static void
+bench_read_mem(void *ctx)
+{
+  struct meminfo_ctx *c = ctx;
+
+  stats_read_mem(&c->stats);
+}
+
+int
+main(void)
+{
+  struct cpu_line_ctx cpu_ctx;
+  struct meminfo_ctx mem_ctx;
+  size_t len = 0;
+  char *stat_data = bench_load_fixture("proc/stat", &len);
+  gchar **all_lines = g_strsplit(stat_data, "\n", -1);
+
+  /* Keep only the CPU rows, matching what stats_read_cpu_stats() parses */
+  memset(&cpu_ctx, 0, sizeof(cpu_ctx));
+  cpu_ctx.lines = g_new0(gchar *, g_strv_length(all_lines) + 1);
+  for (size_t i = 0; all_lines[i]; i++) {
+    if (strncmp(all_lines[i], "cpu", strlen("cpu")) == 0) {
+      cpu_ctx.lines[cpu_ctx.count++] = all_lines[i];
+    }
+  }
+
+  memset(&mem_ctx, 0, sizeof(mem_ctx));
+  mem_ctx.data = bench_load_fixture("proc/meminfo", &mem_ctx.len);
+
+  /* Point stats_read_mem() at the fixture tree instead of the host /proc */
+  gchar *fixture_root = g_canonicalize_filename(BENCH_FIXTURE_DIR, NULL);
+  if (!procfs_set_root(fixture_root)) {
+    fprintf(stderr, "Fixture root too long: %s\n", fixture_root);
+    return EXIT_FAILURE;
+  }
+  g_free(fixture_root);
+
+  bench_run("parse_cpu_stat_line", cpu_ctx.count, bench_parse_cpu_stat_line, &cpu_ctx);
+  bench_run("stats_parse_meminfo", 1, bench_parse_meminfo, &mem_ctx);
+  bench_run("stats_read_mem", 1, bench_read_mem, &mem_ctx);
+
+  g_free(cpu_ctx.lines);
+  g_strfreev(all_lines);
+  g_free(stat_data);
+  g_free(mem_ctx.data);
+
+  return EXIT_SUCCESS;
+}
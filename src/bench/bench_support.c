@@ -0,0 +1,116 @@
+/* Shared runner for the host microbenchmarks.
+ *
+ * Allocation counting:
+ * - malloc(), calloc() and realloc() are interposed for the whole benchmark
+ *   process and forwarded to the glibc implementations.
+ * - Shared libraries (GLib, jansson, stdio) resolve to these definitions,
+ *   so allocations made on behalf of the measured code are counted too.
+ * - This is glibc-specific and intended for host benchmarking only.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "bench_support.h"
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static uint64_t alloc_count = 0;
+
+void *
+malloc(size_t size)
+{
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+  return __libc_realloc(ptr, size);
+}
+
+/* Monotonic time in nanoseconds */
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void
+bench_run(const char *name, uint64_t ops_per_call, bench_fn fn, void *ctx)
+{
+  uint64_t iterations = 1;
+  uint64_t elapsed_ns = 0;
+  uint64_t allocs = 0;
+
+  if (!name || !fn || ops_per_call == 0) {
+    return;
+  }
+
+  /* Warm up caches and any lazily initialized state outside the timed loop */
+  fn(ctx);
+
+  for (;;) {
+    uint64_t allocs_before = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+    uint64_t start_ns = now_ns();
+
+    for (uint64_t i = 0; i < iterations; i++) {
+      fn(ctx);
+    }
+    elapsed_ns = now_ns() - start_ns;
+    allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - allocs_before;
+
+    if (elapsed_ns >= BENCH_MIN_TIME_NS || iterations >= (UINT64_MAX / 2)) {
+      break;
+    }
+    iterations *= 2;
+  }
+
+  uint64_t ops = iterations * ops_per_call;
+  printf("{\"bench\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f}\n",
+         name,
+         (unsigned long long)ops,
+         (double)elapsed_ns / (double)ops,
+         (double)allocs / (double)ops);
+  fflush(stdout);
+}
+
+char *
+bench_load_fixture(const char *relative_path, size_t *len_out)
+{
+  GError *error = NULL;
+  gchar *contents = NULL;
+  gsize len = 0;
+  gchar *path = g_build_filename(BENCH_FIXTURE_DIR, relative_path, NULL);
+
+  if (!g_file_get_contents(path, &contents, &len, &error)) {
+    fprintf(stderr, "Failed to load fixture %s: %s\n", path, error->message);
+    g_error_free(error);
+    g_free(path);
+    exit(EXIT_FAILURE);
+  }
+  g_free(path);
+
+  if (len_out) {
+    *len_out = len;
+  }
+
+  return contents;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Minimum wall time spent in the timed loop of one benchmark.
+ *
+ * The iteration count is doubled from 1 until one timed run takes at least
+ * this long, so fast and slow operations both get a stable ns/op figure.
+ */
+#define BENCH_MIN_TIME_NS 200000000ULL
+
+/* One benchmarked operation. ctx is passed through unchanged. */
+typedef void (*bench_fn)(void *ctx);
+
+/* Run fn repeatedly and print one JSON result line to stdout:
+ *
+ *   {"bench":"<name>","iterations":N,"ns_per_op":X,"allocs_per_op":Y}
+ *
+ * ops_per_call is the number of logical operations performed by one call
+ * to fn (e.g. lines parsed), so results are always reported per operation.
+ *
+ * Allocations are counted for every malloc(), calloc() and realloc() call in
+ * the process while the timed loop runs, including calls made by GLib,
+ * jansson and stdio.
+ */
+void bench_run(const char *name, uint64_t ops_per_call, bench_fn fn, void *ctx);
+
+/* Load one fixture file relative to BENCH_FIXTURE_DIR.
+ *
+ * Returns a NUL-terminated heap copy (release with g_free()) and stores the
+ * length in len_out. Exits the process on failure since every benchmark
+ * depends on its fixture.
+ */
+char *bench_load_fixture(const char *relative_path, size_t *len_out);
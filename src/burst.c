@@ -0,0 +1,508 @@
+/* burst.c
+ *
+ * High-frequency burst capture for transient spikes.
+ *
+ * - A dedicated timer samples /proc/stat (aggregate and per-core counters)
+ *   and /proc/<pid>/stat of the requester's monitored process at interval_ms
+ *   for duration_ms, independently of the regular 500 ms sampler.
+ * - All sample storage is allocated when the capture is requested; the timer
+ *   path only preads the kept-open files, parses and stores 16-bit values.
+ * - The finished capture is sent once, to the requesting session, as a single
+ *   compact { "burst": { ... } } frame, so the regular stream is not flooded.
+ * - With a trigger the capture is armed and starts at the first regular
+ *   sample that satisfies the condition (same syntax as alert rules).
+ *
+ * CPU values are per-mille (0..1000) of the interval. The kernel accounts CPU
+ * time in USER_HZ ticks (typically 10 ms), so at very short intervals per-core
+ * values are coarse and the aggregate is quantized to 1 / (cores) steps.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "alerts.h"
+#include "burst.h"
+#include "loop_monitor.h"
+#include "proc.h"
+#include "procfs.h"
+#include "util.h"
+#include "ws_server.h"
+
+/* Bytes of /proc/stat read per sample; the cpu lines come first */
+#define BURST_STAT_READ_SIZE 16384
+
+static struct {
+  /* Session receiving the capture (NULL = idle) */
+  struct per_session_data *owner;
+  bool armed;
+  bool has_trigger;
+  struct alert_rule trigger;
+  double trigger_observed;
+
+  guint interval_ms;
+  guint duration_ms;
+  guint timer_id;
+
+  /* Kept-open system files, read with pread() */
+  int stat_fd;
+  int proc_fd;
+  pid_t pid;
+  char proc_name[MAX_PROC_NAME_LENGTH];
+
+  /* Preallocated sample storage */
+  size_t cores;
+  size_t capacity;
+  size_t count;
+  uint32_t *t_ms;
+  uint16_t *cpu;
+  uint16_t *core_cpu; /* sample-major: [sample * cores + core] */
+  uint16_t *proc_cpu;
+  char *read_buf;
+
+  /* Counters of the previous tick */
+  bool have_baseline;
+  int64_t start_mono_us;
+  int64_t prev_mono_us;
+  uint64_t start_ts_ms;
+  unsigned long long prev_idle;
+  unsigned long long prev_total;
+  unsigned long long prev_core_idle[MAX_CPU_CORE_SAMPLES];
+  unsigned long long prev_core_total[MAX_CPU_CORE_SAMPLES];
+  unsigned long long prev_proc_ticks;
+} burst = { .stat_fd = -1, .proc_fd = -1 };
+
+/******************************************************************************/
+
+/* Release files and buffers and return to idle */
+static void
+reset_capture(void)
+{
+  if (burst.timer_id != 0) {
+    g_source_remove(burst.timer_id);
+    burst.timer_id = 0;
+  }
+  if (burst.stat_fd >= 0) {
+    close(burst.stat_fd);
+  }
+  if (burst.proc_fd >= 0) {
+    close(burst.proc_fd);
+  }
+  g_free(burst.t_ms);
+  g_free(burst.cpu);
+  g_free(burst.core_cpu);
+  g_free(burst.proc_cpu);
+  g_free(burst.read_buf);
+  memset(&burst, 0, sizeof(burst));
+  burst.stat_fd = -1;
+  burst.proc_fd = -1;
+}
+
+/* pread() a whole small /proc file from offset 0 into buf (NUL-terminated) */
+static bool
+read_proc_fd(int fd, char *buf, size_t size)
+{
+  ssize_t n;
+
+  do {
+    n = pread(fd, buf, size - 1, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    return false;
+  }
+  buf[n] = '\0';
+
+  return true;
+}
+
+static uint16_t
+permille(unsigned long long busy, unsigned long long total)
+{
+  if (total == 0) {
+    return 0;
+  }
+  if (busy > total) {
+    busy = total;
+  }
+
+  return (uint16_t)((busy * 1000ULL + total / 2) / total);
+}
+
+/******************************************************************************/
+
+/* Build and queue the finished capture, then release it */
+static void
+finish_capture(void)
+{
+  json_t *resp = json_object();
+  json_t *body = json_object();
+  json_t *t_ms = json_array();
+  json_t *cpu = json_array();
+  json_t *per_core = json_array();
+
+  if (!resp || !body || !t_ms || !cpu || !per_core) {
+    json_decref(per_core);
+    json_decref(cpu);
+    json_decref(t_ms);
+    json_decref(body);
+    json_decref(resp);
+    reset_capture();
+    return;
+  }
+
+  for (size_t i = 0; i < burst.count; i++) {
+    json_array_append_new(t_ms, json_integer(burst.t_ms[i]));
+    json_array_append_new(cpu, json_integer(burst.cpu[i]));
+  }
+  for (size_t c = 0; c < burst.cores; c++) {
+    json_t *core = json_array();
+    if (!core) {
+      break;
+    }
+    for (size_t i = 0; i < burst.count; i++) {
+      json_array_append_new(core, json_integer(burst.core_cpu[i * burst.cores + c]));
+    }
+    json_array_append_new(per_core, core);
+  }
+
+  json_object_set_new(body, "interval_ms", json_integer(burst.interval_ms));
+  json_object_set_new(body, "duration_ms", json_integer(burst.duration_ms));
+  json_object_set_new(body, "start_ts", json_integer((json_int_t)burst.start_ts_ms));
+  json_object_set_new(body, "unit", json_string("permille"));
+  json_object_set_new(body, "samples", json_integer((json_int_t)burst.count));
+  if (burst.has_trigger) {
+    json_t *trigger = json_object();
+    if (trigger) {
+      json_object_set_new(trigger, "metric", json_string(alerts_metric_name(&burst.trigger)));
+      json_object_set_new(trigger, "op", json_string(alerts_op_name(&burst.trigger)));
+      json_object_set_new(trigger, "value", json_real(burst.trigger.value));
+      json_object_set_new(trigger, "observed", json_real(burst.trigger_observed));
+      json_object_set_new(body, "trigger", trigger);
+    }
+  }
+  json_object_set_new(body, "t_ms", t_ms);
+  json_object_set_new(body, "cpu", cpu);
+  json_object_set_new(body, "cpu_per_core", per_core);
+  if (burst.proc_fd >= 0) {
+    json_t *proc = json_object();
+    json_t *proc_cpu = json_array();
+    if (proc && proc_cpu) {
+      for (size_t i = 0; i < burst.count; i++) {
+        json_array_append_new(proc_cpu, json_integer(burst.proc_cpu[i]));
+      }
+      json_object_set_new(proc, "name", json_string(burst.proc_name));
+      json_object_set_new(proc, "pid", json_integer(burst.pid));
+      json_object_set_new(proc, "cpu", proc_cpu);
+      json_object_set_new(body, "proc", proc);
+    } else {
+      json_decref(proc_cpu);
+      json_decref(proc);
+    }
+  }
+  json_object_set_new(resp, "burst", body);
+
+  /* The frame size depends on the capture, so let jansson allocate it */
+  char *json = json_dumps(resp, JSON_COMPACT);
+  json_decref(resp);
+  if (json) {
+    ws_server_queue_json(burst.owner, json, strlen(json));
+    syslog(LOG_INFO, "Burst capture finished: %zu samples, %zu bytes", burst.count, strlen(json));
+    free(json);
+  }
+
+  reset_capture();
+}
+
+/* Read all counters once and store one sample (after the baseline tick) */
+static gboolean
+burst_timer_cb(gpointer user_data)
+{
+  const size_t cpu_prefix_length = strlen("cpu");
+  unsigned long long idle = 0;
+  unsigned long long total = 0;
+  unsigned long long core_idle[MAX_CPU_CORE_SAMPLES];
+  unsigned long long core_total[MAX_CPU_CORE_SAMPLES];
+  unsigned long long proc_ticks = 0;
+  bool have_proc = false;
+  char label[16];
+  (void)user_data;
+
+  int64_t now_us = g_get_monotonic_time();
+
+  if (!read_proc_fd(burst.stat_fd, burst.read_buf, BURST_STAT_READ_SIZE)) {
+    syslog(LOG_WARNING, "Burst capture: failed to read /proc/stat");
+    /* Without a baseline the caller reports the failure */
+    if (burst.have_baseline) {
+      burst.timer_id = 0;
+      finish_capture();
+    }
+    return G_SOURCE_REMOVE;
+  }
+
+  memset(core_idle, 0, sizeof(core_idle));
+  memset(core_total, 0, sizeof(core_total));
+  for (char *line = burst.read_buf; line && strncmp(line, "cpu", cpu_prefix_length) == 0;) {
+    char *next = strchr(line, '\n');
+    unsigned long long line_idle = 0;
+    unsigned long long line_total = 0;
+
+    if (next) {
+      *next++ = '\0';
+    }
+    if (stats_parse_cpu_stat_line(line, label, sizeof(label), &line_idle, &line_total)) {
+      if (label[cpu_prefix_length] == '\0') {
+        idle = line_idle;
+        total = line_total;
+      } else {
+        char *end = NULL;
+        unsigned long core = strtoul(&label[cpu_prefix_length], &end, 10);
+        if (end && *end == '\0' && core < burst.cores) {
+          core_idle[core] = line_idle;
+          core_total[core] = line_total;
+        }
+      }
+    }
+    line = next;
+  }
+
+  if (burst.proc_fd >= 0 && read_proc_fd(burst.proc_fd, burst.read_buf, BURST_STAT_READ_SIZE)) {
+    unsigned long long utime = 0;
+    unsigned long long stime = 0;
+    if (proc_parse_stat_times(burst.read_buf, &utime, &stime)) {
+      proc_ticks = utime + stime;
+      have_proc = true;
+    }
+  }
+
+  if (burst.have_baseline) {
+    size_t i = burst.count;
+    int64_t dt_us = now_us - burst.prev_mono_us;
+    long clk_tck = sysconf(_SC_CLK_TCK);
+
+    burst.t_ms[i] = (uint32_t)((now_us - burst.start_mono_us) / 1000);
+    burst.cpu[i] = permille(total - idle - (burst.prev_total - burst.prev_idle), total - burst.prev_total);
+    for (size_t c = 0; c < burst.cores; c++) {
+      burst.core_cpu[i * burst.cores + c] =
+          permille(core_total[c] - core_idle[c] - (burst.prev_core_total[c] - burst.prev_core_idle[c]),
+                   core_total[c] - burst.prev_core_total[c]);
+    }
+    if (burst.proc_fd >= 0) {
+      uint64_t busy_us = have_proc && clk_tck > 0 && proc_ticks >= burst.prev_proc_ticks
+                             ? (proc_ticks - burst.prev_proc_ticks) * 1000000ULL / (unsigned long long)clk_tck
+                             : 0;
+      /* Share of the whole system, like the regular "proc.cpu" value */
+      burst.proc_cpu[i] = permille(busy_us, dt_us > 0 ? (unsigned long long)dt_us * burst.cores : 0);
+    }
+    burst.count++;
+  } else {
+    burst.have_baseline = true;
+    burst.start_mono_us = now_us;
+    burst.start_ts_ms = util_get_time_ms(CLOCK_REALTIME);
+  }
+
+  burst.prev_mono_us = now_us;
+  burst.prev_idle = idle;
+  burst.prev_total = total;
+  memcpy(burst.prev_core_idle, core_idle, sizeof(core_idle));
+  memcpy(burst.prev_core_total, core_total, sizeof(core_total));
+  if (have_proc) {
+    burst.prev_proc_ticks = proc_ticks;
+  }
+
+  if (burst.count >= burst.capacity || (now_us - burst.start_mono_us) / 1000 >= (int64_t)burst.duration_ms) {
+    burst.timer_id = 0;
+    finish_capture();
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Open files and start the fast timer of a prepared capture */
+static bool
+start_sampling(void)
+{
+  char path[PATH_MAX];
+
+  if (!procfs_build_path(path, sizeof(path), "/proc/stat") || (burst.stat_fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    syslog(LOG_WARNING, "Burst capture: cannot open /proc/stat");
+    return false;
+  }
+
+  /* The monitored process is optional; resolve it from the owner's regular stream */
+  if (burst.owner->proc_enabled && burst.owner->proc_baseline.pid > 0) {
+    char rel[MAX_PROC_PATH_LENGTH];
+    snprintf(rel, sizeof(rel), "/proc/%d/stat", (int)burst.owner->proc_baseline.pid);
+    if (procfs_build_path(path, sizeof(path), rel)) {
+      burst.proc_fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (burst.proc_fd >= 0) {
+      burst.pid = burst.owner->proc_baseline.pid;
+      g_strlcpy(burst.proc_name, burst.owner->proc_name, sizeof(burst.proc_name));
+    }
+  }
+
+  /* Take the baseline now so the first interval starts immediately */
+  burst.armed = false;
+  burst_timer_cb(NULL);
+  if (!burst.have_baseline) {
+    return false;
+  }
+  burst.timer_id = loop_monitor_timeout_add(burst.interval_ms, "burst_sample", burst_timer_cb, NULL);
+
+  return true;
+}
+
+/* Parse, allocate and start (or arm) one capture */
+static void
+prepare_capture(struct per_session_data *pss, json_t *spec)
+{
+  json_t *interval = json_object_get(spec, "interval_ms");
+  json_t *duration = json_object_get(spec, "duration_ms");
+  json_t *trigger = json_object_get(spec, "trigger");
+  const char *error_message = NULL;
+
+  if (!json_is_integer(interval) || json_integer_value(interval) < BURST_MIN_INTERVAL_MS ||
+      json_integer_value(interval) > BURST_MAX_INTERVAL_MS) {
+    ws_server_send_error(pss, "invalid_burst_request", "interval_ms must be an integer in [5, 500]");
+    return;
+  }
+  if (!json_is_integer(duration) || json_integer_value(duration) < json_integer_value(interval) ||
+      json_integer_value(duration) > BURST_MAX_DURATION_MS) {
+    ws_server_send_error(pss, "invalid_burst_request", "duration_ms must be an integer in [interval_ms, 10000]");
+    return;
+  }
+  if (json_integer_value(duration) / json_integer_value(interval) > BURST_MAX_SAMPLES) {
+    ws_server_send_error(pss, "invalid_burst_request", "Too many samples, increase interval_ms");
+    return;
+  }
+  if (burst.owner) {
+    ws_server_send_error(pss, "burst_busy", "Another burst capture is running or armed");
+    return;
+  }
+
+  burst.owner = pss;
+  if (trigger) {
+    if (!json_is_object(trigger) || !alerts_parse_rule(trigger, &burst.trigger, &error_message)) {
+      burst.owner = NULL;
+      ws_server_send_error(pss, "invalid_burst_request", error_message ? error_message : "trigger must be an object");
+      return;
+    }
+    burst.has_trigger = true;
+  }
+
+  burst.interval_ms = (guint)json_integer_value(interval);
+  burst.duration_ms = (guint)json_integer_value(duration);
+  burst.cores = (size_t)proc_get_cpu_core_count();
+  if (burst.cores > MAX_CPU_CORE_SAMPLES) {
+    burst.cores = MAX_CPU_CORE_SAMPLES;
+  }
+  /* One spare slot absorbs timer jitter before the duration check ends the capture */
+  burst.capacity = burst.duration_ms / burst.interval_ms + 1;
+  burst.t_ms = g_new0(uint32_t, burst.capacity);
+  burst.cpu = g_new0(uint16_t, burst.capacity);
+  burst.core_cpu = g_new0(uint16_t, burst.capacity * burst.cores);
+  burst.proc_cpu = g_new0(uint16_t, burst.capacity);
+  burst.read_buf = g_malloc(BURST_STAT_READ_SIZE);
+
+  if (burst.has_trigger) {
+    burst.armed = true;
+    syslog(LOG_INFO,
+           "Burst capture armed: %s %s %g, %u ms every %u ms",
+           alerts_metric_name(&burst.trigger),
+           alerts_op_name(&burst.trigger),
+           burst.trigger.value,
+           burst.duration_ms,
+           burst.interval_ms);
+  } else if (!start_sampling()) {
+    reset_capture();
+    ws_server_send_error(pss, "burst_failed", "Cannot start burst capture");
+    return;
+  } else {
+    syslog(LOG_INFO, "Burst capture started: %u ms every %u ms", burst.duration_ms, burst.interval_ms);
+  }
+
+  char json[MAX_SMALL_CONTROL_MESSAGE_LENGTH];
+  int len = snprintf(json,
+                     sizeof(json),
+                     "{\"burst_capture\":{\"state\":\"%s\",\"interval_ms\":%u,\"duration_ms\":%u}}",
+                     burst.armed ? "armed" : "running",
+                     burst.interval_ms,
+                     burst.duration_ms);
+  if (len > 0 && (size_t)len < sizeof(json)) {
+    ws_server_queue_json(pss, json, (size_t)len);
+  }
+}
+
+bool
+burst_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root)
+{
+  json_t *spec = json_object_get(root, "burst_capture");
+  (void)wsi;
+
+  if (!spec) {
+    return false;
+  }
+
+  if (json_is_false(spec)) {
+    burst_session_closed(pss);
+    return true;
+  }
+  if (!json_is_object(spec)) {
+    ws_server_send_error(pss, "invalid_burst_request", "burst_capture must be an object or false");
+    return true;
+  }
+
+  prepare_capture(pss, spec);
+  return true;
+}
+
+void
+burst_evaluate_trigger(const struct sys_stats *stats)
+{
+  if (!burst.armed || !alerts_rule_matches(&burst.trigger, stats, &burst.trigger_observed)) {
+    return;
+  }
+
+  syslog(LOG_INFO,
+         "Burst capture triggered: %s = %g",
+         alerts_metric_name(&burst.trigger),
+         burst.trigger_observed);
+  if (!start_sampling()) {
+    struct per_session_data *owner = burst.owner;
+    reset_capture();
+    ws_server_send_error(owner, "burst_failed", "Cannot start burst capture");
+  }
+}
+
+bool
+burst_armed(void)
+{
+  return burst.armed;
+}
+
+bool
+burst_is_owner(const struct per_session_data *pss)
+{
+  return pss && burst.owner == pss;
+}
+
+void
+burst_session_closed(struct per_session_data *pss)
+{
+  if (pss && burst.owner == pss) {
+    reset_capture();
+  }
+}
+
+void
+burst_stop(void)
+{
+  reset_capture();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <jansson.h>
+#include <libwebsockets.h>
+
+#include "session.h"
+#include "stats.h"
+
+/* Fastest and slowest accepted burst sampling interval (ms) */
+#define BURST_MIN_INTERVAL_MS 5
+#define BURST_MAX_INTERVAL_MS 500
+
+/* Longest accepted capture (ms) */
+#define BURST_MAX_DURATION_MS 10000
+
+/* Upper bound on samples per capture (duration_ms / interval_ms) */
+#define BURST_MAX_SAMPLES 2000
+
+/* Handle burst capture control messages.
+ *
+ * Request formats:
+ *   { "burst_capture": { "interval_ms": 10, "duration_ms": 3000 } }
+ *   { "burst_capture": { "interval_ms": 10, "duration_ms": 3000,
+ *                        "trigger": { "metric": "cpu", "op": ">", "value": 80 } } }
+ *   { "burst_capture": false }
+ *
+ * Only one capture (running or armed) exists per server.
+ * Returns true if the command was recognized (successfully or not).
+ */
+bool burst_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root);
+
+/* Check an armed trigger against one regular sample and start the capture when it matches. */
+void burst_evaluate_trigger(const struct sys_stats *stats);
+
+/* True while a trigger is armed (the regular sampler must keep running) */
+bool burst_armed(void);
+
+/* True if the session owns the running or armed capture */
+bool burst_is_owner(const struct per_session_data *pss);
+
+/* Cancel a capture owned by a disconnecting session. */
+void burst_session_closed(struct per_session_data *pss);
+
+/* Cancel any capture and release its buffers. Safe to call multiple times. */
+void burst_stop(void);
@@ -0,0 +1,714 @@
+/* cgi_proxy.c
+ *
+ * Coalescing proxy for widget and overlay updates to the device CGIs.
+ *
+ * - Dragging a widget in the UI produces updates at pointer-event rate. Sent
+ *   directly, each one is a full HTTP request and a re-render on the device.
+ *   Here they are kept per widget id / overlay identity and only the latest
+ *   is forwarded, at most once per CGI_PROXY_INTERVAL_MS and never while the
+ *   previous request of the same widget is still in flight.
+ * - Requests are plain lws HTTP client connections in the server's context,
+ *   serviced by the same GLib timer as everything else.
+ * - Only the update methods of the two overlay CGIs are forwarded; the
+ *   proxy is not a general purpose HTTP relay.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <glib.h>
+
+#include "cgi_proxy.h"
+#include "loop_monitor.h"
+#include "upstream.h"
+#include "util.h"
+#include "ws_server.h"
+
+/* A waiting update counts as due this early, absorbing timer jitter */
+#define CGI_PROXY_INTERVAL_SLACK_MS 5
+
+/* Window over which the forwarded rate is measured */
+#define CGI_PROXY_RATE_WINDOW_MS 1000
+
+/* Longest accepted "user:password" in CGI_PROXY_CREDENTIALS */
+#define MAX_CGI_PROXY_CREDENTIALS_LENGTH 128
+
+/* One allowlisted CGI and the methods forwarded to it */
+struct cgi_target {
+  const char *name;
+  const char *path;
+  const char *methods[2];
+};
+
+static const struct cgi_target targets[] = {
+  { "widget", "/axis-cgi/overlaywidget/overlaywidget.cgi", { "updateWidget", NULL } },
+  { "overlay", "/axis-cgi/dynamicoverlay/dynamicoverlay.cgi", { "setText", "setImage" } },
+};
+
+struct cgi_entry;
+
+/* One forwarded update (one HTTP connection) */
+struct cgi_request {
+  /* Entry the request belongs to, NULL once it was dropped */
+  struct cgi_entry *entry;
+  struct per_session_data *owner;
+  struct lws *wsi;
+
+  /* [LWS_PRE padding | JSON body] */
+  unsigned char *body;
+  size_t body_len;
+  bool body_sent;
+
+  uint64_t received_mono_ms;
+  uint64_t sent_mono_ms;
+  unsigned int coalesced;
+
+  int status;
+  GByteArray *rx;
+  bool rx_overflow;
+};
+
+/* Latest update of one widget or overlay */
+struct cgi_entry {
+  const struct cgi_target *target;
+  json_int_t id;
+
+  /* Session of the newest update, NULL after it closed */
+  struct per_session_data *owner;
+
+  /* Newest update not forwarded yet (serialized request), NULL when none */
+  char *pending;
+  uint64_t pending_mono_ms;
+  /* Updates replaced by a newer one since the last forward */
+  unsigned int coalesced;
+
+  struct cgi_request *inflight;
+  uint64_t last_sent_mono_ms;
+  uint64_t last_used_mono_ms;
+
+  /* Forwarded requests per second */
+  uint64_t window_start_mono_ms;
+  unsigned int window_count;
+  double rate_hz;
+};
+
+static struct {
+  bool enabled;
+  char host[MAX_UPSTREAM_HOST_LENGTH];
+  int port;
+  /* "Basic <base64>", empty without credentials */
+  char auth[16 + (MAX_CGI_PROXY_CREDENTIALS_LENGTH + 2) / 3 * 4];
+
+  /* struct cgi_entry * (owned) */
+  GList *entries;
+
+  struct lws_context *ctx;
+  struct lws_vhost *vhost;
+  guint timer_id;
+
+  /* Totals for the log */
+  uint64_t received;
+  uint64_t forwarded;
+} proxy;
+
+/******************************************************************************/
+
+static void
+free_request(struct cgi_request *req)
+{
+  if (req->rx) {
+    g_byte_array_free(req->rx, TRUE);
+  }
+  g_free(req->body);
+  g_free(req);
+}
+
+/* Send the outcome of a forwarded update to the session that sent it */
+static void
+report_result(const struct cgi_request *req, const struct cgi_entry *e, const char *error, uint64_t now_ms)
+{
+  json_t *resp = json_object();
+  json_t *body = json_object();
+
+  if (!resp || !body) {
+    json_decref(body);
+    json_decref(resp);
+    return;
+  }
+
+  json_object_set_new(body, "target", json_string(e->target->name));
+  json_object_set_new(body, "id", json_integer(e->id));
+  json_object_set_new(body, "status", json_integer(req->status));
+  /* From receipt of the update to the complete CGI response, and the HTTP part of it */
+  json_object_set_new(body, "latency_ms", json_integer((json_int_t)(now_ms - req->received_mono_ms)));
+  json_object_set_new(body, "http_ms", json_integer((json_int_t)(now_ms - req->sent_mono_ms)));
+  json_object_set_new(body, "coalesced", json_integer(req->coalesced));
+  json_object_set_new(body, "rate_hz", json_real(e->rate_hz));
+  if (error) {
+    json_object_set_new(body, "error", json_string(error));
+  } else if (req->rx && !req->rx_overflow) {
+    json_t *cgi_resp = json_loadb((const char *)req->rx->data, req->rx->len, 0, NULL);
+    if (cgi_resp) {
+      json_object_set_new(body, "response", cgi_resp);
+    }
+  }
+  json_object_set_new(resp, "cgi_update_result", body);
+
+  char *json = json_dumps(resp, JSON_COMPACT);
+  json_decref(resp);
+  if (json) {
+    ws_server_queue_json(req->owner, json, strlen(json));
+    free(json);
+  }
+}
+
+static void ensure_timer(void);
+
+/* Request done (error == NULL) or failed: report, free and let the next update go */
+static void
+finish_request(struct cgi_request *req, struct lws *wsi, const char *error)
+{
+  struct cgi_entry *e = req->entry;
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+  /* Later callbacks of this connection must not see the freed request */
+  if (wsi) {
+    lws_set_wsi_user(wsi, NULL);
+  }
+
+  if (e) {
+    e->inflight = NULL;
+    if (error) {
+      syslog(LOG_WARNING, "CGI proxy: %s %lld: %s", e->target->name, (long long)e->id, error);
+    }
+    if (req->owner) {
+      report_result(req, e, error, now_ms);
+    }
+  }
+  free_request(req);
+  ensure_timer();
+}
+
+/* Update the forwarded rate of e with one more request at now_ms */
+static void
+count_forward(struct cgi_entry *e, uint64_t now_ms)
+{
+  uint64_t elapsed_ms = now_ms - e->window_start_mono_ms;
+
+  if (e->window_start_mono_ms == 0 || elapsed_ms >= 2 * CGI_PROXY_RATE_WINDOW_MS) {
+    /* First request or after a pause: start over */
+    e->window_start_mono_ms = now_ms;
+    e->window_count = 0;
+    e->rate_hz = 0.0;
+  } else if (elapsed_ms >= CGI_PROXY_RATE_WINDOW_MS) {
+    e->rate_hz = (double)e->window_count * 1000.0 / (double)elapsed_ms;
+    e->window_start_mono_ms = now_ms;
+    e->window_count = 0;
+  }
+  e->window_count++;
+}
+
+/* Forward the pending update of e */
+static void
+forward(struct cgi_entry *e, uint64_t now_ms)
+{
+  struct lws_client_connect_info ccinfo;
+  struct cgi_request *req = g_new0(struct cgi_request, 1);
+  size_t len = strlen(e->pending);
+
+  req->entry = e;
+  req->owner = e->owner;
+  req->body = g_malloc(LWS_PRE + len);
+  memcpy(&req->body[LWS_PRE], e->pending, len);
+  req->body_len = len;
+  req->received_mono_ms = e->pending_mono_ms;
+  req->sent_mono_ms = now_ms;
+  req->coalesced = e->coalesced;
+
+  g_free(e->pending);
+  e->pending = NULL;
+  e->coalesced = 0;
+  e->inflight = req;
+  e->last_sent_mono_ms = now_ms;
+  count_forward(e, now_ms);
+  proxy.forwarded++;
+
+  memset(&ccinfo, 0, sizeof(ccinfo));
+  ccinfo.context = proxy.ctx;
+  ccinfo.vhost = proxy.vhost;
+  ccinfo.address = proxy.host;
+  ccinfo.port = proxy.port;
+  ccinfo.path = e->target->path;
+  ccinfo.host = proxy.host;
+  ccinfo.origin = proxy.host;
+  ccinfo.method = "POST";
+  ccinfo.alpn = "http/1.1";
+  ccinfo.protocol = CGI_PROXY_PROTOCOL_NAME;
+  ccinfo.local_protocol_name = CGI_PROXY_PROTOCOL_NAME;
+  ccinfo.userdata = req;
+  ccinfo.pwsi = &req->wsi;
+
+  /* A synchronous failure may already have been reported by CLIENT_CONNECTION_ERROR */
+  if (!lws_client_connect_via_info(&ccinfo) && e->inflight == req) {
+    finish_request(req, NULL, "connect failed");
+  }
+}
+
+static bool
+entry_due(const struct cgi_entry *e, uint64_t now_ms)
+{
+  return e->pending && !e->inflight &&
+         now_ms + CGI_PROXY_INTERVAL_SLACK_MS >= e->last_sent_mono_ms + CGI_PROXY_INTERVAL_MS;
+}
+
+static gboolean
+forward_timer_cb(gpointer user_data)
+{
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  (void)user_data;
+
+  for (GList *l = proxy.entries; l; l = l->next) {
+    struct cgi_entry *e = l->data;
+    struct cgi_request *req = e->inflight;
+
+    if (req && now_ms - req->sent_mono_ms >= CGI_PROXY_TIMEOUT_MS) {
+      struct lws *wsi = req->wsi;
+      if (wsi) {
+        lws_set_timeout(wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+      }
+      finish_request(req, wsi, "timeout");
+    }
+    if (entry_due(e, now_ms)) {
+      forward(e, now_ms);
+    }
+  }
+
+  if (!cgi_proxy_active()) {
+    proxy.timer_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+ensure_timer(void)
+{
+  if (proxy.timer_id == 0 && proxy.vhost && cgi_proxy_active()) {
+    proxy.timer_id = loop_monitor_timeout_add(CGI_PROXY_INTERVAL_MS, "cgi_proxy", forward_timer_cb, NULL);
+  }
+}
+
+static void
+free_entry(struct cgi_entry *e)
+{
+  if (e->inflight) {
+    struct cgi_request *req = e->inflight;
+    if (req->wsi) {
+      lws_set_wsi_user(req->wsi, NULL);
+      lws_set_timeout(req->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+    }
+    free_request(req);
+  }
+  g_free(e->pending);
+  g_free(e);
+}
+
+static struct cgi_entry *
+find_entry(const struct cgi_target *target, json_int_t id)
+{
+  for (GList *l = proxy.entries; l; l = l->next) {
+    struct cgi_entry *e = l->data;
+    if (e->target == target && e->id == id) {
+      return e;
+    }
+  }
+
+  return NULL;
+}
+
+/* New entry, evicting the least recently used idle one when full. NULL if all are busy. */
+static struct cgi_entry *
+add_entry(const struct cgi_target *target, json_int_t id)
+{
+  struct cgi_entry *e;
+
+  if (g_list_length(proxy.entries) >= MAX_CGI_PROXY_ENTRIES) {
+    GList *oldest = NULL;
+    for (GList *l = proxy.entries; l; l = l->next) {
+      const struct cgi_entry *c = l->data;
+      if (!c->pending && !c->inflight &&
+          (!oldest || c->last_used_mono_ms < ((struct cgi_entry *)oldest->data)->last_used_mono_ms)) {
+        oldest = l;
+      }
+    }
+    if (!oldest) {
+      return NULL;
+    }
+    free_entry(oldest->data);
+    proxy.entries = g_list_delete_link(proxy.entries, oldest);
+  }
+
+  e = g_new0(struct cgi_entry, 1);
+  e->target = target;
+  e->id = id;
+  proxy.entries = g_list_prepend(proxy.entries, e);
+
+  return e;
+}
+
+/* Check method and extract the coalescing key. Returns an error message or NULL. */
+static const char *
+parse_update(json_t *spec, const struct cgi_target **target_out, json_t **request_out, json_int_t *id_out)
+{
+  const char *target_name = json_string_value(json_object_get(spec, "target"));
+  json_t *request = json_object_get(spec, "request");
+  const struct cgi_target *target = NULL;
+  const char *method;
+  json_t *params;
+  json_t *id;
+
+  for (size_t i = 0; target_name && i < G_N_ELEMENTS(targets); i++) {
+    if (strcmp(target_name, targets[i].name) == 0) {
+      target = &targets[i];
+    }
+  }
+  if (!target) {
+    return "target must be \"widget\" or \"overlay\"";
+  }
+  if (!json_is_object(request)) {
+    return "request must be an object";
+  }
+
+  method = json_string_value(json_object_get(request, "method"));
+  if (!method || !((target->methods[0] && strcmp(method, target->methods[0]) == 0) ||
+                   (target->methods[1] && strcmp(method, target->methods[1]) == 0))) {
+    return target == &targets[0] ? "Only updateWidget is forwarded to the widget CGI"
+                                 : "Only setText and setImage are forwarded to the overlay CGI";
+  }
+
+  /* Widgets are identified by generalParams.id, overlays by their identity */
+  params = json_object_get(request, "params");
+  id = target == &targets[0] ? json_object_get(json_object_get(params, "generalParams"), "id")
+                             : json_object_get(params, "identity");
+  if (!json_is_integer(id)) {
+    return target == &targets[0] ? "params.generalParams.id must be an integer"
+                                 : "params.identity must be an integer";
+  }
+
+  *target_out = target;
+  *request_out = request;
+  *id_out = json_integer_value(id);
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+bool
+cgi_proxy_configure(const char *address)
+{
+  const char *credentials = getenv("CGI_PROXY_CREDENTIALS");
+  char host[MAX_UPSTREAM_HOST_LENGTH];
+  int port = 0;
+
+  memset(&proxy, 0, sizeof(proxy));
+  if (!address) {
+    return false;
+  }
+
+  /* upstream_parse_address() defaults to the backend port */
+  if (!upstream_parse_address(address, host, sizeof(host), &port)) {
+    syslog(LOG_ERR, "Invalid CGI proxy address: %s", address);
+    return false;
+  }
+  if (!strchr(address[0] == '[' ? strchr(address, ']') : address, ':')) {
+    port = CGI_PROXY_DEFAULT_PORT;
+  }
+
+  if (credentials && credentials[0] != '\0') {
+    size_t len = strlen(credentials);
+    int n;
+
+    if (len > MAX_CGI_PROXY_CREDENTIALS_LENGTH || !strchr(credentials, ':')) {
+      syslog(LOG_ERR, "Invalid CGI_PROXY_CREDENTIALS, expected user:password");
+      return false;
+    }
+    memcpy(proxy.auth, "Basic ", 6);
+    n = lws_b64_encode_string(credentials, (int)len, proxy.auth + 6, (int)sizeof(proxy.auth) - 6);
+    if (n <= 0) {
+      proxy.auth[0] = '\0';
+      return false;
+    }
+  }
+
+  g_strlcpy(proxy.host, host, sizeof(proxy.host));
+  proxy.port = port;
+  proxy.enabled = true;
+  syslog(LOG_INFO,
+         "CGI proxy to %s:%d enabled (%s authentication)",
+         proxy.host,
+         proxy.port,
+         proxy.auth[0] ? "basic" : "no");
+
+  return true;
+}
+
+bool
+cgi_proxy_enabled(void)
+{
+  return proxy.enabled;
+}
+
+bool
+cgi_proxy_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root)
+{
+  json_t *spec = json_object_get(root, "cgi_update");
+  const struct cgi_target *target = NULL;
+  json_t *request = NULL;
+  json_int_t id = 0;
+  const char *error;
+  struct cgi_entry *e;
+  char *body;
+  uint64_t now_ms;
+  (void)wsi;
+
+  if (!spec) {
+    return false;
+  }
+  if (!proxy.enabled || !proxy.vhost) {
+    ws_server_send_error(pss, "cgi_proxy_disabled", "The CGI proxy is not enabled on this backend");
+    return true;
+  }
+  if (!json_is_object(spec)) {
+    ws_server_send_error(pss, "invalid_cgi_update", "cgi_update must be an object");
+    return true;
+  }
+  error = parse_update(spec, &target, &request, &id);
+  if (error) {
+    ws_server_send_error(pss, "invalid_cgi_update", error);
+    return true;
+  }
+
+  body = json_dumps(request, JSON_COMPACT);
+  if (!body || strlen(body) > MAX_CGI_PROXY_BODY_LENGTH) {
+    free(body);
+    ws_server_send_error(pss, "invalid_cgi_update", "request is too large");
+    return true;
+  }
+
+  e = find_entry(target, id);
+  if (!e) {
+    e = add_entry(target, id);
+  }
+  if (!e) {
+    free(body);
+    ws_server_send_error(pss, "cgi_proxy_busy", "Too many widgets and overlays are being updated");
+    return true;
+  }
+
+  /* Latest wins */
+  now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  if (e->pending) {
+    g_free(e->pending);
+    e->coalesced++;
+  }
+  e->pending = g_strdup(body);
+  free(body);
+  e->pending_mono_ms = now_ms;
+  e->owner = pss;
+  e->last_used_mono_ms = now_ms;
+  proxy.received++;
+
+  /* An idle widget is forwarded at once, a busy one by the timer */
+  if (entry_due(e, now_ms)) {
+    forward(e, now_ms);
+  }
+  ensure_timer();
+
+  return true;
+}
+
+bool
+cgi_proxy_active(void)
+{
+  for (GList *l = proxy.entries; l; l = l->next) {
+    const struct cgi_entry *e = l->data;
+    if (e->pending || e->inflight) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+cgi_proxy_session_busy(const struct per_session_data *pss)
+{
+  if (!pss) {
+    return false;
+  }
+
+  for (GList *l = proxy.entries; l; l = l->next) {
+    const struct cgi_entry *e = l->data;
+    if ((e->pending && e->owner == pss) || (e->inflight && e->inflight->owner == pss)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+cgi_proxy_session_closed(struct per_session_data *pss)
+{
+  if (!pss) {
+    return;
+  }
+
+  for (GList *l = proxy.entries; l; l = l->next) {
+    struct cgi_entry *e = l->data;
+    if (e->owner == pss) {
+      e->owner = NULL;
+    }
+    if (e->inflight && e->inflight->owner == pss) {
+      e->inflight->owner = NULL;
+    }
+  }
+}
+
+int
+cgi_proxy_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+  struct cgi_request *req = user;
+
+  switch (reason) {
+  case LWS_CALLBACK_FILTER_PROTOCOL_CONNECTION:
+    /* Client-only protocol: refuse peers that ask for it */
+    return -1;
+
+  case LWS_CALLBACK_CLIENT_APPEND_HANDSHAKE_HEADER: {
+    unsigned char **p = (unsigned char **)in;
+    unsigned char *end = *p + len;
+    char content_length[24];
+    int n;
+
+    if (!req) {
+      return -1;
+    }
+    n = snprintf(content_length, sizeof(content_length), "%zu", req->body_len);
+    if (lws_add_http_header_by_token(
+            wsi, WSI_TOKEN_HTTP_CONTENT_TYPE, (const unsigned char *)"application/json", 16, p, end) ||
+        lws_add_http_header_by_token(
+            wsi, WSI_TOKEN_HTTP_CONTENT_LENGTH, (const unsigned char *)content_length, n, p, end)) {
+      return -1;
+    }
+    if (proxy.auth[0] != '\0' &&
+        lws_add_http_header_by_token(
+            wsi, WSI_TOKEN_HTTP_AUTHORIZATION, (const unsigned char *)proxy.auth, (int)strlen(proxy.auth), p, end)) {
+      return -1;
+    }
+    /* The body follows from CLIENT_HTTP_WRITEABLE */
+    lws_client_http_body_pending(wsi, 1);
+    lws_callback_on_writable(wsi);
+    break;
+  }
+
+  case LWS_CALLBACK_CLIENT_HTTP_WRITEABLE: {
+    if (!req || req->body_sent) {
+      break;
+    }
+    req->body_sent = true;
+    lws_client_http_body_pending(wsi, 0);
+    int written = lws_write(wsi, &req->body[LWS_PRE], req->body_len, LWS_WRITE_HTTP_FINAL);
+    if (written < 0 || (size_t)written != req->body_len) {
+      return -1;
+    }
+    break;
+  }
+
+  case LWS_CALLBACK_ESTABLISHED_CLIENT_HTTP:
+    if (req) {
+      req->status = (int)lws_http_client_http_response(wsi);
+    }
+    break;
+
+  case LWS_CALLBACK_RECEIVE_CLIENT_HTTP: {
+    /* Let lws read the body; it arrives as RECEIVE_CLIENT_HTTP_READ */
+    char buf[LWS_PRE + 1024];
+    char *px = buf + LWS_PRE;
+    int lenx = (int)sizeof(buf) - LWS_PRE;
+
+    if (lws_http_client_read(wsi, &px, &lenx) < 0) {
+      return -1;
+    }
+    break;
+  }
+
+  case LWS_CALLBACK_RECEIVE_CLIENT_HTTP_READ:
+    if (!req || req->rx_overflow) {
+      break;
+    }
+    if (!req->rx) {
+      req->rx = g_byte_array_new();
+    }
+    if (len > MAX_CGI_PROXY_BODY_LENGTH - req->rx->len) {
+      req->rx_overflow = true;
+      break;
+    }
+    g_byte_array_append(req->rx, in, (guint)len);
+    break;
+
+  case LWS_CALLBACK_COMPLETED_CLIENT_HTTP:
+    if (req) {
+      finish_request(req, wsi, NULL);
+    }
+    /* One request per connection */
+    lws_set_timeout(wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+    break;
+
+  case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    if (req) {
+      finish_request(req, wsi, in ? (const char *)in : "connection failed");
+    }
+    break;
+
+  case LWS_CALLBACK_CLOSED_CLIENT_HTTP:
+    if (req) {
+      finish_request(req, wsi, "connection closed");
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return 0;
+}
+
+void
+cgi_proxy_start(struct lws_context *ctx, struct lws_vhost *vhost)
+{
+  proxy.ctx = ctx;
+  proxy.vhost = vhost;
+}
+
+void
+cgi_proxy_stop(void)
+{
+  if (proxy.timer_id != 0) {
+    g_source_remove(proxy.timer_id);
+    proxy.timer_id = 0;
+  }
+  if (proxy.received > 0) {
+    syslog(LOG_INFO,
+           "CGI proxy: %llu updates received, %llu forwarded",
+           (unsigned long long)proxy.received,
+           (unsigned long long)proxy.forwarded);
+  }
+  g_list_free_full(proxy.entries, (GDestroyNotify)free_entry);
+  proxy.entries = NULL;
+  proxy.ctx = NULL;
+  proxy.vhost = NULL;
+}
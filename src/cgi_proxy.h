@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <jansson.h>
+#include <libwebsockets.h>
+
+#include "session.h"
+
+/* lws protocol name of the HTTP client connections to the device CGIs */
+#define CGI_PROXY_PROTOCOL_NAME "cgi-proxy"
+
+/* Port used when the CGI address has none */
+#define CGI_PROXY_DEFAULT_PORT 80
+
+/* At most one request per widget or overlay per interval (one frame at 25 fps) */
+#define CGI_PROXY_INTERVAL_MS 40
+
+/* A request without a complete response after this long is aborted */
+#define CGI_PROXY_TIMEOUT_MS 5000
+
+/* Upper bound for widgets and overlays tracked at the same time */
+#define MAX_CGI_PROXY_ENTRIES 64
+
+/* Upper bound for one serialized request body and one CGI response */
+#define MAX_CGI_PROXY_BODY_LENGTH (16 * 1024)
+
+/* Upper bound for one incoming { "cgi_update": ... } WebSocket message: a
+ * full-size request plus the wrapper and some formatting whitespace.
+ */
+#define MAX_CGI_PROXY_RECEIVE_LENGTH (MAX_CGI_PROXY_BODY_LENGTH + 512)
+
+/* Enable the proxy towards the device web server at "host[:port]".
+ *
+ * Basic authentication credentials ("user:password") are taken from the
+ * CGI_PROXY_CREDENTIALS environment variable, so they do not show up in
+ * the process list. Returns false if the address is invalid.
+ */
+bool cgi_proxy_configure(const char *address);
+
+/* True if cgi_proxy_configure() succeeded */
+bool cgi_proxy_enabled(void);
+
+/* Handle widget and overlay update messages.
+ *
+ * Request format:
+ *   { "cgi_update": { "target": "widget", "request": { <updateWidget request> } } }
+ *   { "cgi_update": { "target": "overlay", "request": { <setText or setImage request> } } }
+ *
+ * Updates are coalesced per widget id (generalParams.id) or overlay identity
+ * (params.identity): the latest one wins and at most one is forwarded per
+ * CGI_PROXY_INTERVAL_MS, never more than one in flight. The session that
+ * sent the forwarded update receives a "cgi_update_result" message.
+ * Returns true if the command was recognized (successfully or not).
+ */
+bool cgi_proxy_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root);
+
+/* True while updates are waiting or in flight (lws must be serviced often) */
+bool cgi_proxy_active(void);
+
+/* True while an update of the session is waiting or in flight */
+bool cgi_proxy_session_busy(const struct per_session_data *pss);
+
+/* Stop reporting to a disconnecting session; its waiting updates are still applied. */
+void cgi_proxy_session_closed(struct per_session_data *pss);
+
+/* lws protocol callback of CGI_PROXY_PROTOCOL_NAME. */
+int cgi_proxy_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
+
+/* Start forwarding through vhost (called by ws_server_start()). */
+void cgi_proxy_start(struct lws_context *ctx, struct lws_vhost *vhost);
+
+/* Abort requests and drop waiting updates before the lws context is destroyed. */
+void cgi_proxy_stop(void);
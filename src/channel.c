@@ -0,0 +1,412 @@
+/* channel.c
+ *
+ * Logical stats channels multiplexed over one WebSocket session.
+ *
+ * - A client opens any number of channels (up to MAX_CHANNELS_PER_SESSION)
+ *   with { "open": { "id": N, "type": "stats", ... } }; each has its own
+ *   cadence, field set and monitored process.
+ * - Frames are the regular stats frames restricted to the channel's fields
+ *   and tagged with "ch": N, so a UI and its overlays share one connection
+ *   and one slot of MAX_WS_CONNECTED_CLIENTS.
+ * - Flow control is per channel: an optional credit limits the frames the
+ *   server may send until the client grants more; frames skipped meanwhile
+ *   are counted and reported as "dropped" in the next frame.
+ * - Channels are scheduled from the shared sample tick, so their intervals
+ *   are rounded to multiples of the 500 ms sample period.
+ */
+#include <string.h>
+#include <syslog.h>
+
+#include <glib.h>
+
+#include "channel.h"
+#include "json_out.h"
+#include "relay.h"
+#include "ws_server.h"
+
+/* Sample period the channel intervals are aligned to */
+#define CHANNEL_TICK_MS 500U
+/* Upper bound for interval_ms */
+#define CHANNEL_MAX_INTERVAL_MS 60000U
+/* Upper bound for one credit grant and for the stored credit */
+#define CHANNEL_MAX_CREDIT 100000
+
+static const struct {
+  const char *name;
+  unsigned int bit;
+} channel_field_names[] = {
+  { "cpu", CHANNEL_FIELD_CPU },   { "cpu_per_core", CHANNEL_FIELD_CPU_PER_CORE },
+  { "mem", CHANNEL_FIELD_MEM },   { "load", CHANNEL_FIELD_LOAD },
+  { "uptime", CHANNEL_FIELD_UPTIME }, { "clients", CHANNEL_FIELD_CLIENTS },
+};
+
+/* Sessions that currently hold at least one channel */
+static GList *channel_sessions = NULL;
+
+/******************************************************************************/
+
+static void
+send_channel_message(struct per_session_data *pss, const struct ws_channel *ch, const char *key)
+{
+  char json[MAX_SMALL_CONTROL_MESSAGE_LENGTH * 4];
+  bool truncated = false;
+  size_t len = build_channel_json(json, sizeof(json), ch, key, &truncated);
+
+  if (len > 0 && !truncated) {
+    ws_server_queue_json(pss, json, len);
+  }
+}
+
+static void
+session_channels_changed(struct per_session_data *pss)
+{
+  bool listed = g_list_find(channel_sessions, pss) != NULL;
+  bool has_channels = pss->channels && pss->channels->len > 0;
+
+  if (has_channels && !listed) {
+    channel_sessions = g_list_prepend(channel_sessions, pss);
+  } else if (!has_channels && listed) {
+    channel_sessions = g_list_remove(channel_sessions, pss);
+  }
+}
+
+static struct ws_channel *
+find_channel(struct per_session_data *pss, json_int_t id, guint *index_out)
+{
+  if (!pss->channels) {
+    return NULL;
+  }
+
+  for (guint i = 0; i < pss->channels->len; i++) {
+    struct ws_channel *ch = &g_array_index(pss->channels, struct ws_channel, i);
+    if ((json_int_t)ch->id == id) {
+      if (index_out) {
+        *index_out = i;
+      }
+      return ch;
+    }
+  }
+
+  return NULL;
+}
+
+/* Parse the "fields" array into a bit mask, absent = all fields */
+static bool
+parse_fields(json_t *fields, unsigned int *out)
+{
+  size_t i;
+  json_t *v;
+
+  if (!fields) {
+    *out = CHANNEL_FIELD_ALL;
+    return true;
+  }
+  if (!json_is_array(fields)) {
+    return false;
+  }
+
+  *out = 0;
+  json_array_foreach (fields, i, v) {
+    size_t k;
+
+    if (!json_is_string(v)) {
+      return false;
+    }
+    for (k = 0; k < sizeof(channel_field_names) / sizeof(channel_field_names[0]); k++) {
+      if (strcmp(json_string_value(v), channel_field_names[k].name) == 0) {
+        *out |= channel_field_names[k].bit;
+        break;
+      }
+    }
+    if (k == sizeof(channel_field_names) / sizeof(channel_field_names[0])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void
+open_channel(struct per_session_data *pss, json_t *spec)
+{
+  struct ws_channel ch;
+  json_t *id = json_object_get(spec, "id");
+  json_t *type = json_object_get(spec, "type");
+  json_t *interval = json_object_get(spec, "interval_ms");
+  json_t *monitor = json_object_get(spec, "monitor");
+  json_t *credit = json_object_get(spec, "credit");
+
+  memset(&ch, 0, sizeof(ch));
+  if (!json_is_integer(id) || json_integer_value(id) < 1 || json_integer_value(id) > CHANNEL_MAX_ID) {
+    ws_server_send_error(pss, "invalid_channel_request", "id must be an integer in [1, 65535]");
+    return;
+  }
+  ch.id = (unsigned int)json_integer_value(id);
+  if (!json_is_string(type) || strcmp(json_string_value(type), "stats") != 0) {
+    ws_server_send_error(pss, "invalid_channel_request", "Unsupported channel type (only \"stats\")");
+    return;
+  }
+  if (find_channel(pss, (json_int_t)ch.id, NULL)) {
+    ws_server_send_error(pss, "invalid_channel_request", "A channel with this id is already open");
+    return;
+  }
+
+  ch.interval_ms = CHANNEL_TICK_MS;
+  if (interval) {
+    if (!json_is_integer(interval) || json_integer_value(interval) < 0 ||
+        json_integer_value(interval) > CHANNEL_MAX_INTERVAL_MS) {
+      ws_server_send_error(pss, "invalid_channel_request", "interval_ms must be an integer in [0, 60000]");
+      return;
+    }
+    /* Round up to whole sample periods */
+    unsigned int ticks = ((unsigned int)json_integer_value(interval) + CHANNEL_TICK_MS - 1) / CHANNEL_TICK_MS;
+    ch.interval_ms = (ticks > 0 ? ticks : 1) * CHANNEL_TICK_MS;
+  }
+
+  if (!parse_fields(json_object_get(spec, "fields"), &ch.fields)) {
+    ws_server_send_error(
+        pss, "invalid_channel_request", "fields must be an array of cpu, cpu_per_core, mem, load, uptime, clients");
+    return;
+  }
+
+  if (monitor) {
+    if (relay_enabled()) {
+      ws_server_send_error(pss, "invalid_channel_request", "Process monitoring is not available in relay mode");
+      return;
+    }
+    if (!json_is_string(monitor)) {
+      ws_server_send_error(pss, "invalid_channel_request", "monitor must be a process name");
+      return;
+    }
+    if (json_string_length(monitor) > 0) {
+      g_strlcpy(ch.proc_name, json_string_value(monitor), sizeof(ch.proc_name));
+      ch.proc_enabled = true;
+    }
+  }
+
+  ch.credit = -1;
+  if (credit) {
+    if (!json_is_integer(credit) || json_integer_value(credit) < 0 || json_integer_value(credit) > CHANNEL_MAX_CREDIT) {
+      ws_server_send_error(pss, "invalid_channel_request", "credit must be an integer in [0, 100000]");
+      return;
+    }
+    ch.credit = json_integer_value(credit);
+  }
+
+  if (!pss->channels) {
+    pss->channels = g_array_sized_new(FALSE, FALSE, sizeof(struct ws_channel), MAX_CHANNELS_PER_SESSION);
+  }
+  if (pss->channels->len >= MAX_CHANNELS_PER_SESSION) {
+    ws_server_send_error(pss, "invalid_channel_request", "Too many channels for this connection");
+    return;
+  }
+
+  g_array_append_val(pss->channels, ch);
+  session_channels_changed(pss);
+  syslog(LOG_INFO,
+         "Client opened stats channel %u (%u ms%s%s)",
+         ch.id,
+         ch.interval_ms,
+         ch.proc_enabled ? ", process " : "",
+         ch.proc_enabled ? ch.proc_name : "");
+
+  /* Acknowledge with the effective settings; the first frame follows at the next sample */
+  send_channel_message(pss, &ch, "opened");
+}
+
+static void
+close_channel(struct per_session_data *pss, json_t *id)
+{
+  guint index = 0;
+  struct ws_channel *ch = json_is_integer(id) ? find_channel(pss, json_integer_value(id), &index) : NULL;
+
+  if (!ch) {
+    ws_server_send_error(pss, "invalid_channel_request", "No open channel with this id");
+    return;
+  }
+
+  send_channel_message(pss, ch, "closed");
+  syslog(LOG_INFO, "Client closed stats channel %u", ch->id);
+  g_array_remove_index(pss->channels, index);
+  if (pss->channel_rr >= pss->channels->len) {
+    pss->channel_rr = 0;
+  }
+  session_channels_changed(pss);
+}
+
+static void
+grant_credit(struct per_session_data *pss, json_t *spec)
+{
+  json_t *frames = json_object_get(spec, "frames");
+  struct ws_channel *ch =
+      json_is_object(spec) ? find_channel(pss, json_integer_value(json_object_get(spec, "id")), NULL) : NULL;
+
+  if (!ch) {
+    ws_server_send_error(pss, "invalid_channel_request", "No open channel with this id");
+    return;
+  }
+  if (!json_is_integer(frames) || json_integer_value(frames) < 0 || json_integer_value(frames) > CHANNEL_MAX_CREDIT) {
+    ws_server_send_error(pss, "invalid_channel_request", "frames must be an integer in [0, 100000]");
+    return;
+  }
+
+  /* Granting credit to an unlimited channel keeps it unlimited */
+  if (ch->credit >= 0) {
+    ch->credit += json_integer_value(frames);
+    if (ch->credit > CHANNEL_MAX_CREDIT) {
+      ch->credit = CHANNEL_MAX_CREDIT;
+    }
+  }
+}
+
+bool
+channel_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root)
+{
+  json_t *spec;
+  (void)wsi;
+
+  if ((spec = json_object_get(root, "open"))) {
+    if (!json_is_object(spec)) {
+      ws_server_send_error(pss, "invalid_channel_request", "open must be an object");
+      return true;
+    }
+    open_channel(pss, spec);
+    return true;
+  }
+  if ((spec = json_object_get(root, "close"))) {
+    close_channel(pss, spec);
+    return true;
+  }
+  if ((spec = json_object_get(root, "credit"))) {
+    grant_credit(pss, spec);
+    return true;
+  }
+
+  return false;
+}
+
+/******************************************************************************/
+
+void
+channel_tick(const struct sys_stats *stats)
+{
+  if (!stats) {
+    return;
+  }
+
+  for (GList *l = channel_sessions; l; l = l->next) {
+    struct per_session_data *pss = l->data;
+    bool any_due = false;
+
+    for (guint i = 0; i < pss->channels->len; i++) {
+      struct ws_channel *ch = &g_array_index(pss->channels, struct ws_channel, i);
+
+      if (ch->last_seq == stats->seq) {
+        continue;
+      }
+      /* Half a sample period of slack absorbs timer jitter */
+      if (ch->last_mono_ms != 0 && stats->monotonic_ms + CHANNEL_TICK_MS / 2 < ch->last_mono_ms + ch->interval_ms) {
+        continue;
+      }
+
+      ch->last_seq = stats->seq;
+      ch->last_mono_ms = stats->monotonic_ms;
+      if (ch->credit == 0) {
+        ch->dropped++;
+        continue;
+      }
+      if (ch->proc_enabled) {
+        struct proc_sample *s = &ch->proc_sample;
+        s->found = proc_read_process_stats(ch->proc_name,
+                                           &ch->proc_baseline,
+                                           stats->monotonic_ms,
+                                           &s->cpu,
+                                           &s->rss_kb,
+                                           &s->pss_kb,
+                                           &s->uss_kb,
+                                           &s->pid);
+        s->valid = true;
+      }
+      ch->due = true;
+      any_due = true;
+    }
+
+    if (any_due && pss->wsi) {
+      lws_callback_on_writable(pss->wsi);
+    }
+  }
+}
+
+struct ws_channel *
+channel_next_due(struct per_session_data *pss)
+{
+  if (!pss || !pss->channels || pss->channels->len == 0) {
+    return NULL;
+  }
+
+  /* Start after the last channel served, so one busy channel cannot starve the others */
+  for (guint n = 0; n < pss->channels->len; n++) {
+    guint i = (pss->channel_rr + n) % pss->channels->len;
+    struct ws_channel *ch = &g_array_index(pss->channels, struct ws_channel, i);
+    if (ch->due) {
+      pss->channel_rr = i;
+      return ch;
+    }
+  }
+
+  return NULL;
+}
+
+/* Clear a channel's due flag and move the round robin past it */
+static bool
+channel_frame_done(struct per_session_data *pss, struct ws_channel *ch)
+{
+  ch->due = false;
+  pss->channel_rr = (pss->channel_rr + 1) % pss->channels->len;
+
+  for (guint i = 0; i < pss->channels->len; i++) {
+    if (g_array_index(pss->channels, struct ws_channel, i).due) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+channel_frame_sent(struct per_session_data *pss, struct ws_channel *ch)
+{
+  ch->dropped = 0;
+  if (ch->credit > 0) {
+    ch->credit--;
+  }
+
+  return channel_frame_done(pss, ch);
+}
+
+bool
+channel_frame_failed(struct per_session_data *pss, struct ws_channel *ch)
+{
+  return channel_frame_done(pss, ch);
+}
+
+bool
+channel_active(void)
+{
+  return channel_sessions != NULL;
+}
+
+void
+channel_session_closed(struct per_session_data *pss)
+{
+  if (!pss) {
+    return;
+  }
+
+  channel_sessions = g_list_remove(channel_sessions, pss);
+  if (pss->channels) {
+    g_array_free(pss->channels, TRUE);
+    pss->channels = NULL;
+  }
+  pss->channel_rr = 0;
+}
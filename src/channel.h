@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <jansson.h>
+#include <libwebsockets.h>
+
+#include "proc.h"
+#include "session.h"
+#include "stats.h"
+
+/* Maximum number of open channels per WebSocket session */
+#define MAX_CHANNELS_PER_SESSION 8
+
+/* Channel ids accepted from clients: 1 .. CHANNEL_MAX_ID */
+#define CHANNEL_MAX_ID 65535
+
+/* Stats channel field groups (bit mask), selected with "fields" on open */
+enum channel_field {
+  CHANNEL_FIELD_CPU = 1U << 0,          /* cpu, cpu_cores */
+  CHANNEL_FIELD_CPU_PER_CORE = 1U << 1, /* cpu_per_core */
+  CHANNEL_FIELD_MEM = 1U << 2,          /* mem_total_kb, mem_available_kb */
+  CHANNEL_FIELD_LOAD = 1U << 3,         /* load1, load5, load15 */
+  CHANNEL_FIELD_UPTIME = 1U << 4,       /* uptime_s */
+  CHANNEL_FIELD_CLIENTS = 1U << 5,      /* clients */
+  CHANNEL_FIELD_ALL = (1U << 6) - 1
+};
+
+/* One logical stats channel multiplexed over a session.
+ *
+ * Every channel has its own cadence, field set, monitored process (with its
+ * own CPU baseline) and credit. The process is read when the channel is
+ * scheduled; frames are built from the latest sample when the socket becomes
+ * writable, so a slow connection coalesces a channel's frames instead of
+ * queueing them.
+ */
+struct ws_channel {
+  unsigned int id;
+  unsigned int interval_ms;
+  unsigned int fields;
+
+  /* Remaining frames the client allows (-1 = unlimited) */
+  int64_t credit;
+
+  /* A frame is waiting for the next writable callback */
+  bool due;
+  /* Sample sequence number of the last frame sent (or scheduled) */
+  uint64_t last_seq;
+  /* Monotonic time of the last scheduled frame */
+  uint64_t last_mono_ms;
+  /* Frames skipped for lack of credit since the last frame sent */
+  unsigned int dropped;
+
+  /* Optional process monitoring */
+  bool proc_enabled;
+  char proc_name[MAX_PROC_NAME_LENGTH];
+  struct proc_cpu_baseline proc_baseline;
+  /* Last read of the monitored process, formatted by the frame builder */
+  struct proc_sample proc_sample;
+};
+
+/* Handle channel control messages.
+ *
+ * Request formats:
+ *   { "open": { "id": 3, "type": "stats", "interval_ms": 1000,
+ *               "fields": ["cpu", "mem"], "monitor": "name", "credit": 20 } }
+ *     Only "id" and "type" are required; "stats" is the only channel type.
+ *   { "close": 3 }
+ *   { "credit": { "id": 3, "frames": 20 } }
+ *
+ * Returns true if the command was recognized (successfully or not).
+ */
+bool channel_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root);
+
+/* Schedule the channels whose interval elapsed with this sample.
+ *
+ * Called once per sample tick; reads the monitored process of every scheduled
+ * channel and requests a writable callback for every session with a due
+ * channel.
+ */
+void channel_tick(const struct sys_stats *stats);
+
+/* Return the next due channel of a session (round robin), or NULL. */
+struct ws_channel *channel_next_due(struct per_session_data *pss);
+
+/* Mark a channel frame as written; returns true if more channels are due. */
+bool channel_frame_sent(struct per_session_data *pss, struct ws_channel *ch);
+
+/* Give up on a channel frame that was not written completely.
+ *
+ * The channel waits for its next interval; credit and the dropped count are
+ * left as they were. Returns true if more channels are due.
+ */
+bool channel_frame_failed(struct per_session_data *pss, struct ws_channel *ch);
+
+/* Return true while at least one session has an open channel. */
+bool channel_active(void);
+
+/* Close all channels of a session (on disconnect). */
+void channel_session_closed(struct per_session_data *pss);
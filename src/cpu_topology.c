@@ -0,0 +1,312 @@
+/* cpu_topology.c
+ *
+ * Online CPU set and cluster layout.
+ *
+ * - SoCs hot-unplug cores to save power, so the online set is not constant.
+ *   The sampler sees the change for free: /proc/stat only lists online CPUs.
+ *   Only then is sysfs read again (cpu_topology_refresh()), never per tick.
+ * - Clusters (big.LITTLE groups) are the CPUs sharing a cpufreq policy
+ *   (cpuN/cpufreq/related_cpus, which includes offline members). Without
+ *   cpufreq, topology/cluster_cpus_list is used, and without either all
+ *   CPUs form one cluster.
+ * - Files are read through procfs_fopen(), so recordings capture them and
+ *   replays report the recorded layout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cpu_topology.h"
+#include "procfs.h"
+
+#define CPU_SYSFS_DIR "/sys/devices/system/cpu"
+
+static struct {
+  long online_count;
+  bool online[MAX_CPU_CORE_SAMPLES];
+  /* Cluster index per CPU, -1 while unknown */
+  int cluster_of[MAX_CPU_CORE_SAMPLES];
+  struct cpu_cluster clusters[MAX_CPU_CLUSTERS];
+  size_t cluster_count;
+  /* No cluster information in sysfs: one cluster of all CPUs */
+  bool flat;
+  bool initialized;
+} topo;
+
+/******************************************************************************/
+
+long
+cpu_topology_parse_list(const char *list, bool *mask, size_t mask_size)
+{
+  long count = 0;
+  const char *p = list;
+
+  if (mask) {
+    memset(mask, 0, mask_size * sizeof(*mask));
+  }
+  if (!p) {
+    return 0;
+  }
+
+  while (*p && *p != '\n') {
+    char *endptr = NULL;
+    long first = strtol(p, &endptr, 10);
+    long last = first;
+
+    if (endptr == p || first < 0) {
+      return 0;
+    }
+    p = endptr;
+    if (*p == '-') {
+      last = strtol(p + 1, &endptr, 10);
+      if (endptr == p + 1 || last < first) {
+        return 0;
+      }
+      p = endptr;
+    }
+    for (long cpu = first; mask && cpu <= last && (size_t)cpu < mask_size; cpu++) {
+      mask[cpu] = true;
+    }
+    count += last - first + 1;
+    if (*p == ',') {
+      p++;
+    }
+  }
+
+  return count;
+}
+
+/* Read the first line of a sysfs file below CPU_SYSFS_DIR */
+static bool
+read_cpu_file(const char *relpath, char *buf, size_t buf_size)
+{
+  char path[MAX_PROC_LINE_LENGTH];
+  FILE *f;
+  bool ok = false;
+
+  snprintf(path, sizeof(path), CPU_SYSFS_DIR "/%s", relpath);
+  f = procfs_fopen(path, "r");
+  if (!f) {
+    return false;
+  }
+  ok = fgets(buf, (int)buf_size, f) != NULL;
+  fclose(f);
+
+  return ok;
+}
+
+/* Format mask as a kernel cpu list, e.g. "0-3,6" */
+static void
+format_cpu_list(const bool *mask, size_t mask_size, char *out, size_t out_size)
+{
+  size_t len = 0;
+
+  out[0] = '\0';
+  for (size_t cpu = 0; cpu < mask_size; cpu++) {
+    size_t last = cpu;
+
+    if (!mask[cpu]) {
+      continue;
+    }
+    while (last + 1 < mask_size && mask[last + 1]) {
+      last++;
+    }
+    int n = last == cpu ? snprintf(out + len, out_size - len, "%s%zu", len ? "," : "", cpu)
+                        : snprintf(out + len, out_size - len, "%s%zu-%zu", len ? "," : "", cpu, last);
+    if (n < 0 || (size_t)n >= out_size - len) {
+      return;
+    }
+    len += (size_t)n;
+    cpu = last;
+  }
+}
+
+/* Classify cpu and all CPUs sharing its cluster. Returns false if unknown. */
+static bool
+classify_cpu(size_t cpu)
+{
+  char rel[MAX_PROC_LINE_LENGTH];
+  char buf[MAX_PROC_LINE_LENGTH];
+  bool members[MAX_CPU_CORE_SAMPLES];
+  struct cpu_cluster *cl;
+
+  snprintf(rel, sizeof(rel), "cpu%zu/cpufreq/related_cpus", cpu);
+  if (!read_cpu_file(rel, buf, sizeof(buf))) {
+    snprintf(rel, sizeof(rel), "cpu%zu/topology/cluster_cpus_list", cpu);
+    if (!read_cpu_file(rel, buf, sizeof(buf))) {
+      return false;
+    }
+  }
+  if (cpu_topology_parse_list(buf, members, MAX_CPU_CORE_SAMPLES) <= 0 || !members[cpu] ||
+      topo.cluster_count >= MAX_CPU_CLUSTERS) {
+    return false;
+  }
+
+  cl = &topo.clusters[topo.cluster_count];
+  memset(cl, 0, sizeof(*cl));
+  for (size_t i = 0; i < MAX_CPU_CORE_SAMPLES; i++) {
+    /* A CPU belongs to the first cluster that claimed it */
+    if (members[i] && topo.cluster_of[i] < 0) {
+      topo.cluster_of[i] = (int)topo.cluster_count;
+      cl->core_count++;
+    } else {
+      members[i] = false;
+    }
+  }
+  format_cpu_list(members, MAX_CPU_CORE_SAMPLES, cl->cpus, sizeof(cl->cpus));
+  snprintf(rel, sizeof(rel), "cpu%zu/cpufreq/cpuinfo_max_freq", cpu);
+  if (read_cpu_file(rel, buf, sizeof(buf))) {
+    cl->max_freq_khz = strtoul(buf, NULL, 10);
+  }
+  topo.cluster_count++;
+
+  return true;
+}
+
+/* Put all CPUs into one cluster when sysfs has no cluster information */
+static void
+single_cluster(void)
+{
+  struct cpu_cluster *cl = &topo.clusters[0];
+  bool members[MAX_CPU_CORE_SAMPLES];
+
+  memset(cl, 0, sizeof(*cl));
+  for (size_t i = 0; i < MAX_CPU_CORE_SAMPLES; i++) {
+    members[i] = topo.online[i] || topo.cluster_of[i] == 0;
+    if (members[i]) {
+      topo.cluster_of[i] = 0;
+      cl->core_count++;
+    }
+  }
+  format_cpu_list(members, MAX_CPU_CORE_SAMPLES, cl->cpus, sizeof(cl->cpus));
+  topo.cluster_count = 1;
+}
+
+static void
+classify_online_cpus(void)
+{
+  if (!topo.flat) {
+    for (size_t cpu = 0; cpu < MAX_CPU_CORE_SAMPLES; cpu++) {
+      if (topo.online[cpu] && topo.cluster_of[cpu] < 0) {
+        classify_cpu(cpu);
+      }
+    }
+    topo.flat = topo.cluster_count == 0;
+  }
+  /* Without cluster information the single cluster grows with the online set */
+  if (topo.flat) {
+    single_cluster();
+  }
+}
+
+/******************************************************************************/
+
+bool
+cpu_topology_refresh(void)
+{
+  char buf[MAX_PROC_LINE_LENGTH];
+  bool online[MAX_CPU_CORE_SAMPLES];
+  long count = 0;
+  bool changed;
+
+  if (!topo.initialized) {
+    for (size_t i = 0; i < MAX_CPU_CORE_SAMPLES; i++) {
+      topo.cluster_of[i] = -1;
+    }
+  }
+
+  if (read_cpu_file("online", buf, sizeof(buf))) {
+    count = cpu_topology_parse_list(buf, online, MAX_CPU_CORE_SAMPLES);
+  }
+  if (count <= 0) {
+    /* No sysfs: assume CPUs 0..n-1 */
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count <= 0) {
+      syslog(LOG_WARNING, "sysconf(_SC_NPROCESSORS_ONLN) failed, defaulting to 1 CPU");
+      count = 1;
+    }
+    for (size_t i = 0; i < MAX_CPU_CORE_SAMPLES; i++) {
+      online[i] = (long)i < count;
+    }
+  }
+
+  changed = !topo.initialized || topo.online_count != count || memcmp(topo.online, online, sizeof(online)) != 0;
+  topo.online_count = count;
+  memcpy(topo.online, online, sizeof(online));
+  if (changed) {
+    classify_online_cpus();
+    format_cpu_list(online, MAX_CPU_CORE_SAMPLES, buf, sizeof(buf));
+    syslog(LOG_INFO,
+           "%s %ld CPU core(s) online (%s) in %zu cluster(s)",
+           topo.initialized ? "CPU hotplug:" : "Detected",
+           count,
+           buf,
+           topo.cluster_count);
+  }
+  topo.initialized = true;
+
+  return changed;
+}
+
+long
+cpu_topology_online_count(void)
+{
+  return topo.online_count > 0 ? topo.online_count : 1;
+}
+
+bool
+cpu_topology_is_online(size_t cpu)
+{
+  return cpu < MAX_CPU_CORE_SAMPLES && topo.online[cpu];
+}
+
+size_t
+cpu_topology_cluster_count(void)
+{
+  return topo.cluster_count;
+}
+
+const struct cpu_cluster *
+cpu_topology_get_cluster(size_t index)
+{
+  return index < topo.cluster_count ? &topo.clusters[index] : NULL;
+}
+
+int
+cpu_topology_cluster_of(size_t cpu)
+{
+  return cpu < MAX_CPU_CORE_SAMPLES ? topo.cluster_of[cpu] : -1;
+}
+
+void
+cpu_topology_aggregate(struct sys_stats *stats)
+{
+  size_t online[MAX_CPU_CLUSTERS] = { 0 };
+
+  if (!stats) {
+    return;
+  }
+
+  stats->cpu_cluster_count = 0;
+  memset(stats->cpu_cluster_usage, 0, sizeof(stats->cpu_cluster_usage));
+  if (topo.cluster_count < 2) {
+    return;
+  }
+
+  for (size_t cpu = 0; cpu < stats->cpu_per_core_count; cpu++) {
+    int cl = topo.cluster_of[cpu];
+    if (cl < 0 || stats->cpu_core_offline[cpu]) {
+      continue;
+    }
+    stats->cpu_cluster_usage[cl] += stats->cpu_per_core_usage[cpu];
+    online[cl]++;
+  }
+  for (size_t cl = 0; cl < topo.cluster_count; cl++) {
+    if (online[cl] > 0) {
+      stats->cpu_cluster_usage[cl] /= (double)online[cl];
+    }
+  }
+  stats->cpu_cluster_count = topo.cluster_count;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "stats.h"
+
+/* Maximum length of a formatted kernel cpu list such as "0-3,6" */
+#define MAX_CPU_LIST_LENGTH 64
+
+/* One group of CPUs sharing a clock (a big.LITTLE cluster on typical SoCs) */
+struct cpu_cluster {
+  /* Member CPUs as a kernel cpu list, e.g. "4-7" */
+  char cpus[MAX_CPU_LIST_LENGTH];
+  /* cpuinfo_max_freq of the cluster in kHz, 0 when unknown */
+  unsigned long max_freq_khz;
+  /* Number of member CPUs, online or not */
+  size_t core_count;
+};
+
+/* Parse a kernel cpu list such as "0-3,6,8-9".
+ *
+ * mask (optional, mask_size entries) is cleared and CPUs below mask_size are
+ * set. Returns the number of CPUs in the list, or 0 if the list is empty or
+ * malformed.
+ */
+long cpu_topology_parse_list(const char *list, bool *mask, size_t mask_size);
+
+/* Read the online CPU set and the cluster layout from sysfs.
+ *
+ * Called once at startup and again whenever the set of cpuN lines in
+ * /proc/stat changes (CPU hotplug). Clusters come from
+ * cpuN/cpufreq/related_cpus, or topology/cluster_cpus_list without cpufreq;
+ * a CPU not classified yet (e.g. offline at startup) is looked up again on
+ * the next refresh. Returns true if the online set changed.
+ */
+bool cpu_topology_refresh(void);
+
+/* Number of online CPUs, at least 1 */
+long cpu_topology_online_count(void);
+
+/* True if cpu was online at the last refresh */
+bool cpu_topology_is_online(size_t cpu);
+
+/* Number of known clusters (0 before the first refresh) */
+size_t cpu_topology_cluster_count(void);
+
+/* Cluster by index, NULL if out of range */
+const struct cpu_cluster *cpu_topology_get_cluster(size_t index);
+
+/* Cluster index of cpu, or -1 if unknown */
+int cpu_topology_cluster_of(size_t cpu);
+
+/* Fill stats->cpu_cluster_usage[] with the mean usage of the online cores of
+ * every cluster. Clusters are only reported when there are at least two.
+ */
+void cpu_topology_aggregate(struct sys_stats *stats);
@@ -0,0 +1,380 @@
+/* fleet.c
+ *
+ * Aggregator mode: one backend fans in the stats of many devices.
+ *
+ * - Every configured device gets exactly one upstream connection with
+ *   { "stats_stream": true } (upstream.h); the latest frame of each device
+ *   is kept. Device load is therefore independent of the number of viewers.
+ * - Viewers subscribe with { "fleet_stream": true } and get one site-level
+ *   message per FLEET_INTERVAL_MS: a row per device plus fleet-wide
+ *   percentiles of CPU, memory use and load. The message is built once per
+ *   interval and shared by all subscribers.
+ * - Devices that stop sending are reported "stale" after FLEET_STALE_MS and
+ *   excluded from the percentiles; upstream reconnects with backoff.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <glib.h>
+
+#include "fleet.h"
+#include "json_out.h"
+#include "loop_monitor.h"
+#include "stats.h"
+#include "util.h"
+#include "ws_server.h"
+
+static const char fleet_subscribe_json[] = "{\"stats_stream\":true}";
+
+static struct {
+  /* Device table, allocated once so the upstream pointers stay valid */
+  struct fleet_device *devices;
+  size_t device_count;
+  /* Sessions subscribed to fleet_stream */
+  GList *subscribers;
+  guint timer_id;
+  char json[MAX_FLEET_JSON_LENGTH];
+} fleet;
+
+/******************************************************************************/
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentiles of n values (sorts values in place) */
+static void
+compute_percentiles(double *values, size_t n, struct fleet_percentiles *out)
+{
+  double sum = 0.0;
+
+  memset(out, 0, sizeof(*out));
+  if (n == 0) {
+    return;
+  }
+
+  qsort(values, n, sizeof(values[0]), compare_double);
+  for (size_t i = 0; i < n; i++) {
+    sum += values[i];
+  }
+  out->count = n;
+  out->p50 = values[(size_t)ceil(0.50 * (double)n) - 1];
+  out->p90 = values[(size_t)ceil(0.90 * (double)n) - 1];
+  out->p99 = values[(size_t)ceil(0.99 * (double)n) - 1];
+  out->max = values[n - 1];
+  out->mean = sum / (double)n;
+}
+
+static void
+compute_summary(uint64_t now_mono_ms, struct fleet_summary *summary)
+{
+  double cpu[MAX_FLEET_DEVICES];
+  double mem[MAX_FLEET_DEVICES];
+  double load[MAX_FLEET_DEVICES];
+  size_t n = 0;
+
+  memset(summary, 0, sizeof(*summary));
+  for (size_t i = 0; i < fleet.device_count; i++) {
+    const struct fleet_device *dev = &fleet.devices[i];
+
+    if (dev->up.state != UPSTREAM_CONNECTED) {
+      summary->down++;
+      continue;
+    }
+    if (!fleet_device_is_fresh(dev, now_mono_ms)) {
+      summary->stale++;
+      continue;
+    }
+    summary->up++;
+    cpu[n] = dev->cpu;
+    mem[n] = fleet_device_mem_used_percent(dev);
+    load[n] = dev->load1;
+    n++;
+  }
+
+  compute_percentiles(cpu, n, &summary->cpu);
+  compute_percentiles(mem, n, &summary->mem_used_percent);
+  compute_percentiles(load, n, &summary->load1);
+}
+
+/* Build the fleet view into fleet.json; returns its length, 0 on failure */
+static size_t
+build_view(void)
+{
+  struct fleet_summary summary;
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  bool truncated = false;
+
+  compute_summary(now_ms, &summary);
+  size_t len =
+      build_fleet_json(fleet.json, sizeof(fleet.json), fleet.devices, fleet.device_count, &summary, now_ms, &truncated);
+  if (len == 0 || truncated) {
+    syslog(LOG_ERR, "Fleet view does not fit %u bytes", (unsigned int)sizeof(fleet.json));
+    return 0;
+  }
+
+  return len;
+}
+
+static gboolean
+fleet_timer_cb(gpointer user_data)
+{
+  (void)user_data;
+
+  size_t len = build_view();
+  if (len > 0) {
+    for (GList *l = fleet.subscribers; l; l = l->next) {
+      ws_server_queue_json(l->data, fleet.json, len);
+    }
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+update_timer(void)
+{
+  if (fleet.subscribers && fleet.timer_id == 0) {
+    fleet.timer_id = loop_monitor_timeout_add(FLEET_INTERVAL_MS, "fleet_view", fleet_timer_cb, NULL);
+  } else if (!fleet.subscribers && fleet.timer_id != 0) {
+    g_source_remove(fleet.timer_id);
+    fleet.timer_id = 0;
+  }
+}
+
+/******************************************************************************/
+
+/* Keep the latest stats frame of a device; other messages are ignored */
+static void
+device_message(struct upstream *up, const unsigned char *msg, size_t len, void *user)
+{
+  struct fleet_device *dev = user;
+  json_t *root = json_loadb((const char *)msg, len, 0, NULL);
+  json_t *mem_total;
+  (void)up;
+
+  if (!root) {
+    return;
+  }
+
+  /* Stats frames carry the sample fields; channel frames ("ch") are not requested */
+  mem_total = json_object_get(root, "mem_total_kb");
+  if (json_is_integer(mem_total) && !json_object_get(root, "ch")) {
+    dev->have_sample = true;
+    dev->rx_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+    dev->seq = (uint64_t)json_integer_value(json_object_get(root, "seq"));
+    dev->timestamp_ms = (uint64_t)json_integer_value(json_object_get(root, "ts"));
+    dev->cpu = json_number_value(json_object_get(root, "cpu"));
+    dev->load1 = json_number_value(json_object_get(root, "load1"));
+    dev->uptime_s = json_number_value(json_object_get(root, "uptime_s"));
+    dev->mem_total_kb = (long)json_integer_value(mem_total);
+    dev->mem_available_kb = (long)json_integer_value(json_object_get(root, "mem_available_kb"));
+  }
+
+  json_decref(root);
+}
+
+static void
+device_state(struct upstream *up, void *user)
+{
+  (void)user;
+
+  if (up->state == UPSTREAM_CONNECTED) {
+    upstream_send(up, fleet_subscribe_json, sizeof(fleet_subscribe_json) - 1);
+  }
+}
+
+/* Parse one "host[:port] [name]" line; false if invalid */
+static bool
+parse_device_line(char *line, char *host, size_t host_size, int *port, char *name, size_t name_size)
+{
+  char *addr = strtok(line, " \t");
+  char *label = strtok(NULL, " \t");
+
+  if (!addr || strtok(NULL, " \t") || !upstream_parse_address(addr, host, host_size, port)) {
+    return false;
+  }
+
+  if (label) {
+    g_strlcpy(name, label, name_size);
+  } else {
+    snprintf(name, name_size, "%s:%d", host, *port);
+  }
+
+  return true;
+}
+
+bool
+fleet_load(const char *path)
+{
+  struct fleet_device parsed[MAX_FLEET_DEVICES];
+  char line[MAX_PROC_LINE_LENGTH];
+  size_t count = 0;
+  unsigned int line_no = 0;
+  bool ok = true;
+  FILE *f;
+
+  if (fleet.devices) {
+    return true;
+  }
+
+  f = fopen(path, "r");
+  if (!f) {
+    syslog(LOG_ERR, "Cannot open fleet device list %s", path);
+    return false;
+  }
+
+  memset(parsed, 0, sizeof(parsed));
+  while (ok && fgets(line, sizeof(line), f)) {
+    char *comment = strchr(line, '#');
+    int port = 0;
+
+    line_no++;
+    if (comment) {
+      *comment = '\0';
+    }
+    g_strstrip(line);
+    if (line[0] == '\0') {
+      continue;
+    }
+    if (count == MAX_FLEET_DEVICES) {
+      syslog(LOG_ERR, "Fleet device list %s: more than %d devices", path, MAX_FLEET_DEVICES);
+      ok = false;
+      break;
+    }
+    struct fleet_device *dev = &parsed[count];
+    if (!parse_device_line(line, dev->up.host, sizeof(dev->up.host), &port, dev->name, sizeof(dev->name))) {
+      syslog(LOG_ERR, "Fleet device list %s:%u: expected \"host[:port] [name]\"", path, line_no);
+      ok = false;
+      break;
+    }
+    dev->up.port = port;
+    count++;
+  }
+  fclose(f);
+
+  if (ok && count == 0) {
+    syslog(LOG_ERR, "Fleet device list %s has no devices", path);
+    ok = false;
+  }
+  if (!ok) {
+    return false;
+  }
+
+  fleet.devices = g_new0(struct fleet_device, count);
+  fleet.device_count = count;
+  for (size_t i = 0; i < count; i++) {
+    struct fleet_device *dev = &fleet.devices[i];
+    g_strlcpy(dev->name, parsed[i].name, sizeof(dev->name));
+    upstream_add(&dev->up, parsed[i].up.host, parsed[i].up.port, device_message, device_state, dev);
+  }
+  syslog(LOG_INFO, "Fleet mode: aggregating %zu devices", count);
+
+  return true;
+}
+
+void
+fleet_stop(void)
+{
+  g_list_free(fleet.subscribers);
+  fleet.subscribers = NULL;
+  update_timer();
+
+  for (size_t i = 0; i < fleet.device_count; i++) {
+    upstream_remove(&fleet.devices[i].up);
+  }
+  g_free(fleet.devices);
+  fleet.devices = NULL;
+  fleet.device_count = 0;
+}
+
+bool
+fleet_enabled(void)
+{
+  return fleet.devices != NULL;
+}
+
+bool
+fleet_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root)
+{
+  json_t *once = json_object_get(root, "fleet");
+  json_t *stream = json_object_get(root, "fleet_stream");
+  (void)wsi;
+
+  if (!once && !stream) {
+    return false;
+  }
+  if (!fleet_enabled()) {
+    ws_server_send_error(pss, "fleet_disabled", "Fleet mode is not enabled on this server");
+    return true;
+  }
+
+  if (once) {
+    size_t len = json_is_true(once) ? build_view() : 0;
+    if (len > 0) {
+      ws_server_queue_json(pss, fleet.json, len);
+    }
+    return true;
+  }
+
+  if (!json_is_boolean(stream)) {
+    ws_server_send_error(pss, "invalid_fleet_request", "fleet_stream must be a boolean");
+    return true;
+  }
+
+  if (json_is_true(stream) && !fleet_is_subscribed(pss)) {
+    fleet.subscribers = g_list_prepend(fleet.subscribers, pss);
+    syslog(LOG_INFO, "Client subscribed to the fleet view (%u active)", g_list_length(fleet.subscribers));
+    /* First view right away, then every FLEET_INTERVAL_MS */
+    size_t len = build_view();
+    if (len > 0) {
+      ws_server_queue_json(pss, fleet.json, len);
+    }
+  } else if (!json_is_true(stream)) {
+    fleet_session_closed(pss);
+  }
+  update_timer();
+
+  return true;
+}
+
+bool
+fleet_is_subscribed(const struct per_session_data *pss)
+{
+  return pss && g_list_find(fleet.subscribers, pss) != NULL;
+}
+
+void
+fleet_session_closed(struct per_session_data *pss)
+{
+  if (!pss) {
+    return;
+  }
+
+  fleet.subscribers = g_list_remove(fleet.subscribers, pss);
+  update_timer();
+}
+
+bool
+fleet_device_is_fresh(const struct fleet_device *dev, uint64_t now_mono_ms)
+{
+  return dev->have_sample && now_mono_ms - dev->rx_mono_ms < FLEET_STALE_MS;
+}
+
+double
+fleet_device_mem_used_percent(const struct fleet_device *dev)
+{
+  if (dev->mem_total_kb <= 0) {
+    return 0.0;
+  }
+
+  return 100.0 * (double)(dev->mem_total_kb - dev->mem_available_kb) / (double)dev->mem_total_kb;
+}
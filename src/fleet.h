@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <jansson.h>
+#include <libwebsockets.h>
+
+#include "session.h"
+#include "upstream.h"
+
+/* Maximum number of devices in one fleet */
+#define MAX_FLEET_DEVICES 64
+
+#define MAX_FLEET_DEVICE_NAME_LENGTH 64
+
+/* Upper bound for one fleet message (all device rows) */
+#define MAX_FLEET_JSON_LENGTH (32 * 1024)
+
+/* Cadence of the fleet view sent to fleet_stream subscribers */
+#define FLEET_INTERVAL_MS 1000
+
+/* A device without a frame for this long is reported as "stale" */
+#define FLEET_STALE_MS 5000
+
+/* One monitored device: its upstream subscription and its latest sample */
+struct fleet_device {
+  char name[MAX_FLEET_DEVICE_NAME_LENGTH];
+  struct upstream up;
+
+  /* Latest stats frame of the device */
+  bool have_sample;
+  uint64_t seq;
+  uint64_t timestamp_ms;
+  uint64_t rx_mono_ms;
+  double cpu;
+  double load1;
+  double uptime_s;
+  long mem_total_kb;
+  long mem_available_kb;
+};
+
+/* Fleet-wide distribution of one metric over the devices with a fresh sample */
+struct fleet_percentiles {
+  size_t count;
+  double p50;
+  double p90;
+  double p99;
+  double max;
+  double mean;
+};
+
+/* Site-level view computed from the latest device samples */
+struct fleet_summary {
+  /* Devices by state: fresh sample, connected without fresh sample, not connected */
+  size_t up;
+  size_t stale;
+  size_t down;
+  struct fleet_percentiles cpu;
+  struct fleet_percentiles mem_used_percent;
+  struct fleet_percentiles load1;
+};
+
+/* Load the device list and enable fleet (aggregator) mode.
+ *
+ * One device per line: "host[:port] [name]", '#' starts a comment. Every
+ * device gets one upstream "sysstats" subscription, independent of how many
+ * clients watch the fleet. Returns false if the file is unreadable, empty or
+ * has an invalid line.
+ */
+bool fleet_load(const char *path);
+
+/* Disconnect all devices and disable fleet mode. Safe to call multiple times. */
+void fleet_stop(void);
+
+/* True while fleet mode is enabled */
+bool fleet_enabled(void);
+
+/* Handle fleet requests.
+ *
+ * Request formats:
+ *   { "fleet": true }          one-shot fleet view
+ *   { "fleet_stream": true }   fleet view every FLEET_INTERVAL_MS
+ *   { "fleet_stream": false }
+ *
+ * Returns true if the command was recognized (successfully or not).
+ */
+bool fleet_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root);
+
+/* True if a session subscribed to fleet_stream */
+bool fleet_is_subscribed(const struct per_session_data *pss);
+
+/* Drop the fleet_stream subscription of a session (on disconnect). */
+void fleet_session_closed(struct per_session_data *pss);
+
+/* True if the device has a sample younger than FLEET_STALE_MS */
+bool fleet_device_is_fresh(const struct fleet_device *dev, uint64_t now_mono_ms);
+
+/* Memory in use in percent of the device's total, 0 when unknown */
+double fleet_device_mem_used_percent(const struct fleet_device *dev);
@@ -0,0 +1,88 @@
+#include <string.h>
+
+#include "histogram.h"
+
+/* Upper bucket bounds (ms); the final bucket collects everything larger */
+static const uint64_t bucket_le_ms[HISTOGRAM_BUCKET_COUNT - 1] = {
+  1, 2, 5, 10, 20, 50, 100, 200, 300, 400, 500, 750, 1000, 2000, 5000,
+};
+
+void
+histogram_reset(struct histogram *h)
+{
+  if (h) {
+    memset(h, 0, sizeof(*h));
+  }
+}
+
+void
+histogram_record(struct histogram *h, uint64_t value)
+{
+  size_t idx = 0;
+
+  if (!h) {
+    return;
+  }
+
+  while (idx < HISTOGRAM_BUCKET_COUNT - 1 && value > bucket_le_ms[idx]) {
+    idx++;
+  }
+  h->buckets[idx]++;
+  h->count++;
+  h->sum += value;
+  if (value > h->max) {
+    h->max = value;
+  }
+}
+
+uint64_t
+histogram_bucket_le(size_t idx)
+{
+  if (idx >= HISTOGRAM_BUCKET_COUNT - 1) {
+    return UINT64_MAX;
+  }
+
+  return bucket_le_ms[idx];
+}
+
+uint64_t
+histogram_percentile(const struct histogram *h, double p)
+{
+  uint64_t rank;
+  uint64_t seen = 0;
+
+  if (!h || h->count == 0) {
+    return 0;
+  }
+  if (p < 0.0) {
+    p = 0.0;
+  }
+  if (p > 100.0) {
+    p = 100.0;
+  }
+
+  /* Nearest-rank: smallest bucket whose cumulative count reaches rank */
+  rank = (uint64_t)(p / 100.0 * (double)h->count + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  for (size_t i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t le = histogram_bucket_le(i);
+      return le < h->max ? le : h->max;
+    }
+  }
+
+  return h->max;
+}
+
+double
+histogram_mean(const struct histogram *h)
+{
+  if (!h || h->count == 0) {
+    return 0.0;
+  }
+
+  return (double)h->sum / (double)h->count;
+}
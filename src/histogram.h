@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of buckets in a latency histogram (including the overflow bucket). */
+#define HISTOGRAM_BUCKET_COUNT 16
+
+/* Fixed-size latency histogram in milliseconds.
+ *
+ * - Bucket i counts values <= histogram_bucket_le(i) that did not fit an
+ *   earlier bucket. The last bucket has no upper bound.
+ * - Bounds are tuned around the 500 ms sample cadence.
+ * - No allocation: the struct can be embedded in per-session data.
+ */
+struct histogram {
+  uint64_t buckets[HISTOGRAM_BUCKET_COUNT];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+};
+
+/* Clear all counters. */
+void histogram_reset(struct histogram *h);
+
+/* Record one value (ms). */
+void histogram_record(struct histogram *h, uint64_t value);
+
+/* Return the upper bound of bucket idx, or UINT64_MAX for the overflow bucket. */
+uint64_t histogram_bucket_le(size_t idx);
+
+/* Return an upper estimate of the p-th percentile (0..100).
+ *
+ * The result is the upper bound of the bucket containing the percentile,
+ * clamped to the largest recorded value. Returns 0 for an empty histogram.
+ */
+uint64_t histogram_percentile(const struct histogram *h, double p);
+
+/* Return the mean of all recorded values, 0.0 for an empty histogram. */
+double histogram_mean(const struct histogram *h);
@@ -0,0 +1,542 @@
+/* history.c
+ *
+ * Long system history with min/max-preserving downsampled queries.
+ *
+ * - Every sample is kept at full rate in a raw ring (the last hour) and folded
+ *   into fixed 10 s buckets (the last 24 h). Each bucket keeps the first,
+ *   minimum, maximum and last value of every metric with their times.
+ * - Queries use M4 aggregation: the window is split into one slice per pixel
+ *   column of the client's chart and each slice is reduced to its first, min,
+ *   max and last point. A line drawn through those points rasterizes the same
+ *   as one drawn through every sample, so spikes never disappear, and the
+ *   reply size depends on the chart width only, not on the window length.
+ * - Buckets hold exactly the four M4 points of their 10 s, so the same
+ *   aggregation runs over them unchanged once the raw ring no longer covers
+ *   the window.
+ *
+ * Memory is allocated by history_start() only: ~115 KB raw plus ~620 KB of
+ * buckets.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <glib.h>
+
+#include "history.h"
+#include "json_out.h"
+#include "util.h"
+#include "ws_limits.h"
+#include "ws_server.h"
+
+static const char *const metric_names[HISTORY_METRIC_COUNT] = { "cpu", "mem_used_percent", "load1" };
+
+struct raw_sample {
+  uint64_t ts_ms;
+  float values[HISTORY_METRIC_COUNT];
+};
+
+/* M4 points of one metric within a bucket, times as offsets from start_ms */
+struct bucket_metric {
+  float min;
+  float max;
+  float first;
+  float last;
+  uint16_t min_offset_ms;
+  uint16_t max_offset_ms;
+};
+
+struct history_bucket {
+  uint64_t start_ms;
+  /* Offsets of the first and last sample (shared by all metrics) */
+  uint16_t first_offset_ms;
+  uint16_t last_offset_ms;
+  uint32_t count;
+  struct bucket_metric metrics[HISTORY_METRIC_COUNT];
+};
+
+static struct {
+  bool enabled;
+  /* Raw ring, oldest at raw_start */
+  struct raw_sample *raw;
+  size_t raw_start;
+  size_t raw_count;
+  /* Completed buckets, oldest at bucket_start, and the bucket in progress */
+  struct history_bucket *buckets;
+  size_t bucket_start;
+  size_t bucket_count;
+  struct history_bucket current;
+  uint64_t newest_ms;
+} history;
+
+/******************************************************************************/
+
+static void
+reset_store(void)
+{
+  history.raw_start = 0;
+  history.raw_count = 0;
+  history.bucket_start = 0;
+  history.bucket_count = 0;
+  memset(&history.current, 0, sizeof(history.current));
+  history.newest_ms = 0;
+}
+
+/******************************************************************************/
+
+void
+history_start(void)
+{
+  if (history.enabled) {
+    return;
+  }
+
+  history.raw = g_new0(struct raw_sample, HISTORY_RAW_LENGTH);
+  history.buckets = g_new0(struct history_bucket, HISTORY_BUCKET_COUNT);
+  reset_store();
+  history.enabled = true;
+}
+
+void
+history_stop(void)
+{
+  if (!history.enabled) {
+    return;
+  }
+
+  g_free(history.raw);
+  g_free(history.buckets);
+  history.raw = NULL;
+  history.buckets = NULL;
+  reset_store();
+  history.enabled = false;
+}
+
+bool
+history_enabled(void)
+{
+  return history.enabled;
+}
+
+/* Fold one sample into the bucket in progress */
+static void
+bucket_add(struct history_bucket *b, uint64_t ts_ms, const float *values)
+{
+  uint16_t offset = (uint16_t)(ts_ms - b->start_ms);
+
+  if (b->count == 0) {
+    b->first_offset_ms = offset;
+    for (size_t i = 0; i < HISTORY_METRIC_COUNT; i++) {
+      struct bucket_metric *m = &b->metrics[i];
+      m->min = m->max = m->first = values[i];
+      m->min_offset_ms = m->max_offset_ms = offset;
+    }
+  }
+
+  for (size_t i = 0; i < HISTORY_METRIC_COUNT; i++) {
+    struct bucket_metric *m = &b->metrics[i];
+    if (values[i] < m->min) {
+      m->min = values[i];
+      m->min_offset_ms = offset;
+    }
+    if (values[i] > m->max) {
+      m->max = values[i];
+      m->max_offset_ms = offset;
+    }
+    m->last = values[i];
+  }
+  b->last_offset_ms = offset;
+  b->count++;
+}
+
+void
+history_record(const struct sys_stats *stats)
+{
+  float values[HISTORY_METRIC_COUNT];
+
+  if (!history.enabled || !stats || stats->timestamp_ms == 0 || stats->mem_total_kb <= 0) {
+    return;
+  }
+
+  /* Queries rely on time order; after a clock step back start over */
+  if (stats->timestamp_ms < history.newest_ms) {
+    syslog(LOG_INFO, "System clock moved back, clearing the history");
+    reset_store();
+  }
+  history.newest_ms = stats->timestamp_ms;
+
+  values[HISTORY_METRIC_CPU] = (float)stats->cpu_usage;
+  values[HISTORY_METRIC_MEM_USED_PERCENT] =
+      (float)((double)(stats->mem_total_kb - stats->mem_available_kb) * 100.0 / (double)stats->mem_total_kb);
+  values[HISTORY_METRIC_LOAD1] = (float)stats->load1;
+
+  size_t index = (history.raw_start + history.raw_count) % HISTORY_RAW_LENGTH;
+  if (history.raw_count < HISTORY_RAW_LENGTH) {
+    history.raw_count++;
+  } else {
+    history.raw_start = (history.raw_start + 1) % HISTORY_RAW_LENGTH;
+  }
+  history.raw[index].ts_ms = stats->timestamp_ms;
+  memcpy(history.raw[index].values, values, sizeof(values));
+
+  uint64_t bucket_start = stats->timestamp_ms - stats->timestamp_ms % HISTORY_BUCKET_MS;
+  if (history.current.start_ms != bucket_start) {
+    if (history.current.count > 0) {
+      index = (history.bucket_start + history.bucket_count) % HISTORY_BUCKET_COUNT;
+      if (history.bucket_count < HISTORY_BUCKET_COUNT) {
+        history.bucket_count++;
+      } else {
+        history.bucket_start = (history.bucket_start + 1) % HISTORY_BUCKET_COUNT;
+      }
+      history.buckets[index] = history.current;
+    }
+    memset(&history.current, 0, sizeof(history.current));
+    history.current.start_ms = bucket_start;
+  }
+  bucket_add(&history.current, stats->timestamp_ms, values);
+}
+
+/******************************************************************************/
+
+/* M4 reduction state: the open column and its four candidate points */
+struct m4 {
+  uint64_t from_ms;
+  uint64_t span_ms;
+  size_t columns;
+  size_t column;
+  bool open;
+  struct history_point first;
+  struct history_point min;
+  struct history_point max;
+  struct history_point last;
+  struct history_point *out;
+  size_t n;
+};
+
+static void
+m4_emit_point(struct m4 *m, const struct history_point *p)
+{
+  /* Skip a point already emitted (e.g. first == min) */
+  if (m->n > 0 && m->out[m->n - 1].ts_ms == p->ts_ms) {
+    return;
+  }
+  m->out[m->n++] = *p;
+}
+
+static void
+m4_close(struct m4 *m)
+{
+  const struct history_point *lo = &m->min;
+  const struct history_point *hi = &m->max;
+
+  if (!m->open) {
+    return;
+  }
+  if (hi->ts_ms < lo->ts_ms) {
+    lo = &m->max;
+    hi = &m->min;
+  }
+  m4_emit_point(m, &m->first);
+  m4_emit_point(m, lo);
+  m4_emit_point(m, hi);
+  m4_emit_point(m, &m->last);
+  m->open = false;
+}
+
+/* Add one point; points must arrive in time order and within the window */
+static void
+m4_add(struct m4 *m, uint64_t ts_ms, double value)
+{
+  struct history_point p = { .ts_ms = ts_ms, .value = value };
+  size_t column = (size_t)((ts_ms - m->from_ms) * m->columns / m->span_ms);
+
+  if (m->open && column != m->column) {
+    m4_close(m);
+  }
+  if (!m->open) {
+    m->column = column;
+    m->first = m->min = m->max = p;
+    m->open = true;
+  }
+  if (value < m->min.value) {
+    m->min = p;
+  }
+  if (value > m->max.value) {
+    m->max = p;
+  }
+  m->last = p;
+}
+
+/* Index of the first raw sample at or after ts_ms (raw_count if none) */
+static size_t
+raw_lower_bound(uint64_t ts_ms)
+{
+  size_t lo = 0;
+  size_t hi = history.raw_count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (history.raw[(history.raw_start + mid) % HISTORY_RAW_LENGTH].ts_ms < ts_ms) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void
+m4_add_bucket(struct m4 *m, const struct history_bucket *b, enum history_metric metric, uint64_t to_ms)
+{
+  const struct bucket_metric *bm = &b->metrics[metric];
+  struct history_point points[4] = {
+    { b->start_ms + b->first_offset_ms, bm->first },
+    { b->start_ms + bm->min_offset_ms, bm->min },
+    { b->start_ms + bm->max_offset_ms, bm->max },
+    { b->start_ms + b->last_offset_ms, bm->last },
+  };
+
+  if (points[2].ts_ms < points[1].ts_ms) {
+    struct history_point tmp = points[1];
+    points[1] = points[2];
+    points[2] = tmp;
+  }
+  for (size_t i = 0; i < 4; i++) {
+    if (points[i].ts_ms >= m->from_ms && points[i].ts_ms < to_ms) {
+      m4_add(m, points[i].ts_ms, points[i].value);
+    }
+  }
+}
+
+size_t
+history_query_m4(enum history_metric metric,
+                 uint64_t from_ms,
+                 uint64_t to_ms,
+                 size_t columns,
+                 struct history_point *out,
+                 uint64_t *resolution_ms)
+{
+  struct m4 m = { .from_ms = from_ms, .span_ms = to_ms - from_ms, .columns = columns, .out = out };
+
+  if (resolution_ms) {
+    *resolution_ms = 0;
+  }
+  if (!history.enabled || metric >= HISTORY_METRIC_COUNT || to_ms <= from_ms || columns == 0 || !out ||
+      history.raw_count == 0) {
+    return 0;
+  }
+
+  /* Raw samples while the ring has not dropped anything the window needs */
+  const struct raw_sample *oldest = &history.raw[history.raw_start];
+  if (history.raw_count < HISTORY_RAW_LENGTH || oldest->ts_ms <= from_ms) {
+    for (size_t i = raw_lower_bound(from_ms); i < history.raw_count; i++) {
+      const struct raw_sample *s = &history.raw[(history.raw_start + i) % HISTORY_RAW_LENGTH];
+      if (s->ts_ms >= to_ms) {
+        break;
+      }
+      m4_add(&m, s->ts_ms, s->values[metric]);
+    }
+    if (resolution_ms && history.raw_count > 1) {
+      const struct raw_sample *newest =
+          &history.raw[(history.raw_start + history.raw_count - 1) % HISTORY_RAW_LENGTH];
+      *resolution_ms = (newest->ts_ms - oldest->ts_ms) / (history.raw_count - 1);
+    }
+  } else {
+    for (size_t i = 0; i < history.bucket_count; i++) {
+      const struct history_bucket *b = &history.buckets[(history.bucket_start + i) % HISTORY_BUCKET_COUNT];
+      if (b->start_ms + HISTORY_BUCKET_MS <= from_ms) {
+        continue;
+      }
+      if (b->start_ms >= to_ms) {
+        break;
+      }
+      m4_add_bucket(&m, b, metric, to_ms);
+    }
+    if (history.current.count > 0) {
+      m4_add_bucket(&m, &history.current, metric, to_ms);
+    }
+    if (resolution_ms) {
+      *resolution_ms = HISTORY_BUCKET_MS;
+    }
+  }
+  m4_close(&m);
+
+  return m.n;
+}
+
+const char *
+history_metric_name(enum history_metric metric)
+{
+  return metric < HISTORY_METRIC_COUNT ? metric_names[metric] : "";
+}
+
+/******************************************************************************/
+
+/* Parse "metrics" into a selection mask; false on unknown names */
+static bool
+parse_metrics(json_t *metrics, bool selected[HISTORY_METRIC_COUNT])
+{
+  size_t index;
+  json_t *value;
+
+  if (!metrics) {
+    for (size_t i = 0; i < HISTORY_METRIC_COUNT; i++) {
+      selected[i] = true;
+    }
+    return true;
+  }
+  if (!json_is_array(metrics) || json_array_size(metrics) == 0) {
+    return false;
+  }
+
+  memset(selected, 0, sizeof(bool) * HISTORY_METRIC_COUNT);
+  json_array_foreach (metrics, index, value) {
+    size_t i;
+    const char *name = json_string_value(value);
+    for (i = 0; name && i < HISTORY_METRIC_COUNT; i++) {
+      if (strcmp(name, metric_names[i]) == 0) {
+        selected[i] = true;
+        break;
+      }
+    }
+    if (!name || i == HISTORY_METRIC_COUNT) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Build { "t": [ms since from_ms...], "v": [...] } for one metric */
+static json_t *
+build_series_json(enum history_metric metric,
+                  uint64_t from_ms,
+                  uint64_t to_ms,
+                  size_t columns,
+                  struct history_point *points,
+                  uint64_t *resolution_ms)
+{
+  json_t *series = json_object();
+  json_t *t = json_array();
+  json_t *v = json_array();
+
+  if (!series || !t || !v) {
+    json_decref(v);
+    json_decref(t);
+    json_decref(series);
+    return NULL;
+  }
+
+  size_t n = history_query_m4(metric, from_ms, to_ms, columns, points, resolution_ms);
+  for (size_t i = 0; i < n; i++) {
+    json_array_append_new(t, json_integer((json_int_t)(points[i].ts_ms - from_ms)));
+    json_array_append_new(v, json_real(isfinite(points[i].value) ? points[i].value : 0.0));
+  }
+  json_object_set_new(series, "t", t);
+  json_object_set_new(series, "v", v);
+  return series;
+}
+
+bool
+history_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root)
+{
+  json_t *req = json_object_get(root, "history");
+  bool selected[HISTORY_METRIC_COUNT];
+  uint64_t resolution_ms = 0;
+  (void)wsi;
+
+  if (!req) {
+    return false;
+  }
+
+  if (!history.enabled) {
+    ws_server_send_error(pss, "history_disabled", "History is not enabled on this server");
+    return true;
+  }
+
+  json_t *window = json_object_get(req, "window_ms");
+  json_t *columns = json_object_get(req, "columns");
+  json_t *end = json_object_get(req, "end_ms");
+  if (!json_is_object(req) || !json_is_integer(window) || json_integer_value(window) < 1000 ||
+      (uint64_t)json_integer_value(window) > HISTORY_MAX_WINDOW_MS) {
+    ws_server_send_error(pss, "invalid_history_request", "window_ms must be an integer in [1000, 86400000]");
+    return true;
+  }
+  if (!json_is_integer(columns) || json_integer_value(columns) < 1 ||
+      json_integer_value(columns) > HISTORY_MAX_COLUMNS) {
+    ws_server_send_error(pss, "invalid_history_request", "columns must be an integer in [1, 2000]");
+    return true;
+  }
+  if (end && (!json_is_integer(end) || json_integer_value(end) <= json_integer_value(window))) {
+    ws_server_send_error(pss, "invalid_history_request", "end_ms must be a CLOCK_REALTIME time in ms");
+    return true;
+  }
+  if (!parse_metrics(json_object_get(req, "metrics"), selected)) {
+    ws_server_send_error(pss, "invalid_history_request", "metrics must be a non-empty array of known metric names");
+    return true;
+  }
+  size_t metric_count = 0;
+  for (size_t i = 0; i < HISTORY_METRIC_COUNT; i++) {
+    metric_count += selected[i] ? 1 : 0;
+  }
+  if ((size_t)json_integer_value(columns) * metric_count > HISTORY_MAX_COLUMNS) {
+    ws_server_send_error(pss, "invalid_history_request", "columns times the number of metrics must not exceed 2000");
+    return true;
+  }
+
+  /* A slow client would otherwise pile up replies in its queue */
+  if (ws_server_bulk_reply_queued(pss)) {
+    ws_server_send_error(pss, "history_busy", "The previous history reply has not been sent yet");
+    return true;
+  }
+
+  /* One past the newest sample, so a window ending now includes it */
+  uint64_t to_ms = end ? (uint64_t)json_integer_value(end) : util_get_time_ms(CLOCK_REALTIME) + 1;
+  uint64_t from_ms = to_ms - (uint64_t)json_integer_value(window);
+  size_t column_count = (size_t)json_integer_value(columns);
+  struct history_point *points = g_new(struct history_point, 4 * column_count);
+
+  json_t *resp = json_object();
+  json_t *body = json_object();
+  json_t *series = json_object();
+  if (!resp || !body || !series) {
+    json_decref(series);
+    json_decref(body);
+    json_decref(resp);
+    g_free(points);
+    return true;
+  }
+
+  for (size_t i = 0; i < HISTORY_METRIC_COUNT; i++) {
+    if (selected[i]) {
+      json_t *s = build_series_json((enum history_metric)i, from_ms, to_ms, column_count, points, &resolution_ms);
+      if (s) {
+        json_object_set_new(series, metric_names[i], s);
+      }
+    }
+  }
+  g_free(points);
+
+  json_object_set_new(body, "from_ms", json_integer((json_int_t)from_ms));
+  json_object_set_new(body, "to_ms", json_integer((json_int_t)to_ms));
+  json_object_set_new(body, "columns", json_integer((json_int_t)column_count));
+  json_object_set_new(body, "resolution_ms", json_integer((json_int_t)resolution_ms));
+  json_object_set_new(body, "series", series);
+  json_object_set_new(resp, "history", body);
+
+  /* 5 significant digits are below one pixel on any chart */
+  char *json = json_dumps(resp, JSON_COMPACT | JSON_REAL_PRECISION(5));
+  json_decref(resp);
+  if (!json) {
+    return true;
+  }
+  size_t json_len = strlen(json);
+  if (json_len > HISTORY_MAX_REPLY_LENGTH) {
+    syslog(LOG_WARNING, "History reply of %zu bytes exceeds %u", json_len, HISTORY_MAX_REPLY_LENGTH);
+    ws_server_send_error(pss, "history_too_large", "The history reply does not fit the reply limit");
+  } else {
+    ws_server_queue_bulk_json(pss, json, json_len);
+  }
+  free(json);
+  return true;
+}
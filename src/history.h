@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <jansson.h>
+#include <libwebsockets.h>
+
+#include "session.h"
+#include "stats.h"
+
+/* Full-rate samples kept (1 h at the 500 ms sample interval) */
+#define HISTORY_RAW_LENGTH 7200
+
+/* Width of one aggregated bucket and number of buckets kept (24 h) */
+#define HISTORY_BUCKET_MS 10000
+#define HISTORY_BUCKET_COUNT 8640
+
+/* Longest window a query may ask for */
+#define HISTORY_MAX_WINDOW_MS ((uint64_t)HISTORY_BUCKET_COUNT * HISTORY_BUCKET_MS)
+
+/* Most pixel columns a query may ask for, summed over its metrics
+ * (columns * number of metrics). At 4 points per column and up to
+ * ~17 bytes per point ("86399999," and "100.00,") a reply stays below
+ * HISTORY_MAX_REPLY_LENGTH.
+ */
+#define HISTORY_MAX_COLUMNS 2000
+
+/* Largest serialized reply; larger ones are refused rather than queued */
+#define HISTORY_MAX_REPLY_LENGTH (160U * 1024U)
+
+/* Metrics kept in the history */
+enum history_metric {
+  HISTORY_METRIC_CPU = 0,
+  HISTORY_METRIC_MEM_USED_PERCENT,
+  HISTORY_METRIC_LOAD1,
+  HISTORY_METRIC_COUNT
+};
+
+/* One point of a downsampled series */
+struct history_point {
+  uint64_t ts_ms;
+  double value;
+};
+
+/* Allocate the history store. While enabled the sampler runs continuously. */
+void history_start(void);
+
+/* Release the store. Safe to call multiple times. */
+void history_stop(void);
+
+/* True while the history is enabled */
+bool history_enabled(void);
+
+/* Add one sample (stats->timestamp_ms, CLOCK_REALTIME). */
+void history_record(const struct sys_stats *stats);
+
+/* Downsample metric over [from_ms, to_ms) to at most 4 points per column (M4).
+ *
+ * The window is split into columns equal time slices; each slice with data
+ * yields its first, minimum, maximum and last point in time order, so peaks
+ * and the shape of a line drawn one column per pixel are preserved exactly.
+ * Full-rate samples are used while they cover from_ms, otherwise the
+ * 10 s buckets (which keep the same four points). *resolution_ms receives the
+ * interval of the source used. out must hold 4 * columns points.
+ * Returns the number of points written.
+ */
+size_t history_query_m4(enum history_metric metric,
+                        uint64_t from_ms,
+                        uint64_t to_ms,
+                        size_t columns,
+                        struct history_point *out,
+                        uint64_t *resolution_ms);
+
+/* Return the protocol name of a metric ("cpu", "mem_used_percent", "load1"). */
+const char *history_metric_name(enum history_metric metric);
+
+/* Handle history queries.
+ *
+ * Request format:
+ *   { "history": { "window_ms": 3600000, "columns": 800,
+ *                  "metrics": [ "cpu", "mem_used_percent" ] } }
+ *
+ * "end_ms" (CLOCK_REALTIME ms, default: now) moves the window back in time;
+ * "metrics" defaults to all. columns times the number of metrics may not
+ * exceed HISTORY_MAX_COLUMNS. A session has one reply in flight: a query
+ * while the previous reply is still queued gets a "history_busy" error.
+ * Returns true if the command was recognized (successfully or not).
+ */
+bool history_handle_request(struct lws *wsi, struct per_session_data *pss, json_t *root);
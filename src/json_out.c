@@ -4,24 +4,146 @@
 #include <jansson.h>
 
 #include "json_out.h"
+#include "cpu_topology.h"
+#include "loop_monitor.h"
+#include "self_stats.h"
 #include "storage.h"
 #include "system_info.h"
+#include "throttle.h"
+#include "util.h"
 #include "proc.h"
+#include "proc_identity.h"
 #include "ws_limits.h"
+#include "ws_server.h"
+
+/* Append a per-core CPU usage array to resp; false on allocation failure.
+ *
+ * Hot-unplugged cores (reported as 0) are listed in "cpu_offline", and
+ * per-cluster means in "cpu_clusters" on multi-cluster SoCs.
+ */
+static bool
+add_cpu_per_core_json(json_t *resp, const struct sys_stats *stats)
+{
+  json_t *cpu_per_core = json_array();
+
+  if (!cpu_per_core) {
+    return false;
+  }
+  for (size_t i = 0; i < stats->cpu_per_core_count; i++) {
+    if (json_array_append_new(cpu_per_core, json_real(stats->cpu_per_core_usage[i])) != 0) {
+      json_decref(cpu_per_core);
+      return false;
+    }
+  }
+  json_object_set_new(resp, "cpu_per_core", cpu_per_core);
+
+  if (stats->cpu_offline_count > 0) {
+    json_t *offline = json_array();
+    if (!offline) {
+      return false;
+    }
+    for (size_t i = 0; i < stats->cpu_per_core_count; i++) {
+      if (stats->cpu_core_offline[i]) {
+        json_array_append_new(offline, json_integer((json_int_t)i));
+      }
+    }
+    json_object_set_new(resp, "cpu_offline", offline);
+  }
+
+  if (stats->cpu_cluster_count > 0) {
+    json_t *clusters = json_array();
+    if (!clusters) {
+      return false;
+    }
+    for (size_t i = 0; i < stats->cpu_cluster_count; i++) {
+      json_array_append_new(clusters, json_real(stats->cpu_cluster_usage[i]));
+    }
+    json_object_set_new(resp, "cpu_clusters", clusters);
+  }
+
+  return true;
+}
+
+/* Attach the cached identity of a process (cmdline, exe, uid, cgroup) to obj */
+static void
+add_proc_identity_json(json_t *obj, const struct proc_identity *id)
+{
+  if (!id) {
+    return;
+  }
+  if (id->cmdline[0] != '\0') {
+    json_object_set_new(obj, "cmdline", json_string(id->cmdline));
+  }
+  if (id->exe[0] != '\0') {
+    json_object_set_new(obj, "exe", json_string(id->exe));
+  }
+  if (id->uid >= 0) {
+    json_object_set_new(obj, "uid", json_integer(id->uid));
+  }
+  if (id->cgroup[0] != '\0') {
+    json_object_set_new(obj, "cgroup", json_string(id->cgroup));
+  }
+}
+
+/* Attach one monitored process, as read into sample, to resp.
+ *
+ * Adds "proc" when the process was found, otherwise a process_not_found
+ * "error".
+ *
+ * Returns false only on allocation failure.
+ */
+static bool
+add_process_sample_json(json_t *resp,
+                        const char *proc_name,
+                        const struct proc_cpu_baseline *baseline,
+                        const struct proc_sample *sample)
+{
+  if (sample->found) {
+    json_t *proc = json_object();
+    if (!proc) {
+      return false;
+    }
+    /* Populate process statistics */
+    json_object_set_new(proc, "name", json_string(proc_name));
+    json_object_set_new(proc, "cpu", json_real(sample->cpu));
+    json_object_set_new(proc, "rss_kb", json_integer(sample->rss_kb));
+    json_object_set_new(proc, "pss_kb", json_integer(sample->pss_kb));
+    json_object_set_new(proc, "uss_kb", json_integer(sample->uss_kb));
+    json_object_set_new(proc, "pid", json_integer(sample->pid));
+    add_proc_identity_json(proc, proc_identity_get(sample->pid, baseline->starttime));
+    json_object_set_new(resp, "proc", proc);
+    return true;
+  }
+
+  /* Process not found */
+  json_t *err = json_object();
+  if (!err) {
+    return false;
+  }
+  /* Set error type */
+  json_object_set_new(err, "type", json_string("process_not_found"));
+
+  char msg[128];
+  snprintf(msg, sizeof(msg), "Process '%s' not found", proc_name);
+  json_object_set_new(err, "message", json_string(msg));
+  json_object_set_new(resp, "error", err);
+
+  return true;
+}
 
 size_t
 build_stats_json(char *out_buf,
                  size_t out_size,
                  const struct sys_stats *stats,
+                 uint64_t send_mono_ms,
                  long cpu_core_count,
                  unsigned int connected_clients,
                  unsigned int max_clients,
-                 struct per_session_data *pss,
+                 const struct per_session_data *pss,
                  bool *truncated)
 {
   json_t *resp = NULL;
   json_t *clients = NULL;
-  json_t *cpu_per_core = NULL;
 
   if (truncated) {
     *truncated = false;
@@ -44,37 +166,30 @@ build_stats_json(char *out_buf,
   }
 
   /* Populate system statistics */
+  json_object_set_new(resp, "seq", json_integer((json_int_t)stats->seq));
   json_object_set_new(resp, "ts", json_integer(stats->timestamp_ms));
   json_object_set_new(resp, "mono_ms", json_integer(stats->monotonic_ms));
+  json_object_set_new(resp, "send_mono_ms", json_integer(send_mono_ms));
   json_object_set_new(resp, "delta_ms", json_integer(stats->delta_ms));
   json_object_set_new(resp, "cpu", json_real(stats->cpu_usage));
   json_object_set_new(resp, "cpu_cores", json_integer(cpu_core_count));
-  /* Build the per-core CPU usage array before attaching it to the response */
-  cpu_per_core = json_array();
-  if (!cpu_per_core) {
+  /* Build the per-core CPU usage array before attaching it to the response (dropped while throttled) */
+  if (throttle_per_core_enabled() && !add_cpu_per_core_json(resp, stats)) {
     json_decref(resp);
     if (truncated) {
       *truncated = true;
     }
     return 0;
   }
-  for (size_t i = 0; i < stats->cpu_per_core_count; i++) {
-    if (json_array_append_new(cpu_per_core, json_real(stats->cpu_per_core_usage[i])) != 0) {
-      json_decref(cpu_per_core);
-      json_decref(resp);
-      if (truncated) {
-        *truncated = true;
-      }
-      return 0;
-    }
-  }
-  json_object_set_new(resp, "cpu_per_core", cpu_per_core);
   json_object_set_new(resp, "mem_total_kb", json_integer(stats->mem_total_kb));
   json_object_set_new(resp, "mem_available_kb", json_integer(stats->mem_available_kb));
   json_object_set_new(resp, "uptime_s", json_real(stats->uptime_s));
   json_object_set_new(resp, "load1", json_real(stats->load1));
   json_object_set_new(resp, "load5", json_real(stats->load5));
   json_object_set_new(resp, "load15", json_real(stats->load15));
+  if (throttle_enabled()) {
+    json_object_set_new(resp, "throttle_level", json_integer(throttle_level()));
+  }
 
   /* Clients object */
   clients = json_object();
@@ -89,66 +204,38 @@ build_stats_json(char *out_buf,
   json_object_set_new(clients, "max", json_integer(max_clients));
   json_object_set_new(resp, "clients", clients);
 
-  /* Monitor a process */
-  if (pss->proc_enabled) {
-    double proc_cpu = 0.0;
-    long proc_rss_kb = 0;
-    long proc_pss_kb = 0;
-    long proc_uss_kb = 0;
-    pid_t proc_pid = 0;
-
-    /* Read the process stats */
-    if (proc_read_process_stats(
-            pss->proc_name, pss, stats->monotonic_ms, &proc_cpu, &proc_rss_kb, &proc_pss_kb, &proc_uss_kb, &proc_pid)) {
-      json_t *proc = json_object();
-      if (!proc) {
-        json_decref(resp);
-        /* Truncated output! */
-        if (truncated) {
-          *truncated = true;
-        }
-        return 0;
-      }
-      /* Populate process statistics */
-      json_object_set_new(proc, "name", json_string(pss->proc_name));
-      json_object_set_new(proc, "cpu", json_real(proc_cpu));
-      json_object_set_new(proc, "rss_kb", json_integer(proc_rss_kb));
-      json_object_set_new(proc, "pss_kb", json_integer(proc_pss_kb));
-      json_object_set_new(proc, "uss_kb", json_integer(proc_uss_kb));
-      json_object_set_new(proc, "pid", json_integer(proc_pid));
-      json_object_set_new(resp, "proc", proc);
-    } else {
-      /* Process not found */
-      json_t *err = json_object();
-      if (!err) {
-        json_decref(resp);
-        /* Truncated output! */
-        if (truncated) {
-          *truncated = true;
-        }
-        return 0;
+  /* Monitored process, as read by the sampler (nothing until its first read) */
+  if (pss->proc_enabled && pss->proc_sample.valid) {
+    if (!add_process_sample_json(resp, pss->proc_name, &pss->proc_baseline, &pss->proc_sample)) {
+      json_decref(resp);
+      /* Truncated output! */
+      if (truncated) {
+        *truncated = true;
       }
-      /* Set error type */
-      json_object_set_new(err, "type", json_string("process_not_found"));
-
-      char msg[128];
-      snprintf(msg, sizeof(msg), "Process '%s' not found", pss->proc_name);
-      json_object_set_new(err, "message", json_string(msg));
-      json_object_set_new(resp, "error", err);
+      return 0;
     }
   }
-  /* Serialize into output buffer */
-  int out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  /* Serialize into output buffer (json_dumpb() returns the full size even when it does not fit) */
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+
+  /* The process identity is the only free-form part: drop it rather than the frame */
+  json_t *proc = json_object_get(resp, "proc");
+  if ((out_len == 0 || out_len > out_size) && proc) {
+    json_object_del(proc, "cmdline");
+    json_object_del(proc, "exe");
+    json_object_del(proc, "cgroup");
+    out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  }
   json_decref(resp);
 
-  if (out_len < 0) {
+  if (out_len == 0 || out_len > out_size) {
     if (truncated) {
       *truncated = true;
     }
     return 0;
   }
 
-  return (size_t)out_len;
+  return out_len;
 }
 
 size_t
@@ -210,6 +297,75 @@ build_process_list_json(char *out_buf, size_t out_size, bool *truncated)
   }
 }
 
+size_t
+build_process_info_json(char *out_buf, size_t out_size, const char *proc_name, bool *truncated)
+{
+  pid_t pids[MAX_PROC_INFO_INSTANCES];
+  size_t pid_count = proc_find_pids_by_comm(proc_name, pids, MAX_PROC_INFO_INSTANCES);
+  json_t *resp = json_object();
+  json_t *info = json_object();
+  json_t *arr = json_array();
+
+  if (truncated) {
+    *truncated = false;
+  }
+  if (!resp || !info || !arr) {
+    json_decref(arr);
+    json_decref(info);
+    json_decref(resp);
+    return 0;
+  }
+
+  for (size_t i = 0; i < pid_count; i++) {
+    struct proc_stat_fields st;
+    const struct proc_identity *id;
+    json_t *inst;
+
+    /* Skip processes that exited since the scan */
+    if (!proc_read_stat_fields(pids[i], &st) || !(id = proc_identity_get(pids[i], st.starttime))) {
+      continue;
+    }
+    /* A cached identity from before an exec() has another comm: resolve it again */
+    if (strcmp(id->comm, st.comm) != 0) {
+      proc_identity_forget(pids[i]);
+      if (!(id = proc_identity_get(pids[i], st.starttime))) {
+        continue;
+      }
+    }
+    inst = json_object();
+    if (!inst) {
+      break;
+    }
+    json_object_set_new(inst, "pid", json_integer(pids[i]));
+    json_object_set_new(inst, "state", json_stringn(&st.state, 1));
+    add_proc_identity_json(inst, id);
+    json_array_append_new(arr, inst);
+  }
+  json_object_set_new(info, "name", json_string(proc_name));
+  json_object_set_new(info, "instances", arr);
+  json_object_set_new(resp, "process_info", info);
+
+  /* Serialize into fixed buffer, truncate by dropping tail entries.
+   * json_dumpb() returns the full size even when it does not fit.
+   */
+  for (;;) {
+    size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+    if (out_len > 0 && out_len <= out_size) {
+      json_decref(resp);
+      return out_len;
+    }
+    size_t n = json_array_size(arr);
+    if (n == 0) {
+      json_decref(resp);
+      return 0;
+    }
+    json_array_remove(arr, n - 1);
+    if (truncated) {
+      *truncated = true;
+    }
+  }
+}
+
 size_t
 build_storage_json(char *out_buf, size_t out_size, bool *truncated)
 {
@@ -340,6 +496,24 @@ build_system_info_json(char *out_buf, size_t out_size, bool *truncated)
   }
   /* CPU core count */
   json_object_set_new(sys, "cpu_cores", json_integer(info.cpu_core_count));
+  /* CPU clusters, in the order of the "cpu_clusters" usage array of stats frames */
+  json_t *clusters = json_array();
+  if (clusters) {
+    for (size_t i = 0; i < cpu_topology_cluster_count(); i++) {
+      const struct cpu_cluster *cl = cpu_topology_get_cluster(i);
+      json_t *c = json_object();
+      if (!c) {
+        continue;
+      }
+      json_object_set_new(c, "cpus", json_string(cl->cpus));
+      json_object_set_new(c, "cores", json_integer((json_int_t)cl->core_count));
+      if (cl->max_freq_khz > 0) {
+        json_object_set_new(c, "max_freq_khz", json_integer((json_int_t)cl->max_freq_khz));
+      }
+      json_array_append_new(clusters, c);
+    }
+    json_object_set_new(sys, "cpu_clusters", clusters);
+  }
   json_object_set_new(resp, "system", sys);
 
   int out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
@@ -410,6 +584,7 @@ build_log_line_json(char *out_buf,
                     const char *line,
                     size_t line_len,
                     const char *level,
+                    uint64_t seq,
                     bool *truncated)
 {
   char safe_line[MAX_LOG_LINE_LENGTH + 1];
@@ -446,6 +621,9 @@ build_log_line_json(char *out_buf,
   if (level) {
     json_object_set_new(resp, "level", json_string(level));
   }
+  if (seq != 0) {
+    json_object_set_new(resp, "seq", json_integer((json_int_t)seq));
+  }
 
   int out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
   json_decref(resp);
@@ -458,4 +636,836 @@ build_log_line_json(char *out_buf,
   }
 
   return (size_t)out_len;
-}
\ No newline at end of file
+}
+
+/* Build a compact summary object for one latency histogram */
+static json_t *
+build_histogram_json(const struct histogram *h)
+{
+  json_t *obj = json_object();
+  json_t *buckets = json_array();
+
+  if (!obj || !buckets) {
+    json_decref(obj);
+    json_decref(buckets);
+    return NULL;
+  }
+
+  json_object_set_new(obj, "count", json_integer(h->count));
+  json_object_set_new(obj, "mean", json_real(histogram_mean(h)));
+  json_object_set_new(obj, "p50", json_integer(histogram_percentile(h, 50.0)));
+  json_object_set_new(obj, "p90", json_integer(histogram_percentile(h, 90.0)));
+  json_object_set_new(obj, "p99", json_integer(histogram_percentile(h, 99.0)));
+  json_object_set_new(obj, "max", json_integer(h->max));
+  for (size_t i = 0; i < HISTOGRAM_BUCKET_COUNT; i++) {
+    json_array_append_new(buckets, json_integer(h->buckets[i]));
+  }
+  json_object_set_new(obj, "buckets", buckets);
+
+  return obj;
+}
+
+/* Build { "sample_to_send_ms": {...}, "queue_ms": {...} } */
+static json_t *
+build_latency_pair_json(const struct histogram *sample_to_send, const struct histogram *queue)
+{
+  json_t *obj = json_object();
+
+  if (!obj) {
+    return NULL;
+  }
+  json_object_set_new(obj, "sample_to_send_ms", build_histogram_json(sample_to_send));
+  json_object_set_new(obj, "queue_ms", build_histogram_json(queue));
+
+  return obj;
+}
+
+size_t
+build_self_stats_json(char *out_buf, size_t out_size, const struct per_session_data *pss, bool *truncated)
+{
+  json_t *resp = NULL;
+  json_t *self = NULL;
+  json_t *latency = NULL;
+  json_t *bounds = NULL;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || !pss) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  resp = json_object();
+  self = json_object();
+  latency = json_object();
+  bounds = json_array();
+  if (!resp || !self || !latency || !bounds) {
+    json_decref(bounds);
+    json_decref(latency);
+    json_decref(self);
+    json_decref(resp);
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  /* Upper bucket bounds shared by all histograms, the last bucket is open */
+  for (size_t i = 0; i + 1 < HISTOGRAM_BUCKET_COUNT; i++) {
+    json_array_append_new(bounds, json_integer(histogram_bucket_le(i)));
+  }
+  json_object_set_new(latency, "bucket_le_ms", bounds);
+  json_object_set_new(
+      latency, "global", build_latency_pair_json(self_stats_get_sample_to_send(), self_stats_get_queue()));
+  json_object_set_new(latency, "session", build_latency_pair_json(&pss->sample_to_send_hist, &pss->queue_hist));
+  json_object_set_new(self, "latency", latency);
+
+  /* Main loop lag: cumulative lateness plus the last completed window */
+  json_t *loop = json_object();
+  json_t *window = json_object();
+  if (loop && window) {
+    const struct loop_monitor_window *last = loop_monitor_get_last_window();
+
+    json_object_set_new(loop, "lag_ms", build_histogram_json(loop_monitor_get_lag()));
+    json_object_set_new(loop, "threshold_ms", json_integer(loop_monitor_get_threshold_ms()));
+    json_object_set_new(loop, "warnings", json_integer(loop_monitor_get_warning_count()));
+    json_object_set_new(window, "duration_ms", json_integer(last->duration_ms));
+    json_object_set_new(window, "lag_ms", build_histogram_json(&last->lag));
+    json_object_set_new(window, "longest_callback", json_string(last->longest_name));
+    json_object_set_new(window, "longest_callback_ms", json_real((double)last->longest_us / 1000.0));
+    json_object_set_new(window, "wakeups", json_integer(last->wakeups));
+    json_object_set_new(window, "timer_dispatches", json_integer(last->timer_dispatches));
+    json_object_set_new(loop, "last_window", window);
+    json_object_set_new(self, "loop", loop);
+  } else {
+    json_decref(window);
+    json_decref(loop);
+  }
+
+  /* Client slot occupancy and evictions */
+  json_t *slots = json_object();
+  if (slots) {
+    struct ws_slot_stats slot_stats;
+
+    ws_server_get_slot_stats(&slot_stats);
+    json_object_set_new(slots, "max", json_integer(slot_stats.max));
+    json_object_set_new(slots, "connected", json_integer(slot_stats.connected));
+    json_object_set_new(slots, "local", json_integer(slot_stats.local));
+    json_object_set_new(slots, "pending", json_integer(slot_stats.pending));
+    json_object_set_new(slots, "streaming", json_integer(slot_stats.streaming));
+    json_object_set_new(slots, "idle", json_integer(slot_stats.idle));
+    json_object_set_new(slots, "evicted_idle", json_integer((json_int_t)slot_stats.evicted_idle));
+    json_object_set_new(slots, "evicted_preempted", json_integer((json_int_t)slot_stats.evicted_preempted));
+    json_object_set_new(slots, "rejected", json_integer((json_int_t)slot_stats.rejected));
+    json_object_set_new(self, "slots", slots);
+  }
+
+  /* Adaptive throttling, see throttle.h */
+  json_t *throttle = json_object();
+  if (throttle) {
+    json_object_set_new(throttle, "enabled", json_boolean(throttle_enabled()));
+    json_object_set_new(throttle, "level", json_integer(throttle_level()));
+    json_object_set_new(throttle, "interval_ms", json_integer(throttle_interval_ms()));
+    json_object_set_new(throttle, "cost_percent", json_real(throttle_cost_percent()));
+    json_object_set_new(throttle, "budget_percent", json_real(throttle_budget_percent()));
+    json_object_set_new(self, "throttle", throttle);
+  }
+
+  json_object_set_new(resp, "self_stats", self);
+
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
+
+size_t
+build_loop_lag_event_json(char *out_buf,
+                          size_t out_size,
+                          uint64_t lag_ms,
+                          uint64_t threshold_ms,
+                          const char *longest_callback,
+                          uint64_t longest_callback_us,
+                          bool *truncated)
+{
+  json_t *resp = NULL;
+  json_t *event = NULL;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  resp = json_object();
+  event = json_object();
+  if (!resp || !event) {
+    json_decref(event);
+    json_decref(resp);
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  json_object_set_new(event, "type", json_string("loop_lag"));
+  json_object_set_new(event, "lag_ms", json_integer(lag_ms));
+  json_object_set_new(event, "threshold_ms", json_integer(threshold_ms));
+  if (longest_callback) {
+    json_object_set_new(event, "longest_callback", json_string(longest_callback));
+    json_object_set_new(event, "longest_callback_ms", json_real((double)longest_callback_us / 1000.0));
+  }
+  json_object_set_new(resp, "event", event);
+
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
+
+/******************************************************************************/
+
+size_t
+build_alert_json(char *out_buf,
+                 size_t out_size,
+                 const struct alert_rule *rule,
+                 const char *state,
+                 double observed,
+                 bool *truncated)
+{
+  json_t *resp = NULL;
+  json_t *body = NULL;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || !rule) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  resp = json_object();
+  body = json_object();
+  if (!resp || !body) {
+    json_decref(body);
+    json_decref(resp);
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  if (state) {
+    json_object_set_new(body, "type", json_string("alert"));
+    json_object_set_new(body, "state", json_string(state));
+    json_object_set_new(body, "observed", json_real(observed));
+    json_object_set_new(body, "timestamp_ms", json_integer((json_int_t)util_get_time_ms(CLOCK_REALTIME)));
+  }
+  json_object_set_new(body, "id", json_integer(rule->id));
+  json_object_set_new(body, "metric", json_string(alerts_metric_name(rule)));
+  json_object_set_new(body, "op", json_string(alerts_op_name(rule)));
+  json_object_set_new(body, "value", json_real(rule->value));
+  json_object_set_new(body, "hysteresis", json_real(rule->hysteresis));
+  json_object_set_new(body, "for_ms", json_integer((json_int_t)rule->for_ms));
+  json_object_set_new(body, "clear_ms", json_integer((json_int_t)rule->clear_ms));
+  json_object_set_new(resp, state ? "event" : "alert_rule", body);
+
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
+
+/******************************************************************************/
+
+size_t
+build_anomaly_event_json(char *out_buf,
+                         size_t out_size,
+                         const char *metric,
+                         const char *process,
+                         const char *state,
+                         double value,
+                         double mean,
+                         double sigma,
+                         double z,
+                         double k,
+                         bool *truncated)
+{
+  json_t *resp = NULL;
+  json_t *event = NULL;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || !metric || !state) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  resp = json_object();
+  event = json_object();
+  if (!resp || !event) {
+    json_decref(event);
+    json_decref(resp);
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  json_object_set_new(event, "type", json_string("anomaly"));
+  json_object_set_new(event, "state", json_string(state));
+  json_object_set_new(event, "scope", json_string(process ? "process" : "system"));
+  if (process) {
+    json_object_set_new(event, "process", json_string(process));
+  }
+  json_object_set_new(event, "metric", json_string(metric));
+  json_object_set_new(event, "value", json_real(value));
+  json_object_set_new(event, "mean", json_real(mean));
+  json_object_set_new(event, "sigma", json_real(sigma));
+  json_object_set_new(event, "z", json_real(z));
+  json_object_set_new(event, "k", json_real(k));
+  json_object_set_new(resp, "event", event);
+
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
+
+/******************************************************************************/
+
+/* Build { "p50": X, "p95": X, "p99": X, "max": X } for one sketch */
+static json_t *
+build_sketch_json(const struct sketch *s)
+{
+  json_t *obj = json_object();
+
+  if (!obj) {
+    return NULL;
+  }
+
+  json_object_set_new(obj, "p50", json_real(sketch_quantile(s, 0.50)));
+  json_object_set_new(obj, "p95", json_real(sketch_quantile(s, 0.95)));
+  json_object_set_new(obj, "p99", json_real(sketch_quantile(s, 0.99)));
+  json_object_set_new(obj, "max", json_real(s->max));
+
+  return obj;
+}
+
+size_t
+build_stats_summary_json(char *out_buf, size_t out_size, enum summary_period period, size_t count, bool *truncated)
+{
+  const struct summary_bucket *buckets[SUMMARY_HOUR_COUNT + 1];
+  json_t *resp = NULL;
+  json_t *summary = NULL;
+  json_t *periods = NULL;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  if (count > sizeof(buckets) / sizeof(buckets[0])) {
+    count = sizeof(buckets) / sizeof(buckets[0]);
+  }
+  size_t n = summary_get_periods(period, buckets, count);
+
+  resp = json_object();
+  summary = json_object();
+  periods = json_array();
+  if (!resp || !summary || !periods) {
+    json_decref(periods);
+    json_decref(summary);
+    json_decref(resp);
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    json_t *entry = json_object();
+    if (!entry) {
+      break;
+    }
+    json_object_set_new(entry, "start_ms", json_integer((json_int_t)buckets[i]->start_ms));
+    json_object_set_new(entry, "samples", json_integer(buckets[i]->metrics[0].count));
+    /* Only the first entry can be the period still in progress */
+    if (i == 0) {
+      uint64_t period_ms = period == SUMMARY_PERIOD_DAY ? 86400000ULL : 3600000ULL;
+      uint64_t now_ms = util_get_time_ms(CLOCK_REALTIME);
+      json_object_set_new(entry, "partial", json_boolean(now_ms < buckets[i]->start_ms + period_ms));
+    }
+    for (size_t m = 0; m < SUMMARY_METRIC_COUNT; m++) {
+      json_t *metric = build_sketch_json(&buckets[i]->metrics[m]);
+      if (metric) {
+        json_object_set_new(entry, summary_metric_name((enum summary_metric)m), metric);
+      }
+    }
+    json_array_append_new(periods, entry);
+  }
+
+  json_object_set_new(summary, "period", json_string(period == SUMMARY_PERIOD_DAY ? "day" : "hour"));
+  json_object_set_new(summary, "relative_accuracy", json_real(SKETCH_RELATIVE_ACCURACY));
+  json_object_set_new(summary, "periods", periods);
+  json_object_set_new(resp, "stats_summary", summary);
+
+  /* Sketch estimates are only 2% accurate, so 6 significant digits are plenty */
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT | JSON_REAL_PRECISION(6));
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
+
+/******************************************************************************/
+
+size_t
+build_session_json(char *out_buf, size_t out_size, const char *token, uint64_t resume_ms, bool *truncated)
+{
+  int len;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || !token) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  /* The token is hex only, so no escaping is needed */
+  len = snprintf(out_buf,
+                 out_size,
+                 "{\"session\":{\"token\":\"%s\",\"resume_ms\":%llu}}",
+                 token,
+                 (unsigned long long)resume_ms);
+  if (len < 0 || (size_t)len >= out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return (size_t)len;
+}
+
+size_t
+build_resumed_json(char *out_buf,
+                   size_t out_size,
+                   const struct resume_state *state,
+                   size_t stats_replayed,
+                   bool stats_gap,
+                   size_t log_replayed,
+                   bool log_gap,
+                   bool *truncated)
+{
+  json_t *resp = NULL;
+  json_t *body = NULL;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || !state) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  resp = json_object();
+  body = json_object();
+  if (!resp || !body) {
+    json_decref(body);
+    json_decref(resp);
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  json_object_set_new(body, "stats_stream", json_boolean(state->stats_stream));
+  json_object_set_new(body, "monitor", json_string(state->proc_enabled ? state->proc_name : ""));
+  json_object_set_new(body, "log_stream", json_boolean(state->log_stream));
+  json_object_set_new(body, "stats_replayed", json_integer((json_int_t)stats_replayed));
+  json_object_set_new(body, "stats_gap", json_boolean(stats_gap));
+  json_object_set_new(body, "log_replayed", json_integer((json_int_t)log_replayed));
+  json_object_set_new(body, "log_gap", json_boolean(log_gap));
+  json_object_set_new(resp, "resumed", body);
+
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
+
+/******************************************************************************/
+
+size_t
+build_channel_stats_json(char *out_buf,
+                         size_t out_size,
+                         const struct sys_stats *stats,
+                         uint64_t send_mono_ms,
+                         long cpu_core_count,
+                         unsigned int connected_clients,
+                         unsigned int max_clients,
+                         const struct ws_channel *ch,
+                         bool *truncated)
+{
+  json_t *resp = NULL;
+  bool ok = true;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || !stats || !ch) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  resp = json_object();
+  if (!resp) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  json_object_set_new(resp, "ch", json_integer(ch->id));
+  json_object_set_new(resp, "seq", json_integer((json_int_t)stats->seq));
+  json_object_set_new(resp, "ts", json_integer(stats->timestamp_ms));
+  json_object_set_new(resp, "mono_ms", json_integer(stats->monotonic_ms));
+  json_object_set_new(resp, "send_mono_ms", json_integer(send_mono_ms));
+  json_object_set_new(resp, "delta_ms", json_integer(stats->delta_ms));
+  if (ch->fields & CHANNEL_FIELD_CPU) {
+    json_object_set_new(resp, "cpu", json_real(stats->cpu_usage));
+    json_object_set_new(resp, "cpu_cores", json_integer(cpu_core_count));
+  }
+  if ((ch->fields & CHANNEL_FIELD_CPU_PER_CORE) && throttle_per_core_enabled()) {
+    ok = add_cpu_per_core_json(resp, stats);
+  }
+  if (throttle_enabled()) {
+    json_object_set_new(resp, "throttle_level", json_integer(throttle_level()));
+  }
+  if (ch->fields & CHANNEL_FIELD_MEM) {
+    json_object_set_new(resp, "mem_total_kb", json_integer(stats->mem_total_kb));
+    json_object_set_new(resp, "mem_available_kb", json_integer(stats->mem_available_kb));
+  }
+  if (ch->fields & CHANNEL_FIELD_LOAD) {
+    json_object_set_new(resp, "load1", json_real(stats->load1));
+    json_object_set_new(resp, "load5", json_real(stats->load5));
+    json_object_set_new(resp, "load15", json_real(stats->load15));
+  }
+  if (ch->fields & CHANNEL_FIELD_UPTIME) {
+    json_object_set_new(resp, "uptime_s", json_real(stats->uptime_s));
+  }
+  if (ok && (ch->fields & CHANNEL_FIELD_CLIENTS)) {
+    json_t *clients = json_object();
+    if (clients) {
+      json_object_set_new(clients, "connected", json_integer(connected_clients));
+      json_object_set_new(clients, "max", json_integer(max_clients));
+      json_object_set_new(resp, "clients", clients);
+    } else {
+      ok = false;
+    }
+  }
+  /* Monitored process, as read when the channel was scheduled */
+  if (ok && ch->proc_enabled && ch->proc_sample.valid) {
+    ok = add_process_sample_json(resp, ch->proc_name, &ch->proc_baseline, &ch->proc_sample);
+  }
+  if (ch->dropped > 0) {
+    json_object_set_new(resp, "dropped", json_integer(ch->dropped));
+  }
+
+  size_t out_len = ok ? json_dumpb(resp, out_buf, out_size, JSON_COMPACT) : 0;
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
+
+size_t
+build_channel_json(char *out_buf, size_t out_size, const struct ws_channel *ch, const char *key, bool *truncated)
+{
+  static const char *const field_names[] = { "cpu", "cpu_per_core", "mem", "load", "uptime", "clients" };
+  json_t *resp = NULL;
+  json_t *body = NULL;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || !ch || !key) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  resp = json_object();
+  body = json_object();
+  if (!resp || !body) {
+    json_decref(body);
+    json_decref(resp);
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  json_object_set_new(body, "id", json_integer(ch->id));
+  if (strcmp(key, "opened") == 0) {
+    json_t *fields = json_array();
+
+    json_object_set_new(body, "type", json_string("stats"));
+    json_object_set_new(body, "interval_ms", json_integer(ch->interval_ms));
+    /* field_names follows the bit order of enum channel_field */
+    for (size_t i = 0; fields && i < sizeof(field_names) / sizeof(field_names[0]); i++) {
+      if (ch->fields & (1U << i)) {
+        json_array_append_new(fields, json_string(field_names[i]));
+      }
+    }
+    json_object_set_new(body, "fields", fields ? fields : json_null());
+    if (ch->proc_enabled) {
+      json_object_set_new(body, "monitor", json_string(ch->proc_name));
+    }
+    if (ch->credit >= 0) {
+      json_object_set_new(body, "credit", json_integer((json_int_t)ch->credit));
+    }
+  }
+  json_object_set_new(resp, key, body);
+
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
+
+/******************************************************************************/
+
+size_t
+build_evicted_event_json(char *out_buf, size_t out_size, const char *reason, bool *truncated)
+{
+  int len;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || !reason) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  /* reason is one of the fixed server-side names, no escaping needed */
+  len = snprintf(out_buf, out_size, "{\"event\":{\"type\":\"evicted\",\"reason\":\"%s\"}}", reason);
+  if (len < 0 || (size_t)len >= out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return (size_t)len;
+}
+
+/******************************************************************************/
+
+static json_t *
+build_fleet_percentiles_json(const struct fleet_percentiles *p)
+{
+  json_t *obj = json_object();
+
+  if (!obj) {
+    return NULL;
+  }
+  json_object_set_new(obj, "count", json_integer((json_int_t)p->count));
+  if (p->count > 0) {
+    json_object_set_new(obj, "p50", json_real(p->p50));
+    json_object_set_new(obj, "p90", json_real(p->p90));
+    json_object_set_new(obj, "p99", json_real(p->p99));
+    json_object_set_new(obj, "max", json_real(p->max));
+    json_object_set_new(obj, "mean", json_real(p->mean));
+  }
+
+  return obj;
+}
+
+size_t
+build_fleet_json(char *out_buf,
+                 size_t out_size,
+                 const struct fleet_device *devices,
+                 size_t device_count,
+                 const struct fleet_summary *summary,
+                 uint64_t now_mono_ms,
+                 bool *truncated)
+{
+  json_t *resp = NULL;
+  json_t *fleet = NULL;
+  json_t *percentiles = NULL;
+  json_t *rows = NULL;
+
+  if (truncated) {
+    *truncated = false;
+  }
+
+  if (!out_buf || out_size == 0 || (!devices && device_count > 0) || !summary) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  resp = json_object();
+  fleet = json_object();
+  percentiles = json_object();
+  rows = json_array();
+  if (!resp || !fleet || !percentiles || !rows) {
+    json_decref(resp);
+    json_decref(fleet);
+    json_decref(percentiles);
+    json_decref(rows);
+    return 0;
+  }
+
+  json_object_set_new(fleet, "ts", json_integer((json_int_t)util_get_time_ms(CLOCK_REALTIME)));
+  json_object_set_new(fleet, "total", json_integer((json_int_t)device_count));
+  json_object_set_new(fleet, "up", json_integer((json_int_t)summary->up));
+  json_object_set_new(fleet, "stale", json_integer((json_int_t)summary->stale));
+  json_object_set_new(fleet, "down", json_integer((json_int_t)summary->down));
+  json_object_set_new(percentiles, "cpu", build_fleet_percentiles_json(&summary->cpu));
+  json_object_set_new(percentiles, "mem_used_percent", build_fleet_percentiles_json(&summary->mem_used_percent));
+  json_object_set_new(percentiles, "load1", build_fleet_percentiles_json(&summary->load1));
+  json_object_set_new(fleet, "percentiles", percentiles);
+
+  for (size_t i = 0; i < device_count; i++) {
+    const struct fleet_device *dev = &devices[i];
+    json_t *row = json_object();
+    const char *state = upstream_state_name(dev->up.state);
+
+    if (!row) {
+      break;
+    }
+    if (dev->up.state == UPSTREAM_CONNECTED) {
+      state = fleet_device_is_fresh(dev, now_mono_ms) ? "up" : "stale";
+    } else if (dev->up.state == UPSTREAM_DISCONNECTED) {
+      state = "down";
+    }
+
+    json_object_set_new(row, "name", json_string(dev->name));
+    json_object_set_new(row, "host", json_string(dev->up.host));
+    json_object_set_new(row, "port", json_integer(dev->up.port));
+    json_object_set_new(row, "state", json_string(state));
+    if (dev->have_sample) {
+      json_object_set_new(row, "seq", json_integer((json_int_t)dev->seq));
+      json_object_set_new(row, "ts", json_integer((json_int_t)dev->timestamp_ms));
+      uint64_t age_ms = now_mono_ms >= dev->rx_mono_ms ? now_mono_ms - dev->rx_mono_ms : 0;
+      json_object_set_new(row, "age_ms", json_integer((json_int_t)age_ms));
+      json_object_set_new(row, "cpu", json_real(dev->cpu));
+      json_object_set_new(row, "mem_used_percent", json_real(fleet_device_mem_used_percent(dev)));
+      json_object_set_new(row, "mem_total_kb", json_integer(dev->mem_total_kb));
+      json_object_set_new(row, "mem_available_kb", json_integer(dev->mem_available_kb));
+      json_object_set_new(row, "load1", json_real(dev->load1));
+      json_object_set_new(row, "uptime_s", json_real(dev->uptime_s));
+    }
+    json_array_append_new(rows, row);
+  }
+  json_object_set_new(fleet, "devices", rows);
+  json_object_set_new(resp, "fleet", fleet);
+
+  size_t out_len = json_dumpb(resp, out_buf, out_size, JSON_COMPACT);
+  json_decref(resp);
+
+  if (out_len == 0 || out_len > out_size) {
+    if (truncated) {
+      *truncated = true;
+    }
+    return 0;
+  }
+
+  return out_len;
+}
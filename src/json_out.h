@@ -2,11 +2,24 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
+#include "alerts.h"
+#include "anomaly.h"
+#include "channel.h"
+#include "fleet.h"
+#include "resume.h"
 #include "stats.h"
 #include "session.h"
+#include "summary.h"
 
 /* Build one WebSocket JSON snapshot.
+ *
+ * send_mono_ms is the CLOCK_MONOTONIC time the frame is written; it is
+ * emitted as "send_mono_ms" next to the sample time "mono_ms". The sample
+ * sequence number stats->seq is emitted as "seq". The monitored process
+ * comes from pss->proc_sample (read by the sampler); building a frame has no
+ * side effects, so resume replays can rebuild old ones.
  *
  * Returns:
  *   number of bytes written to out_buf (not including NUL)
@@ -17,10 +30,11 @@
 size_t build_stats_json(char *out_buf,
                         size_t out_size,
                         const struct sys_stats *stats,
+                        uint64_t send_mono_ms,
                         long cpu_core_count,
                         unsigned int connected_clients,
                         unsigned int max_clients,
-                        struct per_session_data *pss,
+                        const struct per_session_data *pss,
                         bool *truncated);
 
 /* Build one-shot process list JSON.
@@ -32,6 +46,21 @@ size_t build_stats_json(char *out_buf,
  */
 size_t build_process_list_json(char *out_buf, size_t out_size, bool *truncated);
 
+/* Maximum number of instances reported by build_process_info_json() */
+#define MAX_PROC_INFO_INSTANCES 16
+
+/* Build one-shot process identity JSON for all processes named proc_name.
+ *
+ * Output format:
+ *   { "process_info": { "name": "...", "instances": [
+ *       { "pid": 123, "state": "S", "cmdline": "...", "exe": "...",
+ *         "uid": 0, "cgroup": "..." }, ... ] } }
+ *
+ * Identity fields come from the process identity cache and are omitted when
+ * unknown. Instances may be dropped from the tail to fit into out_buf.
+ */
+size_t build_process_info_json(char *out_buf, size_t out_size, const char *proc_name, bool *truncated);
+
 /* Build one-shot storage JSON.
  *
  * Output format:
@@ -58,13 +87,189 @@ size_t build_error_json(char *out_buf, size_t out_size, const char *type, const
 /* Build one log line JSON message.
  *
  * Output format:
- *   { "log": "Apr 17 12:34:56 host daemon[1]: message text", "level": "info" }
+ *   { "log": "Apr 17 12:34:56 host daemon[1]: message text", "level": "info", "seq": 42 }
  *
- * level may be NULL, in which case the field is omitted.
+ * level may be NULL, in which case the field is omitted. seq is the live log
+ * stream sequence number; 0 (history replay) omits the field.
  */
 size_t build_log_line_json(char *out_buf,
                            size_t out_size,
                            const char *line,
                            size_t line_len,
                            const char *level,
+                           uint64_t seq,
                            bool *truncated);
+
+/* Build one-shot server self-statistics JSON.
+ *
+ * Output format:
+ *   { "self_stats": { "latency": { "bucket_le_ms": [...],
+ *                                  "global": { "sample_to_send_ms": {...}, "queue_ms": {...} },
+ *                                  "session": { ... } },
+ *                     "loop": { "lag_ms": {...}, "threshold_ms": N, "warnings": N,
+ *                               "last_window": { "duration_ms": N, "lag_ms": {...},
+ *                                                "longest_callback": "name", "longest_callback_ms": X,
+ *                                                "wakeups": N, "timer_dispatches": N } },
+ *                     "slots": { "max": N, "connected": N, "pending": N, "streaming": N, "idle": N,
+ *                                "evicted_idle": N, "evicted_preempted": N, "rejected": N } } }
+ */
+size_t build_self_stats_json(char *out_buf, size_t out_size, const struct per_session_data *pss, bool *truncated);
+
+/* Build a main loop lag warning event.
+ *
+ * Output format:
+ *   { "event": { "type": "loop_lag", "lag_ms": N, "threshold_ms": N,
+ *                "longest_callback": "name", "longest_callback_ms": X } }
+ *
+ * longest_callback may be NULL, in which case both callback fields are omitted.
+ */
+size_t build_loop_lag_event_json(char *out_buf,
+                                 size_t out_size,
+                                 uint64_t lag_ms,
+                                 uint64_t threshold_ms,
+                                 const char *longest_callback,
+                                 uint64_t longest_callback_us,
+                                 bool *truncated);
+
+/* Build an alert rule acknowledgement or an alert transition event.
+ *
+ * Output format (state == NULL, reply to { "alert": {...} }):
+ *   { "alert_rule": { "id": N, "metric": "cpu", "op": ">", "value": X,
+ *                     "hysteresis": X, "for_ms": N, "clear_ms": N } }
+ *
+ * Output format (state = "firing" or "resolved"):
+ *   { "event": { "type": "alert", "state": "...", "observed": X,
+ *                "timestamp_ms": N, <rule fields as above> } }
+ */
+size_t build_alert_json(char *out_buf,
+                        size_t out_size,
+                        const struct alert_rule *rule,
+                        const char *state,
+                        double observed,
+                        bool *truncated);
+
+/* Build an anomaly transition event.
+ *
+ * Output format:
+ *   { "event": { "type": "anomaly", "state": "started" | "ended",
+ *                "scope": "system" | "process", "process": "name",
+ *                "metric": "cpu", "value": X, "mean": X, "sigma": X,
+ *                "z": X, "k": X } }
+ *
+ * process may be NULL for system metrics, in which case it is omitted.
+ */
+size_t build_anomaly_event_json(char *out_buf,
+                                size_t out_size,
+                                const char *metric,
+                                const char *process,
+                                const char *state,
+                                double value,
+                                double mean,
+                                double sigma,
+                                double z,
+                                double k,
+                                bool *truncated);
+
+/* Build a one-shot long-horizon percentile summary.
+ *
+ * Output format:
+ *   { "stats_summary": { "period": "hour", "relative_accuracy": 0.02,
+ *                        "periods": [ { "start_ms": N, "samples": N, "partial": true,
+ *                                       "cpu": { "p50": X, "p95": X, "p99": X, "max": X },
+ *                                       "mem_used_percent": {...}, "load1": {...} }, ... ] } }
+ *
+ * Periods are newest first; only the period in progress has "partial": true.
+ */
+size_t build_stats_summary_json(char *out_buf,
+                                size_t out_size,
+                                enum summary_period period,
+                                size_t count,
+                                bool *truncated);
+
+/* Build the session announcement sent to every new client.
+ *
+ * Output format:
+ *   { "session": { "token": "...", "resume_ms": 60000 } }
+ */
+size_t build_session_json(char *out_buf, size_t out_size, const char *token, uint64_t resume_ms, bool *truncated);
+
+/* Build the reply that completes a resume request.
+ *
+ * Output format:
+ *   { "resumed": { "stats_stream": true, "monitor": "name", "log_stream": true,
+ *                  "stats_replayed": N, "stats_gap": false,
+ *                  "log_replayed": N, "log_gap": false } }
+ *
+ * "monitor" is "" when no process was monitored.
+ */
+size_t build_resumed_json(char *out_buf,
+                          size_t out_size,
+                          const struct resume_state *state,
+                          size_t stats_replayed,
+                          bool stats_gap,
+                          size_t log_replayed,
+                          bool log_gap,
+                          bool *truncated);
+
+/* Build one stats frame of a logical channel.
+ *
+ * Same values as build_stats_json, restricted to the channel's field groups
+ * and tagged with the channel id:
+ *   { "ch": 3, "seq": N, "ts": ..., "mono_ms": ..., "send_mono_ms": ..., "delta_ms": ...,
+ *     <selected fields>, "proc": { ... } | "error": { ... }, "dropped": N }
+ *
+ * "dropped" (frames skipped for lack of credit) is omitted when 0. The process
+ * is formatted from ch->proc_sample, read by channel_tick().
+ */
+size_t build_channel_stats_json(char *out_buf,
+                                size_t out_size,
+                                const struct sys_stats *stats,
+                                uint64_t send_mono_ms,
+                                long cpu_core_count,
+                                unsigned int connected_clients,
+                                unsigned int max_clients,
+                                const struct ws_channel *ch,
+                                bool *truncated);
+
+/* Build a channel acknowledgement, key is "opened" or "closed":
+ *   { "opened": { "id": 3, "type": "stats", "interval_ms": 1000,
+ *                 "fields": ["cpu", ...], "monitor": "name", "credit": 20 } }
+ *   { "closed": { "id": 3 } }
+ *
+ * "monitor" and "credit" are omitted when unset (credit unset = unlimited).
+ */
+size_t build_channel_json(char *out_buf,
+                          size_t out_size,
+                          const struct ws_channel *ch,
+                          const char *key,
+                          bool *truncated);
+
+/* Build the event sent to a session the server is about to close.
+ *
+ * Output format:
+ *   { "event": { "type": "evicted", "reason": "idle" | "preempted" } }
+ */
+size_t build_evicted_event_json(char *out_buf, size_t out_size, const char *reason, bool *truncated);
+
+/* Build the site-level fleet view.
+ *
+ * Output format:
+ *   { "fleet": { "ts": ..., "total": N, "up": N, "stale": N, "down": N,
+ *                "percentiles": { "cpu": { "count": N, "p50": ..., "p90": ...,
+ *                                          "p99": ..., "max": ..., "mean": ... },
+ *                                 "mem_used_percent": { ... }, "load1": { ... } },
+ *                "devices": [ { "name": "...", "host": "...", "port": 9000,
+ *                               "state": "up" | "stale" | "connecting" | "down",
+ *                               "seq": N, "ts": ..., "age_ms": N, "cpu": ...,
+ *                               "mem_used_percent": ..., "mem_total_kb": N,
+ *                               "mem_available_kb": N, "load1": ..., "uptime_s": ... } ] } }
+ *
+ * Sample fields of a device are omitted until its first frame arrived.
+ */
+size_t build_fleet_json(char *out_buf,
+                        size_t out_size,
+                        const struct fleet_device *devices,
+                        size_t device_count,
+                        const struct fleet_summary *summary,
+                        uint64_t now_mono_ms,
+                        bool *truncated);
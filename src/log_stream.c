@@ -23,6 +23,10 @@
  * - On subscribe, the last LOG_STREAM_HISTORY_BYTES of each watched log file are
  *   replayed to the new subscriber only using a separate FILE* per file, so
  *   the live file pointers are not disturbed.
+ * - Live lines carry a global "seq" number and the last
+ *   LOG_STREAM_RESUME_RING_LINES of them are kept, so a resumed session
+ *   (see resume.h) receives exactly the lines it missed. While a disconnected
+ *   subscriber can still resume, the monitor keeps running without subscribers.
  *
  * Limitations:
  * - Only the files listed in watched_filenames[] are monitored.
@@ -66,7 +70,7 @@
  *   read_new_lines()
  *     |
  *     v
- *   queue_line_to_session()
+ *   broadcast_live_line()
  *     |
  *     v
  *   libwebsockets write callback sends queued JSON
@@ -83,7 +87,7 @@
  *   read_new_lines()
  *     |
  *     v
- *   queue_line_to_session()
+ *   broadcast_live_line()
  *     |
  *     v
  *   libwebsockets write callback sends queued JSON
@@ -94,9 +98,11 @@
  *   log_stream_unsubscribe()
  *     |
  *     v
- *   stop_log_monitor() when last subscriber leaves
+ *   stop_log_monitor() when last subscriber leaves and no detached
+ *   subscriber can resume
  */
 #include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
@@ -112,7 +118,11 @@
 
 #include "json_out.h"
 #include "log_stream.h"
+#include "loop_monitor.h"
+#include "procfs.h"
+#include "resume.h"
 #include "session.h"
+#include "util.h"
 #include "ws_limits.h"
 
 /* -------------------------------------------------------------------------- */
@@ -128,6 +138,9 @@
  * pending message is dropped to prevent unbounded memory growth. */
 #define LOG_STREAM_MAX_PENDING_MESSAGES 1000
 
+/* Number of recent live lines kept for resumed sessions. */
+#define LOG_STREAM_RESUME_RING_LINES 256
+
 /* How often to resync watched files even when no inotify event arrives.
  * This recovers from missed events and from stale file handles after
  * rotation without waiting for a later write event.
@@ -211,17 +224,38 @@ static bool log_open_failed[WATCHED_FILE_COUNT];
  */
 static bool live_dropping_oversized_line[WATCHED_FILE_COUNT];
 
+/* One live line kept for resumed sessions */
+struct log_ring_entry {
+  uint64_t seq;
+  size_t len;
+  char json[];
+};
+
+/* Sequence number of the last live line (0 = none yet) */
+static uint64_t live_line_seq = 0;
+/* Recent live lines (struct log_ring_entry *), oldest first */
+static GQueue resume_ring = G_QUEUE_INIT;
+
 /* -------------------------------------------------------------------------- */
 
 static void start_log_monitor(void);
 
 /* -------------------------------------------------------------------------- */
 
-/* Write the absolute path for watched_filenames[idx] into path. */
+/* Write the absolute path for watched_filenames[idx] into path.
+ *
+ * The path is placed below the procfs root but opened with plain fopen():
+ * log files are tailed live and are not part of snapshot recordings.
+ */
 static void
 build_log_path(size_t idx, char *path, size_t path_size)
 {
-  snprintf(path, path_size, "%s/%s", LOG_STREAM_DIR, watched_filenames[idx]);
+  char dir[PATH_MAX];
+
+  if (!procfs_build_path(dir, sizeof(dir), LOG_STREAM_DIR)) {
+    snprintf(dir, sizeof(dir), "%s", LOG_STREAM_DIR);
+  }
+  snprintf(path, path_size, "%s/%s", dir, watched_filenames[idx]);
 }
 
 /*
@@ -281,27 +315,15 @@ log_file_replaced_or_truncated(size_t idx)
   return false;
 }
 
-/* Build one JSON log message and enqueue it for transmission to pss.
- *
- * The outgoing message includes the log text and, when provided, the
- * configured per-file label in the JSON "level" field.
+/* Enqueue one prebuilt JSON log message for transmission to pss.
  *
  * To keep per-session memory bounded, the queue is capped at
  * LOG_STREAM_MAX_PENDING_MESSAGES and the oldest pending entry is dropped
  * when the cap is reached.
  */
 static void
-queue_line_to_session(struct per_session_data *pss, const char *line, size_t line_len, const char *level)
+queue_json_to_session(struct per_session_data *pss, const char *json, size_t json_len)
 {
-  char json_buf[LWS_PRE + MAX_LOG_LINE_LENGTH + 64];
-  bool truncated = false;
-  size_t json_len =
-      build_log_line_json(json_buf + LWS_PRE, sizeof(json_buf) - LWS_PRE, line, line_len, level, &truncated);
-
-  if (json_len == 0 || truncated) {
-    return;
-  }
-
   /* g_malloc allocates n_bytes bytes of memory. If n_bytes is 0 it returns NULL.
    * If the allocation fails (because the system is out of memory), the program is terminated.
    * https://docs.gtk.org/glib/func.malloc.html
@@ -310,7 +332,9 @@ queue_line_to_session(struct per_session_data *pss, const char *line, size_t lin
   struct pending_ws_message *msg = g_malloc(sizeof(*msg) + LWS_PRE + json_len);
 
   msg->len = json_len;
-  memcpy(&msg->buf[LWS_PRE], json_buf + LWS_PRE, json_len);
+  msg->enqueue_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  msg->bulk = false;
+  memcpy(&msg->buf[LWS_PRE], json, json_len);
 
   if (!pss->pending_tx_queue) {
     pss->pending_tx_queue = g_queue_new();
@@ -329,6 +353,51 @@ queue_line_to_session(struct per_session_data *pss, const char *line, size_t lin
   }
 }
 
+/* Queue one history line (without seq) to one session. */
+static void
+queue_line_to_session(struct per_session_data *pss, const char *line, size_t line_len, const char *level)
+{
+  char json_buf[MAX_LOG_LINE_LENGTH + 64];
+  bool truncated = false;
+  size_t json_len = build_log_line_json(json_buf, sizeof(json_buf), line, line_len, level, 0, &truncated);
+
+  if (json_len == 0 || truncated) {
+    return;
+  }
+
+  queue_json_to_session(pss, json_buf, json_len);
+}
+
+/* Number one live line, keep it for resumed sessions and queue it to every subscriber. */
+static void
+broadcast_live_line(const char *line, size_t line_len, const char *level)
+{
+  char json_buf[MAX_LOG_LINE_LENGTH + 96];
+  bool truncated = false;
+  size_t json_len =
+      build_log_line_json(json_buf, sizeof(json_buf), line, line_len, level, ++live_line_seq, &truncated);
+
+  if (json_len == 0 || truncated) {
+    return;
+  }
+
+  struct log_ring_entry *entry = g_malloc(sizeof(*entry) + json_len);
+  entry->seq = live_line_seq;
+  entry->len = json_len;
+  memcpy(entry->json, json_buf, json_len);
+  g_queue_push_tail(&resume_ring, entry);
+  if (g_queue_get_length(&resume_ring) > LOG_STREAM_RESUME_RING_LINES) {
+    g_free(g_queue_pop_head(&resume_ring));
+  }
+
+  for (GSList *node = log_subscribers; node; node = node->next) {
+    struct per_session_data *pss = node->data;
+    if (pss && pss->wsi) {
+      queue_json_to_session(pss, json_buf, json_len);
+    }
+  }
+}
+
 /*
  * Read all newly available complete lines from fp.
  *
@@ -424,16 +493,27 @@ read_new_lines(FILE *fp, bool *dropping_oversized_line, struct per_session_data
     if (target) {
       queue_line_to_session(target, linebuf, len, level);
     } else {
-      for (GSList *node = log_subscribers; node; node = node->next) {
-        struct per_session_data *pss = node->data;
-        if (pss && pss->wsi) {
-          queue_line_to_session(pss, linebuf, len, level);
-        }
-      }
+      broadcast_live_line(linebuf, len, level);
     }
   }
 }
 
+/* Read all complete lines from fp and queue them to pss only.
+ *
+ * Uses a private oversized-line discard state, exactly like history replay,
+ * so the live per-file state is never touched.
+ */
+void
+log_stream_read_lines_to_session(FILE *fp, struct per_session_data *pss, const char *level)
+{
+  bool dropping_oversized_line = false;
+
+  if (!fp || !pss) {
+    return;
+  }
+  read_new_lines(fp, &dropping_oversized_line, pss, level);
+}
+
 /*
  * Replay the last LOG_STREAM_HISTORY_BYTES of every watched log file to pss.
  *
@@ -454,10 +534,6 @@ send_history_to_one(struct per_session_data *pss)
   for (size_t i = 0; i < WATCHED_FILE_COUNT; i++) {
     char path[256];
     FILE *fp;
-    /* History replay uses its own discard state because it reads from a
-     * separate temporary FILE*. It must not share live discard state.
-     */
-    bool dropping_oversized_line = false;
 
     build_log_path(i, path, sizeof(path));
 
@@ -478,7 +554,10 @@ send_history_to_one(struct per_session_data *pss)
       int c;
       while ((c = fgetc(fp)) != EOF && c != '\n') { }
     }
-    read_new_lines(fp, &dropping_oversized_line, pss, watched_levels[i]);
+    /* History replay uses its own discard state because it reads from a
+     * separate temporary FILE*. It must not share live discard state.
+     */
+    log_stream_read_lines_to_session(fp, pss, watched_levels[i]);
     fclose(fp);
   }
 }
@@ -763,12 +842,15 @@ resync_watched_files(gpointer user_data)
 static void
 start_log_monitor(void)
 {
+  char log_dir[PATH_MAX];
+
   /* If the inotify side is already running, only make sure the periodic
    * resync timer also exists.
    */
   if (inotify_fd >= 0 && inotify_watch_id != 0) {
     if (resync_timer_id == 0) {
-      resync_timer_id = g_timeout_add(LOG_STREAM_RESYNC_INTERVAL_MS, resync_watched_files, NULL);
+      resync_timer_id =
+          loop_monitor_timeout_add(LOG_STREAM_RESYNC_INTERVAL_MS, "log_resync", resync_watched_files, NULL);
       if (resync_timer_id == 0) {
         syslog(LOG_WARNING, "log_stream: failed to start periodic resync timer");
       }
@@ -801,6 +883,11 @@ start_log_monitor(void)
   inotify_dir_wd = -1;
   close_all_log_files();
 
+  if (!procfs_build_path(log_dir, sizeof(log_dir), LOG_STREAM_DIR)) {
+    syslog(LOG_ERR, "log_stream: log directory path too long");
+    return;
+  }
+
   inotify_fd = inotify_init1(IN_NONBLOCK);
   if (inotify_fd < 0) {
     syslog(LOG_ERR, "log_stream: inotify_init1 failed: %m");
@@ -808,7 +895,7 @@ start_log_monitor(void)
   }
 
   inotify_dir_wd = inotify_add_watch(
-      inotify_fd, LOG_STREAM_DIR, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM);
+      inotify_fd, log_dir, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM);
   if (inotify_dir_wd < 0) {
     syslog(LOG_ERR, "log_stream: inotify_add_watch failed: %m");
     close(inotify_fd);
@@ -820,7 +907,8 @@ start_log_monitor(void)
   g_io_channel_set_close_on_unref(inotify_chan, TRUE);
   g_io_channel_set_encoding(inotify_chan, NULL, NULL); /* binary mode */
 
-  inotify_watch_id = g_io_add_watch(inotify_chan, G_IO_IN | G_IO_HUP | G_IO_ERR, on_inotify_event, NULL);
+  inotify_watch_id =
+      loop_monitor_io_add_watch(inotify_chan, G_IO_IN | G_IO_HUP | G_IO_ERR, "log_inotify", on_inotify_event, NULL);
   if (inotify_watch_id == 0) {
     syslog(LOG_ERR, "log_stream: g_io_add_watch failed");
     g_io_channel_unref(inotify_chan); /* also closes inotify_fd */
@@ -834,13 +922,14 @@ start_log_monitor(void)
 
   /* Ensure the periodic resync timer is running to recover from missed events and stale file handles. */
   if (resync_timer_id == 0) {
-    resync_timer_id = g_timeout_add(LOG_STREAM_RESYNC_INTERVAL_MS, resync_watched_files, NULL);
+    resync_timer_id =
+        loop_monitor_timeout_add(LOG_STREAM_RESYNC_INTERVAL_MS, "log_resync", resync_watched_files, NULL);
     if (resync_timer_id == 0) {
       syslog(LOG_WARNING, "log_stream: failed to start periodic resync timer");
     }
   }
 
-  syslog(LOG_INFO, "log_stream: monitoring %zu file(s) in %s via inotify", WATCHED_FILE_COUNT, LOG_STREAM_DIR);
+  syslog(LOG_INFO, "log_stream: monitoring %zu file(s) in %s via inotify", WATCHED_FILE_COUNT, log_dir);
 }
 
 /*
@@ -936,15 +1025,73 @@ log_stream_unsubscribe(struct per_session_data *pss)
   log_subscribers = g_slist_remove(log_subscribers, pss);
   syslog(LOG_INFO, "log_stream: client unsubscribed (%u active)", g_slist_length(log_subscribers));
 
-  if (!log_subscribers) {
+  log_stream_check_idle();
+}
+
+bool
+log_stream_is_subscribed(const struct per_session_data *pss)
+{
+  return pss && g_slist_find(log_subscribers, pss) != NULL;
+}
+
+void
+log_stream_check_idle(void)
+{
+  /* Keep collecting live lines while a disconnected subscriber can resume */
+  if (!log_subscribers && !resume_pending_log()) {
     stop_log_monitor();
   }
 }
 
+size_t
+log_stream_resume(struct per_session_data *pss, uint64_t after_seq, bool *gap)
+{
+  size_t replayed = 0;
+
+  if (gap) {
+    *gap = false;
+  }
+  if (!pss || g_slist_find(log_subscribers, pss)) {
+    return 0;
+  }
+
+  if (inotify_fd < 0 || inotify_watch_id == 0 || resync_timer_id == 0) {
+    start_log_monitor();
+    if (inotify_fd < 0 || inotify_watch_id == 0) {
+      syslog(LOG_WARNING, "log_stream: resume failed, monitor unavailable");
+      return 0;
+    }
+  }
+
+  for (GList *l = resume_ring.head; l; l = l->next) {
+    const struct log_ring_entry *entry = l->data;
+    if (entry->seq <= after_seq) {
+      continue;
+    }
+    /* The oldest kept line is newer than the next expected one */
+    if (replayed == 0 && gap && l == resume_ring.head && entry->seq > after_seq + 1) {
+      *gap = true;
+    }
+    queue_json_to_session(pss, entry->json, entry->len);
+    replayed++;
+  }
+
+  log_subscribers = g_slist_prepend(log_subscribers, pss);
+  syslog(LOG_INFO,
+         "log_stream: client resumed, %zu lines replayed (%u active)",
+         replayed,
+         g_slist_length(log_subscribers));
+
+  return replayed;
+}
+
 void
 log_stream_stop(void)
 {
   stop_log_monitor();
   g_slist_free(log_subscribers);
   log_subscribers = NULL;
+  for (gpointer entry = g_queue_pop_head(&resume_ring); entry; entry = g_queue_pop_head(&resume_ring)) {
+    g_free(entry);
+  }
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <jansson.h>
 
 #include "session.h"
@@ -20,6 +23,30 @@ bool log_stream_handle_request(struct per_session_data *pss, json_t *root);
  */
 void log_stream_unsubscribe(struct per_session_data *pss);
 
+/*
+ * Return true if pss is a live log subscriber.
+ */
+bool log_stream_is_subscribed(const struct per_session_data *pss);
+
+/*
+ * Stop the monitor if there are no subscribers and no disconnected subscriber
+ * can still resume. Called when a resume window expires.
+ */
+void log_stream_check_idle(void);
+
+/*
+ * Subscribe a resumed session without history replay and queue the kept live
+ * lines with seq > after_seq to it. *gap (optional) is set when older missed
+ * lines are no longer kept. Returns the number of replayed lines.
+ */
+size_t log_stream_resume(struct per_session_data *pss, uint64_t after_seq, bool *gap);
+
+/*
+ * Read all complete lines from fp and queue them as log messages to pss only.
+ * Used for one-shot delivery outside the live subscriber broadcast.
+ */
+void log_stream_read_lines_to_session(FILE *fp, struct per_session_data *pss, const char *level);
+
 /*
  * Stop the monitor and release all state. Called once on server shutdown.
  */
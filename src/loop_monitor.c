@@ -0,0 +1,375 @@
+/* loop_monitor.c
+ *
+ * Main-loop lag monitor.
+ *
+ * Everything in this app (lws servicing, sampling, JSON building, log reads)
+ * runs on one GLib main loop, so one long callback delays all others.
+ *
+ * - A watchdog timer fires every LOOP_MONITOR_INTERVAL_MS on a fixed grid
+ *   (see "Wakeup coalescing" below). The lateness of a tick is the time from
+ *   the grid point it was due at to its dispatch (now - dispatch_deadline_us).
+ *   The deadline is the first grid point after the previous tick, so a stall
+ *   across several grid points is reported with its full length.
+ * - Sources created through loop_monitor_timeout_add()/io_add_watch() are
+ *   timed. The longest callback is tracked per watchdog tick (used to
+ *   attribute a warning) and per window (reported in self_stats).
+ * - Windows of LOOP_MONITOR_WINDOW_MS roll over into a "last window" summary.
+ *
+ * Wakeup coalescing:
+ * - Timers created here do not fire relative to their creation time but on a
+ *   shared grid: an interval of N ms fires when CLOCK_MONOTONIC is a multiple
+ *   of N ms. The 10 ms lws service, the 100 ms watchdog, the 500 ms sampler
+ *   and all second-granularity timers therefore share their wakeups instead
+ *   of each waking the CPU at its own phase. The grid also keeps periodic
+ *   timers from drifting.
+ * - The watchdog is the exception: it fires LOOP_MONITOR_WATCHDOG_OFFSET_MS
+ *   after the grid points, between two lws service ticks. On the grid it
+ *   would wait behind the sampler and lws_service due at the same time and
+ *   report their run time as lag. This costs one extra wakeup per watchdog
+ *   period, and a callback starting on the grid shows as lag only after it
+ *   ran for longer than the offset.
+ * - The main thread's timer slack is raised to LOOP_MONITOR_TIMER_SLACK_NS so
+ *   the kernel may merge our wakeups with those of other processes.
+ * - Each window counts the process's voluntary context switches, i.e. how
+ *   often it went to sleep and was woken again ("wakeups").
+ */
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <syslog.h>
+
+#include "loop_monitor.h"
+#include "json_out.h"
+#include "ws_server.h"
+
+/* Watchdog period (ms) */
+#define LOOP_MONITOR_INTERVAL_MS 100
+/* Watchdog phase after the shared grid (ms), half the 10 ms lws service period */
+#define LOOP_MONITOR_WATCHDOG_OFFSET_MS 5
+/* Length of one reporting window (ms) */
+#define LOOP_MONITOR_WINDOW_MS 10000
+/* Minimum spacing between two loop_lag warning events (ms) */
+#define LOOP_MONITOR_WARNING_MIN_INTERVAL_MS 5000
+/* Maximum size of one loop_lag event message */
+#define LOOP_MONITOR_EVENT_LENGTH 256
+/* Timer slack of the main thread (the kernel default is 50 us) */
+#define LOOP_MONITOR_TIMER_SLACK_NS 1000000UL
+
+/* Context for one wrapped GLib I/O watch */
+struct monitored_source {
+  const char *name;
+  GIOFunc io_func;
+  gpointer data;
+};
+
+/* Timer source firing on the shared grid of its interval */
+struct aligned_source {
+  GSource source;
+  guint interval_ms;
+  /* Phase after the grid points (0 for all but the watchdog) */
+  guint offset_ms;
+  const char *name;
+  GSourceFunc func;
+  gpointer data;
+};
+
+static struct {
+  guint timer_id;
+  uint64_t threshold_ms;
+  struct histogram lag;
+  /* Grid time the currently dispatched timer was due at */
+  gint64 dispatch_deadline_us;
+
+  /* Current window */
+  gint64 window_start_us;
+  uint64_t window_start_wakeups;
+  struct loop_monitor_window current;
+  struct loop_monitor_window last;
+
+  /* Longest callback since the previous watchdog tick */
+  const char *tick_longest_name;
+  gint64 tick_longest_us;
+
+  uint64_t warning_count;
+  gint64 last_warning_us;
+} lm;
+
+/******************************************************************************/
+
+/* Account one measured callback run */
+static void
+record_callback(const char *name, gint64 duration_us)
+{
+  if (duration_us > lm.tick_longest_us) {
+    lm.tick_longest_us = duration_us;
+    lm.tick_longest_name = name;
+  }
+  if ((uint64_t)duration_us > lm.current.longest_us) {
+    lm.current.longest_us = (uint64_t)duration_us;
+    snprintf(lm.current.longest_name, sizeof(lm.current.longest_name), "%s", name);
+  }
+}
+
+/* First grid point of interval_ms, shifted by offset_ms, strictly after now_us */
+static gint64
+next_tick_us(gint64 now_us, guint interval_ms, guint offset_ms)
+{
+  gint64 interval_us = (gint64)MAX(interval_ms, 1U) * 1000;
+  gint64 offset_us = (gint64)offset_ms * 1000;
+
+  return ((now_us - offset_us) / interval_us + 1) * interval_us + offset_us;
+}
+
+/* Voluntary context switches of the process since startup */
+static uint64_t
+process_wakeups(void)
+{
+  struct rusage ru;
+
+  if (getrusage(RUSAGE_SELF, &ru) != 0) {
+    return 0;
+  }
+
+  return (uint64_t)ru.ru_nvcsw;
+}
+
+static gboolean
+aligned_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+  struct aligned_source *src = (struct aligned_source *)source;
+  gint64 start_us = g_get_monotonic_time();
+  gboolean ret;
+  (void)callback;
+  (void)user_data;
+
+  lm.dispatch_deadline_us = g_source_get_ready_time(source);
+  lm.current.timer_dispatches++;
+  ret = src->func(src->data);
+
+  gint64 end_us = g_get_monotonic_time();
+  record_callback(src->name, end_us - start_us);
+  if (ret) {
+    /* Skip grid points the callback overran instead of firing back to back */
+    g_source_set_ready_time(source, next_tick_us(end_us, src->interval_ms, src->offset_ms));
+  }
+
+  return ret;
+}
+
+static GSourceFuncs aligned_source_funcs = {
+  .dispatch = aligned_dispatch,
+};
+
+static gboolean
+monitored_io_cb(GIOChannel *channel, GIOCondition condition, gpointer user_data)
+{
+  struct monitored_source *src = user_data;
+  gint64 start_us = g_get_monotonic_time();
+  gboolean ret = src->io_func(channel, condition, src->data);
+
+  record_callback(src->name, g_get_monotonic_time() - start_us);
+
+  return ret;
+}
+
+/* Attach a timer source firing offset_ms after each grid point of interval_ms */
+static guint
+add_aligned_source(gint priority,
+                   guint interval_ms,
+                   guint offset_ms,
+                   const char *name,
+                   GSourceFunc func,
+                   gpointer data)
+{
+  GSource *source = g_source_new(&aligned_source_funcs, sizeof(struct aligned_source));
+  struct aligned_source *src = (struct aligned_source *)source;
+  guint id;
+
+  src->interval_ms = MAX(interval_ms, 1U);
+  src->offset_ms = offset_ms;
+  src->name = name;
+  src->func = func;
+  src->data = data;
+  g_source_set_priority(source, priority);
+  g_source_set_name(source, name);
+  g_source_set_ready_time(source, next_tick_us(g_get_monotonic_time(), src->interval_ms, src->offset_ms));
+  id = g_source_attach(source, NULL);
+  g_source_unref(source);
+
+  return id;
+}
+
+guint
+loop_monitor_timeout_add_full(gint priority, guint interval_ms, const char *name, GSourceFunc func, gpointer data)
+{
+  return add_aligned_source(priority, interval_ms, 0, name, func, data);
+}
+
+guint
+loop_monitor_timeout_add(guint interval_ms, const char *name, GSourceFunc func, gpointer data)
+{
+  return loop_monitor_timeout_add_full(G_PRIORITY_DEFAULT, interval_ms, name, func, data);
+}
+
+void
+loop_monitor_timeout_set_interval(guint source_id, guint interval_ms)
+{
+  GSource *source = source_id ? g_main_context_find_source_by_id(NULL, source_id) : NULL;
+
+  if (!source) {
+    return;
+  }
+
+  struct aligned_source *src = (struct aligned_source *)source;
+  interval_ms = MAX(interval_ms, 1U);
+  if (src->interval_ms == interval_ms) {
+    return;
+  }
+  src->interval_ms = interval_ms;
+  /* Outside its own dispatch the pending deadline moves to the new grid */
+  if (g_source_get_ready_time(source) >= 0) {
+    g_source_set_ready_time(source, next_tick_us(g_get_monotonic_time(), interval_ms, src->offset_ms));
+  }
+}
+
+gint64
+loop_monitor_us_to_next_tick(guint interval_ms)
+{
+  gint64 now_us = g_get_monotonic_time();
+
+  return next_tick_us(now_us, interval_ms, 0) - now_us;
+}
+
+guint
+loop_monitor_io_add_watch(GIOChannel *channel,
+                          GIOCondition condition,
+                          const char *name,
+                          GIOFunc func,
+                          gpointer data)
+{
+  struct monitored_source *src = g_new0(struct monitored_source, 1);
+
+  src->name = name;
+  src->io_func = func;
+  src->data = data;
+
+  return g_io_add_watch_full(channel, G_PRIORITY_DEFAULT, condition, monitored_io_cb, src, g_free);
+}
+
+/******************************************************************************/
+
+/* Push one rate-limited loop_lag warning to all clients */
+static void
+send_lag_warning(gint64 now_us, uint64_t lag_ms)
+{
+  char json[LOOP_MONITOR_EVENT_LENGTH];
+  bool truncated = false;
+
+  if (lm.last_warning_us != 0 && now_us - lm.last_warning_us < LOOP_MONITOR_WARNING_MIN_INTERVAL_MS * 1000LL) {
+    return;
+  }
+  lm.last_warning_us = now_us;
+  lm.warning_count++;
+
+  syslog(LOG_WARNING,
+         "Main loop lag %llu ms (threshold %llu ms), longest callback: %s (%lld us)",
+         (unsigned long long)lag_ms,
+         (unsigned long long)lm.threshold_ms,
+         lm.tick_longest_name ? lm.tick_longest_name : "unknown",
+         (long long)lm.tick_longest_us);
+
+  size_t len = build_loop_lag_event_json(
+      json, sizeof(json), lag_ms, lm.threshold_ms, lm.tick_longest_name, (uint64_t)lm.tick_longest_us, &truncated);
+  if (len > 0 && !truncated) {
+    ws_server_broadcast_json(json, len);
+  }
+}
+
+static gboolean
+watchdog_cb(gpointer user_data)
+{
+  gint64 now_us = g_get_monotonic_time();
+  (void)user_data;
+
+  /* Lateness relative to the grid point the watchdog was due at */
+  gint64 late_us = now_us - lm.dispatch_deadline_us;
+  uint64_t lag_ms = late_us > 0 ? (uint64_t)(late_us / 1000) : 0;
+
+  histogram_record(&lm.lag, lag_ms);
+  histogram_record(&lm.current.lag, lag_ms);
+  if (lm.threshold_ms > 0 && lag_ms >= lm.threshold_ms) {
+    send_lag_warning(now_us, lag_ms);
+  }
+  lm.tick_longest_name = NULL;
+  lm.tick_longest_us = 0;
+
+  /* Roll the window */
+  if (now_us - lm.window_start_us >= LOOP_MONITOR_WINDOW_MS * 1000LL) {
+    uint64_t wakeups = process_wakeups();
+
+    lm.current.duration_ms = (uint64_t)((now_us - lm.window_start_us) / 1000);
+    lm.current.wakeups = wakeups - lm.window_start_wakeups;
+    lm.last = lm.current;
+    memset(&lm.current, 0, sizeof(lm.current));
+    lm.window_start_us = now_us;
+    lm.window_start_wakeups = wakeups;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+void
+loop_monitor_start(uint64_t threshold_ms)
+{
+  if (lm.timer_id != 0) {
+    return;
+  }
+
+  lm.threshold_ms = threshold_ms;
+  lm.window_start_us = g_get_monotonic_time();
+  lm.window_start_wakeups = process_wakeups();
+  if (prctl(PR_SET_TIMERSLACK, LOOP_MONITOR_TIMER_SLACK_NS, 0, 0, 0) != 0) {
+    syslog(LOG_WARNING, "Failed to set timer slack: %m");
+  }
+  lm.timer_id = add_aligned_source(G_PRIORITY_DEFAULT,
+                                   LOOP_MONITOR_INTERVAL_MS,
+                                   LOOP_MONITOR_WATCHDOG_OFFSET_MS,
+                                   "loop_watchdog",
+                                   watchdog_cb,
+                                   NULL);
+  syslog(LOG_INFO, "Main loop monitor started (warning threshold %llu ms)", (unsigned long long)threshold_ms);
+}
+
+void
+loop_monitor_stop(void)
+{
+  if (lm.timer_id != 0) {
+    g_source_remove(lm.timer_id);
+    lm.timer_id = 0;
+  }
+}
+
+const struct histogram *
+loop_monitor_get_lag(void)
+{
+  return &lm.lag;
+}
+
+const struct loop_monitor_window *
+loop_monitor_get_last_window(void)
+{
+  return &lm.last;
+}
+
+uint64_t
+loop_monitor_get_warning_count(void)
+{
+  return lm.warning_count;
+}
+
+uint64_t
+loop_monitor_get_threshold_ms(void)
+{
+  return lm.threshold_ms;
+}
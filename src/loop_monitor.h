@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "histogram.h"
+
+/* Maximum length of a recorded callback name (including NUL) */
+#define LOOP_MONITOR_MAX_NAME_LENGTH 32
+
+/* Summary of one completed measurement window */
+struct loop_monitor_window {
+  /* Window length in milliseconds (0 until the first window completes) */
+  uint64_t duration_ms;
+  /* Watchdog lateness samples collected during the window */
+  struct histogram lag;
+  /* Callback that ran longest during the window ("" if none was measured) */
+  char longest_name[LOOP_MONITOR_MAX_NAME_LENGTH];
+  uint64_t longest_us;
+  /* Voluntary context switches of the process, i.e. sleeps ended by a wakeup */
+  uint64_t wakeups;
+  /* Timer callbacks dispatched; several share one wakeup when their grid points coincide */
+  uint64_t timer_dispatches;
+};
+
+/* Start the main-loop watchdog.
+ *
+ * A periodic watchdog timer measures how late it fires compared to its
+ * deadline. When the lateness exceeds threshold_ms a rate-limited
+ * { "event": { "type": "loop_lag", ... } } message is pushed to all clients.
+ */
+void loop_monitor_start(uint64_t threshold_ms);
+
+/* Stop the watchdog. Wrapped sources keep working. Safe to call multiple times. */
+void loop_monitor_stop(void);
+
+/* g_timeout_add() variant that measures each callback invocation under name.
+ *
+ * The timer fires whenever CLOCK_MONOTONIC crosses a multiple of interval_ms,
+ * so timers with related intervals share wakeups (see loop_monitor.c). The
+ * first call comes within one interval. Remove it with g_source_remove().
+ *
+ * name must be a string literal (it is not copied).
+ */
+guint loop_monitor_timeout_add(guint interval_ms, const char *name, GSourceFunc func, gpointer data);
+
+/* loop_monitor_timeout_add() with a GLib source priority. Of timers due at
+ * the same grid point, the one with the higher priority (lower value) runs first.
+ */
+guint loop_monitor_timeout_add_full(gint priority,
+                                    guint interval_ms,
+                                    const char *name,
+                                    GSourceFunc func,
+                                    gpointer data);
+
+/* Change the interval of a timer created by loop_monitor_timeout_add().
+ * Called from the timer's own callback, it applies to the next expiration.
+ */
+void loop_monitor_timeout_set_interval(guint source_id, guint interval_ms);
+
+/* Microseconds until the next grid point of interval_ms, for timers outside
+ * GLib (lws_set_timer_usecs()) that should share the same wakeups.
+ */
+gint64 loop_monitor_us_to_next_tick(guint interval_ms);
+
+/* g_io_add_watch() variant that measures each callback invocation under name. */
+guint loop_monitor_io_add_watch(GIOChannel *channel,
+                                GIOCondition condition,
+                                const char *name,
+                                GIOFunc func,
+                                gpointer data);
+
+/* Lateness of the watchdog timer since startup (ms) */
+const struct histogram *loop_monitor_get_lag(void);
+
+/* Last completed measurement window */
+const struct loop_monitor_window *loop_monitor_get_last_window(void);
+
+/* Number of loop_lag warning events pushed since startup */
+uint64_t loop_monitor_get_warning_count(void);
+
+/* Configured warning threshold (ms) */
+uint64_t loop_monitor_get_threshold_ms(void);
@@ -15,6 +15,7 @@
  * - Each WebSocket client can request a one-shot list of running process names.
  * - Each WebSocket client can request a one-shot filesystem storage summary.
  * - Each WebSocket client can request a one-shot system information summary.
+ * - Each WebSocket client can request a downsampled window of the long history (-H).
  *
  * Data flow:
  *   /proc -> app_state.stats
@@ -38,11 +39,19 @@
  *       "cpu": <percent>,
  *       "rss_kb": <kB>,
  *       "pss_kb": <kB>,
- *       "uss_kb": <kB>
+ *       "uss_kb": <kB>,
+ *       "cmdline": "<arguments joined by spaces>",
+ *       "exe": "<executable path>",
+ *       "uid": <real uid>,
+ *       "cgroup": "<cgroup path>"
  *     }
+ * - cmdline, exe, uid and cgroup are resolved once per process instance and
+ *   cached by (pid, starttime), so PID reuse is detected; each is omitted
+ *   when unknown (e.g. exe of another user's process without privileges).
  * - Process CPU% is computed from (utime + stime) deltas over monotonic time.
  *   Interpretation: 100% = all CPUs fully utilized (system-wide percentage, matches top(1) default).
- * - Process RSS is reported from VmRSS in /proc/<pid>/status (kB).
+ * - Process RSS is reported from the rss field of /proc/<pid>/stat (kB). Per tick
+ *   only /proc/<pid>/stat (and smaps_rollup, see below) is read.
  * - Process PSS and USS are reported from /proc/<pid>/smaps_rollup:
  *     - PSS (Proportional Set Size) is the kernel-accounted RAM cost of the process.
  *     - USS (Unique Set Size) is the amount of private memory that would be freed if the process exited.
@@ -63,6 +72,15 @@
  *   system process inventory.
  * - The response is size-bounded and may be truncated if limits are reached.
  *
+ * One-shot process information:
+ * - The client can request the identity of all processes with a given comm:
+ *     { "process_info": "name" }
+ * - The server responds with up to 16 instances:
+ *     { "process_info": { "name": "name", "instances": [
+ *         { "pid": N, "state": "S", "cmdline": "...", "exe": "...", "uid": N, "cgroup": "..." } ] } }
+ * - Identity fields are omitted when unknown. An empty or non-string name is
+ *   answered with an "invalid_process_info_request" error.
+ *
  * One-shot storage information:
  * - The client can request filesystem usage statistics:
  *     { "storage": true }
@@ -85,6 +103,235 @@
  *     - OS identification (best-effort)
  * - System information is returned only on explicit request and is not streamed.
  *
+ * One-shot server self statistics:
+ * - The client can request latency histograms of the server itself:
+ *     { "self_stats": true }
+ * - The server responds with:
+ *     { "self_stats": { "latency": { "bucket_le_ms": [...], "global": {...}, "session": {...} } } }
+ * - sample_to_send_ms: age of a stats snapshot when its frame is written
+ *   (send_mono_ms - mono_ms).
+ * - queue_ms: time a frame waited between being requested/queued and written.
+ * - "global" covers all sessions since startup, "session" only the requester.
+ * - "loop" reports main loop lag: how late a 100 ms watchdog timer fires,
+ *   plus the longest measured callback of the last 10 s window. The window
+ *   also counts the process wakeups (voluntary context switches) and timer
+ *   callbacks ("wakeups", "timer_dispatches").
+ * - "slots" reports client slot occupancy and evictions:
+ *     { "max": 10, "connected": N, "pending": N, "streaming": N, "idle": N,
+ *       "evicted_idle": N, "evicted_preempted": N, "rejected": N,
+ *       "local": N }
+ *
+ * Timers and wakeups:
+ * - All periodic timers fire on a shared grid of CLOCK_MONOTONIC (an N ms
+ *   timer at multiples of N ms), so the lws service, sampler, per-session
+ *   stream timers and second-granularity timers share wakeups. The 100 ms
+ *   watchdog fires 5 ms after the grid, so it does not measure their run time.
+ * - lws is serviced every 10 ms while clients or upstreams are connected and
+ *   every 100 ms otherwise; an idle backend wakes about 20 times per second
+ *   (lws and the watchdog).
+ * - The timer slack of the main thread is 1 ms.
+ *
+ * Prometheus metrics:
+ * - GET http://<ip>:9000/metrics returns the text exposition format
+ *   (version 0.0.4), served on the WebSocket port by the same lws context.
+ * - Includes the latest sample (sysstats_cpu_usage_percent,
+ *   sysstats_cpu_core_usage_percent, sysstats_memory_*_bytes,
+ *   sysstats_load_average, sysstats_uptime_seconds), every process monitored
+ *   by a client (sysstats_process_up, sysstats_process_cpu_usage_percent,
+ *   sysstats_process_memory_bytes), storage (sysstats_storage_*_bytes) and
+ *   the self statistics (client slots, evictions, latency and loop lag
+ *   histograms in seconds).
+ * - The body is rendered once per sample and shared by concurrent scrapes.
+ *   Without streaming clients a sample is taken on demand.
+ * - Scrapes are plain HTTP and do not take a WebSocket client slot.
+ *
+ * Local Unix-domain socket:
+ * - With -u <path> the server also accepts WebSocket clients on a Unix-domain
+ *   socket, for consumers on the device itself (e.g. an ACAP application or a
+ *   shell tool). The protocol, messages and snapshots are the same as on TCP.
+ * - A path starting with '@' selects the Linux abstract namespace
+ *   (no file on disk). Access to a path is governed by its file permissions.
+ * - Local clients have their own limit of 8, do not count toward the TCP
+ *   client slots and are never preempted; "slots" reports them as "local".
+ *
+ * Fleet aggregator:
+ * - With -F <file> this backend also acts as an aggregator for other devices.
+ *   The file lists one device per line as "host[:port] [name]" (default port
+ *   9000, '#' starts a comment), at most 64 devices.
+ * - The aggregator keeps exactly one upstream connection per device with
+ *   { "stats_stream": true }, reconnecting with backoff (1 s up to 30 s), so
+ *   device load does not grow with the number of viewers.
+ * - { "fleet": true } returns the site-level view once,
+ *   { "fleet_stream": true } sends it every second:
+ *     { "fleet": { "ts": ..., "total": 40, "up": 38, "stale": 1, "down": 1,
+ *                  "percentiles": { "cpu": { "count": 38, "p50": ..., "p90": ...,
+ *                                            "p99": ..., "max": ..., "mean": ... },
+ *                                   "mem_used_percent": { ... }, "load1": { ... } },
+ *                  "devices": [ { "name": "entrance", "host": "10.0.0.21", "port": 9000,
+ *                                 "state": "up", "seq": N, "ts": ..., "age_ms": 210,
+ *                                 "cpu": 12.5, "mem_used_percent": 45.8, "mem_total_kb": N,
+ *                                 "mem_available_kb": N, "load1": 0.42, "uptime_s": N } ] } }
+ * - A device is "stale" when connected without a frame for 5 s, "down" when not
+ *   connected. Percentiles cover the "up" devices only.
+ * - Without -F these requests are answered with an error of type "fleet_disabled".
+ *
+ * Relay mode:
+ * - With -U host[:port] (e.g. on a gateway host) this backend subscribes once
+ *   to another backend and serves its stats stream to any number of clients.
+ *   The device cost does not depend on the audience size.
+ * - { "stats_stream": true } clients get the upstream frames byte for byte, as
+ *   they arrive. Every frame is held once and shared by all clients.
+ * - Channels, alerts, anomaly events, summaries, resume and /metrics use the
+ *   relayed samples, so other field sets and rates are derived locally.
+ *   Upstream events are forwarded to all clients.
+ * - Process monitoring is not relayed: "monitor" requests (also in channels)
+ *   are answered with an error of type "relay_unsupported" or
+ *   "invalid_channel_request". One-shot requests (process list, storage,
+ *   system info) describe the relay host.
+ *
+ * Shared-memory snapshot:
+ * - With -m <name> the sampler runs continuously and writes every sample,
+ *   plus a ring of the last 120 compact samples, into a shared-memory
+ *   segment. The versioned layout is defined in shm_stats.h.
+ * - Updates use a seqlock, so local processes read consistent snapshots
+ *   without a system call per read. shm_stats_reader.h is a header-only
+ *   reader; src/tools/shm_reader.c is an example.
+ * - On shutdown the segment is flagged closed and unlinked.
+ *
+ * Self-throttling:
+ * - With -B <percent> the backend keeps its own CPU use below a budget in
+ *   percent of one core (e.g. 0.5). Every 5 s it compares its process CPU
+ *   time with the budget and the system CPU usage with 95%.
+ * - Over budget or on a saturated device it steps up one level; after three
+ *   calm windows (under half the budget, system below 80%) it steps down:
+ *     level 0  500 ms, all fields
+ *     level 1  1 s, "pss_kb"/"uss_kb" are 0 (smaps_rollup is not read)
+ *     level 2  2 s, additionally no "cpu_per_core"
+ *     level 3  4 s
+ * - While throttled, stats frames carry "throttle_level": N and "delta_ms"
+ *   shows the stretched cadence. self_stats reports the level and the
+ *   measured cost under "throttle".
+ *
+ * Widget and overlay update proxy:
+ * - With -C host[:port] (the device web server, default port 80, e.g.
+ *   -C 127.0.0.1) the backend forwards widget and overlay updates to the
+ *   device CGIs, so a dragged widget does not cost one HTTP request per
+ *   pointer event:
+ *     { "cgi_update": { "target": "widget", "request": { "apiVersion": "2.0",
+ *                       "method": "updateWidget", "params": { ... } } } }
+ *     { "cgi_update": { "target": "overlay", "request": { "apiVersion": "1.8",
+ *                       "method": "setText", "params": { ... } } } }
+ * - Only updateWidget (overlaywidget.cgi) and setText/setImage
+ *   (dynamicoverlay.cgi) are forwarded. Updates are keyed by
+ *   params.generalParams.id or params.identity; the latest one wins, at most
+ *   one per widget is forwarded every 40 ms and never while the previous one
+ *   is in flight. Requests time out after 5 s.
+ * - The session that sent a forwarded update receives its outcome:
+ *     { "cgi_update_result": { "target": "widget", "id": 3, "status": 200,
+ *                              "latency_ms": 48, "http_ms": 12, "coalesced": 4,
+ *                              "rate_hz": 24.6, "response": { <CGI response> } } }
+ *   latency_ms counts from the receipt of the update, http_ms from the
+ *   request; coalesced is the number of updates it replaced; rate_hz is the
+ *   forwarded rate of this widget. Failed requests carry "error" instead of
+ *   "response".
+ * - Basic authentication credentials are read from the environment variable
+ *   CGI_PROXY_CREDENTIALS ("user:password").
+ * - Without -C these requests are answered with an error of type
+ *   "cgi_proxy_disabled"; invalid ones with "invalid_cgi_update".
+ *
+ * Client slots:
+ * - At most 10 clients are connected at a time. When the limit is reached, the
+ *   least recently active session that subscribes to nothing (an "idle"
+ *   session) and sent nothing for 10 s is closed to admit the new client;
+ *   without one the new client is rejected. Monitoring a process, owning a
+ *   burst capture or waiting for a CGI update are subscriptions.
+ * - Closed sessions first receive
+ *     { "event": { "type": "evicted", "reason": "idle" | "preempted" } }
+ *   followed by a close frame (status 1001).
+ *
+ * Server events:
+ * - Pushed to every connected client, wrapped as { "event": { "type": ... } }.
+ * - loop_lag: the main loop was blocked longer than the threshold, e.g.
+ *     { "event": { "type": "loop_lag", "lag_ms": 340, "threshold_ms": 200,
+ *                  "longest_callback": "stats_sample", "longest_callback_ms": 338.2 } }
+ *   At most one loop_lag event is sent per 5 s.
+ *
+ * Burst capture:
+ * - A client can sample CPU counters much faster than the regular stream for
+ *   a short time:
+ *     { "burst_capture": { "interval_ms": 10, "duration_ms": 3000 } }
+ * - Or arm a capture that starts when a regular sample matches a condition
+ *   (same syntax as alert rules):
+ *     { "burst_capture": { "interval_ms": 10, "duration_ms": 3000,
+ *                          "trigger": { "metric": "cpu", "op": ">", "value": 80 } } }
+ * - The server acknowledges with { "burst_capture": { "state": "running" | "armed", ... } }
+ *   and afterwards sends the whole capture as one frame, values in per-mille:
+ *     { "burst": { "interval_ms": 10, "samples": N, "t_ms": [...], "cpu": [...],
+ *                  "cpu_per_core": [[...], ...], "proc": { "name": ..., "pid": N, "cpu": [...] } } }
+ * - "proc" is included when the client monitors a process that was found.
+ * - One capture exists per server; { "burst_capture": false } cancels it.
+ * - Kernel CPU accounting has USER_HZ (typically 10 ms) resolution, so very
+ *   short intervals give coarse per-core values.
+ *
+ * Long-horizon percentile summaries (enabled with -s or -S <file>):
+ * - Every sample updates fixed-size quantile sketches (2% relative accuracy)
+ *   of cpu, mem_used_percent and load1 for the current hour; completed hours
+ *   roll into days. The last 24 hours and 7 days are kept, no raw history.
+ * - The client requests them with:
+ *     { "stats_summary": { "period": "hour", "count": 24 } }
+ *   ("period" is "hour" or "day", "count" defaults to all kept periods)
+ * - The server responds, newest period first:
+ *     { "stats_summary": { "period": "hour", "relative_accuracy": 0.02,
+ *         "periods": [ { "start_ms": N, "samples": N, "partial": true,
+ *                        "cpu": { "p50": X, "p95": X, "p99": X, "max": X }, ... } ] } }
+ *
+ * Long history (enabled with -H):
+ * - Every sample of cpu, mem_used_percent and load1 is kept at full rate for
+ *   the last hour and as 10 s buckets (first, min, max and last value with
+ *   their times) for the last 24 hours.
+ * - A chart requests a window at its width in pixels:
+ *     { "history": { "window_ms": 3600000, "columns": 800,
+ *                    "metrics": [ "cpu", "mem_used_percent" ] } }
+ *   ("metrics" defaults to all, "end_ms" moves the window back from now;
+ *   columns times the number of metrics is at most 2000)
+ * - The server responds with at most 4 points per column (M4: first, min, max
+ *   and last of each column's time slice), so peaks are preserved and the
+ *   size does not depend on the window length:
+ *     { "history": { "from_ms": N, "to_ms": N, "columns": 800, "resolution_ms": 500,
+ *         "series": { "cpu": { "t": [ms after from_ms...], "v": [...] }, ... } } }
+ *   "resolution_ms" is the sample interval of the data used (10000 for
+ *   windows the full-rate hour does not cover); wider gaps between points
+ *   are periods without samples.
+ * - One reply per client is in flight: a query while the previous reply is
+ *   still queued is answered with a "history_busy" error.
+ *
+ * Anomaly events (enabled with -A <k>):
+ * - The server keeps an exponentially weighted mean and variance of cpu,
+ *   mem_used_percent and load1, and of cpu and rss_kb of each monitored process.
+ * - A value beyond k sigma for 5 s opens an anomaly, 5 s back in range closes it:
+ *     { "event": { "type": "anomaly", "state": "started", "scope": "system",
+ *                  "metric": "cpu", "value": 97.1, "mean": 21.4, "sigma": 6.2,
+ *                  "z": 12.2, "k": 4 } }
+ * - System anomalies go to every client; process anomalies ("scope": "process",
+ *   "process": "name") only to the client monitoring that process, whether
+ *   or not it streams stats. Processes monitored by a channel are not evaluated.
+ * - The first 30 s after start (or after changing the monitored process) only
+ *   establish the baseline.
+ *
+ * Threshold alerts:
+ * - A client can register rules evaluated by the server at every sample:
+ *     { "alert": { "metric": "cpu", "op": ">", "value": 90, "for_ms": 10000 } }
+ * - Metrics: cpu, cpu_core_max, mem_used_percent, mem_available_kb,
+ *   load1, load5, load15. Operators: >, >=, <, <=.
+ * - Optional "hysteresis" (default 5% of value) and "clear_ms" (default
+ *   for_ms): a firing alert resolves only after the metric stayed past
+ *   value -/+ hysteresis for clear_ms.
+ * - The server acknowledges with { "alert_rule": { "id": N, ... } } and then
+ *   sends only transitions, to the owning client:
+ *     { "event": { "type": "alert", "state": "firing", "id": N, "observed": 93.2, ... } }
+ * - Rules are removed with { "alert": { "remove": N } } or
+ *   { "alert": { "clear": true } }, and on disconnect. No stats_stream is needed.
+ *
  * Live log streaming:
  * - Any client can subscribe to live log output from the system log files:
  *     { "log_stream": true }
@@ -96,11 +343,93 @@
  * - Log streaming is intended for lightweight live viewing not audit.
  * - To stop log streaming without closing the socket, the client sends:
  *     { "log_stream": false }
+ * - Live lines carry a sequence number, { "log": ..., "level": ..., "seq": N };
+ *   replayed history lines have none.
+ *
+ * Logical channels:
+ * - Several independent stats subscriptions can share one connection (and
+ *   one client slot). A client opens a channel with:
+ *     { "open": { "id": 3, "type": "stats", "interval_ms": 1000,
+ *                 "fields": ["cpu", "mem"], "monitor": "name", "credit": 20 } }
+ * - Only "id" (1..65535) and "type" are required; "stats" is the only type.
+ *   interval_ms is rounded up to a multiple of 500 (default 500). "fields"
+ *   selects cpu, cpu_per_core, mem, load, uptime, clients (default all).
+ *   "monitor" adds a process with its own CPU baseline.
+ * - The server acknowledges with { "opened": { ... effective settings ... } }
+ *   and sends frames tagged with the channel id:
+ *     { "ch": 3, "seq": N, "ts": ..., "mono_ms": ..., "cpu": 5.42, ... }
+ * - Flow control per channel: with "credit" the server sends at most that many
+ *   frames until the client grants more with
+ *     { "credit": { "id": 3, "frames": 20 } }
+ *   Frames skipped meanwhile are counted in "dropped" of the next frame.
+ *   Without "credit" the channel is unlimited.
+ * - { "close": 3 } closes a channel ({ "closed": { "id": 3 } }); all channels
+ *   close on disconnect. Up to 8 channels per connection; channels are not
+ *   restored by resume.
+ *
+ * Resume after reconnect:
+ * - Every new connection first receives its resume token:
+ *     { "session": { "token": "<32 hex>", "resume_ms": 60000 } }
+ * - Stats frames carry "seq", the global sample number. After a dropped
+ *   connection (within resume_ms) a client can restore its subscriptions
+ *   and receive what it missed:
+ *     { "resume": { "token": "...", "stats_seq": N, "log_seq": M } }
+ * - The server replays stats frames after stats_seq (up to 60 s, without
+ *   "proc") and live log lines after log_seq (up to 256), restores the
+ *   monitored process and then replies, marking the end of the replay:
+ *     { "resumed": { "stats_stream": true, "monitor": "name", "log_stream": true,
+ *                    "stats_replayed": N, "stats_gap": false,
+ *                    "log_replayed": N, "log_gap": false } }
+ * - A "*_gap" of true means part of the missed data was no longer kept.
+ * - An unknown or expired token is answered with an error of type
+ *   "resume_failed"; the client then subscribes again as usual.
+ *
+ * System root and snapshot record/replay (command line options):
+ * - -r <dir>   Read /proc, /sys, /etc and /var/log below <dir> instead of "/".
+ *              Intended for fixtures and for running against a copied tree.
+ * - -R <file>  Record every /proc and /sys file read by the sampler into <file>.
+ * - -P <file>  Replay a recording: the sampler reads the recorded files, paced
+ *              by the recorded sample timestamps.
+ * - -x <speed> Replay speed factor for -P (default 1.0, e.g. 10 = 10x faster).
+ * - -L <ms>    Main loop lag above which a loop_lag event is pushed (default 200,
+ *              0 disables the event).
+ * - -A <k>     Enable anomaly detection with a k-sigma threshold (e.g. 4,
+ *              default 0 = disabled), see "Anomaly events" above.
+ * - -s         Enable hourly/daily percentile summaries (see stats_summary).
+ * - -S <file>  Like -s, and persist the summaries in <file> across restarts.
+ * - -H         Keep the long history for downsampled chart queries (see
+ *              "Long history" above).
+ * - -k <s>     Ping a WebSocket peer after <s> seconds without traffic
+ *              (default 10, 0 disables keepalive).
+ * - -K <s>     Close a peer silent for <s> seconds (default 30, at least -k + 1).
+ * - -I <s>     Close sessions that subscribe to nothing (no stats_stream,
+ *              channel, log_stream, fleet_stream, alert, monitor, burst
+ *              capture or waiting CGI update) after <s> seconds without a
+ *              client message (default 600, 0 disables). Local socket clients
+ *              are not closed.
+ * - -u <path>  Also listen on a Unix-domain socket, see "Local Unix-domain
+ *              socket" above.
+ * - -F <file>  Fleet (aggregator) mode with the devices listed in <file>, see
+ *              "Fleet aggregator" above.
+ * - -U <addr>  Relay mode for the backend at <addr> ("host[:port]"), see
+ *              "Relay mode" above.
+ * - -m <name>  Publish every sample in the POSIX shared-memory object <name>
+ *              (e.g. /widget_wizard_stats), see "Shared-memory snapshot" above.
+ * - -B <pct>   Throttle sampling to a CPU budget of <pct> percent of one core
+ *              (default 0 = disabled), see "Self-throttling" above.
+ * - -C <addr>  Forward widget and overlay updates to the web server at <addr>
+ *              ("host[:port]"), see "Widget and overlay update proxy" above.
+ * - Replay drives the normal sampling and JSON pipeline, so a captured incident
+ *   from a device can be reproduced on a host build.
+ * - -r and -P are mutually exclusive (replay installs its own root), as are -U
+ *   and -P (relay mode does not sample locally).
  *
  * Returned JSON message format example:
  * {
  *   "ts": 1766089635269,
  *   "mono_ms": 4689109526,
+ *   "seq": 9378219,
+ *   "send_mono_ms": 4689109531,
  *   "delta_ms": 500,
  *   "cpu": 5.42,
  *   "cpu_cores": 4,
@@ -122,6 +451,18 @@
  *   }
  * }
  *
+ * CPU hotplug and clusters:
+ * - "cpu_cores" is the number of online cores; it follows hotplug, and so
+ *   does the normalization of "proc.cpu". Cores that are offline but below
+ *   the highest online one report 0 in "cpu_per_core" and are listed in
+ *   "cpu_offline": [2, 3] (omitted when none).
+ * - On SoCs with several clusters (cores sharing a cpufreq policy, e.g.
+ *   big.LITTLE), "cpu_clusters": [12.5, 61.0] holds the mean usage of the
+ *   online cores of each cluster. { "system_info": true } describes them:
+ *     "cpu_clusters": [ { "cpus": "0-3", "cores": 4, "max_freq_khz": 1200000 }, ... ]
+ * - sysfs is only read at startup and when the set of cores in /proc/stat
+ *   changes.
+ *
  * Scope and limitations:
  * - Intended for local or trusted networks (no TLS or authentication).
  * - Designed for a small number of concurrent clients.
@@ -143,10 +484,21 @@
 #include <glib/gstdio.h>
 #include <glib-unix.h>
 
+#include "anomaly.h"
 #include "app_state.h"
+#include "cgi_proxy.h"
+#include "fleet.h"
 #include "stats.h"
 #include "proc.h"
 #include "ws_server.h"
+#include "loop_monitor.h"
+#include "procfs.h"
+#include "relay.h"
+#include "shm_publish.h"
+#include "snapshot.h"
+#include "history.h"
+#include "summary.h"
+#include "throttle.h"
 #include "platform/platform.h"
 
 /* Axparameters used by this app */
@@ -159,6 +511,32 @@
  */
 #define WS_PORT_DEFAULT 9000
 
+/* Default main loop lag (ms) above which a loop_lag event is pushed.
+ *
+ * Well above the 10 ms lws service period, below the 500 ms sample cadence.
+ */
+#define LOOP_LAG_WARNING_MS_DEFAULT 200
+
+/* Default WebSocket keepalive: ping after 10 s of silence, hang up after 30 s.
+ *
+ * Frees the slot of a vanished peer (e.g. a suspended laptop) long before
+ * TCP notices.
+ */
+#define WS_PING_S_DEFAULT 10
+#define WS_HANGUP_S_DEFAULT 30
+
+/* Default idle timeout (s) for sessions that subscribe to nothing */
+#define WS_IDLE_TIMEOUT_S_DEFAULT 600
+
+/* Upper bound for the -k, -K and -I options (1 day) */
+#define WS_TIMEOUT_S_MAX 86400
+
+/* Usage string shared by syslog and stderr */
+#define USAGE_FORMAT                                                                                                   \
+  "Usage: %s [-p port] [-r root] [-R record_file] [-P replay_file [-x speed]] [-L lag_warning_ms] [-A k_sigma] "       \
+  "[-s | -S summary_file] [-H] [-k ping_s] [-K hangup_s] [-I idle_s] [-u unix_socket] [-m shm_name] "                  \
+  "[-F fleet_file] [-U relay_upstream] [-B cpu_budget_percent] [-C cgi_address]"
+
 /******************************************************************************/
 
 /* Global variables for this file */
@@ -178,7 +556,13 @@ on_unix_signal(gpointer user_data)
   (void)user_data;
 
   /* Stop WebSocket server and all its timers */
+  loop_monitor_stop();
   ws_server_stop();
+  fleet_stop();
+  relay_stop();
+  summary_stop();
+  history_stop();
+  shm_publish_stop();
 
   if (main_loop) {
     g_main_loop_quit(main_loop);
@@ -194,6 +578,24 @@ main(int argc, char **argv)
 {
   int ret = 0;
   int ws_port = WS_PORT_DEFAULT;
+  const char *root_dir = NULL;
+  const char *record_path = NULL;
+  const char *replay_path = NULL;
+  double replay_speed = 1.0;
+  unsigned long loop_lag_warning_ms = LOOP_LAG_WARNING_MS_DEFAULT;
+  double anomaly_k_sigma = 0.0;
+  double throttle_budget = 0.0;
+  bool summary = false;
+  const char *summary_path = NULL;
+  bool history = false;
+  unsigned long ws_ping_s = WS_PING_S_DEFAULT;
+  unsigned long ws_hangup_s = WS_HANGUP_S_DEFAULT;
+  unsigned long ws_idle_s = WS_IDLE_TIMEOUT_S_DEFAULT;
+  const char *unix_socket_path = NULL;
+  const char *shm_name = NULL;
+  const char *fleet_path = NULL;
+  const char *relay_address = NULL;
+  const char *cgi_address = NULL;
   struct app_state app;
   memset(&app, 0, sizeof(app));
 
@@ -203,7 +605,7 @@ main(int argc, char **argv)
   /* Parse input options */
   opterr = 0;
   int opt;
-  while ((opt = getopt(argc, argv, "p:")) != -1) {
+  while ((opt = getopt(argc, argv, "p:r:R:P:x:L:A:sS:Hk:K:I:u:m:F:U:B:C:")) != -1) {
     switch (opt) {
     case 'p': {
       char *endptr = NULL;
@@ -217,13 +619,152 @@ main(int argc, char **argv)
       ws_port = (int)port;
       break;
     }
+    case 'r':
+      root_dir = optarg;
+      break;
+    case 'R':
+      record_path = optarg;
+      break;
+    case 'P':
+      replay_path = optarg;
+      break;
+    case 'x': {
+      char *endptr = NULL;
+      double speed = strtod(optarg, &endptr);
+      if (optarg[0] == '\0' || *endptr != '\0' || !(speed > 0.0) || speed > 1000.0) {
+        syslog(LOG_ERR, "Invalid replay speed: %s", optarg);
+        fprintf(stderr, "Invalid replay speed: %s\n", optarg);
+        ret = -1;
+        goto exit;
+      }
+      replay_speed = speed;
+      break;
+    }
+    case 'L': {
+      char *endptr = NULL;
+      unsigned long lag_ms = strtoul(optarg, &endptr, 10);
+      if (optarg[0] == '\0' || optarg[0] == '-' || *endptr != '\0' || lag_ms > 60000) {
+        syslog(LOG_ERR, "Invalid loop lag threshold: %s", optarg);
+        fprintf(stderr, "Invalid loop lag threshold: %s\n", optarg);
+        ret = -1;
+        goto exit;
+      }
+      loop_lag_warning_ms = lag_ms;
+      break;
+    }
+    case 'A': {
+      char *endptr = NULL;
+      double k = strtod(optarg, &endptr);
+      if (optarg[0] == '\0' || *endptr != '\0' || !(k >= 0.0) || k > 100.0) {
+        syslog(LOG_ERR, "Invalid anomaly threshold: %s", optarg);
+        fprintf(stderr, "Invalid anomaly threshold: %s\n", optarg);
+        ret = -1;
+        goto exit;
+      }
+      anomaly_k_sigma = k;
+      break;
+    }
+    case 'B': {
+      char *endptr = NULL;
+      double budget = strtod(optarg, &endptr);
+      if (optarg[0] == '\0' || *endptr != '\0' || !(budget >= 0.0) || budget > 100.0) {
+        syslog(LOG_ERR, "Invalid CPU budget: %s", optarg);
+        fprintf(stderr, "Invalid CPU budget: %s\n", optarg);
+        ret = -1;
+        goto exit;
+      }
+      throttle_budget = budget;
+      break;
+    }
+    case 's':
+      summary = true;
+      break;
+    case 'S':
+      summary = true;
+      summary_path = optarg;
+      break;
+    case 'H':
+      history = true;
+      break;
+    case 'k':
+    case 'K':
+    case 'I': {
+      char *endptr = NULL;
+      unsigned long secs = strtoul(optarg, &endptr, 10);
+      if (optarg[0] == '\0' || optarg[0] == '-' || *endptr != '\0' || secs > WS_TIMEOUT_S_MAX) {
+        syslog(LOG_ERR, "Invalid -%c seconds: %s", opt, optarg);
+        fprintf(stderr, "Invalid -%c seconds: %s\n", opt, optarg);
+        ret = -1;
+        goto exit;
+      }
+      if (opt == 'k') {
+        ws_ping_s = secs;
+      } else if (opt == 'K') {
+        ws_hangup_s = secs;
+      } else {
+        ws_idle_s = secs;
+      }
+      break;
+    }
+    case 'u':
+      /* Room for the terminating NUL in sockaddr_un.sun_path (108 bytes) */
+      if (optarg[0] == '\0' || strlen(optarg) >= 108) {
+        syslog(LOG_ERR, "Invalid Unix socket path: %s", optarg);
+        fprintf(stderr, "Invalid Unix socket path: %s\n", optarg);
+        ret = -1;
+        goto exit;
+      }
+      unix_socket_path = optarg;
+      break;
+    case 'm':
+      shm_name = optarg;
+      break;
+    case 'F':
+      fleet_path = optarg;
+      break;
+    case 'U':
+      relay_address = optarg;
+      break;
+    case 'C':
+      cgi_address = optarg;
+      break;
     default:
-      syslog(LOG_ERR, "Usage: %s [-p port]", argv[0]);
-      fprintf(stderr, "Usage: %s [-p port]\n", argv[0]);
+      syslog(LOG_ERR, USAGE_FORMAT, argv[0]);
+      fprintf(stderr, USAGE_FORMAT "\n", argv[0]);
       ret = -1;
       goto exit;
     }
   }
+  if (root_dir && replay_path) {
+    syslog(LOG_ERR, "Options -r and -P cannot be combined");
+    fprintf(stderr, "Options -r and -P cannot be combined\n");
+    ret = -1;
+    goto exit;
+  }
+  if (relay_address && replay_path) {
+    syslog(LOG_ERR, "Options -U and -P cannot be combined");
+    fprintf(stderr, "Options -U and -P cannot be combined\n");
+    ret = -1;
+    goto exit;
+  }
+
+  /* Select where system files are read from: root prefix, replay or live */
+  if (root_dir && !procfs_set_root(root_dir)) {
+    syslog(LOG_ERR, "Invalid root directory: %s", root_dir);
+    fprintf(stderr, "Invalid root directory: %s\n", root_dir);
+    ret = -1;
+    goto exit;
+  }
+  if (replay_path && !snapshot_replay_start(replay_path, replay_speed)) {
+    fprintf(stderr, "Cannot replay snapshot: %s\n", replay_path);
+    ret = -1;
+    goto exit;
+  }
+  if (record_path && !snapshot_record_start(record_path)) {
+    fprintf(stderr, "Cannot record snapshot: %s\n", record_path);
+    ret = -1;
+    goto exit;
+  }
   /* Create the main GLib event loop */
   main_loop = g_main_loop_new(NULL, FALSE);
   if (!main_loop) {
@@ -245,13 +786,53 @@ main(int argc, char **argv)
   /* Cache the number of online CPUs once. */
   proc_init_cpu_count();
 
+  /* Anomaly detection keeps the sampler running, so configure it first */
+  anomaly_configure(anomaly_k_sigma);
+  throttle_configure(throttle_budget);
+  if (summary) {
+    summary_start(summary_path);
+  }
+  if (history) {
+    history_start();
+  }
+  if (shm_name && !shm_publish_start(shm_name)) {
+    fprintf(stderr, "Cannot publish shared memory: %s\n", shm_name);
+    ret = -1;
+    goto exit;
+  }
+
+  /* Fleet devices are connected once the server context exists */
+  if (fleet_path && !fleet_load(fleet_path)) {
+    fprintf(stderr, "Invalid fleet device list: %s\n", fleet_path);
+    ret = -1;
+    goto exit;
+  }
+
+  if (relay_address && !relay_start(&app, relay_address)) {
+    fprintf(stderr, "Invalid relay upstream: %s\n", relay_address);
+    ret = -1;
+    goto exit;
+  }
+
+  if (cgi_address && !cgi_proxy_configure(cgi_address)) {
+    fprintf(stderr, "Invalid CGI proxy address or credentials: %s\n", cgi_address);
+    ret = -1;
+    goto exit;
+  }
+
   /* Start the websocket server */
+  ws_server_set_keepalive((unsigned int)ws_ping_s, (unsigned int)ws_hangup_s);
+  ws_server_set_idle_timeout((unsigned int)ws_idle_s);
+  ws_server_set_unix_socket(unix_socket_path);
   if (!ws_server_start(&app, ws_port)) {
     ret = -1;
     goto exit;
   }
   syslog(LOG_INFO, "WebSocket server listening on port %d", ws_port);
 
+  /* Watch the main loop for stalls, 0 disables loop_lag events */
+  loop_monitor_start(loop_lag_warning_ms);
+
   /* Initialize latest_stats and establish CPU usage baseline */
   stats_read_cpu_stats(&app.stats);
   stats_read_mem(&app.stats);
@@ -263,7 +844,19 @@ main(int argc, char **argv)
 exit:
   syslog(LOG_INFO, "Terminating %s backend.", APP_NAME);
   /* Cleanup WebSocket context */
+  loop_monitor_stop();
   ws_server_stop();
+  /* Free the fleet devices and the relay upstream after their connections are gone */
+  fleet_stop();
+  relay_stop();
+  /* Write summaries before exit */
+  summary_stop();
+  history_stop();
+  /* Unlink the shared-memory segment */
+  shm_publish_stop();
+  /* Finish snapshot archive and remove the replay root */
+  snapshot_record_stop();
+  snapshot_replay_stop();
   /* Unref the main loop */
   if (main_loop) {
     g_main_loop_unref(main_loop);
@@ -0,0 +1,468 @@
+/* metrics.c
+ *
+ * Prometheus text-format endpoint (GET /metrics) on the WebSocket port.
+ *
+ * - Served by an lws HTTP mount on the same lws_context as the WebSocket
+ *   protocol, so scrapes need no extra port and do not take a client slot
+ *   (the slot limit applies to WebSocket upgrades only).
+ * - Exposes the latest system sample, every process monitored by a session
+ *   or channel, storage usage and the server self statistics.
+ * - The body is rendered at most once per sample; concurrent and repeated
+ *   scrapes share the cached GBytes.
+ * - Process CPU is computed against baselines owned by this module, so a
+ *   scrape never disturbs the CPU deltas of the streaming clients.
+ */
+#include <string.h>
+#include <syslog.h>
+
+#include "channel.h"
+#include "cpu_topology.h"
+#include "histogram.h"
+#include "loop_monitor.h"
+#include "metrics.h"
+#include "proc.h"
+#include "relay.h"
+#include "self_stats.h"
+#include "session.h"
+#include "storage.h"
+#include "throttle.h"
+#include "util.h"
+#include "ws_server.h"
+
+/* Metric name prefix */
+#define METRICS_PREFIX "sysstats_"
+
+/* A sample older than this is refreshed before rendering (sampler idle) */
+#define METRICS_SAMPLE_MAX_AGE_MS 1000
+
+/* Baseline of one process monitored by any session or channel */
+struct metrics_proc {
+  struct proc_cpu_baseline baseline;
+  /* Render generation that last saw this process monitored */
+  uint64_t seen_generation;
+};
+
+static struct {
+  GBytes *body;
+  /* Monotonic time of the sample the cached body was rendered from */
+  uint64_t body_mono_ms;
+  /* Process name -> struct metrics_proc */
+  GHashTable *procs;
+  uint64_t generation;
+} metrics;
+
+/******************************************************************************/
+
+/* Append a label value with the escaping required by the text format */
+static void
+append_label_value(GString *out, const char *value)
+{
+  for (const char *p = value; *p; p++) {
+    if (*p == '\\' || *p == '"') {
+      g_string_append_c(out, '\\');
+      g_string_append_c(out, *p);
+    } else if (*p == '\n') {
+      g_string_append(out, "\\n");
+    } else {
+      g_string_append_c(out, *p);
+    }
+  }
+}
+
+static void
+append_header(GString *out, const char *name, const char *type, const char *help)
+{
+  g_string_append_printf(out, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+  g_string_append_printf(out, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+/* Append a millisecond histogram as a Prometheus histogram in seconds */
+static void
+append_histogram(GString *out, const char *name, const char *help, const struct histogram *h)
+{
+  uint64_t cumulative = 0;
+
+  append_header(out, name, "histogram", help);
+  for (size_t i = 0; i + 1 < HISTOGRAM_BUCKET_COUNT; i++) {
+    cumulative += h->buckets[i];
+    g_string_append_printf(out,
+                           METRICS_PREFIX "%s_bucket{le=\"%g\"} %llu\n",
+                           name,
+                           (double)histogram_bucket_le(i) / 1000.0,
+                           (unsigned long long)cumulative);
+  }
+  g_string_append_printf(out, METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)h->count);
+  g_string_append_printf(out, METRICS_PREFIX "%s_sum %g\n", name, (double)h->sum / 1000.0);
+  g_string_append_printf(out, METRICS_PREFIX "%s_count %llu\n", name, (unsigned long long)h->count);
+}
+
+static void
+append_system(GString *out, const struct sys_stats *stats)
+{
+  static const char *const load_periods[] = { "1m", "5m", "15m" };
+  const double loads[] = { stats->load1, stats->load5, stats->load15 };
+
+  append_header(out, "cpu_usage_percent", "gauge", "CPU usage of all cores over the last sample interval.");
+  g_string_append_printf(out, METRICS_PREFIX "cpu_usage_percent %g\n", stats->cpu_usage);
+
+  append_header(out, "cpu_core_usage_percent", "gauge", "CPU usage per core over the last sample interval.");
+  for (size_t i = 0; i < stats->cpu_per_core_count; i++) {
+    g_string_append_printf(
+        out, METRICS_PREFIX "cpu_core_usage_percent{core=\"%zu\"} %g\n", i, stats->cpu_per_core_usage[i]);
+  }
+  append_header(out, "cpu_online_cores", "gauge", "CPU cores online (hot-unplugged cores excluded).");
+  g_string_append_printf(out, METRICS_PREFIX "cpu_online_cores %ld\n", proc_get_cpu_core_count());
+  if (stats->cpu_cluster_count > 0) {
+    append_header(out, "cpu_cluster_usage_percent", "gauge", "Mean CPU usage of the online cores of a cluster.");
+    for (size_t i = 0; i < stats->cpu_cluster_count; i++) {
+      const struct cpu_cluster *cl = cpu_topology_get_cluster(i);
+      g_string_append_printf(out, METRICS_PREFIX "cpu_cluster_usage_percent{cluster=\"%zu\",cpus=\"", i);
+      append_label_value(out, cl ? cl->cpus : "");
+      g_string_append_printf(out, "\"} %g\n", stats->cpu_cluster_usage[i]);
+    }
+  }
+
+  append_header(out, "memory_total_bytes", "gauge", "MemTotal from /proc/meminfo.");
+  g_string_append_printf(out, METRICS_PREFIX "memory_total_bytes %lld\n", (long long)stats->mem_total_kb * 1024);
+  append_header(out, "memory_available_bytes", "gauge", "MemAvailable from /proc/meminfo.");
+  g_string_append_printf(
+      out, METRICS_PREFIX "memory_available_bytes %lld\n", (long long)stats->mem_available_kb * 1024);
+
+  append_header(out, "load_average", "gauge", "System load average.");
+  for (size_t i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+    g_string_append_printf(out, METRICS_PREFIX "load_average{period=\"%s\"} %g\n", load_periods[i], loads[i]);
+  }
+
+  append_header(out, "uptime_seconds", "gauge", "System uptime.");
+  g_string_append_printf(out, METRICS_PREFIX "uptime_seconds %g\n", stats->uptime_s);
+}
+
+/* Remember one monitored process name for this render */
+static void
+note_process(const char *name)
+{
+  struct metrics_proc *mp = g_hash_table_lookup(metrics.procs, name);
+
+  if (!mp) {
+    mp = g_new0(struct metrics_proc, 1);
+    g_hash_table_insert(metrics.procs, g_strdup(name), mp);
+  }
+  mp->seen_generation = metrics.generation;
+}
+
+static void
+collect_session_processes(struct per_session_data *pss, void *user)
+{
+  (void)user;
+
+  if (pss->proc_enabled && pss->proc_name[0] != '\0') {
+    note_process(pss->proc_name);
+  }
+  if (pss->channels) {
+    for (guint i = 0; i < pss->channels->len; i++) {
+      const struct ws_channel *ch = &g_array_index(pss->channels, struct ws_channel, i);
+      if (ch->proc_enabled) {
+        note_process(ch->proc_name);
+      }
+    }
+  }
+}
+
+static void
+append_processes(GString *out, uint64_t now_mono_ms)
+{
+  GString *cpu = g_string_new(NULL);
+  GString *mem = g_string_new(NULL);
+  GString *up = g_string_new(NULL);
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  if (!metrics.procs) {
+    metrics.procs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+  metrics.generation++;
+  ws_server_foreach_session(collect_session_processes, NULL);
+
+  g_hash_table_iter_init(&iter, metrics.procs);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    struct metrics_proc *mp = value;
+    const char *name = key;
+    double proc_cpu = 0.0;
+    long rss_kb = 0;
+    long pss_kb = 0;
+    long uss_kb = 0;
+    pid_t pid = 0;
+
+    /* No longer monitored by anyone */
+    if (mp->seen_generation != metrics.generation) {
+      g_hash_table_iter_remove(&iter);
+      continue;
+    }
+
+    bool found =
+        proc_read_process_stats(name, &mp->baseline, now_mono_ms, &proc_cpu, &rss_kb, &pss_kb, &uss_kb, &pid);
+
+    g_string_append(up, METRICS_PREFIX "process_up{name=\"");
+    append_label_value(up, name);
+    g_string_append_printf(up, "\"} %d\n", found ? 1 : 0);
+    if (!found) {
+      continue;
+    }
+
+    g_string_append(cpu, METRICS_PREFIX "process_cpu_usage_percent{name=\"");
+    append_label_value(cpu, name);
+    g_string_append_printf(cpu, "\",pid=\"%d\"} %g\n", (int)pid, proc_cpu);
+
+    const long kbs[] = { rss_kb, pss_kb, uss_kb };
+    static const char *const kinds[] = { "rss", "pss", "uss" };
+    for (size_t i = 0; i < sizeof(kbs) / sizeof(kbs[0]); i++) {
+      g_string_append(mem, METRICS_PREFIX "process_memory_bytes{name=\"");
+      append_label_value(mem, name);
+      g_string_append_printf(mem, "\",pid=\"%d\",kind=\"%s\"} %lld\n", (int)pid, kinds[i], (long long)kbs[i] * 1024);
+    }
+  }
+
+  append_header(out, "process_up", "gauge", "1 if a process monitored by a client is running.");
+  g_string_append_len(out, up->str, (gssize)up->len);
+  append_header(
+      out, "process_cpu_usage_percent", "gauge", "CPU usage of a monitored process since the previous rendering.");
+  g_string_append_len(out, cpu->str, (gssize)cpu->len);
+  append_header(out, "process_memory_bytes", "gauge", "Memory of a monitored process (rss, pss, uss).");
+  g_string_append_len(out, mem->str, (gssize)mem->len);
+
+  g_string_free(up, TRUE);
+  g_string_free(cpu, TRUE);
+  g_string_free(mem, TRUE);
+}
+
+static void
+append_storage(GString *out)
+{
+  struct storage_info info[MAX_STORAGE_MOUNTS];
+  size_t count = storage_collect_info(info, MAX_STORAGE_MOUNTS);
+  static const char *const names[] = { "storage_size_bytes", "storage_used_bytes", "storage_available_bytes" };
+  static const char *const helps[] = { "Total size of a mount point.",
+                                       "Used space of a mount point.",
+                                       "Space available to unprivileged users." };
+
+  for (size_t m = 0; m < sizeof(names) / sizeof(names[0]); m++) {
+    append_header(out, names[m], "gauge", helps[m]);
+    for (size_t i = 0; i < count; i++) {
+      unsigned long long kb = m == 0 ? info[i].total_kb : m == 1 ? info[i].used_kb : info[i].available_kb;
+
+      g_string_append_printf(out, METRICS_PREFIX "%s{path=\"", names[m]);
+      append_label_value(out, info[i].path);
+      g_string_append(out, "\",fstype=\"");
+      append_label_value(out, info[i].fs_type);
+      g_string_append_printf(out, "\"} %llu\n", kb * 1024ULL);
+    }
+  }
+}
+
+static void
+append_self(GString *out)
+{
+  struct ws_slot_stats slots;
+
+  ws_server_get_slot_stats(&slots);
+  append_header(out, "ws_clients", "gauge", "WebSocket client slots by state.");
+  g_string_append_printf(out, METRICS_PREFIX "ws_clients{state=\"connected\"} %u\n", slots.connected);
+  g_string_append_printf(out, METRICS_PREFIX "ws_clients{state=\"pending\"} %u\n", slots.pending);
+  g_string_append_printf(out, METRICS_PREFIX "ws_clients{state=\"local\"} %u\n", slots.local);
+  g_string_append_printf(out, METRICS_PREFIX "ws_clients{state=\"streaming\"} %u\n", slots.streaming);
+  g_string_append_printf(out, METRICS_PREFIX "ws_clients{state=\"idle\"} %u\n", slots.idle);
+  append_header(out, "ws_clients_max", "gauge", "WebSocket client limit.");
+  g_string_append_printf(out, METRICS_PREFIX "ws_clients_max %u\n", slots.max);
+  append_header(out, "ws_evictions_total", "counter", "WebSocket sessions closed by the server.");
+  g_string_append_printf(
+      out, METRICS_PREFIX "ws_evictions_total{reason=\"idle\"} %llu\n", (unsigned long long)slots.evicted_idle);
+  g_string_append_printf(out,
+                         METRICS_PREFIX "ws_evictions_total{reason=\"preempted\"} %llu\n",
+                         (unsigned long long)slots.evicted_preempted);
+  append_header(out, "ws_rejected_total", "counter", "WebSocket connections refused at the client limit.");
+  g_string_append_printf(out, METRICS_PREFIX "ws_rejected_total %llu\n", (unsigned long long)slots.rejected);
+  append_header(out, "throttle_level", "gauge", "Adaptive sampling throttle level (0 = full fidelity).");
+  g_string_append_printf(out, METRICS_PREFIX "throttle_level %u\n", throttle_level());
+  append_header(out, "self_cpu_usage_percent", "gauge", "Own CPU use in percent of one core.");
+  g_string_append_printf(out, METRICS_PREFIX "self_cpu_usage_percent %.4f\n", throttle_cost_percent());
+
+  append_histogram(out,
+                   "sample_to_send_seconds",
+                   "Age of a stats snapshot when its frame is written.",
+                   self_stats_get_sample_to_send());
+  append_histogram(
+      out, "queue_seconds", "Time a frame waited between being queued and written.", self_stats_get_queue());
+  append_histogram(out, "loop_lag_seconds", "Lateness of the main loop watchdog timer.", loop_monitor_get_lag());
+  append_header(out, "loop_lag_warnings_total", "counter", "Main loop stalls above the loop_lag threshold.");
+  g_string_append_printf(
+      out, METRICS_PREFIX "loop_lag_warnings_total %llu\n", (unsigned long long)loop_monitor_get_warning_count());
+
+  /* Rates over the last completed loop monitor window (0 until one completed) */
+  const struct loop_monitor_window *window = loop_monitor_get_last_window();
+  double window_s = (double)window->duration_ms / 1000.0;
+  append_header(out, "wakeups_per_second", "gauge", "Times the backend process was woken up from sleep.");
+  g_string_append_printf(
+      out, METRICS_PREFIX "wakeups_per_second %.2f\n", window_s > 0.0 ? (double)window->wakeups / window_s : 0.0);
+  append_header(out, "timer_dispatches_per_second", "gauge", "Timer callbacks run by the main loop.");
+  g_string_append_printf(out,
+                         METRICS_PREFIX "timer_dispatches_per_second %.2f\n",
+                         window_s > 0.0 ? (double)window->timer_dispatches / window_s : 0.0);
+}
+
+/******************************************************************************/
+
+GBytes *
+metrics_render(struct app_state *app)
+{
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+  if (!app) {
+    return NULL;
+  }
+
+  /* Without a consumer the sampler is idle; take a sample for this scrape.
+   * While it runs (even throttled) its latest sample is served, so a scrape
+   * does not shorten the CPU delta of the next tick. In relay mode the
+   * samples come from the upstream only.
+   */
+  if (!relay_enabled() && !ws_server_sampling_active() &&
+      now_ms - app->stats.monotonic_ms >= METRICS_SAMPLE_MAX_AGE_MS) {
+    stats_update_sys_stats(&app->stats);
+  }
+
+  if (metrics.body && metrics.body_mono_ms == app->stats.monotonic_ms) {
+    return g_bytes_ref(metrics.body);
+  }
+
+  GString *out = g_string_sized_new(8192);
+  append_system(out, &app->stats);
+  append_processes(out, app->stats.monotonic_ms);
+  append_storage(out);
+  append_self(out);
+
+  if (metrics.body) {
+    g_bytes_unref(metrics.body);
+  }
+  gsize out_len = out->len;
+  metrics.body = g_bytes_new_take(g_string_free(out, FALSE), out_len);
+  metrics.body_mono_ms = app->stats.monotonic_ms;
+
+  return g_bytes_ref(metrics.body);
+}
+
+void
+metrics_stop(void)
+{
+  if (metrics.body) {
+    g_bytes_unref(metrics.body);
+    metrics.body = NULL;
+  }
+  if (metrics.procs) {
+    g_hash_table_destroy(metrics.procs);
+    metrics.procs = NULL;
+  }
+}
+
+/******************************************************************************/
+
+/* Send the response headers of a /metrics request and schedule the body */
+static int
+start_response(struct lws *wsi, struct metrics_http_session *hs)
+{
+  struct app_state *app = lws_context_user(lws_get_context(wsi));
+  unsigned char *start = &hs->buf[LWS_PRE];
+  unsigned char *p = start;
+  unsigned char *end = &hs->buf[sizeof(hs->buf) - 1];
+
+  hs->body = metrics_render(app);
+  hs->offset = 0;
+  if (!hs->body) {
+    return lws_return_http_status(wsi, HTTP_STATUS_SERVICE_UNAVAILABLE, NULL) ? -1 : 0;
+  }
+
+  if (lws_add_http_common_headers(wsi,
+                                  HTTP_STATUS_OK,
+                                  "text/plain; version=0.0.4; charset=utf-8",
+                                  g_bytes_get_size(hs->body),
+                                  &p,
+                                  end) ||
+      lws_finalize_write_http_header(wsi, start, &p, end)) {
+    return -1;
+  }
+
+  lws_callback_on_writable(wsi);
+  return 0;
+}
+
+/* Write the next body chunk; the last one completes the transaction */
+static int
+write_body(struct lws *wsi, struct metrics_http_session *hs)
+{
+  gsize size = 0;
+  const unsigned char *data = hs->body ? g_bytes_get_data(hs->body, &size) : NULL;
+  size_t chunk = MIN(size - hs->offset, sizeof(hs->buf) - LWS_PRE);
+  bool last = hs->offset + chunk >= size;
+
+  if (!data) {
+    return -1;
+  }
+
+  memcpy(&hs->buf[LWS_PRE], data + hs->offset, chunk);
+  if (lws_write(wsi, &hs->buf[LWS_PRE], chunk, last ? LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) != (int)chunk) {
+    return -1;
+  }
+  hs->offset += chunk;
+
+  if (!last) {
+    lws_callback_on_writable(wsi);
+    return 0;
+  }
+
+  g_bytes_unref(hs->body);
+  hs->body = NULL;
+  return lws_http_transaction_completed(wsi) ? -1 : 0;
+}
+
+int
+metrics_http_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+  struct metrics_http_session *hs = user;
+
+  switch (reason) {
+  case LWS_CALLBACK_HTTP: {
+    char uri[32];
+
+    if (!hs) {
+      return -1;
+    }
+    /* Only GET of exactly /metrics (in is the path below the mount point) */
+    if (lws_hdr_copy(wsi, uri, sizeof(uri), WSI_TOKEN_GET_URI) <= 0) {
+      return lws_return_http_status(wsi, HTTP_STATUS_METHOD_NOT_ALLOWED, NULL) ? -1 : 0;
+    }
+    if (in && len > 0 && strcmp((const char *)in, "/") != 0) {
+      return lws_return_http_status(wsi, HTTP_STATUS_NOT_FOUND, NULL) ? -1 : 0;
+    }
+    return start_response(wsi, hs);
+  }
+
+  case LWS_CALLBACK_HTTP_WRITEABLE:
+    if (!hs || !hs->body) {
+      break;
+    }
+    return write_body(wsi, hs);
+
+  case LWS_CALLBACK_CLOSED_HTTP:
+  case LWS_CALLBACK_WSI_DESTROY:
+    if (hs && hs->body) {
+      g_bytes_unref(hs->body);
+      hs->body = NULL;
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return lws_callback_http_dummy(wsi, reason, user, in, len);
+}
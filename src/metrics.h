@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <glib.h>
+#include <libwebsockets.h>
+
+#include "app_state.h"
+
+/* HTTP path of the Prometheus endpoint, served on the WebSocket port */
+#define METRICS_HTTP_PATH "/metrics"
+
+/* lws protocol name the /metrics mount is bound to */
+#define METRICS_PROTOCOL_NAME "http-metrics"
+
+/* Per-request state of a /metrics HTTP connection (lws per_session_data). */
+struct metrics_http_session {
+  /* Body being sent (a reference to the cached rendering) */
+  GBytes *body;
+  size_t offset;
+  /* Headroom for lws plus one body chunk */
+  unsigned char buf[LWS_PRE + 4096];
+};
+
+/* Return the current metrics in the Prometheus text format (version 0.0.4).
+ *
+ * The rendering is cached per sample: scrapes between two samples share one
+ * body. When the sampler is idle (no streaming client) a fresh sample is
+ * taken first. The caller owns the returned reference (g_bytes_unref()).
+ */
+GBytes *metrics_render(struct app_state *app);
+
+/* lws protocol callback serving GET /metrics (see METRICS_PROTOCOL_NAME). */
+int metrics_http_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
+
+/* Release the cached rendering and the per-process baselines. */
+void metrics_stop(void);
@@ -5,69 +5,31 @@
 #include <unistd.h>
 #include <syslog.h>
 
+#include "cpu_topology.h"
 #include "session.h"
 #include "proc.h"
+#include "proc_identity.h"
+#include "procfs.h"
 #include "stats.h"
 
-static long cpu_core_count = 1;
+static bool smaps_enabled = true;
 
-/* Cache the number of online CPUs once.
+/* Read the online CPU set and cluster layout once.
  *
- * The value is constant for the lifetime of the process on typical
- * embedded systems, so caching avoids repeated sysconf() calls.
- * Fallback to 1 ensures safe division if sysconf() fails.
+ * Later hotplug changes are picked up by the sampler (cpu_topology.h), so
+ * the count used to normalize process CPU usage follows the online cores.
  */
 void
 proc_init_cpu_count(void)
 {
-  cpu_core_count = sysconf(_SC_NPROCESSORS_ONLN);
-  if (cpu_core_count <= 0) {
-    syslog(LOG_WARNING, "sysconf(_SC_NPROCESSORS_ONLN) failed, defaulting to 1 CPU");
-    cpu_core_count = 1;
-  }
-  syslog(LOG_INFO, "Detected %ld CPU core(s)", cpu_core_count);
+  cpu_topology_refresh();
 }
 
-/* Return CPU core count. */
+/* Return the number of online CPU cores. */
 long
 proc_get_cpu_core_count(void)
 {
-  return cpu_core_count;
-}
-
-/* Verify that a cached PID still belongs to the given process name.
- *
- * This protects against Linux PID reuse: a different process may reuse
- * the same PID after the original process exits.
- *
- * Returns true if /proc/<pid>/comm exists and matches proc_name.
- */
-static bool
-pid_matches_comm(pid_t pid, const char *proc_name)
-{
-  char path[MAX_PROC_PATH_LENGTH];
-  char buf[MAX_PROC_LINE_LENGTH];
-
-  if (pid <= 0 || !proc_name || proc_name[0] == '\0') {
-    return false;
-  }
-
-  snprintf(path, sizeof(path), "/proc/%d/comm", pid);
-  FILE *f = fopen(path, "r");
-  if (!f) {
-    return false;
-  }
-
-  if (!fgets(buf, sizeof(buf), f)) {
-    fclose(f);
-    return false;
-  }
-  fclose(f);
-
-  /* Strip trailing newline */
-  buf[strcspn(buf, "\n")] = '\0';
-
-  return strcmp(buf, proc_name) == 0;
+  return cpu_topology_online_count();
 }
 
 /* Find the first PID whose /proc/<pid>/comm matches proc_name.
@@ -76,18 +38,27 @@ pid_matches_comm(pid_t pid, const char *proc_name)
  */
 static pid_t
 find_pid_by_comm(const char *proc_name)
+{
+  pid_t pid = 0;
+
+  return proc_find_pids_by_comm(proc_name, &pid, 1) == 1 ? pid : 0;
+}
+
+size_t
+proc_find_pids_by_comm(const char *proc_name, pid_t *pids, size_t max_pids)
 {
   DIR *proc_dir = NULL;
   struct dirent *ent; /* Directory entry used when iterating over /proc */
   char path[MAX_PROC_PATH_LENGTH];
   char buf[MAX_PROC_LINE_LENGTH];
+  size_t count = 0;
 
-  if (!proc_name || proc_name[0] == '\0') {
+  if (!proc_name || proc_name[0] == '\0' || !pids || max_pids == 0) {
     return 0;
   }
 
   /* Open /proc to iterate over all running processes, return empty result on failure */
-  proc_dir = opendir("/proc");
+  proc_dir = procfs_opendir("/proc");
   if (!proc_dir) {
     return 0;
   }
@@ -112,7 +83,7 @@ find_pid_by_comm(const char *proc_name)
      * skip entries that disappear or cannot be opened
      */
     snprintf(path, sizeof(path), "/proc/%ld/comm", pid);
-    FILE *f = fopen(path, "r");
+    FILE *f = procfs_fopen(path, "r");
     if (!f) {
       continue;
     }
@@ -133,15 +104,16 @@ find_pid_by_comm(const char *proc_name)
     }
     /* Match the requested process name */
     if (strcmp(buf, proc_name) == 0) {
-      /* Release the /proc directory handle before returning to avoid leaking an fd */
-      closedir(proc_dir);
-      return (pid_t)pid;
+      pids[count++] = (pid_t)pid;
+      if (count >= max_pids) {
+        break;
+      }
     }
   }
   /* Release the /proc directory handle before returning to avoid leaking an fd */
   closedir(proc_dir);
 
-  return 0;
+  return count;
 }
 
 /* Parse utime and stime from /proc/<pid>/stat safely.
@@ -157,20 +129,17 @@ find_pid_by_comm(const char *proc_name)
  *
  * For more info check out: http://brokestream.com/procstat.html
  */
-static bool
-parse_proc_stat_times(const char *line, unsigned long long *utime_out, unsigned long long *stime_out)
+/* Return the state field of a /proc/<pid>/stat line, NULL if malformed */
+static const char *
+stat_state_field(const char *line)
 {
   const char *p;
   const char *end = NULL;
 
-  if (!line || !utime_out || !stime_out) {
-    return false;
-  }
-
   /* Find the opening '(' */
   p = strchr(line, '(');
   if (!p) {
-    return false;
+    return NULL;
   }
   /* Find the closing ')' that is followed by " <state> " */
   for (const char *q = p + 1; *q; q++) {
@@ -184,10 +153,25 @@ parse_proc_stat_times(const char *line, unsigned long long *utime_out, unsigned
   }
   /* Invalid /proc/<pid>/stat format */
   if (!end) {
+    return NULL;
+  }
+
+  return end + 2;
+}
+
+bool
+proc_parse_stat_times(const char *line, unsigned long long *utime_out, unsigned long long *stime_out)
+{
+  const char *p;
+
+  if (!line || !utime_out || !stime_out) {
     return false;
   }
   /* Move to the state field */
-  p = end + 2;
+  p = stat_state_field(line);
+  if (!p) {
+    return false;
+  }
 
   /* We are now at: state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime */
   char state;
@@ -221,18 +205,119 @@ parse_proc_stat_times(const char *line, unsigned long long *utime_out, unsigned
   return true;
 }
 
+bool
+proc_parse_stat_fields(const char *line, struct proc_stat_fields *out)
+{
+  const char *p;
+
+  if (!line || !out) {
+    return false;
+  }
+  p = stat_state_field(line);
+  if (!p) {
+    return false;
+  }
+
+  /* comm is everything between the first '(' and the ") " before the state */
+  memset(out, 0, sizeof(*out));
+  const char *comm = strchr(line, '(') + 1;
+  size_t comm_len = (size_t)(p - 2 - comm);
+  if (comm_len >= sizeof(out->comm)) {
+    comm_len = sizeof(out->comm) - 1;
+  }
+  memcpy(out->comm, comm, comm_len);
+
+  /* state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime
+   * cutime cstime priority nice num_threads itrealvalue starttime vsize rss
+   */
+  if (sscanf(p,
+             "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu %*u %ld",
+             &out->state,
+             &out->utime,
+             &out->stime,
+             &out->starttime,
+             &out->rss_pages) != 5) {
+    return false;
+  }
+
+  return true;
+}
+
+/* Parse PSS and USS totals from an open /proc/<pid>/smaps_rollup stream.
+ *
+ * USS is the sum of all "Private_*" categories in kB. Both outputs are set
+ * to 0 first, so a stream without the expected keys reads as 0.
+ */
+void
+proc_parse_smaps_rollup(FILE *f, long *pss_kb_out, long *uss_kb_out)
+{
+  char buf[MAX_PROC_LINE_LENGTH];
+  long pss_kb = 0;
+  long uss_kb = 0;
+
+  if (!f || !pss_kb_out || !uss_kb_out) {
+    return;
+  }
+
+  while (fgets(buf, sizeof(buf), f)) {
+    long v;
+    if (sscanf(buf, "Pss: %ld kB", &v) == 1) {
+      pss_kb = v;
+    } else if (sscanf(buf, "Private_Clean: %ld kB", &v) == 1) {
+      uss_kb += v;
+    } else if (sscanf(buf, "Private_Dirty: %ld kB", &v) == 1) {
+      uss_kb += v;
+    } else if (sscanf(buf, "Private_Hugetlb: %ld kB", &v) == 1) {
+      uss_kb += v;
+    } else if (sscanf(buf, "Private_Shmem: %ld kB", &v) == 1) {
+      uss_kb += v;
+    }
+  }
+  *pss_kb_out = pss_kb;
+  *uss_kb_out = uss_kb;
+}
+
+bool
+proc_read_stat_fields(pid_t pid, struct proc_stat_fields *out)
+{
+  char path[MAX_PROC_PATH_LENGTH];
+  char line[MAX_PROC_LINE_LENGTH];
+  FILE *f;
+  bool ok;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  f = procfs_fopen(path, "r");
+  if (!f) {
+    return false;
+  }
+  ok = fgets(line, sizeof(line), f) && proc_parse_stat_fields(line, out);
+  fclose(f);
+
+  return ok;
+}
+
+/* Reset a monitor baseline to "no process" */
+static void
+reset_baseline(struct proc_cpu_baseline *baseline)
+{
+  memset(baseline, 0, sizeof(*baseline));
+}
+
 /* Read CPU and memory usage for a named process.
  *
  * - Matches the first /proc/<pid>/comm equal to proc_name.
+ * - The process is then tracked by (pid, starttime), so a tick reads only
+ *   /proc/<pid>/stat (plus smaps_rollup when enabled). The comm in that line
+ *   must still equal proc_name, otherwise /proc is scanned again.
  * - CPU usage is computed from utime + stime deltas over monotonic time.
- * - Memory usage is reported as VmRSS in kB.
+ * - Memory usage is reported as the stat RSS (VmRSS) in kB.
  *
  * Returns true on success, false if the process was not found or data
  * could not be read. On failure, outputs are set to 0.
  */
 bool
 proc_read_process_stats(const char *proc_name,
-                        struct per_session_data *pss,
+                        struct proc_cpu_baseline *baseline,
                         uint64_t now_mono_ms,
                         double *cpu_out,
                         long *rss_kb_out,
@@ -242,7 +327,6 @@ proc_read_process_stats(const char *proc_name,
 {
   pid_t pid = -1;
   char path[MAX_PROC_PATH_LENGTH];
-  char buf[MAX_PROC_LINE_LENGTH];
 
   unsigned long long utime = 0;
   unsigned long long stime = 0;
@@ -250,7 +334,7 @@ proc_read_process_stats(const char *proc_name,
 
   const long clk_tck = sysconf(_SC_CLK_TCK);
 
-  if (!proc_name || !pss || !cpu_out || !rss_kb_out || !pss_kb_out || !uss_kb_out || clk_tck <= 0) {
+  if (!proc_name || !baseline || !cpu_out || !rss_kb_out || !pss_kb_out || !uss_kb_out || clk_tck <= 0) {
     return false;
   }
 
@@ -262,78 +346,49 @@ proc_read_process_stats(const char *proc_name,
   *pss_kb_out = 0;
   *uss_kb_out = 0;
 
-  /* Find PID by scanning /proc */
-  if (pss->proc_pid == 0) {
-    pss->proc_pid = find_pid_by_comm(proc_name);
-  } else {
-    /* Guard against Linux PID reuse */
-    if (!pid_matches_comm(pss->proc_pid, proc_name)) {
-      pss->proc_pid = 0;
-      pss->prev_proc_utime = 0;
-      pss->prev_proc_stime = 0;
-      pss->prev_proc_sample_mono_ms = 0;
-      pss->proc_pid = find_pid_by_comm(proc_name);
+  /* Read /proc/<pid>/stat of the tracked process, (re)scanning /proc by name
+   * when there is none or its identity changed. Two attempts: a vanished or
+   * reused PID is followed by one rescan in the same tick.
+   */
+  struct proc_stat_fields st;
+  bool have_stat = false;
+  for (int attempt = 0; attempt < 2 && !have_stat; attempt++) {
+    if (baseline->pid == 0) {
+      reset_baseline(baseline);
+      baseline->pid = find_pid_by_comm(proc_name);
+      if (baseline->pid <= 0) {
+        break;
+      }
     }
-  }
-  pid = pss->proc_pid;
+    pid = baseline->pid;
 
-  if (pid_out) {
-    *pid_out = pid;
-  }
+    bool ok = proc_read_stat_fields(pid, &st);
 
-  if (pid <= 0) {
-    /* Process not found */
-    if (pid_out) {
-      *pid_out = 0;
+    /* Gone, malformed, the PID now belongs to another process (PID reuse),
+     * or the process changed its name (exec, PR_SET_NAME)
+     */
+    if (!ok || (baseline->starttime != 0 && st.starttime != baseline->starttime) ||
+        strcmp(st.comm, proc_name) != 0) {
+      proc_identity_forget(pid);
+      baseline->pid = 0;
+      continue;
     }
-    pss->prev_proc_utime = 0;
-    pss->prev_proc_stime = 0;
-    pss->prev_proc_sample_mono_ms = 0;
-    pss->proc_pid = 0;
-    return false;
+    baseline->starttime = st.starttime;
+    have_stat = true;
   }
-  /* Read /proc/<pid>/stat */
-  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-  FILE *statf = fopen(path, "r");
-  if (!statf) {
-    pss->proc_pid = 0;
-    pss->prev_proc_utime = 0;
-    pss->prev_proc_stime = 0;
-    pss->prev_proc_sample_mono_ms = 0;
-    return false;
-  }
-
-  char line[MAX_PROC_LINE_LENGTH];
 
-  if (!fgets(line, sizeof(line), statf)) {
-    fclose(statf);
-    return false;
-  }
-  fclose(statf);
-
-  if (!parse_proc_stat_times(line, &utime, &stime)) {
-    /* Malformed or unexpected /proc/<pid>/stat
-     * Reset baseline to avoid bogus deltas
-     */
-    pss->prev_proc_utime = 0;
-    pss->prev_proc_stime = 0;
-    pss->prev_proc_sample_mono_ms = 0;
-    pss->proc_pid = 0;
+  if (!have_stat) {
+    /* Process not found */
+    reset_baseline(baseline);
     return false;
   }
-
-  /* Read VmRSS from /proc/<pid>/status */
-  snprintf(path, sizeof(path), "/proc/%d/status", pid);
-  FILE *statusf = fopen(path, "r");
-  if (statusf) {
-    /* Scan /proc/<pid>/status for the VmRSS field to obtain the memory usage */
-    while (fgets(buf, sizeof(buf), statusf)) {
-      if (sscanf(buf, "VmRSS: %ld kB", &rss_kb) == 1) {
-        break;
-      }
-    }
-    fclose(statusf);
+  if (pid_out) {
+    *pid_out = pid;
   }
+  utime = st.utime;
+  stime = st.stime;
+  /* RSS in pages, the same value /proc/<pid>/status reports as VmRSS */
+  rss_kb = st.rss_pages * (sysconf(_SC_PAGESIZE) / 1024);
 
   long pss_kb = 0;
   long uss_kb = 0;
@@ -353,33 +408,20 @@ proc_read_process_stats(const char *proc_name,
    *
    * NOTE:
    * - smaps_rollup may be unavailable on older kernels or restricted by permissions.
-   *   In that case, pss_kb and uss_kb remain 0 and RSS from /proc/<pid>/status is used.
+   *   In that case, pss_kb and uss_kb remain 0 and only RSS is reported.
    */
   snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
-  FILE *smaps = fopen(path, "r");
+  FILE *smaps = smaps_enabled ? procfs_fopen(path, "r") : NULL;
   if (smaps) {
-    while (fgets(buf, sizeof(buf), smaps)) {
-      long v;
-      if (sscanf(buf, "Pss: %ld kB", &v) == 1) {
-        pss_kb = v;
-      } else if (sscanf(buf, "Private_Clean: %ld kB", &v) == 1) {
-        uss_kb += v;
-      } else if (sscanf(buf, "Private_Dirty: %ld kB", &v) == 1) {
-        uss_kb += v;
-      } else if (sscanf(buf, "Private_Hugetlb: %ld kB", &v) == 1) {
-        uss_kb += v;
-      } else if (sscanf(buf, "Private_Shmem: %ld kB", &v) == 1) {
-        uss_kb += v;
-      }
-    }
+    proc_parse_smaps_rollup(smaps, &pss_kb, &uss_kb);
     fclose(smaps);
   }
 
   /* First sample: establish baseline */
-  if (pss->prev_proc_sample_mono_ms == 0) {
-    pss->prev_proc_utime = utime;
-    pss->prev_proc_stime = stime;
-    pss->prev_proc_sample_mono_ms = now_mono_ms;
+  if (baseline->prev_sample_mono_ms == 0) {
+    baseline->prev_utime = utime;
+    baseline->prev_stime = stime;
+    baseline->prev_sample_mono_ms = now_mono_ms;
     *rss_kb_out = rss_kb;
     *pss_kb_out = pss_kb;
     *uss_kb_out = uss_kb;
@@ -387,14 +429,14 @@ proc_read_process_stats(const char *proc_name,
   }
 
   /* Compute deltas */
-  unsigned long long prev_total = pss->prev_proc_utime + pss->prev_proc_stime;
+  unsigned long long prev_total = baseline->prev_utime + baseline->prev_stime;
   unsigned long long curr_total = utime + stime;
 
-  if (curr_total < prev_total || now_mono_ms <= pss->prev_proc_sample_mono_ms) {
+  if (curr_total < prev_total || now_mono_ms <= baseline->prev_sample_mono_ms) {
     /* Process restarted or clock anomaly */
-    pss->prev_proc_utime = utime;
-    pss->prev_proc_stime = stime;
-    pss->prev_proc_sample_mono_ms = now_mono_ms;
+    baseline->prev_utime = utime;
+    baseline->prev_stime = stime;
+    baseline->prev_sample_mono_ms = now_mono_ms;
     *rss_kb_out = rss_kb;
     *pss_kb_out = pss_kb;
     *uss_kb_out = uss_kb;
@@ -403,7 +445,7 @@ proc_read_process_stats(const char *proc_name,
 
   /* Compute CPU time delta (in jiffies) and elapsed wall time (in seconds) since last sample */
   unsigned long long delta_jiffies = curr_total - prev_total;
-  double delta_seconds = (double)(now_mono_ms - pss->prev_proc_sample_mono_ms) / 1000.0;
+  double delta_seconds = (double)(now_mono_ms - baseline->prev_sample_mono_ms) / 1000.0;
 
   /* Convert jiffy delta to CPU usage percentage over the sampling interval */
   if (delta_seconds > 0.0) {
@@ -413,13 +455,13 @@ proc_read_process_stats(const char *proc_name,
      * - 100% means all CPUs fully utilized
      * - Matches top(1) default behavior
      */
-    *cpu_out = ((double)delta_jiffies / (double)clk_tck / delta_seconds * 100.0) / (double)cpu_core_count;
+    *cpu_out = ((double)delta_jiffies / (double)clk_tck / delta_seconds * 100.0) / (double)cpu_topology_online_count();
   }
 
   /* Return memory metrics to the caller:
    *
    * - rss_kb_out:
-   *     Resident Set Size from /proc/<pid>/status (VmRSS).
+   *     Resident Set Size from /proc/<pid>/stat (equal to VmRSS).
    *     This is how large the process appears in RAM, counting all shared pages in full.
    *
    * - pss_kb_out:
@@ -436,9 +478,9 @@ proc_read_process_stats(const char *proc_name,
   *uss_kb_out = uss_kb;
 
   /* Update baselines */
-  pss->prev_proc_utime = utime;
-  pss->prev_proc_stime = stime;
-  pss->prev_proc_sample_mono_ms = now_mono_ms;
+  baseline->prev_utime = utime;
+  baseline->prev_stime = stime;
+  baseline->prev_sample_mono_ms = now_mono_ms;
 
   return true;
 }
@@ -480,7 +522,7 @@ proc_collect_process_list(char names[][MAX_PROC_NAME_LENGTH], size_t max_names)
   char buf[MAX_PROC_LINE_LENGTH];
 
   /* Open /proc to iterate over all running processes, return empty result on failure */
-  proc_dir = opendir("/proc");
+  proc_dir = procfs_opendir("/proc");
   if (!proc_dir) {
     return 0;
   }
@@ -505,7 +547,7 @@ proc_collect_process_list(char names[][MAX_PROC_NAME_LENGTH], size_t max_names)
      * skip entries that disappear or cannot be opened
      */
     snprintf(path, sizeof(path), "/proc/%ld/comm", pid);
-    FILE *f = fopen(path, "r");
+    FILE *f = procfs_fopen(path, "r");
     if (!f) {
       continue;
     }
@@ -551,3 +593,15 @@ proc_collect_process_list(char names[][MAX_PROC_NAME_LENGTH], size_t max_names)
 
   return count;
 }
+
+void
+proc_set_smaps_enabled(bool enabled)
+{
+  smaps_enabled = enabled;
+}
+
+bool
+proc_get_smaps_enabled(void)
+{
+  return smaps_enabled;
+}
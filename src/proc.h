@@ -2,10 +2,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <sys/types.h>
 
-struct per_session_data;
-
 /* Maximum process name length accepted from clients (stored as NUL-terminated string).
  *
  * This is compared against /proc/<pid>/comm, which is typically limited (e.g. 16 chars),
@@ -33,28 +32,101 @@ struct per_session_data;
  */
 #define MAX_PROC_PATH_LENGTH 256
 
-/* Cache the number of online CPUs once.
+/* Read the online CPU set and cluster layout (see cpu_topology.h).
  *
- * The value is constant for the lifetime of the process on typical
- * embedded systems, so caching avoids repeated sysconf() calls.
- * Fallback to 1 ensures safe division if sysconf() fails.
+ * Called once at startup; the sampler refreshes it on CPU hotplug, so no
+ * sysfs read happens per tick. Falls back to sysconf() and then 1 CPU.
  */
 void proc_init_cpu_count(void);
 
-/* Return CPU core count. */
+/* Return the number of online CPU cores (at least 1). */
 long proc_get_cpu_core_count(void);
 
+/* Parse utime and stime from one /proc/<pid>/stat line.
+ *
+ * The comm field may contain spaces and ')', so the parser locates the
+ * closing ") <state> " sequence before scanning the numeric fields.
+ *
+ * Returns true on success.
+ */
+bool proc_parse_stat_times(const char *line, unsigned long long *utime_out, unsigned long long *stime_out);
+
+/* Fields of one /proc/<pid>/stat line used by the process monitor */
+struct proc_stat_fields {
+  /* Command name (comm, field 2), as /proc/<pid>/comm reports it */
+  char comm[MAX_PROC_NAME_LENGTH];
+  char state;
+  unsigned long long utime;
+  unsigned long long stime;
+  /* Start time in clock ticks since boot; with the PID it identifies a process */
+  unsigned long long starttime;
+  long rss_pages;
+};
+
+/* Parse comm, state, utime, stime, starttime and rss from one /proc/<pid>/stat line.
+ *
+ * Returns true on success.
+ */
+bool proc_parse_stat_fields(const char *line, struct proc_stat_fields *out);
+
+/* Read and parse /proc/<pid>/stat. Returns false if the process is gone. */
+bool proc_read_stat_fields(pid_t pid, struct proc_stat_fields *out);
+
+/* Find up to max_pids PIDs whose /proc/<pid>/comm equals proc_name
+ * (kernel threads excluded). Returns the number found.
+ */
+size_t proc_find_pids_by_comm(const char *proc_name, pid_t *pids, size_t max_pids);
+
+/* Parse PSS and USS totals from an open /proc/<pid>/smaps_rollup stream.
+ *
+ * USS is the sum of all "Private_*" categories in kB. Both outputs are set
+ * to 0 first, so a stream without the expected keys reads as 0.
+ */
+void proc_parse_smaps_rollup(FILE *f, long *pss_kb_out, long *uss_kb_out);
+
+/* CPU baseline of one monitored process.
+ *
+ * Holds the tracked (pid, starttime) and the previous utime/stime sample, so
+ * each monitor (a session or a channel) computes its own CPU deltas. All
+ * zero = no baseline.
+ */
+struct proc_cpu_baseline {
+  pid_t pid;
+  unsigned long long starttime;
+  unsigned long long prev_utime;
+  unsigned long long prev_stime;
+  uint64_t prev_sample_mono_ms;
+};
+
+/* Values of one monitored process read for one sample.
+ *
+ * valid is false until the first read after monitoring (re)started.
+ */
+struct proc_sample {
+  bool valid;
+  bool found;
+  double cpu;
+  long rss_kb;
+  long pss_kb;
+  long uss_kb;
+  pid_t pid;
+};
+
 /* Read CPU and memory usage for a named process.
  *
  * - Matches the first /proc/<pid>/comm equal to proc_name.
  * - CPU usage is computed from utime + stime deltas over monotonic time.
  * - Memory usage is reported as VmRSS in kB.
+ * - baseline caches (pid, starttime) and is updated with the new CPU sample;
+ *   a tick reads /proc/<pid>/stat only (and smaps_rollup when enabled).
+ *   The identity is available from proc_identity_get(baseline->pid,
+ *   baseline->starttime).
  *
  * Returns true on success, false if the process was not found or data
  * could not be read. On failure, outputs are set to 0.
  */
 bool proc_read_process_stats(const char *proc_name,
-                             struct per_session_data *pss,
+                             struct proc_cpu_baseline *baseline,
                              uint64_t now_mono_ms,
                              double *cpu_out,
                              long *rss_kb_out,
@@ -62,6 +134,16 @@ bool proc_read_process_stats(const char *proc_name,
                              long *uss_kb_out,
                              pid_t *pid_out);
 
+/* Enable or disable reading /proc/<pid>/smaps_rollup (PSS/USS).
+ *
+ * smaps_rollup walks all mappings of the process in the kernel and is the
+ * most expensive per-sample read. While disabled, pss_kb and uss_kb read as 0.
+ */
+void proc_set_smaps_enabled(bool enabled);
+
+/* True while smaps_rollup is read */
+bool proc_get_smaps_enabled(void);
+
 /* Collect a unique list of running process names from /proc.
  *
  * Implementation details:
@@ -0,0 +1,227 @@
+/* proc_identity.c
+ *
+ * Process identity cache keyed by (pid, starttime).
+ *
+ * - comm is limited to 15 characters and says little about a process.
+ *   cmdline, exe, uid and cgroup identify it, but cost four more files.
+ *   They are read once per process lifetime. An exec() keeps pid and
+ *   starttime, so callers compare the comm of the stat line they read with
+ *   the cached one and forget the entry on a mismatch.
+ * - Monitors already read /proc/<pid>/stat every tick; its starttime field
+ *   detects PID reuse, so the per-tick cost stays one stat read.
+ * - Entries are dropped when a monitor sees the process exit or PID reuse,
+ *   and the least recently used one is evicted at MAX_PROC_IDENTITY_ENTRIES.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "proc.h"
+#include "proc_identity.h"
+#include "procfs.h"
+#include "stats.h"
+#include "util.h"
+
+/* pid (GINT_TO_POINTER) -> struct proc_identity * */
+static GHashTable *identities = NULL;
+
+/******************************************************************************/
+
+/* Read the first line of /proc/<pid>/<name> without the newline */
+static bool
+read_pid_line(pid_t pid, const char *name, char *buf, size_t buf_size)
+{
+  char path[MAX_PROC_PATH_LENGTH];
+  FILE *f;
+  bool ok;
+
+  snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+  f = procfs_fopen(path, "r");
+  if (!f) {
+    return false;
+  }
+  ok = fgets(buf, (int)buf_size, f) != NULL;
+  fclose(f);
+  if (ok) {
+    buf[strcspn(buf, "\n")] = '\0';
+  }
+
+  return ok;
+}
+
+/* cmdline is NUL-separated; join the arguments with spaces */
+static void
+read_cmdline(struct proc_identity *id)
+{
+  char path[MAX_PROC_PATH_LENGTH];
+  FILE *f;
+  size_t len;
+
+  snprintf(path, sizeof(path), "/proc/%d/cmdline", id->pid);
+  f = procfs_fopen(path, "r");
+  if (!f) {
+    return;
+  }
+  len = fread(id->cmdline, 1, sizeof(id->cmdline) - 1, f);
+  fclose(f);
+
+  while (len > 0 && id->cmdline[len - 1] == '\0') {
+    len--;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (id->cmdline[i] == '\0') {
+      id->cmdline[i] = ' ';
+    }
+  }
+  id->cmdline[len] = '\0';
+}
+
+static void
+read_exe(struct proc_identity *id)
+{
+  char rel[MAX_PROC_PATH_LENGTH];
+  char path[MAX_PROC_PATH_LENGTH];
+  ssize_t len;
+
+  snprintf(rel, sizeof(rel), "/proc/%d/exe", id->pid);
+  if (!procfs_build_path(path, sizeof(path), rel)) {
+    return;
+  }
+  len = readlink(path, id->exe, sizeof(id->exe) - 1);
+  id->exe[len > 0 ? len : 0] = '\0';
+}
+
+static void
+read_uid(struct proc_identity *id)
+{
+  char path[MAX_PROC_PATH_LENGTH];
+  char buf[MAX_PROC_LINE_LENGTH];
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/status", id->pid);
+  f = procfs_fopen(path, "r");
+  if (!f) {
+    return;
+  }
+  while (fgets(buf, sizeof(buf), f)) {
+    if (sscanf(buf, "Uid: %ld", &id->uid) == 1) {
+      break;
+    }
+  }
+  fclose(f);
+}
+
+/* Prefer the unified (v2) hierarchy "0::/path", else the first line */
+static void
+read_cgroup(struct proc_identity *id)
+{
+  char path[MAX_PROC_PATH_LENGTH];
+  char buf[MAX_PROC_LINE_LENGTH];
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/cgroup", id->pid);
+  f = procfs_fopen(path, "r");
+  if (!f) {
+    return;
+  }
+  while (fgets(buf, sizeof(buf), f)) {
+    /* hierarchy-ID:controllers:path */
+    char *cg = strchr(buf, ':');
+    cg = cg ? strchr(cg + 1, ':') : NULL;
+    if (!cg) {
+      continue;
+    }
+    cg[strcspn(cg, "\n")] = '\0';
+    if (id->cgroup[0] == '\0' || strncmp(buf, "0::", 3) == 0) {
+      snprintf(id->cgroup, sizeof(id->cgroup), "%s", cg + 1);
+    }
+    if (strncmp(buf, "0::", 3) == 0) {
+      break;
+    }
+  }
+  fclose(f);
+}
+
+static void
+evict_least_recently_used(void)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  gpointer oldest_key = NULL;
+  uint64_t oldest_ms = UINT64_MAX;
+
+  g_hash_table_iter_init(&iter, identities);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    const struct proc_identity *id = value;
+    if (id->last_used_mono_ms < oldest_ms) {
+      oldest_ms = id->last_used_mono_ms;
+      oldest_key = key;
+    }
+  }
+  if (oldest_key) {
+    g_hash_table_remove(identities, oldest_key);
+  }
+}
+
+/******************************************************************************/
+
+const struct proc_identity *
+proc_identity_get(pid_t pid, unsigned long long starttime)
+{
+  struct proc_identity *id;
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+  if (pid <= 0) {
+    return NULL;
+  }
+  if (!identities) {
+    identities = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  }
+
+  id = g_hash_table_lookup(identities, GINT_TO_POINTER(pid));
+  if (id && id->starttime == starttime) {
+    id->last_used_mono_ms = now_ms;
+    return id;
+  }
+
+  /* New process, or the PID now belongs to another one */
+  if (!id && g_hash_table_size(identities) >= MAX_PROC_IDENTITY_ENTRIES) {
+    evict_least_recently_used();
+  }
+  id = g_new0(struct proc_identity, 1);
+  id->pid = pid;
+  id->starttime = starttime;
+  id->uid = -1;
+  if (!read_pid_line(pid, "comm", id->comm, sizeof(id->comm))) {
+    g_free(id);
+    g_hash_table_remove(identities, GINT_TO_POINTER(pid));
+    return NULL;
+  }
+  read_cmdline(id);
+  read_exe(id);
+  read_uid(id);
+  read_cgroup(id);
+  id->last_used_mono_ms = now_ms;
+  g_hash_table_replace(identities, GINT_TO_POINTER(pid), id);
+
+  return id;
+}
+
+void
+proc_identity_forget(pid_t pid)
+{
+  if (identities && pid > 0) {
+    g_hash_table_remove(identities, GINT_TO_POINTER(pid));
+  }
+}
+
+unsigned int
+proc_identity_count(void)
+{
+  return identities ? g_hash_table_size(identities) : 0;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Maximum length of a cached command line (arguments joined by spaces) */
+#define MAX_PROC_CMDLINE_LENGTH 256
+
+/* Maximum length of a cached cgroup path */
+#define MAX_PROC_CGROUP_LENGTH 128
+
+/* Upper bound for cached processes; the least recently used entry is evicted */
+#define MAX_PROC_IDENTITY_ENTRIES 512
+
+/* Identity of one process instance.
+ *
+ * A PID alone is not an identity: PIDs are reused after a process exits.
+ * (pid, starttime) is, because starttime (field 22 of /proc/<pid>/stat,
+ * clock ticks since boot) differs between two processes with the same PID.
+ */
+struct proc_identity {
+  pid_t pid;
+  unsigned long long starttime;
+  /* /proc/<pid>/comm (at resolution time) */
+  char comm[16];
+  /* /proc/<pid>/cmdline, "" for kernel threads and zombies */
+  char cmdline[MAX_PROC_CMDLINE_LENGTH];
+  /* readlink(/proc/<pid>/exe), "" when not permitted */
+  char exe[256];
+  /* Real UID from /proc/<pid>/status, -1 when unknown */
+  long uid;
+  /* cgroup v2 path (or the first v1 hierarchy) from /proc/<pid>/cgroup */
+  char cgroup[MAX_PROC_CGROUP_LENGTH];
+  /* CLOCK_MONOTONIC of the last lookup in ms, for LRU eviction */
+  uint64_t last_used_mono_ms;
+};
+
+/* Return the identity of (pid, starttime), resolving it on first use.
+ *
+ * Resolution reads comm, cmdline, exe, status and cgroup once per process
+ * lifetime; later lookups cost no system call. An entry for the same PID
+ * with another starttime (PID reuse) is replaced. The pointer stays valid
+ * until the next call of any proc_identity function.
+ *
+ * Returns NULL if pid is not positive or the process is gone.
+ */
+const struct proc_identity *proc_identity_get(pid_t pid, unsigned long long starttime);
+
+/* Drop the entry of pid (the process exited). */
+void proc_identity_forget(pid_t pid);
+
+/* Number of cached entries */
+unsigned int proc_identity_count(void);
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+
+#include "procfs.h"
+#include "proc.h"
+#include "snapshot.h"
+
+/* Root prefix without trailing '/', empty for the real root */
+static char procfs_root[MAX_PROCFS_ROOT_LENGTH] = "";
+
+bool
+procfs_set_root(const char *root)
+{
+  size_t len;
+
+  if (!root || root[0] == '\0') {
+    procfs_root[0] = '\0';
+    return true;
+  }
+  if (root[0] != '/') {
+    return false;
+  }
+
+  /* Strip trailing slashes so "<root>" + "/proc/..." never doubles them */
+  len = strlen(root);
+  while (len > 0 && root[len - 1] == '/') {
+    len--;
+  }
+  if (len >= sizeof(procfs_root)) {
+    return false;
+  }
+  memcpy(procfs_root, root, len);
+  procfs_root[len] = '\0';
+
+  return true;
+}
+
+const char *
+procfs_get_root(void)
+{
+  return procfs_root[0] != '\0' ? procfs_root : "/";
+}
+
+bool
+procfs_build_path(char *out, size_t out_size, const char *path)
+{
+  int n;
+
+  if (!out || out_size == 0 || !path || path[0] != '/') {
+    return false;
+  }
+  n = snprintf(out, out_size, "%s%s", procfs_root, path);
+
+  return n >= 0 && (size_t)n < out_size;
+}
+
+FILE *
+procfs_fopen(const char *path, const char *mode)
+{
+  char full_path[MAX_PROC_PATH_LENGTH];
+  FILE *f = NULL;
+
+  if (!procfs_build_path(full_path, sizeof(full_path), path)) {
+    return NULL;
+  }
+  f = fopen(full_path, mode);
+
+  /* Capture the file (or its absence) into the current archive tick */
+  if (snapshot_recording()) {
+    return snapshot_record_file(path, f);
+  }
+
+  return f;
+}
+
+DIR *
+procfs_opendir(const char *path)
+{
+  char full_path[MAX_PROC_PATH_LENGTH];
+  DIR *d = NULL;
+
+  if (!procfs_build_path(full_path, sizeof(full_path), path)) {
+    return NULL;
+  }
+  d = opendir(full_path);
+
+  /* Capture the listing, so a replay sees the same PIDs as the recorded files */
+  if (snapshot_recording()) {
+    snapshot_record_dir(path, d);
+  }
+
+  return d;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <dirent.h>
+
+/* Maximum length of the configurable root prefix.
+ *
+ * Kept well below MAX_PROC_PATH_LENGTH so that prefixed paths such as
+ * "<root>/proc/123456/smaps_rollup" still fit the existing path buffers.
+ */
+#define MAX_PROCFS_ROOT_LENGTH 128
+
+/* Set the root prefix prepended to every system path read by this app.
+ *
+ * Applies to /proc, /sys, /etc and /var/log readers. NULL, "" and "/" all
+ * select the real root filesystem. A trailing '/' is ignored.
+ *
+ * Returns false if the prefix is too long or not absolute.
+ */
+bool procfs_set_root(const char *root);
+
+/* Return the current root prefix ("/" when unset). */
+const char *procfs_get_root(void);
+
+/* Write "<root><path>" to out. path must be absolute (e.g. "/proc/stat").
+ *
+ * Returns false if the result does not fit into out.
+ */
+bool procfs_build_path(char *out, size_t out_size, const char *path);
+
+/* fopen() a system file below the configured root.
+ *
+ * While snapshot recording is active the file is captured into the archive
+ * and a private in-memory copy is returned, so the caller parses exactly
+ * the recorded bytes. The returned stream is released with fclose().
+ */
+FILE *procfs_fopen(const char *path, const char *mode);
+
+/* opendir() a system directory below the configured root.
+ *
+ * While snapshot recording is active the listing is captured into the archive.
+ */
+DIR *procfs_opendir(const char *path);
@@ -0,0 +1,221 @@
+/* relay.c
+ *
+ * Relay mode: serve the stats stream of one upstream backend to many clients.
+ *
+ * - A single upstream connection subscribes with { "stats_stream": true },
+ *   so the relayed device sees one client however many viewers there are.
+ * - Each stats frame is copied once into a GBytes buffer with LWS_PRE bytes of
+ *   headroom and shared by reference with every subscribed session. A slow
+ *   session only holds the newest frame; older ones are released.
+ * - The frame is also parsed into app_state::stats, which replaces local
+ *   sampling: channels (other field sets and rates), alerts, summaries and
+ *   resume work on the relayed samples.
+ * - Upstream events ({ "event": ... }) are forwarded to all sessions.
+ */
+#include <string.h>
+#include <syslog.h>
+
+#include <jansson.h>
+
+#include "relay.h"
+#include "stats.h"
+#include "upstream.h"
+#include "util.h"
+#include "ws_server.h"
+
+static const char relay_subscribe_json[] = "{\"stats_stream\":true}";
+
+static struct {
+  bool enabled;
+  struct app_state *app;
+  struct upstream up;
+  /* Latest relayed frame: [LWS_PRE headroom | JSON payload] */
+  GBytes *latest;
+} relay;
+
+/******************************************************************************/
+
+/* Fill stats from one upstream stats frame; false for other messages */
+static bool
+parse_stats_frame(json_t *root, struct sys_stats *stats)
+{
+  json_t *mem_total = json_object_get(root, "mem_total_kb");
+  json_t *cores = json_object_get(root, "cpu_per_core");
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  size_t i;
+  json_t *v;
+
+  if (!json_is_integer(mem_total) || json_object_get(root, "ch")) {
+    return false;
+  }
+
+  stats->cpu_usage = json_number_value(json_object_get(root, "cpu"));
+  stats->cpu_per_core_count = 0;
+  json_array_foreach (cores, i, v) {
+    if (i >= MAX_CPU_CORE_SAMPLES) {
+      break;
+    }
+    stats->cpu_per_core_usage[i] = json_number_value(v);
+    stats->cpu_per_core_count = i + 1;
+  }
+  stats->mem_total_kb = (long)json_integer_value(mem_total);
+  stats->mem_available_kb = (long)json_integer_value(json_object_get(root, "mem_available_kb"));
+  stats->uptime_s = json_number_value(json_object_get(root, "uptime_s"));
+  stats->load1 = json_number_value(json_object_get(root, "load1"));
+  stats->load5 = json_number_value(json_object_get(root, "load5"));
+  stats->load15 = json_number_value(json_object_get(root, "load15"));
+  stats->timestamp_ms = (uint64_t)json_integer_value(json_object_get(root, "ts"));
+  /* The upstream monotonic clock means nothing here; time the sample by its arrival */
+  stats->delta_ms = stats->monotonic_ms != 0 && now_ms > stats->monotonic_ms ? now_ms - stats->monotonic_ms : 0;
+  stats->monotonic_ms = now_ms;
+  stats->seq = (uint64_t)json_integer_value(json_object_get(root, "seq"));
+
+  return true;
+}
+
+static void
+attach_frame(struct per_session_data *pss, void *user)
+{
+  GBytes *frame = user;
+
+  if (!pss->stats_stream_enabled || pss->evict_reason) {
+    return;
+  }
+
+  /* Coalesce: a session that has not sent the previous frame skips it */
+  if (pss->relay_frame) {
+    g_bytes_unref(pss->relay_frame);
+  }
+  pss->relay_frame = g_bytes_ref(frame);
+  ws_server_request_stats_frame(pss);
+}
+
+static void
+relay_message(struct upstream *up, const unsigned char *msg, size_t len, void *user)
+{
+  json_t *root = json_loadb((const char *)msg, len, 0, NULL);
+  (void)up;
+  (void)user;
+
+  if (!root) {
+    return;
+  }
+
+  if (json_object_get(root, "event")) {
+    ws_server_broadcast_json((const char *)msg, len);
+  } else if (relay.app && parse_stats_frame(root, &relay.app->stats)) {
+    unsigned char *buf = g_malloc(LWS_PRE + len);
+
+    memcpy(&buf[LWS_PRE], msg, len);
+    if (relay.latest) {
+      g_bytes_unref(relay.latest);
+    }
+    relay.latest = g_bytes_new_take(buf, LWS_PRE + len);
+    ws_server_foreach_session(attach_frame, relay.latest);
+    ws_server_ingest_sample();
+  }
+
+  json_decref(root);
+}
+
+static void
+relay_state(struct upstream *up, void *user)
+{
+  (void)user;
+
+  if (up->state == UPSTREAM_CONNECTED) {
+    upstream_send(up, relay_subscribe_json, sizeof(relay_subscribe_json) - 1);
+  }
+}
+
+/******************************************************************************/
+
+bool
+relay_start(struct app_state *app, const char *address)
+{
+  char host[MAX_UPSTREAM_HOST_LENGTH];
+  int port = 0;
+
+  if (relay.enabled) {
+    return true;
+  }
+  if (!app || !upstream_parse_address(address, host, sizeof(host), &port)) {
+    syslog(LOG_ERR, "Invalid relay upstream address: %s", address ? address : "(null)");
+    return false;
+  }
+
+  relay.app = app;
+  relay.enabled = true;
+  upstream_add(&relay.up, host, port, relay_message, relay_state, NULL);
+  syslog(LOG_INFO, "Relay mode: serving the stats stream of %s:%d", host, port);
+
+  return true;
+}
+
+void
+relay_stop(void)
+{
+  if (!relay.enabled) {
+    return;
+  }
+
+  upstream_remove(&relay.up);
+  if (relay.latest) {
+    g_bytes_unref(relay.latest);
+    relay.latest = NULL;
+  }
+  relay.app = NULL;
+  relay.enabled = false;
+}
+
+bool
+relay_enabled(void)
+{
+  return relay.enabled;
+}
+
+void
+relay_attach_latest(struct per_session_data *pss)
+{
+  if (pss && relay.latest) {
+    attach_frame(pss, relay.latest);
+  }
+}
+
+size_t
+relay_write_frame(struct lws *wsi, struct per_session_data *pss)
+{
+  gsize size = 0;
+  unsigned char *buf;
+  size_t len;
+
+  if (!pss || !pss->relay_frame) {
+    return 0;
+  }
+
+  /* lws writes the frame header into the LWS_PRE headroom. The header is the
+   * same for every session (same length, unmasked server frame) and writes
+   * are sequential on the main loop, so the buffer can be shared.
+   */
+  buf = (unsigned char *)g_bytes_get_data(pss->relay_frame, &size);
+  len = size - LWS_PRE;
+  int written = lws_write(wsi, &buf[LWS_PRE], len, LWS_WRITE_TEXT);
+  g_bytes_unref(pss->relay_frame);
+  pss->relay_frame = NULL;
+
+  if (written < 0 || (size_t)written != len) {
+    syslog(LOG_WARNING, "Relayed frame write failed: %d of %zu", written, len);
+    return 0;
+  }
+
+  return len;
+}
+
+void
+relay_session_closed(struct per_session_data *pss)
+{
+  if (pss && pss->relay_frame) {
+    g_bytes_unref(pss->relay_frame);
+    pss->relay_frame = NULL;
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <glib.h>
+#include <libwebsockets.h>
+
+#include "app_state.h"
+#include "session.h"
+
+/* Relay (fan-out proxy) mode.
+ *
+ * The backend subscribes once to another backend (address "host[:port]")
+ * and serves its stats frames, byte for byte, to every local stats_stream
+ * subscriber. Each frame is held once as a reference-counted buffer (GBytes
+ * with LWS_PRE headroom) shared by all sessions; nothing is re-encoded.
+ * The upstream samples also replace local sampling, so channels, alerts,
+ * summaries and resume are derived locally from the relayed data.
+ * Returns false if the address is invalid.
+ */
+bool relay_start(struct app_state *app, const char *address);
+
+/* Disconnect from the upstream and release the latest frame. */
+void relay_stop(void);
+
+/* True while relay mode is enabled */
+bool relay_enabled(void);
+
+/* Hand the latest relayed frame to a session that just subscribed. */
+void relay_attach_latest(struct per_session_data *pss);
+
+/* Write the session's pending relayed frame.
+ *
+ * Returns the number of payload bytes written, 0 if there was no frame or
+ * the write failed.
+ */
+size_t relay_write_frame(struct lws *wsi, struct per_session_data *pss);
+
+/* Drop the session's pending frame reference (unsubscribe, disconnect). */
+void relay_session_closed(struct per_session_data *pss);
@@ -0,0 +1,213 @@
+/* resume.c
+ *
+ * Resume-after-reconnect support.
+ *
+ * - Every session gets a random token, announced with
+ *     { "session": { "token": "...", "resume_ms": 60000 } }
+ * - On disconnect its subscriptions (stats_stream, monitor, log_stream) are
+ *   kept for RESUME_WINDOW_MS in a small fixed table.
+ * - Regular samples are kept in a ring so missed stats frames can be rebuilt
+ *   from their sample sequence numbers; log lines have their own ring in
+ *   log_stream.c.
+ * - While a detached session exists the sampler keeps running, so the rings
+ *   cover the whole disconnect.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include <syslog.h>
+
+#include <glib.h>
+
+#include "log_stream.h"
+#include "resume.h"
+#include "session.h"
+#include "util.h"
+#include "ws_limits.h"
+
+/* One detached session per connection slot is enough for one reconnect each */
+#define RESUME_MAX_DETACHED MAX_WS_CONNECTED_CLIENTS
+
+static struct resume_state detached[RESUME_MAX_DETACHED];
+static struct sys_stats stats_ring[RESUME_STATS_RING_SIZE];
+static size_t stats_ring_next = 0;
+static size_t stats_ring_count = 0;
+
+/******************************************************************************/
+
+static void
+expire_detached(uint64_t now_mono_ms)
+{
+  bool log_released = false;
+
+  for (size_t i = 0; i < RESUME_MAX_DETACHED; i++) {
+    if (detached[i].token[0] != '\0' && now_mono_ms >= detached[i].expire_mono_ms) {
+      syslog(LOG_INFO, "Resume window expired for a disconnected client");
+      log_released |= detached[i].log_stream;
+      memset(&detached[i], 0, sizeof(detached[i]));
+    }
+  }
+
+  /* The log monitor may have been kept running only for this session */
+  if (log_released) {
+    log_stream_check_idle();
+  }
+}
+
+bool
+resume_assign_token(struct per_session_data *pss)
+{
+  unsigned char bytes[RESUME_TOKEN_LENGTH / 2];
+  size_t filled = 0;
+
+  if (!pss) {
+    return false;
+  }
+  pss->resume_token[0] = '\0';
+
+  /* The token is the only credential for taking over a session: use the
+   * kernel CSPRNG, not the predictable GLib generator
+   */
+  while (filled < sizeof(bytes)) {
+    ssize_t n = getrandom(&bytes[filled], sizeof(bytes) - filled, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      syslog(LOG_WARNING, "Resume token not assigned: getrandom: %s", strerror(errno));
+      return false;
+    }
+    filled += (size_t)n;
+  }
+
+  for (size_t i = 0; i < sizeof(bytes); i++) {
+    snprintf(&pss->resume_token[i * 2], 3, "%02x", bytes[i]);
+  }
+  return true;
+}
+
+void
+resume_detach(struct per_session_data *pss, bool log_stream)
+{
+  struct resume_state *slot = NULL;
+  uint64_t now_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+  if (!pss || pss->resume_token[0] == '\0' || (!pss->stats_stream_enabled && !pss->proc_enabled && !log_stream)) {
+    return;
+  }
+
+  expire_detached(now_mono_ms);
+  /* Reuse a free slot, or the one closest to expiry */
+  for (size_t i = 0; i < RESUME_MAX_DETACHED; i++) {
+    if (detached[i].token[0] == '\0') {
+      slot = &detached[i];
+      break;
+    }
+    if (!slot || detached[i].expire_mono_ms < slot->expire_mono_ms) {
+      slot = &detached[i];
+    }
+  }
+
+  memset(slot, 0, sizeof(*slot));
+  memcpy(slot->token, pss->resume_token, sizeof(slot->token));
+  slot->expire_mono_ms = now_mono_ms + RESUME_WINDOW_MS;
+  slot->stats_stream = pss->stats_stream_enabled;
+  slot->log_stream = log_stream;
+  slot->proc_enabled = pss->proc_enabled;
+  memcpy(slot->proc_name, pss->proc_name, sizeof(slot->proc_name));
+}
+
+bool
+resume_take(const char *token, struct resume_state *out)
+{
+  if (!token || strlen(token) != RESUME_TOKEN_LENGTH) {
+    return false;
+  }
+
+  expire_detached(util_get_time_ms(CLOCK_MONOTONIC));
+  for (size_t i = 0; i < RESUME_MAX_DETACHED; i++) {
+    if (detached[i].token[0] != '\0' && strcmp(detached[i].token, token) == 0) {
+      *out = detached[i];
+      memset(&detached[i], 0, sizeof(detached[i]));
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+resume_pending(void)
+{
+  for (size_t i = 0; i < RESUME_MAX_DETACHED; i++) {
+    if (detached[i].token[0] != '\0') {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool
+resume_pending_log(void)
+{
+  for (size_t i = 0; i < RESUME_MAX_DETACHED; i++) {
+    if (detached[i].token[0] != '\0' && detached[i].log_stream) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/******************************************************************************/
+
+void
+resume_record_sample(const struct sys_stats *stats)
+{
+  if (!stats) {
+    return;
+  }
+
+  stats_ring[stats_ring_next] = *stats;
+  stats_ring_next = (stats_ring_next + 1) % RESUME_STATS_RING_SIZE;
+  if (stats_ring_count < RESUME_STATS_RING_SIZE) {
+    stats_ring_count++;
+  }
+
+  expire_detached(stats->monotonic_ms);
+}
+
+size_t
+resume_samples_since(uint64_t after_seq, const struct sys_stats **out, size_t max, bool *gap)
+{
+  size_t n = 0;
+  size_t oldest = (stats_ring_next + RESUME_STATS_RING_SIZE - stats_ring_count) % RESUME_STATS_RING_SIZE;
+
+  if (gap) {
+    *gap = false;
+  }
+
+  for (size_t i = 0; i < stats_ring_count && n < max; i++) {
+    const struct sys_stats *s = &stats_ring[(oldest + i) % RESUME_STATS_RING_SIZE];
+    if (s->seq <= after_seq) {
+      continue;
+    }
+    /* The first newer sample must directly follow after_seq, otherwise some were lost */
+    if (n == 0 && gap && s->seq > after_seq + 1 && i == 0) {
+      *gap = true;
+    }
+    out[n++] = s;
+  }
+
+  return n;
+}
+
+void
+resume_stop(void)
+{
+  memset(detached, 0, sizeof(detached));
+  stats_ring_next = 0;
+  stats_ring_count = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proc.h"
+#include "stats.h"
+
+struct per_session_data;
+
+/* Length of a resume token in hex characters (128 bits) */
+#define RESUME_TOKEN_LENGTH 32
+
+/* How long a disconnected session can be resumed */
+#define RESUME_WINDOW_MS 60000
+
+/* Stats samples kept for replay (RESUME_WINDOW_MS at the 500 ms sample rate) */
+#define RESUME_STATS_RING_SIZE 120
+
+/* Subscriptions of a disconnected session, restored by a resume request */
+struct resume_state {
+  char token[RESUME_TOKEN_LENGTH + 1];
+  uint64_t expire_mono_ms;
+  bool stats_stream;
+  bool log_stream;
+  bool proc_enabled;
+  char proc_name[MAX_PROC_NAME_LENGTH];
+};
+
+/* Assign a fresh random resume token to a new session (pss->resume_token).
+ * Returns false, leaving the token empty (no resume), if no random bytes
+ * were available.
+ */
+bool resume_assign_token(struct per_session_data *pss);
+
+/* Remember the subscriptions of a closing session for RESUME_WINDOW_MS.
+ *
+ * Sessions without subscriptions are not kept.
+ */
+void resume_detach(struct per_session_data *pss, bool log_stream);
+
+/* Look up and consume the state stored for token.
+ *
+ * Returns false if the token is unknown or expired.
+ */
+bool resume_take(const char *token, struct resume_state *out);
+
+/* True while at least one detached session can still be resumed
+ * (the sampler keeps running so that its ring covers the gap).
+ */
+bool resume_pending(void);
+
+/* True while a detached session had a log subscription */
+bool resume_pending_log(void);
+
+/* Store one regular sample in the replay ring and expire old detached sessions. */
+void resume_record_sample(const struct sys_stats *stats);
+
+/* Collect ring samples with seq > after_seq, oldest first.
+ *
+ * *gap is set when samples newer than after_seq were already overwritten.
+ * Returns the number of entries written to out.
+ */
+size_t resume_samples_since(uint64_t after_seq, const struct sys_stats **out, size_t max, bool *gap);
+
+/* Release all stored state. */
+void resume_stop(void);
@@ -0,0 +1,44 @@
+#include "self_stats.h"
+
+/* Global latency histograms, updated from the GLib main loop thread only */
+static struct histogram global_sample_to_send;
+static struct histogram global_queue;
+
+void
+self_stats_record_stats_frame(struct per_session_data *pss, uint64_t sample_to_send_ms, uint64_t queue_ms)
+{
+  histogram_record(&global_sample_to_send, sample_to_send_ms);
+  histogram_record(&global_queue, queue_ms);
+  if (pss) {
+    histogram_record(&pss->sample_to_send_hist, sample_to_send_ms);
+    histogram_record(&pss->queue_hist, queue_ms);
+  }
+}
+
+void
+self_stats_record_queued_message(struct per_session_data *pss, uint64_t queue_ms)
+{
+  histogram_record(&global_queue, queue_ms);
+  if (pss) {
+    histogram_record(&pss->queue_hist, queue_ms);
+  }
+}
+
+const struct histogram *
+self_stats_get_sample_to_send(void)
+{
+  return &global_sample_to_send;
+}
+
+const struct histogram *
+self_stats_get_queue(void)
+{
+  return &global_queue;
+}
+
+void
+self_stats_reset(void)
+{
+  histogram_reset(&global_sample_to_send);
+  histogram_reset(&global_queue);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "histogram.h"
+#include "session.h"
+
+/* Server self-observability counters.
+ *
+ * Latency histograms (milliseconds) are kept per session (in
+ * per_session_data) and globally (here):
+ * - sample_to_send: stats frame send time minus its sample time
+ *   (sys_stats::monotonic_ms), i.e. how old a snapshot is when it is written.
+ * - queue: time between requesting a writable callback for a frame and
+ *   actually writing it (stats frames and queued one-shot/log messages).
+ */
+
+/* Record one written stats frame. */
+void self_stats_record_stats_frame(struct per_session_data *pss, uint64_t sample_to_send_ms, uint64_t queue_ms);
+
+/* Record one written queued message (one-shot response or log line). */
+void self_stats_record_queued_message(struct per_session_data *pss, uint64_t queue_ms);
+
+/* Global histograms across all sessions since startup */
+const struct histogram *self_stats_get_sample_to_send(void);
+const struct histogram *self_stats_get_queue(void);
+
+/* Clear the global histograms. */
+void self_stats_reset(void);
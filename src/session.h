@@ -6,16 +6,24 @@
 #include <glib.h>
 #include <libwebsockets.h>
 
+#include "anomaly.h"
+#include "histogram.h"
 #include "proc.h"
+#include "resume.h"
 #include "ws_limits.h"
 
 /* Outgoing message queued for delivery from LWS_CALLBACK_SERVER_WRITEABLE.
  *
  * - buf[] is allocated with LWS_PRE bytes of headroom before the payload.
  * - len is the payload length (bytes after the LWS_PRE offset).
+ * - enqueue_mono_ms is the CLOCK_MONOTONIC time the message was queued.
+ * - bulk marks a large one-shot reply (a history window); a session has at
+ *   most one queued, see ws_server_bulk_reply_queued().
  */
 struct pending_ws_message {
   size_t len;
+  uint64_t enqueue_mono_ms;
+  bool bulk;
   unsigned char buf[]; /* layout: [LWS_PRE padding | payload] */
 };
 
@@ -35,9 +43,23 @@ struct per_session_data {
   /* Cached websocket handle used to schedule writable callbacks */
   struct lws *wsi;
 
+  /* True if this connection holds a slot reserved in FILTER_PROTOCOL_CONNECTION
+   * (a local one when local is set)
+   */
+  bool slot_reserved;
+
   /* True if this connection was counted toward ws_connected_client_count */
   bool counted;
 
+  /* True for clients of the local Unix-domain socket (own slot pool) */
+  bool local;
+
+  /* Monotonic time of the last client message (or of the connect) */
+  uint64_t last_activity_mono_ms;
+
+  /* Set when the server closes this session; the close follows the queued messages */
+  const char *evict_reason;
+
   /* Queue of one-shot JSON responses waiting for LWS_CALLBACK_SERVER_WRITEABLE */
   GQueue *pending_tx_queue;
 
@@ -54,11 +76,34 @@ struct per_session_data {
   char proc_name[MAX_PROC_NAME_LENGTH];
   bool proc_enabled;
 
-  /* Per-process CPU baseline */
-  unsigned long long prev_proc_utime;
-  unsigned long long prev_proc_stime;
-  uint64_t prev_proc_sample_mono_ms;
+  /* Per-process CPU baseline and cached PID (pid 0 = unknown / needs lookup) */
+  struct proc_cpu_baseline proc_baseline;
+
+  /* Monitored process as read for the latest sample, see process_sample() */
+  struct proc_sample proc_sample;
+
+  /* Anomaly baselines of the monitored process, see anomaly.h */
+  struct anomaly_detector proc_cpu_anomaly;
+  struct anomaly_detector proc_rss_anomaly;
+
+  /* Monotonic time the next stats frame was requested (0 = none pending) */
+  uint64_t stats_write_requested_mono_ms;
+
+  /* Per-session latency histograms, see self_stats.h */
+  struct histogram sample_to_send_hist;
+  struct histogram queue_hist;
+
+  /* Token announced to the client for resume-after-reconnect, see resume.h */
+  char resume_token[RESUME_TOKEN_LENGTH + 1];
+
+  /* Alert rules (struct alert_rule, see alerts.h), NULL when none */
+  GArray *alert_rules;
+
+  /* Open logical channels (struct ws_channel, see channel.h), NULL when none */
+  GArray *channels;
+  /* Index of the channel to serve first on the next writable callback */
+  guint channel_rr;
 
-  /* Cached PID of the monitored process (0 = unknown / needs lookup) */
-  pid_t proc_pid;
+  /* Relay mode: next relayed stats frame to write (shared, see relay.h), NULL when none */
+  GBytes *relay_frame;
 };
@@ -0,0 +1,183 @@
+/* shm_publish.c
+ *
+ * Shared-memory publication of the latest sample for local readers.
+ *
+ * - The segment is created with shm_open() and sized once; its layout
+ *   (shm_stats.h) is fixed, so a sample is published with plain stores.
+ * - Updates are guarded by a seqlock (odd "seq" while writing). The sampler
+ *   is the only writer, readers never block it and it never waits for them.
+ * - On stop the segment is flagged closed before it is unlinked, so readers
+ *   that still have it mapped can tell a stopped backend from a stalled one.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "shm_publish.h"
+#include "shm_stats.h"
+#include "util.h"
+
+G_STATIC_ASSERT(SHM_STATS_MAX_CORES == MAX_CPU_CORE_SAMPLES);
+
+static struct {
+  struct shm_stats_segment *segment;
+  char *name;
+} shm;
+
+/******************************************************************************/
+
+/* Seqlock write section: make seq odd before and even after the stores */
+static void
+write_begin(struct shm_stats_segment *seg)
+{
+  __atomic_store_n(&seg->seq, seg->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+write_end(struct shm_stats_segment *seg)
+{
+  __atomic_store_n(&seg->seq, seg->seq + 1, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************/
+
+bool
+shm_publish_start(const char *name)
+{
+  struct shm_stats_segment *seg;
+  int fd;
+
+  if (shm.segment) {
+    return true;
+  }
+  if (!name || name[0] != '/' || strchr(name + 1, '/')) {
+    syslog(LOG_ERR, "Invalid shared memory name: %s", name ? name : "(null)");
+    return false;
+  }
+
+  /* Readers only need read access; the mode is still subject to the umask */
+  fd = shm_open(name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  if (fd < 0) {
+    syslog(LOG_ERR, "Cannot create shared memory %s: %s", name, strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, (off_t)sizeof(*seg)) != 0) {
+    syslog(LOG_ERR, "Cannot size shared memory %s: %s", name, strerror(errno));
+    close(fd);
+    shm_unlink(name);
+    return false;
+  }
+  seg = mmap(NULL, sizeof(*seg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (seg == MAP_FAILED) {
+    syslog(LOG_ERR, "Cannot map shared memory %s: %s", name, strerror(errno));
+    shm_unlink(name);
+    return false;
+  }
+
+  /* A segment left by a previous run is reinitialized under the seqlock. A
+   * writer that died inside a write section left seq odd; round it up to even
+   * first, or the section below would end on an odd seq and readers would
+   * retry forever.
+   */
+  __atomic_store_n(&seg->seq, (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) + 1) & ~(uint64_t)1, __ATOMIC_RELAXED);
+  write_begin(seg);
+  seg->version_major = SHM_STATS_VERSION_MAJOR;
+  seg->version_minor = SHM_STATS_VERSION_MINOR;
+  seg->segment_size = (uint32_t)sizeof(*seg);
+  seg->sample_size = (uint32_t)sizeof(seg->sample);
+  seg->history_entry_size = (uint32_t)sizeof(seg->history[0]);
+  seg->history_length = SHM_STATS_HISTORY_LENGTH;
+  seg->writer_pid = (int32_t)getpid();
+  seg->writer_start_ms = util_get_time_ms(CLOCK_REALTIME);
+  seg->flags = 0;
+  seg->history_next = 0;
+  seg->history_count = 0;
+  seg->publish_mono_ms = 0;
+  memset(&seg->sample, 0, sizeof(seg->sample));
+  memset(seg->history, 0, sizeof(seg->history));
+  write_end(seg);
+  /* Readers validate the magic first, so it is set last */
+  __atomic_store_n(&seg->magic, SHM_STATS_MAGIC, __ATOMIC_RELEASE);
+
+  shm.segment = seg;
+  shm.name = g_strdup(name);
+  syslog(LOG_INFO, "Publishing stats in shared memory %s (%zu bytes)", name, sizeof(*seg));
+
+  return true;
+}
+
+void
+shm_publish_stop(void)
+{
+  if (!shm.segment) {
+    return;
+  }
+
+  write_begin(shm.segment);
+  shm.segment->flags |= SHM_STATS_FLAG_CLOSED;
+  write_end(shm.segment);
+
+  munmap(shm.segment, sizeof(*shm.segment));
+  shm_unlink(shm.name);
+  shm.segment = NULL;
+  g_free(shm.name);
+  shm.name = NULL;
+}
+
+bool
+shm_publish_enabled(void)
+{
+  return shm.segment != NULL;
+}
+
+void
+shm_publish_sample(const struct sys_stats *stats)
+{
+  struct shm_stats_segment *seg = shm.segment;
+  struct shm_stats_sample *s;
+  struct shm_stats_history_entry *h;
+
+  if (!seg || !stats) {
+    return;
+  }
+
+  write_begin(seg);
+
+  s = &seg->sample;
+  s->seq = stats->seq;
+  s->timestamp_ms = stats->timestamp_ms;
+  s->monotonic_ms = stats->monotonic_ms;
+  s->delta_ms = stats->delta_ms;
+  s->cpu_usage = stats->cpu_usage;
+  s->uptime_s = stats->uptime_s;
+  s->load1 = stats->load1;
+  s->load5 = stats->load5;
+  s->load15 = stats->load15;
+  s->mem_total_kb = stats->mem_total_kb;
+  s->mem_available_kb = stats->mem_available_kb;
+  s->cpu_core_count = (uint32_t)stats->cpu_per_core_count;
+  memcpy(s->cpu_per_core_usage, stats->cpu_per_core_usage, stats->cpu_per_core_count * sizeof(double));
+
+  h = &seg->history[seg->history_next];
+  h->seq = stats->seq;
+  h->timestamp_ms = stats->timestamp_ms;
+  h->monotonic_ms = stats->monotonic_ms;
+  h->cpu_usage = stats->cpu_usage;
+  h->load1 = stats->load1;
+  h->mem_available_kb = stats->mem_available_kb;
+  seg->history_next = (seg->history_next + 1) % SHM_STATS_HISTORY_LENGTH;
+  if (seg->history_count < SHM_STATS_HISTORY_LENGTH) {
+    seg->history_count++;
+  }
+  seg->publish_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+  write_end(seg);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "stats.h"
+
+/* Publish every sample into a POSIX shared-memory segment.
+ *
+ * name is an shm_open() object name ("/name"). The layout is described in
+ * shm_stats.h; local processes read it with shm_stats_reader.h without any
+ * system call per read. While enabled the sampler runs continuously, since
+ * the backend cannot see the readers. Returns false if the segment cannot
+ * be created.
+ */
+bool shm_publish_start(const char *name);
+
+/* Mark the segment closed, unmap and unlink it. Safe to call multiple times. */
+void shm_publish_stop(void);
+
+/* True while a segment is published */
+bool shm_publish_enabled(void);
+
+/* Write one sample and append it to the history ring. */
+void shm_publish_sample(const struct sys_stats *stats);
@@ -0,0 +1,96 @@
+#pragma once
+
+/* Shared-memory layout of the published system stats (see shm_publish.h).
+ *
+ * This header is the ABI between the backend and local readers. It only
+ * depends on the C library, so consumers can copy it together with
+ * shm_stats_reader.h into their own build.
+ *
+ * Versioning:
+ * - version_major changes when existing fields move or change meaning;
+ *   readers must reject a segment with another major version.
+ * - version_minor changes when fields are appended; older readers keep
+ *   working and use sample_size/history_entry_size to skip what they do not
+ *   know.
+ *
+ * Consistency:
+ * - The writer uses a seqlock: "seq" is odd while an update is in progress
+ *   and even otherwise. A reader copies the data between two loads of "seq"
+ *   and retries if they differ or are odd. Readers never write to the segment.
+ */
+#include <stdint.h>
+
+/* Default object name for shm_open() */
+#define SHM_STATS_DEFAULT_NAME "/widget_wizard_stats"
+
+#define SHM_STATS_MAGIC 0x54535757U /* "WWST" in little endian memory */
+#define SHM_STATS_VERSION_MAJOR 1
+#define SHM_STATS_VERSION_MINOR 0
+
+/* Per-core capacity of a sample, equal to MAX_CPU_CORE_SAMPLES in stats.h */
+#define SHM_STATS_MAX_CORES 128
+
+/* Number of compact samples kept in the history ring (60 s at 500 ms) */
+#define SHM_STATS_HISTORY_LENGTH 120
+
+/* The writer has stopped; the data is the last published sample */
+#define SHM_STATS_FLAG_CLOSED (1U << 0)
+
+/* Latest full sample */
+struct shm_stats_sample {
+  /* Sample sequence number ("seq" in the WebSocket stats frames) */
+  uint64_t seq;
+  /* CLOCK_REALTIME and CLOCK_MONOTONIC of the sample in ms, and time since the previous one */
+  uint64_t timestamp_ms;
+  uint64_t monotonic_ms;
+  uint64_t delta_ms;
+  double cpu_usage;
+  double uptime_s;
+  double load1;
+  double load5;
+  double load15;
+  int64_t mem_total_kb;
+  int64_t mem_available_kb;
+  uint32_t cpu_core_count;
+  uint32_t reserved;
+  double cpu_per_core_usage[SHM_STATS_MAX_CORES];
+};
+
+/* One entry of the history ring */
+struct shm_stats_history_entry {
+  uint64_t seq;
+  uint64_t timestamp_ms;
+  uint64_t monotonic_ms;
+  double cpu_usage;
+  double load1;
+  int64_t mem_available_kb;
+};
+
+struct shm_stats_segment {
+  /* Constant while the segment exists */
+  uint32_t magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  uint32_t segment_size;
+  uint32_t sample_size;
+  uint32_t history_entry_size;
+  uint32_t history_length;
+  int32_t writer_pid;
+  uint32_t reserved;
+  /* CLOCK_REALTIME of the writer start in ms, changes when the backend restarts */
+  uint64_t writer_start_ms;
+
+  /* Seqlock counter guarding everything below */
+  uint64_t seq;
+
+  uint32_t flags;
+  /* Index of the next history slot to write and number of valid entries */
+  uint32_t history_next;
+  uint32_t history_count;
+  uint32_t reserved2;
+  /* CLOCK_MONOTONIC of the last publication in ms */
+  uint64_t publish_mono_ms;
+
+  struct shm_stats_sample sample;
+  struct shm_stats_history_entry history[SHM_STATS_HISTORY_LENGTH];
+};
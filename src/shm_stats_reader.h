@@ -0,0 +1,171 @@
+#pragma once
+
+/* Header-only reader for the shared-memory stats segment (shm_stats.h).
+ *
+ * Usage:
+ *   struct shm_stats_reader r;
+ *   struct shm_stats_sample s;
+ *   if (shm_stats_reader_open(&r, SHM_STATS_DEFAULT_NAME) == 0) {
+ *     if (shm_stats_reader_read(&r, &s, NULL)) { ... }
+ *     shm_stats_reader_close(&r);
+ *   }
+ *
+ * Only open and close make system calls; reads are plain memory copies, so
+ * a reader may poll at any rate. Link with -lrt on C libraries older than
+ * glibc 2.34.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shm_stats.h"
+
+/* Copies retried while the writer is busy before a read gives up */
+#define SHM_STATS_READ_RETRIES 1000
+
+struct shm_stats_reader {
+  const struct shm_stats_segment *segment;
+  size_t map_size;
+};
+
+/* Map the segment read-only. Returns 0 or an errno value (EPROTO for an
+ * unknown layout).
+ */
+static inline int
+shm_stats_reader_open(struct shm_stats_reader *reader, const char *name)
+{
+  struct stat st;
+  const struct shm_stats_segment *seg;
+  int fd;
+  int err;
+
+  memset(reader, 0, sizeof(*reader));
+  fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    return errno;
+  }
+  if (fstat(fd, &st) != 0) {
+    err = errno;
+    close(fd);
+    return err;
+  }
+  if ((size_t)st.st_size < sizeof(struct shm_stats_segment)) {
+    close(fd);
+    return EPROTO;
+  }
+
+  seg = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  err = errno;
+  close(fd);
+  if (seg == MAP_FAILED) {
+    return err;
+  }
+
+  /* Appended fields (minor versions) are fine, other layouts are not */
+  if (seg->magic != SHM_STATS_MAGIC || seg->version_major != SHM_STATS_VERSION_MAJOR ||
+      seg->sample_size < sizeof(struct shm_stats_sample) ||
+      seg->history_entry_size != sizeof(struct shm_stats_history_entry) ||
+      seg->history_length != SHM_STATS_HISTORY_LENGTH) {
+    munmap((void *)seg, (size_t)st.st_size);
+    return EPROTO;
+  }
+
+  reader->segment = seg;
+  reader->map_size = (size_t)st.st_size;
+  return 0;
+}
+
+static inline void
+shm_stats_reader_close(struct shm_stats_reader *reader)
+{
+  if (reader->segment) {
+    munmap((void *)reader->segment, reader->map_size);
+  }
+  memset(reader, 0, sizeof(*reader));
+}
+
+/* Seqlock read section: copy len bytes at src once no write overlapped it */
+static inline bool
+shm_stats_reader_copy(const struct shm_stats_reader *reader, void *dst, const void *src, size_t len, uint32_t *flags)
+{
+  const struct shm_stats_segment *seg = reader->segment;
+
+  for (int i = 0; seg && i < SHM_STATS_READ_RETRIES; i++) {
+    uint64_t begin = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+    if (begin & 1U) {
+      continue;
+    }
+    memcpy(dst, src, len);
+    if (flags) {
+      *flags = seg->flags;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == begin) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Read a consistent copy of the latest sample.
+ *
+ * flags (optional) receives the segment flags, e.g. SHM_STATS_FLAG_CLOSED.
+ * Returns false if the writer kept the segment busy for all retries.
+ */
+static inline bool
+shm_stats_reader_read(const struct shm_stats_reader *reader, struct shm_stats_sample *out, uint32_t *flags)
+{
+  return reader->segment && shm_stats_reader_copy(reader, out, &reader->segment->sample, sizeof(*out), flags);
+}
+
+/* Copy up to max history entries, oldest first. Returns the number copied. */
+static inline size_t
+shm_stats_reader_read_history(const struct shm_stats_reader *reader, struct shm_stats_history_entry *out, size_t max)
+{
+  struct shm_stats_history_entry ring[SHM_STATS_HISTORY_LENGTH];
+  struct {
+    uint32_t next;
+    uint32_t count;
+  } pos;
+  uint64_t begin;
+  const struct shm_stats_segment *seg = reader->segment;
+
+  if (!seg || max == 0) {
+    return 0;
+  }
+
+  /* Ring and its positions must come from the same publication */
+  for (int i = 0; i < SHM_STATS_READ_RETRIES; i++) {
+    begin = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+    if (begin & 1U) {
+      continue;
+    }
+    pos.next = seg->history_next;
+    pos.count = seg->history_count;
+    memcpy(ring, seg->history, sizeof(ring));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) != begin) {
+      continue;
+    }
+
+    size_t count = pos.count < max ? pos.count : max;
+    if (pos.count > SHM_STATS_HISTORY_LENGTH || pos.next >= SHM_STATS_HISTORY_LENGTH) {
+      return 0;
+    }
+    /* The newest "count" entries end just before next */
+    for (size_t k = 0; k < count; k++) {
+      size_t idx = (pos.next + SHM_STATS_HISTORY_LENGTH - count + k) % SHM_STATS_HISTORY_LENGTH;
+      out[k] = ring[idx];
+    }
+    return count;
+  }
+
+  return 0;
+}
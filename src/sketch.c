@@ -0,0 +1,112 @@
+#include <math.h>
+#include <string.h>
+
+#include "sketch.h"
+
+/* log(gamma) with gamma = (1 + a) / (1 - a) */
+static double
+log_gamma(void)
+{
+  return log((1.0 + SKETCH_RELATIVE_ACCURACY) / (1.0 - SKETCH_RELATIVE_ACCURACY));
+}
+
+void
+sketch_reset(struct sketch *s)
+{
+  if (s) {
+    memset(s, 0, sizeof(*s));
+  }
+}
+
+void
+sketch_add(struct sketch *s, double value)
+{
+  if (!s || !isfinite(value)) {
+    return;
+  }
+  if (value < 0.0) {
+    value = 0.0;
+  }
+
+  if (value <= SKETCH_MIN_VALUE) {
+    s->zero_count++;
+  } else {
+    double idx = ceil(log(value / SKETCH_MIN_VALUE) / log_gamma());
+    /* idx >= 1 for value > MIN; bucket i stores index i + 1 */
+    size_t i = idx > (double)SKETCH_BIN_COUNT ? SKETCH_BIN_COUNT - 1 : (size_t)idx - 1;
+    s->bins[i]++;
+  }
+
+  if (s->count == 0 || value < s->min) {
+    s->min = value;
+  }
+  if (s->count == 0 || value > s->max) {
+    s->max = value;
+  }
+  s->count++;
+}
+
+void
+sketch_merge(struct sketch *dst, const struct sketch *src)
+{
+  if (!dst || !src || src->count == 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < SKETCH_BIN_COUNT; i++) {
+    dst->bins[i] += src->bins[i];
+  }
+  dst->zero_count += src->zero_count;
+  if (dst->count == 0 || src->min < dst->min) {
+    dst->min = src->min;
+  }
+  if (dst->count == 0 || src->max > dst->max) {
+    dst->max = src->max;
+  }
+  dst->count += src->count;
+}
+
+double
+sketch_quantile(const struct sketch *s, double q)
+{
+  double value;
+
+  if (!s || s->count == 0) {
+    return 0.0;
+  }
+  if (q <= 0.0) {
+    return s->min;
+  }
+  if (q >= 1.0) {
+    return s->max;
+  }
+
+  /* Rank of the requested sample (0-based) */
+  uint64_t rank = (uint64_t)(q * (double)(s->count - 1));
+  uint64_t seen = s->zero_count;
+
+  if (rank < seen) {
+    value = 0.0;
+  } else {
+    size_t i = 0;
+    for (; i < SKETCH_BIN_COUNT - 1; i++) {
+      seen += s->bins[i];
+      if (rank < seen) {
+        break;
+      }
+    }
+    /* Bucket midpoint in the relative sense: 2 * g^k / (g + 1) * MIN */
+    double gamma = exp(log_gamma());
+    value = 2.0 * SKETCH_MIN_VALUE * pow(gamma, (double)(i + 1)) / (gamma + 1.0);
+  }
+
+  /* Exact bounds are known, keep estimates inside them */
+  if (value < s->min) {
+    value = s->min;
+  }
+  if (value > s->max) {
+    value = s->max;
+  }
+
+  return value;
+}
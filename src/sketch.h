@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Relative accuracy of quantile estimates (2%). */
+#define SKETCH_RELATIVE_ACCURACY 0.02
+
+/* Values at or below this bound are counted in the zero bucket. */
+#define SKETCH_MIN_VALUE 0.1
+
+/* Number of logarithmic buckets above SKETCH_MIN_VALUE.
+ *
+ * With 2% accuracy the buckets cover (0.1, ~1400], enough for percentages
+ * and load averages. Larger values are clamped into the last bucket.
+ */
+#define SKETCH_BIN_COUNT 240
+
+/* Fixed-size mergeable quantile sketch (DDSketch with a bounded bucket range).
+ *
+ * - Bucket i counts values in (MIN * g^(i-1), MIN * g^i] where
+ *   g = (1 + a) / (1 - a), so any quantile is returned within a relative
+ *   error of a (SKETCH_RELATIVE_ACCURACY) of a real sample.
+ * - Two sketches merge by adding their buckets, so hourly sketches roll up
+ *   into daily ones without keeping samples.
+ * - No allocation: the struct can be embedded or written to a file as is.
+ */
+struct sketch {
+  uint32_t bins[SKETCH_BIN_COUNT];
+  uint32_t zero_count;
+  uint32_t count;
+  double min;
+  double max;
+};
+
+/* Clear all counters. */
+void sketch_reset(struct sketch *s);
+
+/* Record one non-negative value. */
+void sketch_add(struct sketch *s, double value);
+
+/* Add all values recorded in src to dst. */
+void sketch_merge(struct sketch *dst, const struct sketch *src);
+
+/* Return the q-quantile (0..1), 0.0 for an empty sketch. */
+double sketch_quantile(const struct sketch *s, double q);
@@ -0,0 +1,621 @@
+/* snapshot.c
+ *
+ * Record/replay of the /proc and /sys files read by the sampler.
+ *
+ * Recording:
+ * - procfs_fopen() hands every opened system file to snapshot_record_file().
+ * - The file is read completely, appended to the archive and served back to
+ *   the caller from an in-memory copy, so parsing sees the recorded bytes.
+ * - snapshot_tick() writes a tick marker with the sample timestamps. Files read
+ *   between two markers belong to the earlier tick.
+ * - Unchanged files are stored as a reference to keep the archive compact.
+ * - Files over SNAPSHOT_MAX_FILE_BYTES are cut, logged and stored as truncated.
+ * - procfs_opendir() hands every listed directory to snapshot_record_dir(),
+ *   which stores its entry names and kinds.
+ *
+ * Replay:
+ * - The archive is read sequentially. Each due tick is materialized into a
+ *   private temporary directory that is installed as the procfs root.
+ * - Replay time advances with the monotonic clock, scaled by the speed factor.
+ *   Every sample sees one consistent tick. When samples are further apart than
+ *   the recorded ticks, intermediate ticks are applied in order so counter
+ *   deltas stay correct over the longer interval.
+ * - A directory listing is applied by creating the listed subdirectories and
+ *   removing everything not listed, so readdir() sees the recorded PIDs.
+ * - Replay stops advancing at the end of the archive and keeps serving the
+ *   last tick.
+ *
+ * Limitations:
+ * - Only reads made through procfs_fopen() and procfs_opendir() are captured.
+ *   Live log files and statvfs() results are not part of the archive.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "snapshot.h"
+#include "procfs.h"
+#include "proc.h"
+#include "util.h"
+
+#define SNAPSHOT_MAGIC "WWSNAP01"
+#define SNAPSHOT_MAGIC_LENGTH 8
+
+#define SNAPSHOT_RECORD_TICK 'T'
+#define SNAPSHOT_RECORD_FILE 'F'
+#define SNAPSHOT_RECORD_TRUNCATED_FILE 'P'
+#define SNAPSHOT_RECORD_DIR 'D'
+
+#define SNAPSHOT_ENTRY_UNCHANGED 0xFFFFFFFFU
+#define SNAPSHOT_ENTRY_MISSING 0xFFFFFFFEU
+
+/* Upper bound for one captured file. /proc text files are far smaller. */
+#define SNAPSHOT_MAX_FILE_BYTES (1024U * 1024U)
+
+/* Recording state */
+static FILE *record_fp = NULL;
+/* Last recorded content per path (char * -> GBytes *), for unchanged detection */
+static GHashTable *record_last = NULL;
+/* Paths already reported as truncated (char * set), to warn once per path */
+static GHashTable *record_truncated = NULL;
+
+/* Replay state */
+static FILE *replay_fp = NULL;
+static char *replay_dir = NULL;
+static double replay_speed = 1.0;
+static uint64_t replay_start_mono_ms = 0;
+static uint64_t replay_first_tick_mono_ms = 0;
+/* Recorded monotonic time of the next tick that has been read but not applied */
+static uint64_t replay_next_tick_mono_ms = 0;
+static bool replay_have_next_tick = false;
+static bool replay_done = false;
+
+/******************************************************************************/
+
+static bool
+write_u16(FILE *f, uint16_t v)
+{
+  unsigned char b[2] = { (unsigned char)(v & 0xff), (unsigned char)(v >> 8) };
+
+  return fwrite(b, 1, sizeof(b), f) == sizeof(b);
+}
+
+static bool
+write_u32(FILE *f, uint32_t v)
+{
+  unsigned char b[4];
+
+  for (size_t i = 0; i < sizeof(b); i++) {
+    b[i] = (unsigned char)(v >> (8 * i));
+  }
+
+  return fwrite(b, 1, sizeof(b), f) == sizeof(b);
+}
+
+static bool
+write_u64(FILE *f, uint64_t v)
+{
+  unsigned char b[8];
+
+  for (size_t i = 0; i < sizeof(b); i++) {
+    b[i] = (unsigned char)(v >> (8 * i));
+  }
+
+  return fwrite(b, 1, sizeof(b), f) == sizeof(b);
+}
+
+static bool
+read_u16(FILE *f, uint16_t *out)
+{
+  unsigned char b[2];
+
+  if (fread(b, 1, sizeof(b), f) != sizeof(b)) {
+    return false;
+  }
+  *out = (uint16_t)(b[0] | (b[1] << 8));
+
+  return true;
+}
+
+static bool
+read_u32(FILE *f, uint32_t *out)
+{
+  unsigned char b[4];
+
+  if (fread(b, 1, sizeof(b), f) != sizeof(b)) {
+    return false;
+  }
+  *out = 0;
+  for (size_t i = 0; i < sizeof(b); i++) {
+    *out |= (uint32_t)b[i] << (8 * i);
+  }
+
+  return true;
+}
+
+static bool
+read_u64(FILE *f, uint64_t *out)
+{
+  unsigned char b[8];
+
+  if (fread(b, 1, sizeof(b), f) != sizeof(b)) {
+    return false;
+  }
+  *out = 0;
+  for (size_t i = 0; i < sizeof(b); i++) {
+    *out |= (uint64_t)b[i] << (8 * i);
+  }
+
+  return true;
+}
+
+/******************************************************************************/
+
+/* Write one tick marker using the current clocks */
+static void
+record_write_tick(void)
+{
+  if (!record_fp) {
+    return;
+  }
+  if (fputc(SNAPSHOT_RECORD_TICK, record_fp) == EOF || !write_u64(record_fp, util_get_time_ms(CLOCK_MONOTONIC)) ||
+      !write_u64(record_fp, util_get_time_ms(CLOCK_REALTIME))) {
+    syslog(LOG_WARNING, "snapshot: failed to write tick, stopping recording");
+    snapshot_record_stop();
+  }
+}
+
+/* Write one file or directory entry header and optional payload */
+static void
+record_write_entry(int type, const char *path, uint32_t len, const void *data)
+{
+  size_t path_len = strlen(path);
+
+  if (!record_fp || path_len > UINT16_MAX) {
+    return;
+  }
+  if (fputc(type, record_fp) == EOF || !write_u16(record_fp, (uint16_t)path_len) ||
+      fwrite(path, 1, path_len, record_fp) != path_len || !write_u32(record_fp, len) ||
+      (data && len > 0 && fwrite(data, 1, len, record_fp) != len)) {
+    syslog(LOG_WARNING, "snapshot: failed to write %s, stopping recording", path);
+    snapshot_record_stop();
+  }
+}
+
+/* Write the captured content of path, or a reference if it did not change */
+static void
+record_write_content(int type, const char *path, const GByteArray *data)
+{
+  GBytes *last = record_last ? g_hash_table_lookup(record_last, path) : NULL;
+  gsize last_len = 0;
+  gconstpointer last_data = last ? g_bytes_get_data(last, &last_len) : NULL;
+
+  if (last && last_len == data->len && (last_len == 0 || memcmp(last_data, data->data, last_len) == 0)) {
+    record_write_entry(type, path, SNAPSHOT_ENTRY_UNCHANGED, NULL);
+    return;
+  }
+  record_write_entry(type, path, data->len, data->data);
+  if (record_last) {
+    g_hash_table_replace(record_last, g_strdup(path), g_bytes_new(data->data, data->len));
+  }
+}
+
+/* Record a path that could not be opened */
+static void
+record_write_missing(int type, const char *path)
+{
+  record_write_entry(type, path, SNAPSHOT_ENTRY_MISSING, NULL);
+  if (record_last) {
+    g_hash_table_remove(record_last, path);
+  }
+}
+
+bool
+snapshot_record_start(const char *archive_path)
+{
+  if (!archive_path || record_fp) {
+    return false;
+  }
+
+  record_fp = fopen(archive_path, "wb");
+  if (!record_fp) {
+    syslog(LOG_ERR, "snapshot: cannot create %s: %m", archive_path);
+    return false;
+  }
+  if (fwrite(SNAPSHOT_MAGIC, 1, SNAPSHOT_MAGIC_LENGTH, record_fp) != SNAPSHOT_MAGIC_LENGTH) {
+    syslog(LOG_ERR, "snapshot: cannot write %s: %m", archive_path);
+    fclose(record_fp);
+    record_fp = NULL;
+    return false;
+  }
+  record_last = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_bytes_unref);
+  record_truncated = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  /* Reads made before the first sample (e.g. CPU topology) go into tick 0 */
+  record_write_tick();
+  syslog(LOG_INFO, "snapshot: recording to %s", archive_path);
+
+  return true;
+}
+
+void
+snapshot_record_stop(void)
+{
+  if (record_fp) {
+    fclose(record_fp);
+    record_fp = NULL;
+    syslog(LOG_INFO, "snapshot: recording stopped");
+  }
+  if (record_last) {
+    g_hash_table_destroy(record_last);
+    record_last = NULL;
+  }
+  if (record_truncated) {
+    g_hash_table_destroy(record_truncated);
+    record_truncated = NULL;
+  }
+}
+
+bool
+snapshot_recording(void)
+{
+  return record_fp != NULL;
+}
+
+FILE *
+snapshot_record_file(const char *path, FILE *f)
+{
+  GByteArray *data = NULL;
+  unsigned char chunk[4096];
+  size_t n;
+  bool truncated = false;
+  FILE *copy = NULL;
+
+  if (!record_fp || !path) {
+    return f;
+  }
+
+  if (!f) {
+    record_write_missing(SNAPSHOT_RECORD_FILE, path);
+    return NULL;
+  }
+
+  /* Read the complete file once, procfs files are generated on read */
+  data = g_byte_array_new();
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    if (data->len + n > SNAPSHOT_MAX_FILE_BYTES) {
+      n = SNAPSHOT_MAX_FILE_BYTES - data->len;
+      truncated = true;
+    }
+    g_byte_array_append(data, chunk, (guint)n);
+    if (truncated) {
+      break;
+    }
+  }
+  fclose(f);
+
+  if (truncated && record_truncated && !g_hash_table_contains(record_truncated, path)) {
+    syslog(LOG_WARNING, "snapshot: %s exceeds %u bytes, recording it truncated", path, SNAPSHOT_MAX_FILE_BYTES);
+    g_hash_table_add(record_truncated, g_strdup(path));
+  }
+  record_write_content(truncated ? SNAPSHOT_RECORD_TRUNCATED_FILE : SNAPSHOT_RECORD_FILE, path, data);
+
+  /* Serve the caller from a private copy of exactly the recorded bytes.
+   * One spare byte: in "w+" mode fmemopen() reserves room for a NUL.
+   */
+  if (data->len > 0) {
+    copy = fmemopen(NULL, data->len + 1, "w+");
+    if (copy) {
+      if (fwrite(data->data, 1, data->len, copy) != data->len) {
+        fclose(copy);
+        copy = NULL;
+      } else {
+        rewind(copy);
+      }
+    }
+  } else {
+    copy = fopen("/dev/null", "r");
+  }
+  g_byte_array_free(data, TRUE);
+
+  return copy;
+}
+
+void
+snapshot_record_dir(const char *path, DIR *d)
+{
+  struct dirent *ent;
+
+  if (!record_fp || !path) {
+    return;
+  }
+  if (!d) {
+    record_write_missing(SNAPSHOT_RECORD_DIR, path);
+    return;
+  }
+
+  GByteArray *data = g_byte_array_new();
+  while ((ent = readdir(d)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+      continue;
+    }
+    size_t name_len = strlen(ent->d_name);
+    if (data->len + name_len + 2 > SNAPSHOT_MAX_FILE_BYTES) {
+      syslog(LOG_WARNING,
+             "snapshot: listing of %s exceeds %u bytes, recording it truncated",
+             path,
+             SNAPSHOT_MAX_FILE_BYTES);
+      break;
+    }
+    guint8 kind = ent->d_type == DT_DIR ? 'd' : 'f';
+    g_byte_array_append(data, &kind, 1);
+    g_byte_array_append(data, (const guint8 *)ent->d_name, (guint)name_len);
+    g_byte_array_append(data, (const guint8 *)"\n", 1);
+  }
+  rewinddir(d);
+
+  record_write_content(SNAPSHOT_RECORD_DIR, path, data);
+  g_byte_array_free(data, TRUE);
+}
+
+/******************************************************************************/
+
+/* Recursively remove a replay directory tree. Symlinks are never created. */
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+
+  if (dir) {
+    const char *name;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+      char *child = g_build_filename(path, name, NULL);
+      remove_tree(child);
+      g_free(child);
+    }
+    g_dir_close(dir);
+  }
+  if (g_remove(path) != 0) {
+    syslog(LOG_WARNING, "snapshot: failed to remove %s: %m", path);
+  }
+}
+
+/* Reject archive paths that could escape the replay directory */
+static bool
+replay_path_is_safe(const char *path)
+{
+  return path[0] == '/' && strstr(path, "..") == NULL;
+}
+
+/* Make the materialized directory full_path hold exactly the listed entries.
+ *
+ * Listed subdirectories are created (their files arrive with their own
+ * records), entries that are not listed are removed.
+ */
+static void
+replay_apply_listing(const char *full_path, const char *listing)
+{
+  GHashTable *names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  gchar **lines = g_strsplit(listing, "\n", -1);
+
+  g_mkdir_with_parents(full_path, 0700);
+  for (size_t i = 0; lines[i]; i++) {
+    const char *name = lines[i] + 1;
+    if (lines[i][0] == '\0' || name[0] == '\0' || strchr(name, '/') || strcmp(name, ".") == 0 ||
+        strcmp(name, "..") == 0) {
+      continue;
+    }
+    g_hash_table_add(names, g_strdup(name));
+    if (lines[i][0] == 'd') {
+      char *child = g_build_filename(full_path, name, NULL);
+      g_mkdir(child, 0700);
+      g_free(child);
+    }
+  }
+  g_strfreev(lines);
+
+  GDir *dir = g_dir_open(full_path, 0, NULL);
+  if (dir) {
+    const char *name;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+      if (!g_hash_table_contains(names, name)) {
+        char *child = g_build_filename(full_path, name, NULL);
+        remove_tree(child);
+        g_free(child);
+      }
+    }
+    g_dir_close(dir);
+  }
+  g_hash_table_destroy(names);
+}
+
+/* Read and apply one 'F', 'P' or 'D' record body (the type byte is already consumed) */
+static bool
+replay_apply_entry(int type)
+{
+  uint16_t path_len = 0;
+  uint32_t len = 0;
+  char path[MAX_PROC_PATH_LENGTH];
+  char *full_path = NULL;
+  char *data = NULL;
+
+  if (!read_u16(replay_fp, &path_len) || path_len == 0 || path_len >= sizeof(path) ||
+      fread(path, 1, path_len, replay_fp) != path_len || !read_u32(replay_fp, &len)) {
+    return false;
+  }
+  path[path_len] = '\0';
+
+  if (len != SNAPSHOT_ENTRY_UNCHANGED && len != SNAPSHOT_ENTRY_MISSING) {
+    if (len > SNAPSHOT_MAX_FILE_BYTES) {
+      return false;
+    }
+    data = g_malloc(len + 1);
+    if (len > 0 && fread(data, 1, len, replay_fp) != len) {
+      g_free(data);
+      return false;
+    }
+  }
+  if (!replay_path_is_safe(path)) {
+    g_free(data);
+    return true;
+  }
+
+  full_path = g_build_filename(replay_dir, path, NULL);
+  if (type == SNAPSHOT_RECORD_DIR) {
+    if (len == SNAPSHOT_ENTRY_MISSING) {
+      remove_tree(full_path);
+    } else if (data) {
+      data[len] = '\0';
+      replay_apply_listing(full_path, data);
+    }
+  } else if (len == SNAPSHOT_ENTRY_MISSING) {
+    g_unlink(full_path);
+  } else if (data) {
+    if (type == SNAPSHOT_RECORD_TRUNCATED_FILE) {
+      syslog(LOG_DEBUG, "snapshot: %s was recorded truncated", path);
+    }
+    char *dir = g_path_get_dirname(full_path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+    g_file_set_contents(full_path, data, len, NULL);
+  }
+  g_free(full_path);
+  g_free(data);
+
+  return true;
+}
+
+/* Apply every tick whose scaled offset is <= target_offset_ms */
+static void
+replay_apply_until(uint64_t target_offset_ms)
+{
+  while (!replay_done) {
+    int type;
+
+    if (!replay_have_next_tick) {
+      type = fgetc(replay_fp);
+      if (type != SNAPSHOT_RECORD_TICK) {
+        replay_done = true;
+        break;
+      }
+      uint64_t real_ms = 0;
+      if (!read_u64(replay_fp, &replay_next_tick_mono_ms) || !read_u64(replay_fp, &real_ms)) {
+        replay_done = true;
+        break;
+      }
+      replay_have_next_tick = true;
+    }
+    if (replay_next_tick_mono_ms - replay_first_tick_mono_ms > target_offset_ms) {
+      break;
+    }
+
+    /* The tick is due: apply its file entries up to the next marker */
+    replay_have_next_tick = false;
+    while ((type = fgetc(replay_fp)) == SNAPSHOT_RECORD_FILE || type == SNAPSHOT_RECORD_TRUNCATED_FILE ||
+           type == SNAPSHOT_RECORD_DIR) {
+      if (!replay_apply_entry(type)) {
+        syslog(LOG_WARNING, "snapshot: corrupt archive entry, replay stopped");
+        replay_done = true;
+        return;
+      }
+    }
+    if (type == EOF) {
+      replay_done = true;
+    } else {
+      ungetc(type, replay_fp);
+    }
+  }
+  if (replay_done) {
+    syslog(LOG_INFO, "snapshot: end of archive reached, serving last tick");
+  }
+}
+
+bool
+snapshot_replay_start(const char *archive_path, double speed)
+{
+  char magic[SNAPSHOT_MAGIC_LENGTH];
+  GError *error = NULL;
+  int type;
+  uint64_t real_ms = 0;
+
+  if (!archive_path || replay_fp || speed <= 0.0) {
+    return false;
+  }
+
+  replay_fp = fopen(archive_path, "rb");
+  if (!replay_fp) {
+    syslog(LOG_ERR, "snapshot: cannot open %s: %m", archive_path);
+    return false;
+  }
+  type = 0;
+  if (fread(magic, 1, sizeof(magic), replay_fp) != sizeof(magic) ||
+      memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LENGTH) != 0 || (type = fgetc(replay_fp)) != SNAPSHOT_RECORD_TICK ||
+      !read_u64(replay_fp, &replay_first_tick_mono_ms) || !read_u64(replay_fp, &real_ms)) {
+    syslog(LOG_ERR, "snapshot: %s is not a valid snapshot archive", archive_path);
+    fclose(replay_fp);
+    replay_fp = NULL;
+    return false;
+  }
+
+  replay_dir = g_dir_make_tmp(APP_NAME "-replay-XXXXXX", &error);
+  if (!replay_dir) {
+    syslog(LOG_ERR, "snapshot: cannot create replay directory: %s", error->message);
+    g_error_free(error);
+    fclose(replay_fp);
+    replay_fp = NULL;
+    return false;
+  }
+  if (!procfs_set_root(replay_dir)) {
+    syslog(LOG_ERR, "snapshot: replay directory path too long: %s", replay_dir);
+    snapshot_replay_stop();
+    return false;
+  }
+
+  replay_speed = speed;
+  replay_next_tick_mono_ms = replay_first_tick_mono_ms;
+  replay_have_next_tick = true;
+  replay_done = false;
+  replay_start_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+  /* Materialize tick 0 so startup reads see recorded data */
+  replay_apply_until(0);
+  syslog(LOG_INFO, "snapshot: replaying %s at %.2fx from %s", archive_path, speed, replay_dir);
+
+  return true;
+}
+
+void
+snapshot_replay_stop(void)
+{
+  if (replay_fp) {
+    fclose(replay_fp);
+    replay_fp = NULL;
+  }
+  if (replay_dir) {
+    procfs_set_root(NULL);
+    remove_tree(replay_dir);
+    g_free(replay_dir);
+    replay_dir = NULL;
+  }
+  replay_have_next_tick = false;
+  replay_done = false;
+}
+
+void
+snapshot_tick(void)
+{
+  if (record_fp) {
+    record_write_tick();
+  }
+  if (replay_fp && !replay_done) {
+    uint64_t elapsed_ms = util_get_time_ms(CLOCK_MONOTONIC) - replay_start_mono_ms;
+    replay_apply_until((uint64_t)((double)elapsed_ms * replay_speed));
+  }
+}
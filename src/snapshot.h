@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <dirent.h>
+
+/* Record and replay of the system files read by the sampler.
+ *
+ * Archive format (all integers little-endian):
+ *
+ *   "WWSNAP01"                                   file magic
+ *   'T' <u64 mono_ms> <u64 real_ms>              start of one sample tick
+ *   'F' <u16 path_len> <path> <u32 len> <data>   one file read during the tick
+ *   'P' <u16 path_len> <path> <u32 len> <data>   same, cut at SNAPSHOT_MAX_FILE_BYTES
+ *   'D' <u16 path_len> <path> <u32 len> <data>   one directory listed during the tick
+ *
+ * A directory listing holds one "<kind><name>\n" line per entry, kind 'd' for
+ * subdirectories and 'f' for everything else ("." and ".." are left out).
+ *
+ * An entry whose content is identical to the previous entry for the same
+ * path is stored with len == SNAPSHOT_ENTRY_UNCHANGED and no data. A path that
+ * could not be opened is stored with len == SNAPSHOT_ENTRY_MISSING.
+ */
+
+/* Start recording every procfs_fopen() read into archive_path.
+ *
+ * Returns false if the archive cannot be created.
+ */
+bool snapshot_record_start(const char *archive_path);
+
+/* Flush and close the archive. Safe to call if recording never started. */
+void snapshot_record_stop(void);
+
+/* Return true while recording is active. */
+bool snapshot_recording(void);
+
+/* Capture one opened (or failed) system file into the current tick.
+ *
+ * Takes ownership of f, which may be NULL if the open failed. Returns a
+ * stream over the captured bytes, or NULL if the file was missing.
+ */
+FILE *snapshot_record_file(const char *path, FILE *f);
+
+/* Capture the listing of one opened (or failed) system directory into the
+ * current tick. d may be NULL if the open failed; otherwise it is rewound so
+ * the caller reads the same entries.
+ */
+void snapshot_record_dir(const char *path, DIR *d);
+
+/* Start serving the snapshots from archive_path.
+ *
+ * Files are materialized into a private temporary directory that is used
+ * as the procfs root. speed scales recorded time: 1.0 is real time, 10.0
+ * replays ten recorded seconds per wall-clock second.
+ *
+ * Returns false if the archive is invalid or the directory cannot be created.
+ */
+bool snapshot_replay_start(const char *archive_path, double speed);
+
+/* Stop replay and remove the temporary root directory. */
+void snapshot_replay_stop(void);
+
+/* Called once per sample tick, before the system files are read.
+ *
+ * - Recording: starts a new tick in the archive.
+ * - Replay: materializes every recorded tick that is due at the current
+ *   (scaled) replay time.
+ */
+void snapshot_tick(void);
@@ -6,6 +6,9 @@
 #include <time.h>
 
 #include "stats.h"
+#include "cpu_topology.h"
+#include "procfs.h"
+#include "snapshot.h"
 #include "util.h"
 
 /* Parse one "cpu" or "cpuN" line from /proc/stat.
@@ -24,12 +27,12 @@
  *  ...
  *  cpuN
  */
-static bool
-parse_cpu_stat_line(const char *line,
-                    char *label_out,
-                    size_t label_out_size,
-                    unsigned long long *idle_time_out,
-                    unsigned long long *total_time_out)
+bool
+stats_parse_cpu_stat_line(const char *line,
+                          char *label_out,
+                          size_t label_out_size,
+                          unsigned long long *idle_time_out,
+                          unsigned long long *total_time_out)
 {
   char parsed_label[16];
   /* CPU time counters read from /proc/stat "cpu" / "cpuN" lines
@@ -105,19 +108,16 @@ parse_cpu_index(const char *label, size_t *cpu_index_out)
   return true;
 }
 
-/* Read MemTotal and MemAvailable from /proc/meminfo
- * and return them in stats structure.
- */
+/* Parse MemTotal and MemAvailable from an open /proc/meminfo stream. */
 void
-stats_read_mem(struct sys_stats *stats)
+stats_parse_meminfo(FILE *f, struct sys_stats *stats)
 {
   char line[MAX_PROC_LINE_LENGTH];
   long value = 0;
   int got_total = 0;
   int got_avail = 0;
-  FILE *f;
 
-  if (!stats) {
+  if (!f || !stats) {
     return;
   }
 
@@ -125,11 +125,6 @@ stats_read_mem(struct sys_stats *stats)
   stats->mem_total_kb = 0;
   stats->mem_available_kb = 0;
 
-  f = fopen("/proc/meminfo", "r");
-  if (!f) {
-    return;
-  }
-
   while (fgets(line, sizeof(line), f)) {
     if (!got_total) {
       if (sscanf(line, "MemTotal: %ld kB", &value) == 1) {
@@ -151,7 +146,29 @@ stats_read_mem(struct sys_stats *stats)
       break;
     }
   }
+}
+
+/* Read MemTotal and MemAvailable from /proc/meminfo
+ * and return them in stats structure.
+ */
+void
+stats_read_mem(struct sys_stats *stats)
+{
+  FILE *f;
+
+  if (!stats) {
+    return;
+  }
+
+  /* Clear old values */
+  stats->mem_total_kb = 0;
+  stats->mem_available_kb = 0;
 
+  f = procfs_fopen("/proc/meminfo", "r");
+  if (!f) {
+    return;
+  }
+  stats_parse_meminfo(f, stats);
   fclose(f);
 }
 
@@ -187,8 +204,10 @@ stats_read_cpu_stats(struct sys_stats *stats)
   static unsigned long long prev_core_idle[MAX_CPU_CORE_SAMPLES];
   /* Previous per-core total counters, indexed by parsed CPU number */
   static unsigned long long prev_core_total[MAX_CPU_CORE_SAMPLES];
-  /* Number of cached per-core baselines currently stored */
-  static size_t prev_core_count = 0;
+  /* CPUs that had a "cpuN" line (were online) in the previous sample */
+  static bool prev_core_online[MAX_CPU_CORE_SAMPLES];
+  /* CPUs with a "cpuN" line in this sample */
+  bool core_online[MAX_CPU_CORE_SAMPLES] = { false };
   /* Indicates whether a baseline CPU sample has been recorded */
   static bool initialized = false;
 
@@ -211,8 +230,10 @@ stats_read_cpu_stats(struct sys_stats *stats)
   stats->cpu_usage = 0.0;
   stats->cpu_per_core_count = 0;
   memset(stats->cpu_per_core_usage, 0, sizeof(stats->cpu_per_core_usage));
+  stats->cpu_offline_count = 0;
+  memset(stats->cpu_core_offline, 0, sizeof(stats->cpu_core_offline));
 
-  f = fopen("/proc/stat", "r");
+  f = procfs_fopen("/proc/stat", "r");
   if (!f) {
     return;
   }
@@ -226,7 +247,7 @@ stats_read_cpu_stats(struct sys_stats *stats)
       break;
     }
     /* Parse one "cpu" or "cpuN" line from /proc/stat */
-    if (!parse_cpu_stat_line(line, label, sizeof(label), &idle_time, &total_time)) {
+    if (!stats_parse_cpu_stat_line(line, label, sizeof(label), &idle_time, &total_time)) {
       continue;
     }
     /* The aggregate "cpu" line represents combined time across all CPUs.
@@ -274,8 +295,9 @@ stats_read_cpu_stats(struct sys_stats *stats)
     if (cpu_index + 1 > max_cpu_index_seen) {
       max_cpu_index_seen = cpu_index + 1;
     }
-    /* First sample for this core: store a baseline and wait for the next interval */
-    if (!initialized || cpu_index >= prev_core_count) {
+    core_online[cpu_index] = true;
+    /* First sample for this core, or back from offline: store a baseline and wait for the next interval */
+    if (!initialized || !prev_core_online[cpu_index]) {
       prev_core_idle[cpu_index] = idle_time;
       prev_core_total[cpu_index] = total_time;
       continue;
@@ -306,9 +328,21 @@ stats_read_cpu_stats(struct sys_stats *stats)
 
   /* Keep the highest parsed CPU index seen in this pass, plus one */
   stats->cpu_per_core_count = max_cpu_index_seen;
+  for (size_t i = 0; i < max_cpu_index_seen; i++) {
+    if (!core_online[i]) {
+      stats->cpu_core_offline[i] = true;
+      stats->cpu_offline_count++;
+    }
+  }
+
+  /* Hotplug: re-read the online set (process CPU normalization) and clusters */
+  if (initialized && memcmp(core_online, prev_core_online, sizeof(core_online)) != 0) {
+    cpu_topology_refresh();
+  }
+  cpu_topology_aggregate(stats);
 
-  /* Save the current core count and mark CPU sampling as initialized */
-  prev_core_count = max_cpu_index_seen;
+  /* Save the current online set and mark CPU sampling as initialized */
+  memcpy(prev_core_online, core_online, sizeof(core_online));
   if (!initialized) {
     initialized = true;
   }
@@ -344,7 +378,7 @@ read_uptime_load(struct sys_stats *stats)
   stats->load5 = 0.0;
   stats->load15 = 0.0;
 
-  f = fopen("/proc/uptime", "r");
+  f = procfs_fopen("/proc/uptime", "r");
   if (f) {
     double up = 0.0;
     double idle = 0.0;
@@ -356,7 +390,7 @@ read_uptime_load(struct sys_stats *stats)
     fclose(f);
   }
 
-  f = fopen("/proc/loadavg", "r");
+  f = procfs_fopen("/proc/loadavg", "r");
   if (f) {
     double a = 0.0, b = 0.0, c = 0.0;
     if (fgets(line, sizeof(line), f)) {
@@ -388,6 +422,9 @@ stats_update_sys_stats(struct sys_stats *stats)
   if (!stats) {
     return;
   }
+  /* Start a new snapshot tick: record marker or materialize due replay data */
+  snapshot_tick();
+
   /* Read stats */
   stats_read_cpu_stats(stats);
   stats_read_mem(stats);
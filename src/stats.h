@@ -1,7 +1,9 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 /* Maximum length of a single line read from /proc text files.
  *
@@ -22,6 +24,9 @@
  */
 #define MAX_CPU_CORE_SAMPLES 128
 
+/* Maximum number of CPU clusters (cores sharing a clock), see cpu_topology.h */
+#define MAX_CPU_CLUSTERS 16
+
 /* Struct for collecting system stats */
 struct sys_stats {
   /* CPU usage */
@@ -29,6 +34,12 @@ struct sys_stats {
   /* Per-core CPU usage samples */
   double cpu_per_core_usage[MAX_CPU_CORE_SAMPLES];
   size_t cpu_per_core_count;
+  /* Cores below cpu_per_core_count without a /proc/stat line (hot-unplugged) */
+  bool cpu_core_offline[MAX_CPU_CORE_SAMPLES];
+  size_t cpu_offline_count;
+  /* Mean usage of the online cores per cluster, empty with fewer than two clusters */
+  double cpu_cluster_usage[MAX_CPU_CLUSTERS];
+  size_t cpu_cluster_count;
   /* Memory usage */
   long mem_total_kb;
   long mem_available_kb;
@@ -42,8 +53,30 @@ struct sys_stats {
   /* Monotonic timestamp and delta */
   uint64_t monotonic_ms;
   uint64_t delta_ms;
+  /* Sample sequence number, advanced for each sample handed to the consumers
+   * (resume ring, channels); out-of-band refreshes keep it
+   */
+  uint64_t seq;
 };
 
+/* Parse one "cpu" or "cpuN" line from /proc/stat.
+ *
+ * Returns true when the line contains the expected 8 CPU counters.
+ * idle_time_out receives idle + iowait and total_time_out receives the sum
+ * of all parsed counters so callers can compute interval deltas.
+ */
+bool stats_parse_cpu_stat_line(const char *line,
+                               char *label_out,
+                               size_t label_out_size,
+                               unsigned long long *idle_time_out,
+                               unsigned long long *total_time_out);
+
+/* Parse MemTotal and MemAvailable from an open /proc/meminfo stream.
+ *
+ * Both fields are reset to 0 before parsing, so missing keys read as 0.
+ */
+void stats_parse_meminfo(FILE *f, struct sys_stats *stats);
+
 /* Read MemTotal and MemAvailable from /proc/meminfo
  * and return them in stats structure.
  */
@@ -64,6 +97,10 @@ void stats_read_mem(struct sys_stats *stats);
  * The first call only initializes the previous counters and returns 0.0
  * samples. On read or parse failure, cpu_usage is set to 0.0 and the per-core
  * array is left empty.
+ *
+ * Offline CPUs have no "cpuN" line. They are flagged in cpu_core_offline[],
+ * and a CPU coming back online starts from a fresh baseline. A change of the
+ * online set triggers cpu_topology_refresh().
  */
 void stats_read_cpu_stats(struct sys_stats *stats);
 
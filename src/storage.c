@@ -5,6 +5,7 @@
 #include <sys/statvfs.h>
 
 #include "storage.h"
+#include "procfs.h"
 
 // clang-format off
 /* List of filesystem mount points for one-shot storage reporting */
@@ -30,7 +31,7 @@ static bool
 get_fs_type_for_path(const char *path, char *fs_type, size_t fs_type_len)
 {
   /* Open the current process mount table, fail gracefully if unavailable */
-  FILE *f = fopen("/proc/self/mounts", "r");
+  FILE *f = procfs_fopen("/proc/self/mounts", "r");
   if (!f) {
     return false;
   }
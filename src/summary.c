@@ -0,0 +1,238 @@
+/* summary.c
+ *
+ * Long-horizon percentile summaries without raw history.
+ *
+ * - Every sample is added to quantile sketches (sketch.h) of the current hour.
+ * - When the hour changes, its sketches are kept in a ring of completed hours
+ *   and merged into the current day, which rolls into a ring of days the same
+ *   way. Memory use is fixed: (hours + days + 2) buckets of ~3 KB.
+ * - The whole state is plain data and is optionally persisted as one binary
+ *   file, replaced atomically, so summaries survive restarts.
+ */
+#include <string.h>
+#include <syslog.h>
+
+#include <glib.h>
+
+#include "summary.h"
+
+#define SUMMARY_FILE_MAGIC "WWSUMMR1"
+#define MS_PER_HOUR (3600ULL * 1000ULL)
+#define MS_PER_DAY (24ULL * MS_PER_HOUR)
+
+static const char *const metric_names[SUMMARY_METRIC_COUNT] = { "cpu", "mem_used_percent", "load1" };
+
+/* Persisted state, written to disk as is */
+struct summary_state {
+  char magic[8];
+  /* Layout guards: a file from a build with other sketch parameters is ignored */
+  uint32_t struct_size;
+  uint32_t bin_count;
+  uint32_t accuracy_ppm;
+  struct summary_bucket current_hour;
+  struct summary_bucket current_day;
+  /* Completed periods, newest at index (next - 1) */
+  struct summary_bucket hours[SUMMARY_HOUR_COUNT];
+  struct summary_bucket days[SUMMARY_DAY_COUNT];
+  uint32_t next_hour;
+  uint32_t next_day;
+};
+
+static struct {
+  bool enabled;
+  char *persist_path;
+  struct summary_state state;
+} summary;
+
+/******************************************************************************/
+
+static void
+reset_state(void)
+{
+  memset(&summary.state, 0, sizeof(summary.state));
+  memcpy(summary.state.magic, SUMMARY_FILE_MAGIC, sizeof(summary.state.magic));
+  summary.state.struct_size = (uint32_t)sizeof(summary.state);
+  summary.state.bin_count = SKETCH_BIN_COUNT;
+  summary.state.accuracy_ppm = (uint32_t)(SKETCH_RELATIVE_ACCURACY * 1e6);
+}
+
+static void
+load_state(const char *path)
+{
+  gchar *contents = NULL;
+  gsize len = 0;
+  GError *error = NULL;
+  struct summary_state loaded;
+
+  if (!g_file_get_contents(path, &contents, &len, &error)) {
+    syslog(LOG_INFO, "No stored summaries loaded from %s: %s", path, error ? error->message : "unknown error");
+    g_clear_error(&error);
+    return;
+  }
+
+  if (len != sizeof(loaded)) {
+    syslog(LOG_WARNING, "Ignoring summary file %s: unexpected size %zu", path, (size_t)len);
+    g_free(contents);
+    return;
+  }
+  memcpy(&loaded, contents, sizeof(loaded));
+  g_free(contents);
+
+  if (memcmp(loaded.magic, SUMMARY_FILE_MAGIC, sizeof(loaded.magic)) != 0 || loaded.struct_size != sizeof(loaded) ||
+      loaded.bin_count != SKETCH_BIN_COUNT || loaded.accuracy_ppm != (uint32_t)(SKETCH_RELATIVE_ACCURACY * 1e6) ||
+      loaded.next_hour >= SUMMARY_HOUR_COUNT || loaded.next_day >= SUMMARY_DAY_COUNT) {
+    syslog(LOG_WARNING, "Ignoring summary file %s: incompatible layout", path);
+    return;
+  }
+
+  summary.state = loaded;
+  syslog(LOG_INFO, "Loaded stored summaries from %s", path);
+}
+
+static void
+save_state(void)
+{
+  GError *error = NULL;
+
+  if (!summary.persist_path) {
+    return;
+  }
+
+  /* g_file_set_contents() writes a temporary file and renames it */
+  if (!g_file_set_contents(
+          summary.persist_path, (const gchar *)&summary.state, (gssize)sizeof(summary.state), &error)) {
+    syslog(LOG_WARNING,
+           "Failed to store summaries to %s: %s",
+           summary.persist_path,
+           error ? error->message : "unknown error");
+    g_clear_error(&error);
+  }
+}
+
+/******************************************************************************/
+
+void
+summary_start(const char *persist_path)
+{
+  reset_state();
+  g_free(summary.persist_path);
+  summary.persist_path = persist_path ? g_strdup(persist_path) : NULL;
+  if (summary.persist_path) {
+    load_state(summary.persist_path);
+  }
+  summary.enabled = true;
+}
+
+void
+summary_stop(void)
+{
+  if (!summary.enabled) {
+    return;
+  }
+
+  save_state();
+  g_free(summary.persist_path);
+  summary.persist_path = NULL;
+  summary.enabled = false;
+}
+
+bool
+summary_enabled(void)
+{
+  return summary.enabled;
+}
+
+/* Move a completed bucket into a ring and clear it */
+static void
+push_bucket(struct summary_bucket *ring, size_t ring_len, uint32_t *next, struct summary_bucket *bucket)
+{
+  ring[*next] = *bucket;
+  *next = (uint32_t)((*next + 1) % ring_len);
+  memset(bucket, 0, sizeof(*bucket));
+}
+
+void
+summary_update(const struct sys_stats *stats)
+{
+  struct summary_state *st = &summary.state;
+  double values[SUMMARY_METRIC_COUNT];
+
+  if (!summary.enabled || !stats || stats->timestamp_ms == 0 || stats->mem_total_kb <= 0) {
+    return;
+  }
+
+  uint64_t hour_start = stats->timestamp_ms - stats->timestamp_ms % MS_PER_HOUR;
+  uint64_t day_start = stats->timestamp_ms - stats->timestamp_ms % MS_PER_DAY;
+
+  if (st->current_hour.start_ms != hour_start) {
+    if (st->current_hour.start_ms != 0) {
+      /* Days are merged from hours, so roll the day after its last hour */
+      for (size_t i = 0; i < SUMMARY_METRIC_COUNT; i++) {
+        sketch_merge(&st->current_day.metrics[i], &st->current_hour.metrics[i]);
+      }
+      push_bucket(st->hours, SUMMARY_HOUR_COUNT, &st->next_hour, &st->current_hour);
+    }
+    if (st->current_day.start_ms != day_start) {
+      if (st->current_day.start_ms != 0) {
+        push_bucket(st->days, SUMMARY_DAY_COUNT, &st->next_day, &st->current_day);
+      }
+      st->current_day.start_ms = day_start;
+    }
+    st->current_hour.start_ms = hour_start;
+    save_state();
+  }
+
+  values[SUMMARY_METRIC_CPU] = stats->cpu_usage;
+  values[SUMMARY_METRIC_MEM_USED_PERCENT] =
+      (double)(stats->mem_total_kb - stats->mem_available_kb) * 100.0 / (double)stats->mem_total_kb;
+  values[SUMMARY_METRIC_LOAD1] = stats->load1;
+  for (size_t i = 0; i < SUMMARY_METRIC_COUNT; i++) {
+    sketch_add(&st->current_hour.metrics[i], values[i]);
+  }
+}
+
+size_t
+summary_get_periods(enum summary_period period, const struct summary_bucket **out, size_t max)
+{
+  const struct summary_state *st = &summary.state;
+  const struct summary_bucket *ring = period == SUMMARY_PERIOD_DAY ? st->days : st->hours;
+  size_t ring_len = period == SUMMARY_PERIOD_DAY ? SUMMARY_DAY_COUNT : SUMMARY_HOUR_COUNT;
+  uint32_t next = period == SUMMARY_PERIOD_DAY ? st->next_day : st->next_hour;
+  size_t n = 0;
+
+  if (!out || max == 0) {
+    return 0;
+  }
+
+  /* The current day holds completed hours only, so add the hour in progress on request */
+  if (period == SUMMARY_PERIOD_HOUR) {
+    if (st->current_hour.metrics[0].count > 0) {
+      out[n++] = &st->current_hour;
+    }
+  } else if (st->current_day.start_ms != 0) {
+    static struct summary_bucket today;
+    today = st->current_day;
+    for (size_t i = 0; i < SUMMARY_METRIC_COUNT; i++) {
+      sketch_merge(&today.metrics[i], &st->current_hour.metrics[i]);
+    }
+    if (today.metrics[0].count > 0) {
+      out[n++] = &today;
+    }
+  }
+
+  for (size_t i = 1; i <= ring_len && n < max; i++) {
+    const struct summary_bucket *b = &ring[(next + ring_len - i) % ring_len];
+    if (b->start_ms == 0) {
+      break;
+    }
+    out[n++] = b;
+  }
+
+  return n;
+}
+
+const char *
+summary_metric_name(enum summary_metric metric)
+{
+  return metric < SUMMARY_METRIC_COUNT ? metric_names[metric] : "";
+}
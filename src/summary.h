@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sketch.h"
+#include "stats.h"
+
+/* Number of completed hours and days kept */
+#define SUMMARY_HOUR_COUNT 24
+#define SUMMARY_DAY_COUNT 7
+
+/* Metrics summarized per period */
+enum summary_metric {
+  SUMMARY_METRIC_CPU = 0,
+  SUMMARY_METRIC_MEM_USED_PERCENT,
+  SUMMARY_METRIC_LOAD1,
+  SUMMARY_METRIC_COUNT
+};
+
+enum summary_period {
+  SUMMARY_PERIOD_HOUR = 0,
+  SUMMARY_PERIOD_DAY,
+};
+
+/* Quantile sketches of all metrics for one hour or day (UTC aligned) */
+struct summary_bucket {
+  /* CLOCK_REALTIME start of the period in ms (0 = unused slot) */
+  uint64_t start_ms;
+  struct sketch metrics[SUMMARY_METRIC_COUNT];
+};
+
+/* Enable long-horizon summaries.
+ *
+ * While enabled the sampler runs continuously. If persist_path is not NULL,
+ * previous summaries are loaded from it and the state is written back each
+ * time an hour completes and on summary_stop().
+ */
+void summary_start(const char *persist_path);
+
+/* Persist (if configured) and disable summaries. Safe to call multiple times. */
+void summary_stop(void);
+
+/* True while summaries are enabled */
+bool summary_enabled(void);
+
+/* Add one sample to the current hour, rolling hours into days. */
+void summary_update(const struct sys_stats *stats);
+
+/* Collect up to max periods, newest first.
+ *
+ * The first entry is the period in progress (when it has samples), followed
+ * by completed periods. Returns the number of entries written to out.
+ */
+size_t summary_get_periods(enum summary_period period, const struct summary_bucket **out, size_t max);
+
+/* Return the protocol name of a metric ("cpu", "mem_used_percent", "load1"). */
+const char *summary_metric_name(enum summary_metric metric);
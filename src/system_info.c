@@ -5,6 +5,7 @@
 
 #include "system_info.h"
 #include "proc.h"
+#include "procfs.h"
 
 /* Strip surrounding double quotes if present */
 static void
@@ -34,10 +35,10 @@ read_os_release(struct system_info *out)
     return;
   }
 
-  f = fopen("/etc/os-release", "r");
+  f = procfs_fopen("/etc/os-release", "r");
   if (!f) {
     /* Fallback path */
-    f = fopen("/usr/lib/os-release", "r");
+    f = procfs_fopen("/usr/lib/os-release", "r");
     if (!f) {
       return;
     }
@@ -0,0 +1,564 @@
+/* test_cgi_proxy.c
+ *
+ * A full-size updateWidget request sent over the WebSocket interface is
+ * forwarded by the CGI proxy to a local HTTP stand-in for the device, and
+ * the sender receives its cgi_update_result. A burst of updates behind a slow
+ * reply is coalesced to its latest, and a steady stream is forwarded at most
+ * once per CGI_PROXY_INTERVAL_MS with one request in flight. Other commands
+ * keep the small receive limit.
+ */
+#include "test_support.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include <jansson.h>
+
+#include "app_state.h"
+#include "cgi_proxy.h"
+#include "upstream.h"
+#include "ws_limits.h"
+#include "ws_server.h"
+
+#define TEST_WS_PORT 19731
+#define TEST_TIMEOUT_US (10 * G_USEC_PER_SEC)
+#define TEST_WIDGET_ID 7
+
+/* Updates sent in one burst, and the stand-in's delay of its first reply */
+#define TEST_BURST_UPDATES 10
+#define TEST_SLOW_REPLY_MS 300
+/* Streaming test: one update every TEST_STREAM_PERIOD_MS for TEST_STREAM_MS */
+#define TEST_STREAM_PERIOD_MS 5
+#define TEST_STREAM_MS 1500
+/* cgi_proxy.c lets a waiting update go up to 5 ms before its interval ends */
+#define TEST_INTERVAL_SLACK_MS 5
+
+/* Reply of the stand-in, as the overlay widget CGI would answer */
+#define TEST_CGI_RESPONSE "{\"apiVersion\":\"2.0\",\"method\":\"updateWidget\",\"data\":{}}"
+
+/* HTTP server on 127.0.0.1 answering one request per connection, run in its own thread */
+struct http_stand_in {
+  int listen_fd;
+  int port;
+  GThread *thread;
+  /* Requests served before the thread ends, and the delay of the first reply */
+  unsigned int max_requests;
+  gint64 first_reply_delay_us;
+  /* Request line and headers (lower case) and body of the first request */
+  GString *head;
+  GString *body;
+  /* Bodies of all requests (GString *), read after stand_in_stop() */
+  GPtrArray *bodies;
+  /* Connections waiting while a request was being answered */
+  volatile gint overlaps;
+};
+
+/* WebSocket client of the server under test */
+struct test_client {
+  struct upstream up;
+  volatile size_t connected;
+  volatile size_t replies;
+  /* Last cgi_update_result or error message */
+  json_t *reply;
+  /* Bodies of all cgi_update_result messages */
+  json_t *results;
+};
+
+/******************************************************************************/
+
+/* Read one request: head (lower case) and body of Content-Length bytes */
+static void
+read_request(int fd, GString *head, GString *body)
+{
+  char buf[4096];
+  size_t content_length = 0;
+  bool have_head = false;
+
+  while (!have_head || body->len < content_length) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      break;
+    }
+    if (have_head) {
+      g_string_append_len(body, buf, n);
+      continue;
+    }
+
+    g_string_append_len(head, buf, n);
+    const char *end = strstr(head->str, "\r\n\r\n");
+    if (!end) {
+      continue;
+    }
+    size_t head_len = (size_t)(end - head->str) + 4;
+    g_string_append(body, head->str + head_len);
+    g_string_truncate(head, head_len);
+    for (size_t i = 0; i < head->len; i++) {
+      head->str[i] = g_ascii_tolower(head->str[i]);
+    }
+    const char *cl = strstr(head->str, "content-length:");
+    content_length = cl ? strtoul(cl + strlen("content-length:"), NULL, 10) : 0;
+    have_head = true;
+  }
+}
+
+static gpointer
+stand_in_thread(gpointer user_data)
+{
+  struct http_stand_in *s = user_data;
+
+  for (unsigned int i = 0; i < s->max_requests; i++) {
+    int fd = accept(s->listen_fd, NULL, NULL);
+    if (fd < 0) {
+      break;
+    }
+
+    GString *head = i == 0 ? s->head : g_string_new(NULL);
+    GString *body = g_string_new(NULL);
+    read_request(fd, head, body);
+    if (i == 0) {
+      g_string_assign(s->body, body->str);
+    } else {
+      g_string_free(head, TRUE);
+    }
+    g_ptr_array_add(s->bodies, body);
+
+    if (i == 0 && s->first_reply_delay_us > 0) {
+      g_usleep((gulong)s->first_reply_delay_us);
+    }
+
+    /* Another connection before this reply means two requests in flight */
+    struct pollfd pfd = { .fd = s->listen_fd, .events = POLLIN };
+    if (poll(&pfd, 1, 0) > 0) {
+      g_atomic_int_inc(&s->overlaps);
+    }
+
+    char *response = g_strdup_printf("HTTP/1.1 200 OK\r\n"
+                                     "Content-Type: application/json\r\n"
+                                     "Content-Length: %zu\r\n"
+                                     "Connection: close\r\n"
+                                     "\r\n" TEST_CGI_RESPONSE,
+                                     strlen(TEST_CGI_RESPONSE));
+    ssize_t written = write(fd, response, strlen(response));
+    (void)written;
+    g_free(response);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+static void
+stand_in_start(struct http_stand_in *s, unsigned int max_requests, gint64 first_reply_delay_us)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+
+  memset(s, 0, sizeof(*s));
+  s->max_requests = max_requests;
+  s->first_reply_delay_us = first_reply_delay_us;
+  s->head = g_string_new(NULL);
+  s->body = g_string_new(NULL);
+  s->bodies = g_ptr_array_new();
+
+  s->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  assert_true(s->listen_fd >= 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  assert_int_equal(bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+  assert_int_equal(listen(s->listen_fd, 4), 0);
+  assert_int_equal(getsockname(s->listen_fd, (struct sockaddr *)&addr, &addr_len), 0);
+  s->port = ntohs(addr.sin_port);
+
+  s->thread = g_thread_new("cgi_stand_in", stand_in_thread, s);
+}
+
+/* Stop serving; the received requests stay readable until stand_in_free() */
+static void
+stand_in_stop(struct http_stand_in *s)
+{
+  /* Unblocks accept() if fewer requests arrived */
+  shutdown(s->listen_fd, SHUT_RDWR);
+  g_thread_join(s->thread);
+  close(s->listen_fd);
+}
+
+static void
+stand_in_free(struct http_stand_in *s)
+{
+  g_string_free(s->head, TRUE);
+  g_string_free(s->body, TRUE);
+  for (guint i = 0; i < s->bodies->len; i++) {
+    g_string_free(g_ptr_array_index(s->bodies, i), TRUE);
+  }
+  g_ptr_array_free(s->bodies, TRUE);
+}
+
+/* Parse the body of the index-th request, after stand_in_stop() */
+static json_t *
+stand_in_request(const struct http_stand_in *s, guint index)
+{
+  const GString *body = g_ptr_array_index(s->bodies, index);
+  json_t *request = json_loadb(body->str, body->len, 0, NULL);
+
+  assert_non_null(request);
+  return request;
+}
+
+/******************************************************************************/
+
+static void
+client_on_state(struct upstream *up, void *user)
+{
+  struct test_client *c = user;
+
+  if (up->state == UPSTREAM_CONNECTED) {
+    c->connected++;
+  }
+}
+
+static void
+client_on_message(struct upstream *up, const unsigned char *msg, size_t len, void *user)
+{
+  struct test_client *c = user;
+  json_t *root = json_loadb((const char *)msg, len, 0, NULL);
+  (void)up;
+
+  if (root && (json_object_get(root, "cgi_update_result") || json_object_get(root, "error"))) {
+    json_t *result = json_object_get(root, "cgi_update_result");
+    if (result) {
+      if (!c->results) {
+        c->results = json_array();
+      }
+      json_array_append(c->results, result);
+    }
+    json_decref(c->reply);
+    c->reply = root;
+    c->replies++;
+    return;
+  }
+  json_decref(root);
+}
+
+static void
+client_send(struct test_client *c, json_t *message)
+{
+  char *json = json_dumps(message, JSON_COMPACT);
+
+  assert_non_null(json);
+  upstream_send(&c->up, json, strlen(json));
+  free(json);
+}
+
+/* updateWidget request of about body_len bytes once serialized */
+static json_t *
+build_update_widget(size_t body_len)
+{
+  json_t *request = json_pack("{s:s, s:s, s:{s:{s:i, s:s, s:b}, s:{s:s}}}",
+                              "apiVersion",
+                              "2.0",
+                              "method",
+                              "updateWidget",
+                              "params",
+                              "generalParams",
+                              "id",
+                              TEST_WIDGET_ID,
+                              "type",
+                              "linegraph",
+                              "isVisible",
+                              1,
+                              "widgetParams",
+                              "title",
+                              "");
+  assert_non_null(request);
+
+  char *compact = json_dumps(request, JSON_COMPACT);
+  size_t base_len = strlen(compact);
+  free(compact);
+  assert_true(body_len > base_len);
+
+  char *title = g_strnfill(body_len - base_len, 'x');
+  json_object_set_new(json_object_get(json_object_get(request, "params"), "widgetParams"),
+                      "title",
+                      json_string(title));
+  g_free(title);
+
+  return request;
+}
+
+/* Send the n-th update of the test widget; returns the request for comparison */
+static json_t *
+send_numbered_update(struct test_client *c, unsigned int n)
+{
+  json_t *request = build_update_widget(256);
+  char title[32];
+
+  snprintf(title, sizeof(title), "update %u", n);
+  json_object_set_new(json_object_get(json_object_get(request, "params"), "widgetParams"), "title", json_string(title));
+  json_t *message = json_pack("{s:{s:s, s:O}}", "cgi_update", "target", "widget", "request", request);
+  assert_non_null(message);
+  client_send(c, message);
+  json_decref(message);
+
+  return request;
+}
+
+static void
+drive_until(volatile size_t *count, size_t expected)
+{
+  test_support_wait_for_callback_count(g_main_context_default(), count, expected, TEST_TIMEOUT_US);
+}
+
+/* Run the main loop for duration_us */
+static void
+drive_for(gint64 duration_us)
+{
+  gint64 deadline = g_get_monotonic_time() + duration_us;
+
+  while (g_get_monotonic_time() < deadline) {
+    if (!g_main_context_iteration(g_main_context_default(), FALSE)) {
+      g_usleep(1000);
+    }
+  }
+}
+
+static json_int_t
+result_integer(const json_t *results, size_t index, const char *key)
+{
+  return json_integer_value(json_object_get(json_array_get(results, index), key));
+}
+
+/******************************************************************************/
+
+static void
+test_full_size_update_widget_is_forwarded(void **state)
+{
+  struct app_state app;
+  struct http_stand_in stand_in;
+  struct test_client client;
+  (void)state;
+
+  memset(&app, 0, sizeof(app));
+  memset(&client, 0, sizeof(client));
+  stand_in_start(&stand_in, 1, 0);
+
+  char address[32];
+  snprintf(address, sizeof(address), "127.0.0.1:%d", stand_in.port);
+  setenv("CGI_PROXY_CREDENTIALS", "user:pass", 1);
+  assert_true(cgi_proxy_configure(address));
+  assert_true(ws_server_start(&app, TEST_WS_PORT));
+
+  upstream_add(&client.up, "127.0.0.1", TEST_WS_PORT, client_on_message, client_on_state, &client);
+  drive_until(&client.connected, 1);
+
+  /* The largest request the proxy forwards, far above the regular receive limit */
+  json_t *request = build_update_widget(MAX_CGI_PROXY_BODY_LENGTH);
+  json_t *message = json_pack("{s:{s:s, s:O}}", "cgi_update", "target", "widget", "request", request);
+  assert_non_null(message);
+  client_send(&client, message);
+  json_decref(message);
+  drive_until(&client.replies, 1);
+
+  json_t *result = json_object_get(client.reply, "cgi_update_result");
+  assert_non_null(result);
+  assert_string_equal(json_string_value(json_object_get(result, "target")), "widget");
+  assert_int_equal(json_integer_value(json_object_get(result, "id")), TEST_WIDGET_ID);
+  assert_int_equal(json_integer_value(json_object_get(result, "status")), 200);
+  assert_null(json_object_get(result, "error"));
+  assert_non_null(json_object_get(result, "response"));
+
+  /* The stand-in received the request unchanged, with authentication */
+  stand_in_stop(&stand_in);
+  assert_non_null(strstr(stand_in.head->str, "post /axis-cgi/overlaywidget/overlaywidget.cgi http/1.1\r\n"));
+  assert_non_null(strstr(stand_in.head->str, "authorization: basic dxnlcjpwyxnz\r\n"));
+  json_t *forwarded = json_loadb(stand_in.body->str, stand_in.body->len, 0, NULL);
+  assert_non_null(forwarded);
+  assert_true(json_equal(forwarded, request));
+  json_decref(forwarded);
+  json_decref(request);
+  stand_in_free(&stand_in);
+
+  upstream_remove(&client.up);
+  json_decref(client.reply);
+  json_decref(client.results);
+  ws_server_stop();
+  unsetenv("CGI_PROXY_CREDENTIALS");
+}
+
+static void
+test_burst_behind_slow_reply_is_coalesced(void **state)
+{
+  struct app_state app;
+  struct http_stand_in stand_in;
+  struct test_client client;
+  json_t *first = NULL;
+  json_t *latest = NULL;
+  (void)state;
+
+  memset(&app, 0, sizeof(app));
+  memset(&client, 0, sizeof(client));
+  /* Room for one request more than expected, to catch an extra forward */
+  stand_in_start(&stand_in, 3, (gint64)TEST_SLOW_REPLY_MS * 1000);
+
+  char address[32];
+  snprintf(address, sizeof(address), "127.0.0.1:%d", stand_in.port);
+  unsetenv("CGI_PROXY_CREDENTIALS");
+  assert_true(cgi_proxy_configure(address));
+  assert_true(ws_server_start(&app, TEST_WS_PORT));
+
+  upstream_add(&client.up, "127.0.0.1", TEST_WS_PORT, client_on_message, client_on_state, &client);
+  drive_until(&client.connected, 1);
+
+  /* The first update goes out at once, the others wait behind its slow reply */
+  for (unsigned int n = 1; n <= TEST_BURST_UPDATES; n++) {
+    json_t *request = send_numbered_update(&client, n);
+    if (n == 1) {
+      first = request;
+    } else {
+      json_decref(latest);
+      latest = request;
+    }
+  }
+  drive_until(&client.replies, 2);
+  drive_for(5 * CGI_PROXY_INTERVAL_MS * 1000);
+  stand_in_stop(&stand_in);
+
+  /* Only the first and the latest update reached the device, one at a time */
+  assert_int_equal(stand_in.bodies->len, 2);
+  assert_int_equal(g_atomic_int_get(&stand_in.overlaps), 0);
+  json_t *forwarded = stand_in_request(&stand_in, 0);
+  assert_true(json_equal(forwarded, first));
+  json_decref(forwarded);
+  forwarded = stand_in_request(&stand_in, 1);
+  assert_true(json_equal(forwarded, latest));
+  json_decref(forwarded);
+
+  /* The second result replaced all updates between the first and the latest */
+  assert_int_equal(client.replies, 2);
+  assert_int_equal(result_integer(client.results, 0, "coalesced"), 0);
+  assert_int_equal(result_integer(client.results, 1, "coalesced"), TEST_BURST_UPDATES - 2);
+  assert_int_equal(result_integer(client.results, 0, "status"), 200);
+  assert_int_equal(result_integer(client.results, 1, "status"), 200);
+  /* The first waited for the slow reply, the latest for that reply and its own request */
+  assert_true(result_integer(client.results, 0, "latency_ms") >= TEST_SLOW_REPLY_MS);
+  assert_true(result_integer(client.results, 0, "http_ms") >= TEST_SLOW_REPLY_MS);
+  assert_true(result_integer(client.results, 1, "latency_ms") >= TEST_SLOW_REPLY_MS / 2);
+  assert_true(result_integer(client.results, 1, "latency_ms") >= result_integer(client.results, 1, "http_ms"));
+
+  json_decref(first);
+  json_decref(latest);
+  stand_in_free(&stand_in);
+  upstream_remove(&client.up);
+  json_decref(client.reply);
+  json_decref(client.results);
+  ws_server_stop();
+}
+
+static void
+test_update_stream_is_paced(void **state)
+{
+  struct app_state app;
+  struct http_stand_in stand_in;
+  struct test_client client;
+  json_t *latest = NULL;
+  unsigned int sent = 0;
+  (void)state;
+
+  memset(&app, 0, sizeof(app));
+  memset(&client, 0, sizeof(client));
+  stand_in_start(&stand_in, TEST_STREAM_MS / TEST_STREAM_PERIOD_MS, 0);
+
+  char address[32];
+  snprintf(address, sizeof(address), "127.0.0.1:%d", stand_in.port);
+  unsetenv("CGI_PROXY_CREDENTIALS");
+  assert_true(cgi_proxy_configure(address));
+  assert_true(ws_server_start(&app, TEST_WS_PORT));
+
+  upstream_add(&client.up, "127.0.0.1", TEST_WS_PORT, client_on_message, client_on_state, &client);
+  drive_until(&client.connected, 1);
+
+  /* A drag: one update every TEST_STREAM_PERIOD_MS, far above the forward rate */
+  gint64 start_us = g_get_monotonic_time();
+  while (g_get_monotonic_time() - start_us < (gint64)TEST_STREAM_MS * 1000) {
+    json_decref(latest);
+    latest = send_numbered_update(&client, ++sent);
+    drive_for(TEST_STREAM_PERIOD_MS * 1000);
+  }
+  drive_for(5 * CGI_PROXY_INTERVAL_MS * 1000);
+  gint64 elapsed_ms = (g_get_monotonic_time() - start_us) / 1000;
+  stand_in_stop(&stand_in);
+
+  /* At most one forward per interval (less the timer slack), never two in flight */
+  guint forwarded = stand_in.bodies->len;
+  assert_true(forwarded >= 2);
+  assert_true(forwarded < sent);
+  assert_true(forwarded <= elapsed_ms / (CGI_PROXY_INTERVAL_MS - TEST_INTERVAL_SLACK_MS) + 1);
+  assert_int_equal(g_atomic_int_get(&stand_in.overlaps), 0);
+  assert_int_equal(client.replies, forwarded);
+
+  /* The latest update is not lost */
+  json_t *last = stand_in_request(&stand_in, forwarded - 1);
+  assert_true(json_equal(last, latest));
+  json_decref(last);
+
+  /* Past the first rate window the reported rate is known and within the pacing */
+  double rate_hz = json_number_value(json_object_get(json_array_get(client.results, forwarded - 1), "rate_hz"));
+  assert_true(rate_hz > 0.0);
+  assert_true(rate_hz <= 1000.0 / (CGI_PROXY_INTERVAL_MS - TEST_INTERVAL_SLACK_MS));
+
+  json_decref(latest);
+  stand_in_free(&stand_in);
+  upstream_remove(&client.up);
+  json_decref(client.reply);
+  json_decref(client.results);
+  ws_server_stop();
+}
+
+static void
+test_other_commands_keep_receive_limit(void **state)
+{
+  struct app_state app;
+  struct test_client client;
+  (void)state;
+
+  memset(&app, 0, sizeof(app));
+  memset(&client, 0, sizeof(client));
+  unsetenv("CGI_PROXY_CREDENTIALS");
+  assert_true(cgi_proxy_configure("127.0.0.1:9"));
+  assert_true(ws_server_start(&app, TEST_WS_PORT));
+
+  upstream_add(&client.up, "127.0.0.1", TEST_WS_PORT, client_on_message, client_on_state, &client);
+  drive_until(&client.connected, 1);
+
+  char *padding = g_strnfill(MAX_RECEIVE_MESSAGE_LENGTH, ' ');
+  char *oversize = g_strdup_printf("{\"storage\":true%s}", padding);
+  upstream_send(&client.up, oversize, strlen(oversize));
+  g_free(oversize);
+  g_free(padding);
+  drive_until(&client.replies, 1);
+
+  json_t *error = json_object_get(client.reply, "error");
+  assert_non_null(error);
+  assert_string_equal(json_string_value(json_object_get(error, "type")), "control_message_too_large");
+
+  upstream_remove(&client.up);
+  json_decref(client.reply);
+  ws_server_stop();
+}
+
+int
+main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_full_size_update_widget_is_forwarded),
+    cmocka_unit_test(test_burst_behind_slow_reply_is_coalesced),
+    cmocka_unit_test(test_update_stream_is_paced),
+    cmocka_unit_test(test_other_commands_keep_receive_limit),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
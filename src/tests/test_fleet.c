@@ -0,0 +1,535 @@
+/* test_fleet.c
+ *
+ * An aggregator loads a device list of scripted WebSocket stand-ins and one
+ * unreachable device. However many clients watch the fleet, every device
+ * gets a single { "stats_stream": true } subscription. The fleet view reports
+ * the per-device rows, the up/stale/down counts and the percentiles of the
+ * known device samples, and a device that stops sending turns stale after
+ * FLEET_STALE_MS.
+ */
+#include "test_support.h"
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include <jansson.h>
+
+#include "app_state.h"
+#include "fleet.h"
+#include "upstream.h"
+#include "ws_server.h"
+
+#define TEST_WS_PORT 19732
+#define TEST_TIMEOUT_US (10 * G_USEC_PER_SEC)
+#define TEST_VIEWERS 3
+#define TEST_DEVICES 3
+/* Period of the frames of the devices that keep streaming */
+#define TEST_FRAME_INTERVAL_US (250 * 1000)
+
+#define TEST_SUBSCRIBE_JSON "{\"stats_stream\":true}"
+#define TEST_WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/* One device: a WebSocket server on 127.0.0.1 for a single connection, run in
+ * its own thread. It answers the subscription with stats frames carrying the
+ * given values, once or every TEST_FRAME_INTERVAL_US.
+ */
+struct device_stand_in {
+  const char *name;
+  double cpu;
+  long mem_available_kb;
+  double load1;
+  bool repeat;
+
+  int listen_fd;
+  int port;
+  GThread *thread;
+  volatile gint stop;
+  /* Connections accepted, text messages received and subscriptions among them */
+  volatile gint connections;
+  volatile gint messages;
+  volatile gint subscriptions;
+  /* Frames sent */
+  volatile gint frames;
+};
+
+/* WebSocket client of the aggregator */
+struct test_viewer {
+  struct upstream up;
+  volatile size_t connected;
+  volatile size_t views;
+  /* Last fleet view */
+  json_t *view;
+};
+
+/******************************************************************************/
+
+static bool
+write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+
+  return true;
+}
+
+/* Send one unmasked server frame (payloads here are below 64 KiB) */
+static bool
+send_frame(int fd, unsigned char opcode, const void *payload, size_t len)
+{
+  unsigned char head[4];
+  size_t head_len = 2;
+
+  head[0] = 0x80 | opcode;
+  if (len < 126) {
+    head[1] = (unsigned char)len;
+  } else {
+    head[1] = 126;
+    head[2] = (unsigned char)(len >> 8);
+    head[3] = (unsigned char)len;
+    head_len = 4;
+  }
+
+  return write_all(fd, head, head_len) && write_all(fd, payload, len);
+}
+
+static bool
+send_stats_frame(struct device_stand_in *s, int fd)
+{
+  gint seq = g_atomic_int_add(&s->frames, 1) + 1;
+  char *json = g_strdup_printf("{\"seq\":%d,\"ts\":%d,\"mono_ms\":%d,\"cpu\":%.1f,\"load1\":%.2f,"
+                               "\"uptime_s\":100.0,\"mem_total_kb\":1000,\"mem_available_kb\":%ld}",
+                               seq,
+                               1000 + seq,
+                               1000 + seq,
+                               s->cpu,
+                               s->load1,
+                               s->mem_available_kb);
+  bool ok = send_frame(fd, 0x1, json, strlen(json));
+
+  g_free(json);
+  return ok;
+}
+
+/* Read the upgrade request and accept it; false if the peer went away.
+ *
+ * Runs in the stand-in thread, so failures are returned rather than asserted.
+ */
+static bool
+accept_handshake(int fd)
+{
+  GString *head = g_string_new(NULL);
+  char buf[1024];
+  const char *key = NULL;
+  const char *end = NULL;
+
+  while (!(end = strstr(head->str, "\r\n\r\n"))) {
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n <= 0) {
+      g_string_free(head, TRUE);
+      return false;
+    }
+    g_string_append_len(head, buf, n);
+  }
+
+  /* The key is case sensitive, only the header name is matched without case */
+  for (const char *line = head->str; line < end; line = strstr(line, "\r\n") + 2) {
+    if (g_ascii_strncasecmp(line, "sec-websocket-key:", strlen("sec-websocket-key:")) == 0) {
+      key = line + strlen("sec-websocket-key:");
+      break;
+    }
+  }
+  if (!key) {
+    g_string_free(head, TRUE);
+    return false;
+  }
+  while (*key == ' ') {
+    key++;
+  }
+
+  guint8 digest[20];
+  gsize digest_len = sizeof(digest);
+  GChecksum *sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+  g_checksum_update(sha1, (const guchar *)key, (gssize)strcspn(key, "\r\n"));
+  g_checksum_update(sha1, (const guchar *)TEST_WS_GUID, -1);
+  g_checksum_get_digest(sha1, digest, &digest_len);
+  g_checksum_free(sha1);
+  g_string_free(head, TRUE);
+
+  gchar *accept_key = g_base64_encode(digest, digest_len);
+  char *response = g_strdup_printf("HTTP/1.1 101 Switching Protocols\r\n"
+                                   "Upgrade: websocket\r\n"
+                                   "Connection: Upgrade\r\n"
+                                   "Sec-WebSocket-Accept: %s\r\n"
+                                   "Sec-WebSocket-Protocol: sysstats\r\n"
+                                   "\r\n",
+                                   accept_key);
+  bool ok = write_all(fd, response, strlen(response));
+
+  g_free(response);
+  g_free(accept_key);
+  return ok;
+}
+
+/* Handle the complete client frames at the start of rx; false on close */
+static bool
+handle_client_frames(struct device_stand_in *s, int fd, GByteArray *rx)
+{
+  while (rx->len >= 2) {
+    const guint8 *p = rx->data;
+    unsigned char opcode = p[0] & 0x0f;
+    size_t len = p[1] & 0x7f;
+    size_t head_len = 2;
+
+    if (len == 126) {
+      if (rx->len < 4) {
+        break;
+      }
+      len = ((size_t)p[2] << 8) | p[3];
+      head_len = 4;
+    }
+    /* The aggregator only sends small messages */
+    if (len == 127) {
+      return false;
+    }
+    /* Client frames are masked */
+    if (rx->len < head_len + 4 + len) {
+      break;
+    }
+
+    char *payload = g_malloc(len + 1);
+    for (size_t i = 0; i < len; i++) {
+      payload[i] = (char)(p[head_len + 4 + i] ^ p[head_len + (i % 4)]);
+    }
+    payload[len] = '\0';
+    g_byte_array_remove_range(rx, 0, (guint)(head_len + 4 + len));
+
+    bool open = true;
+    if (opcode == 0x1) {
+      g_atomic_int_inc(&s->messages);
+      if (strcmp(payload, TEST_SUBSCRIBE_JSON) == 0) {
+        g_atomic_int_inc(&s->subscriptions);
+        open = send_stats_frame(s, fd);
+      }
+    } else if (opcode == 0x9) {
+      open = send_frame(fd, 0xa, payload, len);
+    } else if (opcode == 0x8) {
+      open = false;
+    }
+    g_free(payload);
+    if (!open) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static gpointer
+device_thread(gpointer user_data)
+{
+  struct device_stand_in *s = user_data;
+  GByteArray *rx = g_byte_array_new();
+  gint64 next_frame_us = 0;
+  int fd = accept(s->listen_fd, NULL, NULL);
+
+  if (fd < 0) {
+    g_byte_array_unref(rx);
+    return NULL;
+  }
+  g_atomic_int_inc(&s->connections);
+
+  bool open = accept_handshake(fd);
+  while (open && !g_atomic_int_get(&s->stop)) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    guint8 buf[1024];
+
+    if (poll(&pfd, 1, 20) > 0) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n <= 0) {
+        break;
+      }
+      g_byte_array_append(rx, buf, (guint)n);
+      open = handle_client_frames(s, fd, rx);
+    }
+
+    /* Streaming devices keep sending once subscribed */
+    gint64 now_us = g_get_monotonic_time();
+    if (open && s->repeat && g_atomic_int_get(&s->subscriptions) > 0 && now_us >= next_frame_us) {
+      open = send_stats_frame(s, fd);
+      next_frame_us = now_us + TEST_FRAME_INTERVAL_US;
+    }
+  }
+
+  g_byte_array_unref(rx);
+  close(fd);
+  return NULL;
+}
+
+/* Bind a listening socket on 127.0.0.1 and an ephemeral port */
+static int
+listen_loopback(int *port)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  assert_true(fd >= 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  assert_int_equal(bind(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+  assert_int_equal(listen(fd, 4), 0);
+  assert_int_equal(getsockname(fd, (struct sockaddr *)&addr, &addr_len), 0);
+  *port = ntohs(addr.sin_port);
+
+  return fd;
+}
+
+static void
+device_start(struct device_stand_in *s)
+{
+  s->listen_fd = listen_loopback(&s->port);
+  s->thread = g_thread_new(s->name, device_thread, s);
+}
+
+static void
+device_stop(struct device_stand_in *s)
+{
+  g_atomic_int_set(&s->stop, 1);
+  /* Unblocks accept() if the aggregator never connected */
+  shutdown(s->listen_fd, SHUT_RDWR);
+  g_thread_join(s->thread);
+  close(s->listen_fd);
+}
+
+/******************************************************************************/
+
+static void
+viewer_on_state(struct upstream *up, void *user)
+{
+  struct test_viewer *v = user;
+
+  if (up->state == UPSTREAM_CONNECTED) {
+    v->connected++;
+  }
+}
+
+static void
+viewer_on_message(struct upstream *up, const unsigned char *msg, size_t len, void *user)
+{
+  struct test_viewer *v = user;
+  json_t *root = json_loadb((const char *)msg, len, 0, NULL);
+  (void)up;
+
+  if (root && json_object_get(root, "fleet")) {
+    json_decref(v->view);
+    v->view = root;
+    v->views++;
+    return;
+  }
+  json_decref(root);
+}
+
+static void
+drive_until(volatile size_t *count, size_t expected)
+{
+  test_support_wait_for_callback_count(g_main_context_default(), count, expected, TEST_TIMEOUT_US);
+}
+
+static json_int_t
+view_count(const json_t *view, const char *key)
+{
+  return json_integer_value(json_object_get(json_object_get(view, "fleet"), key));
+}
+
+/* Wait for a view of the viewer with the given up and stale counts */
+static void
+wait_for_view(struct test_viewer *v, json_int_t up, json_int_t stale, gint64 timeout_us)
+{
+  gint64 deadline = g_get_monotonic_time() + timeout_us;
+
+  while (!(v->view && view_count(v->view, "up") == up && view_count(v->view, "stale") == stale) &&
+         g_get_monotonic_time() < deadline) {
+    size_t views = v->views;
+    test_support_wait_for_callback_count(g_main_context_default(), &v->views, views + 1, timeout_us);
+  }
+
+  assert_non_null(v->view);
+  assert_int_equal(view_count(v->view, "up"), up);
+  assert_int_equal(view_count(v->view, "stale"), stale);
+}
+
+/* Values are exact or percentages of 1000 kB, so a small epsilon is enough */
+static void
+assert_number(const json_t *value, double expected)
+{
+  assert_true(json_is_number(value));
+  assert_true(fabs(json_number_value(value) - expected) < 1e-6);
+}
+
+static const json_t *
+find_row(const json_t *view, const char *name)
+{
+  const json_t *rows = json_object_get(json_object_get(view, "fleet"), "devices");
+
+  for (size_t i = 0; i < json_array_size(rows); i++) {
+    const json_t *row = json_array_get(rows, i);
+    if (strcmp(json_string_value(json_object_get(row, "name")), name) == 0) {
+      return row;
+    }
+  }
+
+  fail_msg("No row for device %s", name);
+  return NULL;
+}
+
+static void
+assert_percentiles(const json_t *view,
+                   const char *metric,
+                   json_int_t count,
+                   double p50,
+                   double p90,
+                   double p99,
+                   double max,
+                   double mean)
+{
+  const json_t *p = json_object_get(json_object_get(json_object_get(view, "fleet"), "percentiles"), metric);
+
+  assert_non_null(p);
+  assert_int_equal(json_integer_value(json_object_get(p, "count")), count);
+  assert_number(json_object_get(p, "p50"), p50);
+  assert_number(json_object_get(p, "p90"), p90);
+  assert_number(json_object_get(p, "p99"), p99);
+  assert_number(json_object_get(p, "max"), max);
+  assert_number(json_object_get(p, "mean"), mean);
+}
+
+static void
+assert_row(const json_t *view, const struct device_stand_in *s, const char *state)
+{
+  const json_t *row = find_row(view, s->name);
+
+  assert_string_equal(json_string_value(json_object_get(row, "state")), state);
+  assert_int_equal(json_integer_value(json_object_get(row, "port")), s->port);
+  assert_number(json_object_get(row, "cpu"), s->cpu);
+  assert_number(json_object_get(row, "load1"), s->load1);
+  assert_int_equal(json_integer_value(json_object_get(row, "mem_total_kb")), 1000);
+  assert_int_equal(json_integer_value(json_object_get(row, "mem_available_kb")), s->mem_available_kb);
+  assert_number(json_object_get(row, "mem_used_percent"), (double)(1000 - s->mem_available_kb) / 10.0);
+}
+
+/******************************************************************************/
+
+static void
+test_fleet_view_of_stand_in_devices(void **state)
+{
+  struct app_state app;
+  struct test_viewer viewers[TEST_VIEWERS];
+  /* a and b keep streaming, c sends one frame and falls silent */
+  struct device_stand_in devices[TEST_DEVICES] = {
+    { .name = "a", .cpu = 10.0, .mem_available_kb = 800, .load1 = 0.5, .repeat = true },
+    { .name = "b", .cpu = 20.0, .mem_available_kb = 600, .load1 = 1.0, .repeat = true },
+    { .name = "c", .cpu = 60.0, .mem_available_kb = 100, .load1 = 3.0, .repeat = false },
+  };
+  (void)state;
+
+  memset(&app, 0, sizeof(app));
+  memset(viewers, 0, sizeof(viewers));
+  for (size_t i = 0; i < TEST_DEVICES; i++) {
+    device_start(&devices[i]);
+  }
+
+  /* A port nobody listens on stands in for an unreachable device */
+  int down_port = 0;
+  close(listen_loopback(&down_port));
+
+  gchar *path = NULL;
+  int fd = g_file_open_tmp("fleet_XXXXXX.txt", &path, NULL);
+  assert_true(fd >= 0);
+  GString *list = g_string_new("# test fleet\n");
+  for (size_t i = 0; i < TEST_DEVICES; i++) {
+    g_string_append_printf(list, "127.0.0.1:%d %s\n", devices[i].port, devices[i].name);
+  }
+  g_string_append_printf(list, "127.0.0.1:%d down\n", down_port);
+  assert_true(write_all(fd, list->str, list->len));
+  close(fd);
+  g_string_free(list, TRUE);
+
+  assert_true(fleet_load(path));
+  unlink(path);
+  g_free(path);
+  assert_true(ws_server_start(&app, TEST_WS_PORT));
+
+  for (size_t i = 0; i < TEST_VIEWERS; i++) {
+    upstream_add(&viewers[i].up, "127.0.0.1", TEST_WS_PORT, viewer_on_message, viewer_on_state, &viewers[i]);
+    drive_until(&viewers[i].connected, 1);
+    upstream_send(&viewers[i].up, "{\"fleet_stream\":true}", strlen("{\"fleet_stream\":true}"));
+    drive_until(&viewers[i].views, 1);
+  }
+
+  /* All three devices fresh: percentiles over 10/20/60 % CPU, 20/40/90 % memory, 0.5/1/3 load */
+  wait_for_view(&viewers[0], TEST_DEVICES, 0, TEST_TIMEOUT_US);
+  json_t *view = viewers[0].view;
+  assert_int_equal(view_count(view, "total"), TEST_DEVICES + 1);
+  assert_int_equal(view_count(view, "down"), 1);
+  for (size_t i = 0; i < TEST_DEVICES; i++) {
+    assert_row(view, &devices[i], "up");
+  }
+  assert_string_not_equal(json_string_value(json_object_get(find_row(view, "down"), "state")), "up");
+  assert_null(json_object_get(find_row(view, "down"), "cpu"));
+  assert_percentiles(view, "cpu", 3, 20.0, 60.0, 60.0, 60.0, 30.0);
+  assert_percentiles(view, "mem_used_percent", 3, 40.0, 90.0, 90.0, 90.0, 50.0);
+  assert_percentiles(view, "load1", 3, 1.0, 3.0, 3.0, 3.0, 1.5);
+
+  /* c is still connected but silent: stale after FLEET_STALE_MS, out of the percentiles */
+  wait_for_view(&viewers[0], TEST_DEVICES - 1, 1, (FLEET_STALE_MS + 2 * FLEET_INTERVAL_MS) * 1000);
+  view = viewers[0].view;
+  assert_int_equal(view_count(view, "down"), 1);
+  assert_row(view, &devices[0], "up");
+  assert_row(view, &devices[1], "up");
+  assert_row(view, &devices[2], "stale");
+  assert_true(json_integer_value(json_object_get(find_row(view, "c"), "age_ms")) >= FLEET_STALE_MS);
+  assert_percentiles(view, "cpu", 2, 10.0, 20.0, 20.0, 20.0, 15.0);
+  assert_percentiles(view, "mem_used_percent", 2, 20.0, 40.0, 40.0, 40.0, 30.0);
+  assert_percentiles(view, "load1", 2, 0.5, 1.0, 1.0, 1.0, 0.75);
+
+  /* Every viewer got the views; no viewer opened a device connection of its own */
+  for (size_t i = 0; i < TEST_VIEWERS; i++) {
+    assert_true(viewers[i].views >= 2);
+    upstream_remove(&viewers[i].up);
+    json_decref(viewers[i].view);
+  }
+  ws_server_stop();
+  fleet_stop();
+
+  for (size_t i = 0; i < TEST_DEVICES; i++) {
+    device_stop(&devices[i]);
+    assert_int_equal(g_atomic_int_get(&devices[i].connections), 1);
+    assert_int_equal(g_atomic_int_get(&devices[i].messages), 1);
+    assert_int_equal(g_atomic_int_get(&devices[i].subscriptions), 1);
+  }
+  assert_int_equal(g_atomic_int_get(&devices[2].frames), 1);
+}
+
+int
+main(void)
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_fleet_view_of_stand_in_devices),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
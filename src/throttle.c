@@ -0,0 +1,177 @@
+/* throttle.c
+ *
+ * Adaptive self-throttling of the sampler.
+ *
+ * - The backend shares the CPUs with the camera's video pipeline. Every
+ *   THROTTLE_WINDOW_MS the process CPU time (CLOCK_PROCESS_CPUTIME_ID) is
+ *   compared with the configured budget, and the system CPU usage with
+ *   THROTTLE_SYSTEM_CPU_HIGH.
+ * - Over budget or on a busy system the level goes up by one: the sample
+ *   and stream period doubles and expensive sources are switched off.
+ * - The level goes down by one only after THROTTLE_CALM_WINDOWS windows
+ *   below half the budget on a system below THROTTLE_SYSTEM_CPU_LOW, so the
+ *   cheaper cadence does not immediately flip back.
+ */
+#include <syslog.h>
+#include <time.h>
+
+#include "proc.h"
+#include "throttle.h"
+#include "util.h"
+
+/* Length of one measurement window */
+#define THROTTLE_WINDOW_MS 5000U
+/* System CPU usage (%) that counts as overload, and as headroom */
+#define THROTTLE_SYSTEM_CPU_HIGH 95.0
+#define THROTTLE_SYSTEM_CPU_LOW 80.0
+/* Consecutive calm windows before one level is released */
+#define THROTTLE_CALM_WINDOWS 3U
+
+static struct {
+  double budget_percent;
+  unsigned int level;
+  /* Sampling ticks since the last sample */
+  unsigned int ticks;
+  /* Start of the current window */
+  uint64_t window_start_mono_ms;
+  uint64_t window_start_cpu_ns;
+  unsigned int calm_windows;
+  double cost_percent;
+} throttle;
+
+/******************************************************************************/
+
+static uint64_t
+process_cpu_ns(void)
+{
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void
+set_level(unsigned int level, double system_cpu)
+{
+  if (level == throttle.level) {
+    return;
+  }
+
+  syslog(LOG_INFO,
+         "Throttle level %u -> %u (own CPU %.2f%% of one core, budget %.2f%%, system CPU %.1f%%)",
+         throttle.level,
+         level,
+         throttle.cost_percent,
+         throttle.budget_percent,
+         system_cpu);
+  throttle.level = level;
+  throttle.ticks = 0;
+  proc_set_smaps_enabled(level == 0);
+}
+
+/******************************************************************************/
+
+void
+throttle_configure(double budget_percent)
+{
+  throttle.budget_percent = budget_percent > 0.0 ? budget_percent : 0.0;
+  throttle.level = 0;
+  throttle.ticks = 0;
+  throttle.window_start_mono_ms = 0;
+  throttle.calm_windows = 0;
+  throttle.cost_percent = 0.0;
+  proc_set_smaps_enabled(true);
+}
+
+bool
+throttle_enabled(void)
+{
+  return throttle.budget_percent > 0.0;
+}
+
+bool
+throttle_sample_due(void)
+{
+  if (++throttle.ticks < (1U << throttle.level)) {
+    return false;
+  }
+
+  throttle.ticks = 0;
+  return true;
+}
+
+void
+throttle_evaluate(const struct sys_stats *stats)
+{
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  uint64_t cpu_ns = process_cpu_ns();
+
+  if (!throttle_enabled() || !stats) {
+    return;
+  }
+
+  if (throttle.window_start_mono_ms == 0 || cpu_ns < throttle.window_start_cpu_ns) {
+    throttle.window_start_mono_ms = now_ms;
+    throttle.window_start_cpu_ns = cpu_ns;
+    return;
+  }
+  if (now_ms - throttle.window_start_mono_ms < THROTTLE_WINDOW_MS) {
+    return;
+  }
+
+  /* ns of CPU per ms of wall time: 1e6 ns/ms = 100 % of one core */
+  throttle.cost_percent =
+      (double)(cpu_ns - throttle.window_start_cpu_ns) / ((double)(now_ms - throttle.window_start_mono_ms) * 1e4);
+  throttle.window_start_mono_ms = now_ms;
+  throttle.window_start_cpu_ns = cpu_ns;
+
+  if (throttle.cost_percent > throttle.budget_percent || stats->cpu_usage >= THROTTLE_SYSTEM_CPU_HIGH) {
+    throttle.calm_windows = 0;
+    if (throttle.level < THROTTLE_MAX_LEVEL) {
+      set_level(throttle.level + 1, stats->cpu_usage);
+    }
+    return;
+  }
+
+  if (throttle.cost_percent < throttle.budget_percent / 2 && stats->cpu_usage < THROTTLE_SYSTEM_CPU_LOW) {
+    if (++throttle.calm_windows >= THROTTLE_CALM_WINDOWS && throttle.level > 0) {
+      throttle.calm_windows = 0;
+      set_level(throttle.level - 1, stats->cpu_usage);
+    }
+  } else {
+    throttle.calm_windows = 0;
+  }
+}
+
+unsigned int
+throttle_level(void)
+{
+  return throttle.level;
+}
+
+unsigned int
+throttle_interval_ms(void)
+{
+  return THROTTLE_BASE_INTERVAL_MS << throttle.level;
+}
+
+bool
+throttle_per_core_enabled(void)
+{
+  return throttle.level < 2;
+}
+
+double
+throttle_cost_percent(void)
+{
+  return throttle.cost_percent;
+}
+
+double
+throttle_budget_percent(void)
+{
+  return throttle.budget_percent;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "stats.h"
+
+/* Highest throttling level */
+#define THROTTLE_MAX_LEVEL 3
+
+/* Sample period at level 0; each level doubles it */
+#define THROTTLE_BASE_INTERVAL_MS 500U
+
+/* Enable adaptive throttling with a CPU budget in percent of one core
+ * (e.g. 0.5). 0 disables throttling (level 0 forever).
+ *
+ * Levels:
+ *   0  500 ms, all sources
+ *   1  1 s, no smaps_rollup (pss_kb/uss_kb read 0)
+ *   2  2 s, additionally no per-core CPU array
+ *   3  4 s
+ */
+void throttle_configure(double budget_percent);
+
+/* True if a budget is configured */
+bool throttle_enabled(void);
+
+/* Called on every sampling tick; false if this tick is skipped at the current level. */
+bool throttle_sample_due(void);
+
+/* Account the process CPU cost and system load of the last window and
+ * move the level. Called after every sample.
+ */
+void throttle_evaluate(const struct sys_stats *stats);
+
+/* Current level, 0 .. THROTTLE_MAX_LEVEL */
+unsigned int throttle_level(void);
+
+/* Current sample and stream period in ms */
+unsigned int throttle_interval_ms(void);
+
+/* False while the per-core CPU array is dropped from frames */
+bool throttle_per_core_enabled(void);
+
+/* Own CPU use of the last complete window in percent of one core */
+double throttle_cost_percent(void);
+
+/* Configured budget in percent of one core (0 = disabled) */
+double throttle_budget_percent(void);
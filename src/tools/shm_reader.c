@@ -0,0 +1,155 @@
+/* shm_reader.c
+ *
+ * Example reader of the shared-memory stats segment (backend option -m).
+ *
+ * Maps the segment with shm_stats_reader.h and prints the latest sample
+ * whenever its sequence number changes, polling at the given interval.
+ * With -H it prints the history ring once and exits. Reads are plain memory
+ * copies, the only system calls in the loop are the sleeps.
+ *
+ * The reader only depends on shm_stats.h and shm_stats_reader.h, both
+ * usable without the rest of the backend sources.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shm_stats_reader.h"
+
+static bool
+parse_uint_option(const char *arg, unsigned long max, unsigned long *out)
+{
+  char *endptr = NULL;
+  unsigned long value = strtoul(arg, &endptr, 10);
+
+  if (arg[0] == '\0' || arg[0] == '-' || *endptr != '\0' || value > max) {
+    return false;
+  }
+  *out = value;
+
+  return true;
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-n shm_name] [-i interval_ms] [-c count] [-H]\n"
+          "  -n shm_name    Segment name (default " SHM_STATS_DEFAULT_NAME ")\n"
+          "  -i interval_ms Poll interval (default 100)\n"
+          "  -c count       Exit after count new samples (default 0 = never)\n"
+          "  -H             Print the history ring and exit\n",
+          prog);
+}
+
+static void
+sleep_ms(unsigned long ms)
+{
+  struct timespec ts = { .tv_sec = (time_t)(ms / 1000), .tv_nsec = (long)(ms % 1000) * 1000000L };
+
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+  }
+}
+
+static int
+print_history(const struct shm_stats_reader *reader)
+{
+  struct shm_stats_history_entry entries[SHM_STATS_HISTORY_LENGTH];
+  size_t count = shm_stats_reader_read_history(reader, entries, SHM_STATS_HISTORY_LENGTH);
+
+  for (size_t i = 0; i < count; i++) {
+    printf("seq=%llu ts=%llu cpu=%.2f load1=%.2f mem_available_kb=%lld\n",
+           (unsigned long long)entries[i].seq,
+           (unsigned long long)entries[i].timestamp_ms,
+           entries[i].cpu_usage,
+           entries[i].load1,
+           (long long)entries[i].mem_available_kb);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct shm_stats_reader reader;
+  const char *name = SHM_STATS_DEFAULT_NAME;
+  unsigned long interval_ms = 100;
+  unsigned long max_count = 0;
+  unsigned long printed = 0;
+  uint64_t last_seq = 0;
+  bool history = false;
+  int opt;
+  int err;
+
+  while ((opt = getopt(argc, argv, "n:i:c:H")) != -1) {
+    switch (opt) {
+    case 'n':
+      name = optarg;
+      break;
+    case 'i':
+      if (!parse_uint_option(optarg, 60000, &interval_ms) || interval_ms == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'c':
+      if (!parse_uint_option(optarg, 1000000000UL, &max_count)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'H':
+      history = true;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  err = shm_stats_reader_open(&reader, name);
+  if (err != 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", name, strerror(err));
+    return EXIT_FAILURE;
+  }
+  if (history) {
+    int ret = print_history(&reader);
+    shm_stats_reader_close(&reader);
+    return ret;
+  }
+
+  for (;;) {
+    struct shm_stats_sample sample;
+    uint32_t flags = 0;
+
+    if (shm_stats_reader_read(&reader, &sample, &flags) && sample.seq != last_seq) {
+      last_seq = sample.seq;
+      printf("seq=%llu ts=%llu cpu=%.2f cores=%u load1=%.2f mem_available_kb=%lld/%lld\n",
+             (unsigned long long)sample.seq,
+             (unsigned long long)sample.timestamp_ms,
+             sample.cpu_usage,
+             sample.cpu_core_count,
+             sample.load1,
+             (long long)sample.mem_available_kb,
+             (long long)sample.mem_total_kb);
+      fflush(stdout);
+      if (max_count > 0 && ++printed >= max_count) {
+        break;
+      }
+    }
+    if (flags & SHM_STATS_FLAG_CLOSED) {
+      fprintf(stderr, "Backend stopped\n");
+      break;
+    }
+    sleep_ms(interval_ms);
+  }
+
+  shm_stats_reader_close(&reader);
+
+  return EXIT_SUCCESS;
+}
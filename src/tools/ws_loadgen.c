@@ -0,0 +1,907 @@
+/* ws_loadgen.c
+ *
+ * WebSocket load generator and latency probe for the sysstats protocol.
+ *
+ * Opens N client connections to a running backend, subscribes each connection
+ * according to a configurable role mix and optionally churns connections
+ * (close + reconnect) at a fixed rate. At the end of the run it prints a
+ * summary report, so server changes can be compared under identical load.
+ *
+ * Roles:
+ * - stats:   { "stats_stream": true }
+ * - logs:    { "log_stream": true }
+ * - monitor: { "stats_stream": true } followed by { "monitor": "<name>" }
+ *
+ * Measurements (per role):
+ * - Frame inter-arrival jitter: |arrival delta - interval| for consecutive
+ *   stats frames. Deltas spanning a dropped frame are excluded.
+ * - Sample-to-receive latency: local CLOCK_MONOTONIC at receive minus the
+ *   frame "mono_ms" field. Only meaningful when the tool runs on the same
+ *   host as the server (both clocks must share the same origin).
+ * - Dropped frames: missing sample intervals detected from gaps in "mono_ms".
+ * - Server CPU (optional, -S <pid>): utime + stime of the server process from
+ *   /proc/<pid>/stat, reported as percent of one core.
+ *
+ * The client is serviced from a GLib main loop timer, like the server. The
+ * service interval bounds the receive timestamp resolution.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <jansson.h>
+#include <libwebsockets.h>
+
+#include "proc.h"
+#include "stats.h"
+#include "util.h"
+#include "ws_limits.h"
+
+/* Client service interval, also the receive timestamp resolution */
+#define LOADGEN_SERVICE_INTERVAL_MS 2
+/* Period of the connection maintenance timer (reconnect, churn) */
+#define LOADGEN_MAINTENANCE_INTERVAL_MS 100
+/* Period of server CPU sampling */
+#define LOADGEN_CPU_SAMPLE_INTERVAL_MS 1000
+/* Upper bound for one reassembled server message */
+#define LOADGEN_MAX_MESSAGE_LENGTH (256 * 1024)
+/* Upper bound for the connection count */
+#define LOADGEN_MAX_CONNECTIONS 4096
+/* Maximum number of subscription commands per role */
+#define LOADGEN_MAX_COMMANDS 2
+#define LOADGEN_MAX_COMMAND_LENGTH 256
+
+enum loadgen_role {
+  LOADGEN_ROLE_STATS = 0,
+  LOADGEN_ROLE_LOGS,
+  LOADGEN_ROLE_MONITOR,
+  LOADGEN_ROLE_COUNT
+};
+
+static const char *const role_names[LOADGEN_ROLE_COUNT] = { "stats", "logs", "monitor" };
+
+/* One client connection slot. A slot is reconnected when its wsi closes. */
+struct loadgen_conn {
+  struct lws *wsi;
+  enum loadgen_role role;
+  bool established;
+  bool churned;        /* closed on purpose by the churn logic */
+  size_t next_command; /* index of the next subscription command to send */
+  uint64_t last_recv_mono_ms;
+  int64_t last_sample_mono_ms; /* server "mono_ms" of the last stats frame, -1 if none */
+  GByteArray *rx;              /* reassembly buffer for fragmented messages */
+};
+
+/* Counters and samples aggregated per role */
+struct loadgen_role_stats {
+  unsigned int connections;
+  uint64_t connects;
+  uint64_t connect_errors;
+  uint64_t unexpected_closes;
+  uint64_t churn_closes;
+  uint64_t frames;
+  uint64_t bytes;
+  uint64_t stats_frames;
+  uint64_t log_lines;
+  uint64_t error_frames;
+  uint64_t parse_errors;
+  uint64_t dropped_frames;
+  GArray *jitter_ms;  /* double */
+  GArray *latency_ms; /* double */
+};
+
+struct loadgen_config {
+  const char *host;
+  int port;
+  unsigned int connections;
+  unsigned int duration_s;
+  unsigned int mix[LOADGEN_ROLE_COUNT];
+  const char *monitor_name;
+  double churn_per_s;
+  pid_t server_pid;
+  unsigned int interval_ms;
+  bool json_output;
+};
+
+static struct loadgen_config config = {
+  .host = "127.0.0.1",
+  .port = 9000,
+  .connections = 10,
+  .duration_s = 30,
+  .mix = { 1, 0, 0 },
+  .monitor_name = APP_NAME,
+  .churn_per_s = 0.0,
+  .server_pid = 0,
+  .interval_ms = 500,
+  .json_output = false,
+};
+
+static struct lws_context *context = NULL;
+static GMainLoop *main_loop = NULL;
+static struct loadgen_conn *conns = NULL;
+static struct loadgen_role_stats role_stats[LOADGEN_ROLE_COUNT];
+static bool running = false;
+static double churn_credit = 0.0;
+static uint64_t start_mono_ms = 0;
+static uint64_t end_mono_ms = 0;
+
+/* Server CPU accounting */
+static uint64_t cpu_first_ticks = 0;
+static uint64_t cpu_first_mono_ms = 0;
+static uint64_t cpu_prev_ticks = 0;
+static uint64_t cpu_prev_mono_ms = 0;
+static uint64_t cpu_last_ticks = 0;
+static uint64_t cpu_last_mono_ms = 0;
+static GArray *cpu_samples = NULL; /* double, percent of one core per interval */
+
+/******************************************************************************/
+
+/* Read utime + stime of pid in clock ticks. */
+static bool
+read_process_ticks(pid_t pid, uint64_t *ticks_out)
+{
+  char path[MAX_PROC_PATH_LENGTH];
+  char line[MAX_PROC_LINE_LENGTH];
+  unsigned long long utime = 0;
+  unsigned long long stime = 0;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return false;
+  }
+  if (!fgets(line, sizeof(line), f)) {
+    fclose(f);
+    return false;
+  }
+  fclose(f);
+  if (!proc_parse_stat_times(line, &utime, &stime)) {
+    return false;
+  }
+  *ticks_out = utime + stime;
+
+  return true;
+}
+
+/* Convert a tick delta over elapsed_ms into percent of one core. */
+static double
+ticks_to_cpu_percent(uint64_t ticks, uint64_t elapsed_ms)
+{
+  long hz = sysconf(_SC_CLK_TCK);
+
+  if (hz <= 0 || elapsed_ms == 0) {
+    return 0.0;
+  }
+
+  return (double)ticks * 1000.0 * 100.0 / ((double)hz * (double)elapsed_ms);
+}
+
+static gboolean
+cpu_sample_cb(gpointer user_data)
+{
+  uint64_t ticks = 0;
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  (void)user_data;
+
+  if (!read_process_ticks(config.server_pid, &ticks)) {
+    return G_SOURCE_CONTINUE;
+  }
+  if (cpu_prev_mono_ms != 0 && ticks >= cpu_prev_ticks) {
+    double percent = ticks_to_cpu_percent(ticks - cpu_prev_ticks, now_ms - cpu_prev_mono_ms);
+    g_array_append_val(cpu_samples, percent);
+  }
+  cpu_prev_ticks = ticks;
+  cpu_prev_mono_ms = now_ms;
+  cpu_last_ticks = ticks;
+  cpu_last_mono_ms = now_ms;
+
+  return G_SOURCE_CONTINUE;
+}
+
+/******************************************************************************/
+
+/* Build the subscription command idx for role into out. Returns false when done. */
+static bool
+build_role_command(enum loadgen_role role, size_t idx, char *out, size_t out_size)
+{
+  switch (role) {
+  case LOADGEN_ROLE_STATS:
+    if (idx == 0) {
+      snprintf(out, out_size, "{ \"stats_stream\": true }");
+      return true;
+    }
+    return false;
+  case LOADGEN_ROLE_LOGS:
+    if (idx == 0) {
+      snprintf(out, out_size, "{ \"log_stream\": true }");
+      return true;
+    }
+    return false;
+  case LOADGEN_ROLE_MONITOR:
+    if (idx == 0) {
+      snprintf(out, out_size, "{ \"stats_stream\": true }");
+      return true;
+    }
+    if (idx == 1) {
+      json_t *cmd = json_pack("{s:s}", "monitor", config.monitor_name);
+      size_t len = cmd ? json_dumpb(cmd, out, out_size - 1, JSON_COMPACT) : 0;
+      json_decref(cmd);
+      if (len == 0 || len >= out_size) {
+        return false;
+      }
+      out[len] = '\0';
+      return true;
+    }
+    return false;
+  default:
+    return false;
+  }
+}
+
+/* Account one complete server message for conn. */
+static void
+handle_message(struct loadgen_conn *conn, const char *msg, size_t len)
+{
+  struct loadgen_role_stats *rs = &role_stats[conn->role];
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  json_error_t json_error;
+
+  rs->frames++;
+  rs->bytes += len;
+
+  json_t *root = json_loadb(msg, len, 0, &json_error);
+  if (!root || !json_is_object(root)) {
+    rs->parse_errors++;
+    json_decref(root);
+    return;
+  }
+
+  if (json_object_get(root, "error")) {
+    rs->error_frames++;
+  }
+  if (json_object_get(root, "log")) {
+    rs->log_lines++;
+  }
+
+  json_t *mono = json_object_get(root, "mono_ms");
+  if (json_is_integer(mono)) {
+    int64_t sample_ms = (int64_t)json_integer_value(mono);
+    bool gap = false;
+
+    rs->stats_frames++;
+
+    /* Sample-to-receive latency (same-host clocks only) */
+    if (sample_ms > 0 && now_ms >= (uint64_t)sample_ms) {
+      double latency = (double)(now_ms - (uint64_t)sample_ms);
+      g_array_append_val(rs->latency_ms, latency);
+    }
+
+    /* Dropped frames: intervals missing between consecutive samples */
+    if (conn->last_sample_mono_ms >= 0 && sample_ms > conn->last_sample_mono_ms) {
+      uint64_t delta = (uint64_t)(sample_ms - conn->last_sample_mono_ms);
+      uint64_t intervals = (delta + config.interval_ms / 2) / config.interval_ms;
+      if (intervals > 1) {
+        rs->dropped_frames += intervals - 1;
+        gap = true;
+      }
+    }
+
+    /* Inter-arrival jitter against the nominal cadence */
+    if (conn->last_recv_mono_ms != 0 && !gap && conn->last_sample_mono_ms >= 0) {
+      double arrival = (double)(now_ms - conn->last_recv_mono_ms);
+      double jitter = arrival > config.interval_ms ? arrival - config.interval_ms : config.interval_ms - arrival;
+      g_array_append_val(rs->jitter_ms, jitter);
+    }
+
+    conn->last_sample_mono_ms = sample_ms;
+    conn->last_recv_mono_ms = now_ms;
+  }
+
+  json_decref(root);
+}
+
+static void
+reset_conn(struct loadgen_conn *conn)
+{
+  conn->wsi = NULL;
+  conn->established = false;
+  conn->churned = false;
+  conn->next_command = 0;
+  conn->last_recv_mono_ms = 0;
+  conn->last_sample_mono_ms = -1;
+  g_byte_array_set_size(conn->rx, 0);
+}
+
+static int
+loadgen_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+  struct loadgen_conn *conn = user;
+
+  switch (reason) {
+  case LWS_CALLBACK_CLIENT_ESTABLISHED:
+    if (!conn) {
+      return -1;
+    }
+    conn->established = true;
+    role_stats[conn->role].connects++;
+    lws_callback_on_writable(wsi);
+    break;
+
+  case LWS_CALLBACK_CLIENT_WRITEABLE: {
+    unsigned char buf[LWS_PRE + LOADGEN_MAX_COMMAND_LENGTH];
+    char *cmd = (char *)&buf[LWS_PRE];
+
+    if (!conn || !build_role_command(conn->role, conn->next_command, cmd, LOADGEN_MAX_COMMAND_LENGTH)) {
+      break;
+    }
+    size_t cmd_len = strlen(cmd);
+    if (lws_write(wsi, &buf[LWS_PRE], cmd_len, LWS_WRITE_TEXT) < (int)cmd_len) {
+      return -1;
+    }
+    conn->next_command++;
+    if (conn->next_command < LOADGEN_MAX_COMMANDS) {
+      lws_callback_on_writable(wsi);
+    }
+    break;
+  }
+
+  case LWS_CALLBACK_CLIENT_RECEIVE:
+    if (!conn) {
+      break;
+    }
+    if (conn->rx->len + len > LOADGEN_MAX_MESSAGE_LENGTH) {
+      role_stats[conn->role].parse_errors++;
+      g_byte_array_set_size(conn->rx, 0);
+      break;
+    }
+    g_byte_array_append(conn->rx, in, (guint)len);
+    if (lws_is_final_fragment(wsi)) {
+      handle_message(conn, (const char *)conn->rx->data, conn->rx->len);
+      g_byte_array_set_size(conn->rx, 0);
+    }
+    break;
+
+  case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    if (conn) {
+      role_stats[conn->role].connect_errors++;
+      reset_conn(conn);
+    }
+    break;
+
+  case LWS_CALLBACK_CLIENT_CLOSED:
+    if (conn) {
+      if (conn->churned) {
+        role_stats[conn->role].churn_closes++;
+      } else if (running) {
+        role_stats[conn->role].unexpected_closes++;
+      }
+      reset_conn(conn);
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return 0;
+}
+
+static const struct lws_protocols protocols[] = { {
+                                                      .name = "sysstats",
+                                                      .callback = loadgen_callback,
+                                                      .per_session_data_size = 0,
+                                                  },
+                                                  { NULL, NULL, 0, 0, 0, NULL, 0 } };
+
+/******************************************************************************/
+
+static void
+connect_slot(struct loadgen_conn *conn)
+{
+  struct lws_client_connect_info ccinfo;
+
+  memset(&ccinfo, 0, sizeof(ccinfo));
+  ccinfo.context = context;
+  ccinfo.address = config.host;
+  ccinfo.port = config.port;
+  ccinfo.path = "/";
+  ccinfo.host = config.host;
+  ccinfo.origin = config.host;
+  ccinfo.protocol = protocols[0].name;
+  ccinfo.userdata = conn;
+  ccinfo.pwsi = &conn->wsi;
+
+  /* Failures are reported through LWS_CALLBACK_CLIENT_CONNECTION_ERROR */
+  if (!lws_client_connect_via_info(&ccinfo)) {
+    conn->wsi = NULL;
+  }
+}
+
+/* Reconnect closed slots and apply connection churn. */
+static gboolean
+maintenance_cb(gpointer user_data)
+{
+  (void)user_data;
+
+  if (!running) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  /* Churn: close randomly chosen established connections at the requested rate */
+  churn_credit += config.churn_per_s * LOADGEN_MAINTENANCE_INTERVAL_MS / 1000.0;
+  while (churn_credit >= 1.0) {
+    struct loadgen_conn *conn = &conns[g_random_int_range(0, (gint32)config.connections)];
+    churn_credit -= 1.0;
+    if (conn->wsi && conn->established && !conn->churned) {
+      conn->churned = true;
+      lws_set_timeout(conn->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+    }
+  }
+
+  for (unsigned int i = 0; i < config.connections; i++) {
+    if (!conns[i].wsi) {
+      connect_slot(&conns[i]);
+    }
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+lws_service_cb(gpointer user_data)
+{
+  (void)user_data;
+
+  /* Non-blocking: GLib owns the wait */
+  lws_service(context, -1);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+end_of_run_cb(gpointer user_data)
+{
+  (void)user_data;
+
+  running = false;
+  end_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  g_main_loop_quit(main_loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+on_unix_signal(gpointer user_data)
+{
+  return end_of_run_cb(user_data);
+}
+
+/******************************************************************************/
+
+static int
+compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of a sorted sample array, 0 if empty. */
+static double
+percentile(const GArray *sorted, double p)
+{
+  if (sorted->len == 0) {
+    return 0.0;
+  }
+  size_t rank = (size_t)(p / 100.0 * (double)sorted->len + 0.5);
+  if (rank == 0) {
+    rank = 1;
+  }
+  if (rank > sorted->len) {
+    rank = sorted->len;
+  }
+
+  return g_array_index(sorted, double, rank - 1);
+}
+
+static json_t *
+distribution_json(GArray *samples)
+{
+  g_array_sort(samples, compare_double);
+
+  return json_pack("{s:I, s:f, s:f, s:f, s:f}",
+                   "count",
+                   (json_int_t)samples->len,
+                   "p50",
+                   percentile(samples, 50.0),
+                   "p95",
+                   percentile(samples, 95.0),
+                   "p99",
+                   percentile(samples, 99.0),
+                   "max",
+                   percentile(samples, 100.0));
+}
+
+static void
+print_report(void)
+{
+  double duration_s = (double)(end_mono_ms - start_mono_ms) / 1000.0;
+  json_t *report = json_object();
+  json_t *roles = json_object();
+
+  json_object_set_new(report, "host", json_string(config.host));
+  json_object_set_new(report, "port", json_integer(config.port));
+  json_object_set_new(report, "connections", json_integer(config.connections));
+  json_object_set_new(report, "server_max_clients", json_integer(MAX_WS_CONNECTED_CLIENTS));
+  json_object_set_new(report, "duration_s", json_real(duration_s));
+  json_object_set_new(report, "churn_per_s", json_real(config.churn_per_s));
+  json_object_set_new(report, "interval_ms", json_integer(config.interval_ms));
+
+  for (int r = 0; r < LOADGEN_ROLE_COUNT; r++) {
+    struct loadgen_role_stats *rs = &role_stats[r];
+    if (rs->connections == 0) {
+      continue;
+    }
+    json_t *role = json_pack("{s:i, s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I, s:I}",
+                             "connections",
+                             (int)rs->connections,
+                             "connects",
+                             (json_int_t)rs->connects,
+                             "connect_errors",
+                             (json_int_t)rs->connect_errors,
+                             "unexpected_closes",
+                             (json_int_t)rs->unexpected_closes,
+                             "churn_closes",
+                             (json_int_t)rs->churn_closes,
+                             "frames",
+                             (json_int_t)rs->frames,
+                             "bytes",
+                             (json_int_t)rs->bytes,
+                             "stats_frames",
+                             (json_int_t)rs->stats_frames,
+                             "log_lines",
+                             (json_int_t)rs->log_lines,
+                             "error_frames",
+                             (json_int_t)rs->error_frames,
+                             "parse_errors",
+                             (json_int_t)rs->parse_errors,
+                             "dropped_frames",
+                             (json_int_t)rs->dropped_frames);
+    json_object_set_new(role, "jitter_ms", distribution_json(rs->jitter_ms));
+    json_object_set_new(role, "latency_ms", distribution_json(rs->latency_ms));
+    json_object_set_new(roles, role_names[r], role);
+  }
+  json_object_set_new(report, "roles", roles);
+
+  if (config.server_pid > 0 && cpu_last_mono_ms > cpu_first_mono_ms) {
+    double avg = ticks_to_cpu_percent(cpu_last_ticks - cpu_first_ticks, cpu_last_mono_ms - cpu_first_mono_ms);
+    g_array_sort(cpu_samples, compare_double);
+    json_object_set_new(report,
+                        "server_cpu",
+                        json_pack("{s:i, s:f, s:f, s:f}",
+                                  "pid",
+                                  (int)config.server_pid,
+                                  "avg_percent",
+                                  avg,
+                                  "p95_percent",
+                                  percentile(cpu_samples, 95.0),
+                                  "max_percent",
+                                  percentile(cpu_samples, 100.0)));
+  }
+
+  if (config.json_output) {
+    char *text = json_dumps(report, JSON_COMPACT | JSON_REAL_PRECISION(6));
+    if (text) {
+      printf("%s\n", text);
+      free(text);
+    }
+    json_decref(report);
+    return;
+  }
+
+  printf("ws_loadgen: %u connection(s) to %s:%d for %.1f s, churn %.2f/s, server limit %d\n",
+         config.connections,
+         config.host,
+         config.port,
+         duration_s,
+         config.churn_per_s,
+         MAX_WS_CONNECTED_CLIENTS);
+  printf("%-8s %5s %8s %6s %6s %8s %8s %6s %9s %9s %9s %9s %9s %9s\n",
+         "role",
+         "conns",
+         "connects",
+         "errors",
+         "closes",
+         "frames",
+         "logs",
+         "drops",
+         "jit_p50",
+         "jit_p99",
+         "jit_max",
+         "lat_p50",
+         "lat_p99",
+         "lat_max");
+  for (int r = 0; r < LOADGEN_ROLE_COUNT; r++) {
+    struct loadgen_role_stats *rs = &role_stats[r];
+    if (rs->connections == 0) {
+      continue;
+    }
+    /* Samples are already sorted by distribution_json() */
+    printf("%-8s %5u %8llu %6llu %6llu %8llu %8llu %6llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+           role_names[r],
+           rs->connections,
+           (unsigned long long)rs->connects,
+           (unsigned long long)rs->connect_errors,
+           (unsigned long long)rs->unexpected_closes,
+           (unsigned long long)rs->frames,
+           (unsigned long long)rs->log_lines,
+           (unsigned long long)rs->dropped_frames,
+           percentile(rs->jitter_ms, 50.0),
+           percentile(rs->jitter_ms, 99.0),
+           percentile(rs->jitter_ms, 100.0),
+           percentile(rs->latency_ms, 50.0),
+           percentile(rs->latency_ms, 99.0),
+           percentile(rs->latency_ms, 100.0));
+  }
+  json_t *cpu = json_object_get(report, "server_cpu");
+  if (cpu) {
+    printf("server pid %d cpu: avg %.1f%%, p95 %.1f%%, max %.1f%% (of one core)\n",
+           (int)config.server_pid,
+           json_real_value(json_object_get(cpu, "avg_percent")),
+           json_real_value(json_object_get(cpu, "p95_percent")),
+           json_real_value(json_object_get(cpu, "max_percent")));
+  }
+  json_decref(report);
+}
+
+/******************************************************************************/
+
+/* Parse "stats:6,logs:2,monitor:2" into config.mix. */
+static bool
+parse_mix(const char *spec)
+{
+  unsigned int mix[LOADGEN_ROLE_COUNT] = { 0 };
+  unsigned int total = 0;
+  gchar **parts = g_strsplit(spec, ",", -1);
+  bool ok = true;
+
+  for (size_t i = 0; parts[i] && ok; i++) {
+    char *sep = strchr(parts[i], ':');
+    long weight = 1;
+    int r;
+
+    if (sep) {
+      char *endptr = NULL;
+      *sep = '\0';
+      weight = strtol(sep + 1, &endptr, 10);
+      if (sep[1] == '\0' || *endptr != '\0' || weight < 0 || weight > 1000) {
+        ok = false;
+        break;
+      }
+    }
+    for (r = 0; r < LOADGEN_ROLE_COUNT; r++) {
+      if (strcmp(parts[i], role_names[r]) == 0) {
+        break;
+      }
+    }
+    if (r == LOADGEN_ROLE_COUNT) {
+      ok = false;
+      break;
+    }
+    mix[r] = (unsigned int)weight;
+    total += (unsigned int)weight;
+  }
+  g_strfreev(parts);
+
+  if (!ok || total == 0) {
+    return false;
+  }
+  memcpy(config.mix, mix, sizeof(mix));
+
+  return true;
+}
+
+/* Assign roles to slots so every prefix of slots follows the mix closely. */
+static void
+assign_roles(void)
+{
+  unsigned int total = 0;
+
+  for (int r = 0; r < LOADGEN_ROLE_COUNT; r++) {
+    total += config.mix[r];
+  }
+  for (unsigned int i = 0; i < config.connections; i++) {
+    int best = 0;
+    double best_deficit = -1e300;
+    for (int r = 0; r < LOADGEN_ROLE_COUNT; r++) {
+      double deficit = (double)config.mix[r] * (i + 1) / total - role_stats[r].connections;
+      if (config.mix[r] > 0 && deficit > best_deficit) {
+        best = r;
+        best_deficit = deficit;
+      }
+    }
+    conns[i].role = (enum loadgen_role)best;
+    role_stats[best].connections++;
+  }
+}
+
+static bool
+parse_uint_option(const char *arg, unsigned long max, unsigned long *out)
+{
+  char *endptr = NULL;
+  unsigned long value = strtoul(arg, &endptr, 10);
+
+  if (arg[0] == '\0' || arg[0] == '-' || *endptr != '\0' || value > max) {
+    return false;
+  }
+  *out = value;
+
+  return true;
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr,
+          "Usage: %s [-H host] [-p port] [-n connections] [-d seconds] [-m mix]\n"
+          "          [-M process_name] [-c churn_per_s] [-S server_pid] [-i interval_ms] [-j]\n"
+          "  -m mix  Role weights, e.g. stats:6,logs:2,monitor:2 (default stats:1)\n"
+          "  -j      Print the summary as one JSON line\n",
+          prog);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct lws_context_creation_info info;
+  unsigned long value = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "H:p:n:d:m:M:c:S:i:j")) != -1) {
+    switch (opt) {
+    case 'H':
+      config.host = optarg;
+      break;
+    case 'p':
+      if (!parse_uint_option(optarg, 65535, &value) || value == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      config.port = (int)value;
+      break;
+    case 'n':
+      if (!parse_uint_option(optarg, LOADGEN_MAX_CONNECTIONS, &value) || value == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      config.connections = (unsigned int)value;
+      break;
+    case 'd':
+      if (!parse_uint_option(optarg, 24 * 3600, &value) || value == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      config.duration_s = (unsigned int)value;
+      break;
+    case 'm':
+      if (!parse_mix(optarg)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    case 'M':
+      config.monitor_name = optarg;
+      break;
+    case 'c': {
+      char *endptr = NULL;
+      config.churn_per_s = strtod(optarg, &endptr);
+      if (optarg[0] == '\0' || *endptr != '\0' || config.churn_per_s < 0.0 || config.churn_per_s > 1000.0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    }
+    case 'S':
+      if (!parse_uint_option(optarg, INT32_MAX, &value) || value == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      config.server_pid = (pid_t)value;
+      break;
+    case 'i':
+      if (!parse_uint_option(optarg, 60000, &value) || value == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      config.interval_ms = (unsigned int)value;
+      break;
+    case 'j':
+      config.json_output = true;
+      break;
+    default:
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (int r = 0; r < LOADGEN_ROLE_COUNT; r++) {
+    role_stats[r].jitter_ms = g_array_new(FALSE, FALSE, sizeof(double));
+    role_stats[r].latency_ms = g_array_new(FALSE, FALSE, sizeof(double));
+  }
+  cpu_samples = g_array_new(FALSE, FALSE, sizeof(double));
+  conns = g_new0(struct loadgen_conn, config.connections);
+  for (unsigned int i = 0; i < config.connections; i++) {
+    conns[i].rx = g_byte_array_new();
+    reset_conn(&conns[i]);
+  }
+  assign_roles();
+
+  memset(&info, 0, sizeof(info));
+  info.port = CONTEXT_PORT_NO_LISTEN;
+  info.protocols = protocols;
+  info.gid = -1;
+  info.uid = -1;
+  lws_set_log_level(LLL_ERR, NULL);
+  context = lws_create_context(&info);
+  if (!context) {
+    fprintf(stderr, "lws_create_context failed\n");
+    return EXIT_FAILURE;
+  }
+
+  if (config.server_pid > 0) {
+    if (!read_process_ticks(config.server_pid, &cpu_first_ticks)) {
+      fprintf(stderr, "Cannot read /proc/%d/stat\n", (int)config.server_pid);
+      lws_context_destroy(context);
+      return EXIT_FAILURE;
+    }
+    cpu_first_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+    cpu_prev_ticks = cpu_first_ticks;
+    cpu_prev_mono_ms = cpu_first_mono_ms;
+    g_timeout_add(LOADGEN_CPU_SAMPLE_INTERVAL_MS, cpu_sample_cb, NULL);
+  }
+
+  main_loop = g_main_loop_new(NULL, FALSE);
+  g_unix_signal_add(SIGINT, on_unix_signal, NULL);
+  g_unix_signal_add(SIGTERM, on_unix_signal, NULL);
+
+  running = true;
+  start_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  for (unsigned int i = 0; i < config.connections; i++) {
+    connect_slot(&conns[i]);
+  }
+  g_timeout_add(LOADGEN_SERVICE_INTERVAL_MS, lws_service_cb, NULL);
+  g_timeout_add(LOADGEN_MAINTENANCE_INTERVAL_MS, maintenance_cb, NULL);
+  g_timeout_add_seconds(config.duration_s, end_of_run_cb, NULL);
+
+  g_main_loop_run(main_loop);
+
+  /* Take the final CPU reading at the end of the measured window */
+  if (config.server_pid > 0) {
+    cpu_sample_cb(NULL);
+  }
+  lws_context_destroy(context);
+  context = NULL;
+
+  print_report();
+
+  uint64_t total_connects = 0;
+  for (int r = 0; r < LOADGEN_ROLE_COUNT; r++) {
+    total_connects += role_stats[r].connects;
+    g_array_free(role_stats[r].jitter_ms, TRUE);
+    g_array_free(role_stats[r].latency_ms, TRUE);
+  }
+  for (unsigned int i = 0; i < config.connections; i++) {
+    g_byte_array_free(conns[i].rx, TRUE);
+  }
+  g_free(conns);
+  g_array_free(cpu_samples, TRUE);
+  g_main_loop_unref(main_loop);
+
+  return total_connects > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
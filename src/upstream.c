@@ -0,0 +1,404 @@
+/* upstream.c
+ *
+ * Client connections from this backend to other widget_wizard backends.
+ *
+ * - Upstreams share the server's lws context and are serviced by the same
+ *   GLib timer; no extra thread or event loop is involved.
+ * - A maintenance timer connects every registered upstream that is down,
+ *   with exponential backoff (1 s doubling up to UPSTREAM_MAX_BACKOFF_S), so
+ *   an unreachable device costs one connection attempt per backoff period.
+ * - Messages are reassembled and handed to the owner as complete JSON text;
+ *   parsing is left to the owner.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "loop_monitor.h"
+#include "session.h"
+#include "upstream.h"
+#include "util.h"
+
+/* Period of the reconnect check */
+#define UPSTREAM_MAINTENANCE_INTERVAL_MS 1000
+/* Upper bound for the reconnect backoff */
+#define UPSTREAM_MAX_BACKOFF_S 30U
+
+static struct {
+  /* Registered upstreams (struct upstream *, not owned) */
+  GList *list;
+  /* Context and vhost client connections are made through, NULL until started */
+  struct lws_context *ctx;
+  struct lws_vhost *vhost;
+  guint timer_id;
+} upstreams;
+
+/******************************************************************************/
+
+static void
+free_tx_queue(struct upstream *up)
+{
+  if (!up->tx) {
+    return;
+  }
+
+  while (!g_queue_is_empty(up->tx)) {
+    g_free(g_queue_pop_head(up->tx));
+  }
+  g_queue_free(up->tx);
+  up->tx = NULL;
+}
+
+static void
+free_rx_buffer(struct upstream *up)
+{
+  if (up->rx) {
+    g_byte_array_free(up->rx, TRUE);
+    up->rx = NULL;
+  }
+  up->rx_discard = false;
+}
+
+static void
+set_state(struct upstream *up, enum upstream_state state)
+{
+  if (up->state == state) {
+    return;
+  }
+
+  up->state = state;
+  if (up->on_state) {
+    up->on_state(up, up->user);
+  }
+}
+
+/* Connection closed or failed: schedule the next attempt */
+static void
+connection_lost(struct upstream *up, const char *why)
+{
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+  if (up->state == UPSTREAM_CONNECTED) {
+    syslog(LOG_WARNING, "Upstream %s:%d disconnected", up->host, up->port);
+  } else {
+    syslog(LOG_DEBUG, "Upstream %s:%d connect failed: %s", up->host, up->port, why ? why : "unknown");
+  }
+
+  up->wsi = NULL;
+  free_rx_buffer(up);
+  free_tx_queue(up);
+  up->backoff_s = up->backoff_s == 0 ? 1 : MIN(up->backoff_s * 2, UPSTREAM_MAX_BACKOFF_S);
+  up->next_attempt_mono_ms = now_ms + (uint64_t)up->backoff_s * 1000;
+  set_state(up, UPSTREAM_DISCONNECTED);
+}
+
+static void
+connect_upstream(struct upstream *up)
+{
+  struct lws_client_connect_info ccinfo;
+
+  memset(&ccinfo, 0, sizeof(ccinfo));
+  ccinfo.context = upstreams.ctx;
+  ccinfo.vhost = upstreams.vhost;
+  ccinfo.address = up->host;
+  ccinfo.port = up->port;
+  ccinfo.path = "/";
+  ccinfo.host = up->host;
+  ccinfo.origin = up->host;
+  ccinfo.protocol = "sysstats";
+  ccinfo.local_protocol_name = UPSTREAM_PROTOCOL_NAME;
+  ccinfo.ietf_version_or_minus_one = -1;
+  ccinfo.userdata = up;
+  ccinfo.pwsi = &up->wsi;
+
+  set_state(up, UPSTREAM_CONNECTING);
+  /* A synchronous failure may already have been reported by CLIENT_CONNECTION_ERROR */
+  if (!lws_client_connect_via_info(&ccinfo) && up->state == UPSTREAM_CONNECTING) {
+    connection_lost(up, "lws_client_connect_via_info failed");
+  }
+}
+
+static gboolean
+maintenance_timer_cb(gpointer user_data)
+{
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  (void)user_data;
+
+  for (GList *l = upstreams.list; l; l = l->next) {
+    struct upstream *up = l->data;
+    if (up->state == UPSTREAM_DISCONNECTED && now_ms >= up->next_attempt_mono_ms) {
+      connect_upstream(up);
+    }
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+ensure_timer(void)
+{
+  if (upstreams.timer_id == 0 && upstreams.vhost && upstreams.list) {
+    upstreams.timer_id = loop_monitor_timeout_add(
+        UPSTREAM_MAINTENANCE_INTERVAL_MS, "upstream_maintenance", maintenance_timer_cb, NULL);
+  }
+}
+
+/******************************************************************************/
+
+bool
+upstream_parse_address(const char *spec, char *host, size_t host_size, int *port)
+{
+  const char *host_start = spec;
+  const char *host_end;
+  const char *port_str = NULL;
+
+  if (!spec || spec[0] == '\0' || !host || host_size == 0 || !port) {
+    return false;
+  }
+
+  if (spec[0] == '[') {
+    /* [IPv6]:port */
+    host_start = spec + 1;
+    host_end = strchr(host_start, ']');
+    if (!host_end) {
+      return false;
+    }
+    if (host_end[1] == ':') {
+      port_str = host_end + 2;
+    } else if (host_end[1] != '\0') {
+      return false;
+    }
+  } else {
+    host_end = strchr(spec, ':');
+    if (host_end) {
+      port_str = host_end + 1;
+    } else {
+      host_end = spec + strlen(spec);
+    }
+  }
+
+  if (host_end == host_start || (size_t)(host_end - host_start) >= host_size) {
+    return false;
+  }
+  memcpy(host, host_start, (size_t)(host_end - host_start));
+  host[host_end - host_start] = '\0';
+
+  *port = UPSTREAM_DEFAULT_PORT;
+  if (port_str) {
+    char *endptr = NULL;
+    long value = strtol(port_str, &endptr, 10);
+    if (port_str[0] == '\0' || *endptr != '\0' || value <= 0 || value > 65535) {
+      return false;
+    }
+    *port = (int)value;
+  }
+
+  return true;
+}
+
+void
+upstream_add(struct upstream *up,
+             const char *host,
+             int port,
+             upstream_message_fn on_message,
+             upstream_state_fn on_state,
+             void *user)
+{
+  if (!up || !host) {
+    return;
+  }
+
+  memset(up, 0, sizeof(*up));
+  g_strlcpy(up->host, host, sizeof(up->host));
+  up->port = port;
+  up->on_message = on_message;
+  up->on_state = on_state;
+  up->user = user;
+  upstreams.list = g_list_append(upstreams.list, up);
+
+  if (upstreams.vhost) {
+    connect_upstream(up);
+  }
+  ensure_timer();
+}
+
+void
+upstream_remove(struct upstream *up)
+{
+  if (!up) {
+    return;
+  }
+
+  upstreams.list = g_list_remove(upstreams.list, up);
+  if (up->wsi) {
+    /* Detach first: the close completes later and must not reach the owner */
+    lws_set_wsi_user(up->wsi, NULL);
+    lws_set_timeout(up->wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+    up->wsi = NULL;
+  }
+  free_rx_buffer(up);
+  free_tx_queue(up);
+  up->state = UPSTREAM_DISCONNECTED;
+
+  if (!upstreams.list && upstreams.timer_id != 0) {
+    g_source_remove(upstreams.timer_id);
+    upstreams.timer_id = 0;
+  }
+}
+
+void
+upstream_send(struct upstream *up, const char *json, size_t len)
+{
+  struct pending_ws_message *msg;
+
+  if (!up || !json || len == 0 || !up->wsi || up->state != UPSTREAM_CONNECTED) {
+    return;
+  }
+
+  if (!up->tx) {
+    up->tx = g_queue_new();
+  }
+  msg = g_malloc(sizeof(*msg) + LWS_PRE + len);
+  msg->len = len;
+  msg->enqueue_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  msg->bulk = false;
+  memcpy(&msg->buf[LWS_PRE], json, len);
+  g_queue_push_tail(up->tx, msg);
+  lws_callback_on_writable(up->wsi);
+}
+
+const char *
+upstream_state_name(enum upstream_state state)
+{
+  switch (state) {
+  case UPSTREAM_CONNECTED:
+    return "connected";
+  case UPSTREAM_CONNECTING:
+    return "connecting";
+  case UPSTREAM_DISCONNECTED:
+  default:
+    return "disconnected";
+  }
+}
+
+bool
+upstream_active(void)
+{
+  return upstreams.list != NULL;
+}
+
+int
+upstream_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
+{
+  struct upstream *up = user;
+
+  switch (reason) {
+  case LWS_CALLBACK_FILTER_PROTOCOL_CONNECTION:
+    /* Client-only protocol: refuse peers that ask for it */
+    return -1;
+
+  case LWS_CALLBACK_CLIENT_ESTABLISHED:
+    if (!up) {
+      return -1;
+    }
+    up->connects++;
+    up->backoff_s = 0;
+    up->connected_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+    syslog(LOG_INFO, "Upstream %s:%d connected", up->host, up->port);
+    set_state(up, UPSTREAM_CONNECTED);
+    break;
+
+  case LWS_CALLBACK_CLIENT_RECEIVE:
+    if (!up) {
+      break;
+    }
+    if (up->rx_discard) {
+      up->rx_discard = !lws_is_final_fragment(wsi);
+      break;
+    }
+    if (!up->rx) {
+      up->rx = g_byte_array_new();
+    }
+    if (len > MAX_UPSTREAM_MESSAGE_LENGTH - up->rx->len) {
+      syslog(LOG_WARNING, "Upstream %s:%d: message too large, dropped", up->host, up->port);
+      g_byte_array_set_size(up->rx, 0);
+      up->rx_discard = !lws_is_final_fragment(wsi);
+      break;
+    }
+    g_byte_array_append(up->rx, in, (guint)len);
+    if (lws_is_final_fragment(wsi)) {
+      up->messages++;
+      if (up->on_message) {
+        up->on_message(up, up->rx->data, up->rx->len, up->user);
+      }
+      /* The owner may have removed the upstream from its callback */
+      if (up->rx) {
+        g_byte_array_set_size(up->rx, 0);
+      }
+    }
+    break;
+
+  case LWS_CALLBACK_CLIENT_WRITEABLE: {
+    struct pending_ws_message *msg = up && up->tx ? g_queue_pop_head(up->tx) : NULL;
+
+    if (!msg) {
+      break;
+    }
+    int written = lws_write(wsi, &msg->buf[LWS_PRE], msg->len, LWS_WRITE_TEXT);
+    if (written < 0 || (size_t)written != msg->len) {
+      syslog(LOG_WARNING, "Upstream %s:%d: write failed", up->host, up->port);
+    }
+    g_free(msg);
+    if (!g_queue_is_empty(up->tx)) {
+      lws_callback_on_writable(wsi);
+    }
+    break;
+  }
+
+  /* lws may clear the wsi pointer before these, so match on the state */
+  case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    if (up && up->state != UPSTREAM_DISCONNECTED && (!up->wsi || up->wsi == wsi)) {
+      connection_lost(up, in ? (const char *)in : NULL);
+    }
+    break;
+
+  case LWS_CALLBACK_CLIENT_CLOSED:
+  case LWS_CALLBACK_WSI_DESTROY:
+    if (up && up->state != UPSTREAM_DISCONNECTED && (!up->wsi || up->wsi == wsi)) {
+      connection_lost(up, "closed");
+    }
+    break;
+
+  default:
+    break;
+  }
+
+  return 0;
+}
+
+void
+upstream_start(struct lws_context *ctx, struct lws_vhost *vhost)
+{
+  upstreams.ctx = ctx;
+  upstreams.vhost = vhost;
+  if (!ctx || !vhost) {
+    return;
+  }
+
+  for (GList *l = upstreams.list; l; l = l->next) {
+    connect_upstream(l->data);
+  }
+  ensure_timer();
+}
+
+void
+upstream_stop(void)
+{
+  if (upstreams.timer_id != 0) {
+    g_source_remove(upstreams.timer_id);
+    upstreams.timer_id = 0;
+  }
+  upstreams.ctx = NULL;
+  upstreams.vhost = NULL;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <glib.h>
+#include <libwebsockets.h>
+
+/* lws protocol name of the upstream client connections. On the wire the
+ * client requests the "sysstats" subprotocol of the remote backend.
+ */
+#define UPSTREAM_PROTOCOL_NAME "sysstats-upstream"
+
+/* Port used when an upstream address has none (the backend default) */
+#define UPSTREAM_DEFAULT_PORT 9000
+
+#define MAX_UPSTREAM_HOST_LENGTH 128
+
+/* Upper bound for one reassembled upstream message */
+#define MAX_UPSTREAM_MESSAGE_LENGTH (256 * 1024)
+
+enum upstream_state {
+  UPSTREAM_DISCONNECTED = 0,
+  UPSTREAM_CONNECTING,
+  UPSTREAM_CONNECTED,
+};
+
+struct upstream;
+
+/* One complete upstream message (text frame, reassembled) */
+typedef void (*upstream_message_fn)(struct upstream *up, const unsigned char *msg, size_t len, void *user);
+/* Connection state changed; on UPSTREAM_CONNECTED the owner sends its subscriptions */
+typedef void (*upstream_state_fn)(struct upstream *up, void *user);
+
+/* One WebSocket client connection to another widget_wizard backend.
+ *
+ * The connection is (re)established by the upstream maintenance timer with
+ * exponential backoff; the owner only reacts to messages and state changes.
+ * The struct is owned by the caller and must stay valid until
+ * upstream_remove() (or until ws_server_stop() for the last callbacks).
+ */
+struct upstream {
+  char host[MAX_UPSTREAM_HOST_LENGTH];
+  int port;
+
+  upstream_message_fn on_message;
+  upstream_state_fn on_state;
+  void *user;
+
+  enum upstream_state state;
+  struct lws *wsi;
+
+  /* Reassembly of fragmented messages */
+  GByteArray *rx;
+  bool rx_discard;
+  /* Outgoing messages (GBytes) waiting for CLIENT_WRITEABLE */
+  GQueue *tx;
+
+  /* Reconnect backoff */
+  unsigned int backoff_s;
+  uint64_t next_attempt_mono_ms;
+
+  /* Counters for diagnostics */
+  uint64_t connects;
+  uint64_t messages;
+  uint64_t connected_mono_ms;
+};
+
+/* Parse "host[:port]" (IPv6 as "[addr]:port"). Returns false if invalid. */
+bool upstream_parse_address(const char *spec, char *host, size_t host_size, int *port);
+
+/* Initialize an upstream and register it for connection. */
+void upstream_add(struct upstream *up,
+                  const char *host,
+                  int port,
+                  upstream_message_fn on_message,
+                  upstream_state_fn on_state,
+                  void *user);
+
+/* Close and unregister an upstream; no callbacks follow. */
+void upstream_remove(struct upstream *up);
+
+/* Queue one text message to the remote backend (dropped when not connected). */
+void upstream_send(struct upstream *up, const char *json, size_t len);
+
+/* Return "connected", "connecting" or "disconnected". */
+const char *upstream_state_name(enum upstream_state state);
+
+/* True while any upstream is registered (connected or reconnecting). */
+bool upstream_active(void);
+
+/* lws protocol callback of UPSTREAM_PROTOCOL_NAME. */
+int upstream_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
+
+/* Start connecting the registered upstreams through vhost (called by ws_server_start()). */
+void upstream_start(struct lws_context *ctx, struct lws_vhost *vhost);
+
+/* Stop reconnecting before the lws context is destroyed (called by ws_server_stop()). */
+void upstream_stop(void);
@@ -8,14 +8,28 @@
  */
 #define MAX_WS_CONNECTED_CLIENTS 10
 
+/* Maximum number of concurrent clients on the local Unix-domain socket.
+ *
+ * Counted separately from MAX_WS_CONNECTED_CLIENTS, so on-device consumers
+ * never take (or lose) a slot to browsers.
+ */
+#define MAX_WS_LOCAL_CLIENTS 8
+
 /* Maximum size of a single JSON WebSocket message.
  *
- * Current worst-case payload includes aggregate stats, per-process stats,
- * and a per-core CPU usage array, so we reserve additional headroom for
- * systems with a larger CPU count.
- * Messages are constructed using snprintf() and dropped on truncation.
+ * Worst-case stats frame (MAX_CPU_CORE_SAMPLES cores, process monitoring):
+ * - aggregate stats and clients: ~450 bytes
+ * - cpu_per_core: 128 reals of up to 24 characters: ~3.2 KB
+ * - cpu_offline (up to 128 indices) and cpu_clusters (16 reals): ~0.9 KB
+ * - proc with its identity (cmdline 256, exe 256, cgroup 128 bytes): ~0.9 KB
+ * That is ~5.5 KB before JSON escaping of the identity strings, which can
+ * grow them up to 6x; build_stats_json() drops the identity from a frame
+ * that would not fit rather than the frame.
+ * Messages are serialized with jansson and dropped on truncation. Resume
+ * replays build the same frames in pss->list_buf, so MAX_LIST_JSON_LENGTH
+ * must not be smaller than this.
  */
-#define MAX_WS_MESSAGE_LENGTH 4096
+#define MAX_WS_MESSAGE_LENGTH 8192
 
 /* Maximum size (bytes) of the one-shot JSON response for the process list.
  *
@@ -47,9 +61,13 @@
  * The receive path accumulates fragments until one full client message is
  * available, then parses it as JSON.
  *
- * Messages larger than this limit are rejected.
+ * Messages larger than this limit are rejected. It is larger than
+ * MAX_SMALL_CONTROL_MESSAGE_LENGTH so that structured requests such as
+ * { "alert": { "metric": ..., "op": ..., "value": ..., "for_ms": ... } } fit.
+ * With the CGI proxy enabled, { "cgi_update": ... } messages (which carry a
+ * whole updateWidget request) may use MAX_CGI_PROXY_RECEIVE_LENGTH instead.
  */
-#define MAX_RECEIVE_MESSAGE_LENGTH MAX_SMALL_CONTROL_MESSAGE_LENGTH
+#define MAX_RECEIVE_MESSAGE_LENGTH 256U
 
 /* Maximum length of a single log line forwarded to WebSocket clients.
  *
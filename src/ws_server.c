@@ -6,11 +6,28 @@
 #include <glib.h>
 
 #include "session.h"
+#include "alerts.h"
+#include "anomaly.h"
+#include "burst.h"
+#include "cgi_proxy.h"
+#include "channel.h"
+#include "fleet.h"
+#include "history.h"
 #include "proc.h"
 #include "json_out.h"
 #include "ws_limits.h"
 #include "ws_server.h"
 #include "log_stream.h"
+#include "metrics.h"
+#include "relay.h"
+#include "loop_monitor.h"
+#include "resume.h"
+#include "self_stats.h"
+#include "shm_publish.h"
+#include "summary.h"
+#include "throttle.h"
+#include "upstream.h"
+#include "util.h"
 
 /* Internal WebSocket server state (singleton instance).
  *
@@ -23,10 +40,40 @@ static struct {
   struct app_state *app;
   /* System statistics sampling timer */
   guint stats_timer_id;
-  /* libwebsockets service timer */
+  /* libwebsockets service timer and its current interval */
   guint lws_timer_id;
+  guint lws_interval_ms;
+  /* Established sessions (struct per_session_data *), for broadcasts */
+  GList *sessions;
+  /* Idle-session eviction timer */
+  guint housekeeping_timer_id;
+  /* Ping/pong keepalive policy handed to lws (no retries, server side only) */
+  lws_retry_bo_t keepalive;
+  /* Idle timeout in seconds, 0 = never evict idle sessions */
+  unsigned int idle_timeout_s;
+  /* TCP listener vhost, also used for upstream client connections */
+  struct lws_vhost *vhost;
+  /* Unix-domain socket path (not owned, NULL = TCP only) and its vhost */
+  const char *unix_path;
+  struct lws_vhost *local_vhost;
+  /* Slot counters reported in self_stats */
+  uint64_t evicted_idle;
+  uint64_t evicted_preempted;
+  uint64_t rejected;
 } ws;
 
+/* Interval of the idle-session check */
+#define WS_HOUSEKEEPING_INTERVAL_MS 5000
+/* lws service period with connections to serve, and without any */
+#define WS_SERVICE_INTERVAL_MS 10
+#define WS_SERVICE_IDLE_INTERVAL_MS 100
+/* Seconds an evicted session gets to flush its queue before lws drops it */
+#define WS_EVICT_GRACE_S 5
+/* Client inactivity before an idle session may be preempted by a new client */
+#define WS_PREEMPT_MIN_IDLE_MS 10000
+/* Upper bound for the keepalive intervals (lws stores them as 16-bit seconds) */
+#define WS_KEEPALIVE_MAX_S 65535U
+
 /******************************************************************************/
 
 /* Connection accounting:
@@ -39,6 +86,15 @@ static struct {
  * - ws_connected_client_count tracks fully established WebSocket
  *   connections only and is decremented in LWS_CALLBACK_CLOSED.
  *
+ * - ws_local_client_count tracks established clients of the Unix-domain
+ *   socket. They are outside the TCP counters and limited on their own,
+ *   with ws_local_pending_client_count reserving their handshakes the same
+ *   way ws_pending_client_count does.
+ *
+ * - ws_evicting_client_count tracks established sessions the server is
+ *   closing. Their slots are already handed to new connections, so the
+ *   limit briefly allows that many extra sessions.
+ *
  * This accounting is required because libwebsockets does not guarantee
  * that FILTER_PROTOCOL_CONNECTION is paired with ESTABLISHED or CLOSED
  * on all handshake failure paths.
@@ -46,8 +102,14 @@ static struct {
 static unsigned int ws_pending_client_count = 0;
 static unsigned int ws_connected_client_count = 0;
 static unsigned int ws_streaming_client_count = 0;
+static unsigned int ws_evicting_client_count = 0;
+static unsigned int ws_local_client_count = 0;
+static unsigned int ws_local_pending_client_count = 0;
 
 static void set_stats_stream_enabled(struct lws *wsi, struct per_session_data *pss, bool enabled);
+static void update_stats_timer(void);
+static bool stats_sampling_needed(void);
+static void process_sample(struct app_state *app);
 
 /******************************************************************************/
 
@@ -61,10 +123,9 @@ reset_process_monitoring(struct per_session_data *pss)
 
   pss->proc_enabled = false;
   pss->proc_name[0] = '\0';
-  pss->prev_proc_utime = 0;
-  pss->prev_proc_stime = 0;
-  pss->prev_proc_sample_mono_ms = 0;
-  pss->proc_pid = 0;
+  memset(&pss->proc_baseline, 0, sizeof(pss->proc_baseline));
+  memset(&pss->proc_sample, 0, sizeof(pss->proc_sample));
+  anomaly_reset_process(pss);
 }
 
 /* Release the per-session receive accumulator, if any. */
@@ -95,20 +156,21 @@ free_pending_tx_queue(struct per_session_data *pss)
   pss->pending_tx_queue = NULL;
 }
 
-/* Queue one prebuilt JSON response for delivery from SERVER_WRITEABLE.
+/* Queue one prebuilt JSON message for delivery from SERVER_WRITEABLE.
  *
  * The websocket helper paths may need to emit one-shot responses outside the
  * immediate receive callback, so replies are copied into a per-session queue
  * and flushed from the writable callback instead of writing inline.
+ * Returns the queued message, or NULL if nothing was queued.
  */
-static void
-queue_list_buffer_json(struct lws *wsi, struct per_session_data *pss, size_t out_len, const char *context)
+static struct pending_ws_message *
+queue_json_message(struct lws *wsi, struct per_session_data *pss, const char *json, size_t out_len, const char *context)
 {
   struct lws *target_wsi = wsi;
   struct pending_ws_message *pending = NULL;
 
-  if (!pss || out_len == 0) {
-    return;
+  if (!pss || !json || out_len == 0) {
+    return NULL;
   }
 
   if (!target_wsi) {
@@ -116,27 +178,41 @@ queue_list_buffer_json(struct lws *wsi, struct per_session_data *pss, size_t out
   }
   if (!target_wsi) {
     syslog(LOG_WARNING, "%s: missing websocket handle for queued response", context);
-    return;
+    return NULL;
   }
 
   if (!pss->pending_tx_queue) {
     pss->pending_tx_queue = g_queue_new();
     if (!pss->pending_tx_queue) {
       syslog(LOG_ERR, "%s: failed to allocate response queue", context);
-      return;
+      return NULL;
     }
   }
 
   pending = g_malloc(sizeof(*pending) + LWS_PRE + out_len);
   if (!pending) {
     syslog(LOG_ERR, "%s: failed to allocate response buffer", context);
-    return;
+    return NULL;
   }
 
   pending->len = out_len;
-  memcpy(&pending->buf[LWS_PRE], &pss->list_buf[LWS_PRE], out_len);
+  pending->enqueue_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  pending->bulk = false;
+  memcpy(&pending->buf[LWS_PRE], json, out_len);
   g_queue_push_tail(pss->pending_tx_queue, pending);
   lws_callback_on_writable(target_wsi);
+  return pending;
+}
+
+/* Queue the one-shot response currently held in pss->list_buf. */
+static void
+queue_list_buffer_json(struct lws *wsi, struct per_session_data *pss, size_t out_len, const char *context)
+{
+  if (!pss) {
+    return;
+  }
+
+  queue_json_message(wsi, pss, (const char *)&pss->list_buf[LWS_PRE], out_len, context);
 }
 
 /* Build and send a compact error response for one client command. */
@@ -160,6 +236,15 @@ send_error_response(struct lws *wsi,
 
 enum receive_append_status { RECEIVE_APPEND_OK = 0, RECEIVE_APPEND_TOO_LARGE, RECEIVE_APPEND_NO_MEMORY };
 
+/* Largest message accepted while receiving; only cgi_update may exceed
+ * MAX_RECEIVE_MESSAGE_LENGTH, which handle_client_message() checks once parsed.
+ */
+static size_t
+receive_limit(void)
+{
+  return cgi_proxy_enabled() ? (size_t)MAX_CGI_PROXY_RECEIVE_LENGTH : (size_t)MAX_RECEIVE_MESSAGE_LENGTH;
+}
+
 /* Append one receive fragment to the per-session message accumulator. */
 static enum receive_append_status
 append_receive_fragment(struct per_session_data *pss, const void *in, size_t len)
@@ -176,7 +261,7 @@ append_receive_fragment(struct per_session_data *pss, const void *in, size_t len
     }
   }
 
-  if (len > (size_t)MAX_RECEIVE_MESSAGE_LENGTH - pss->recv_buf->len) {
+  if (len > receive_limit() - pss->recv_buf->len) {
     return RECEIVE_APPEND_TOO_LARGE;
   }
 
@@ -210,6 +295,129 @@ handle_stats_stream_request(struct lws *wsi, struct per_session_data *pss, json_
   return true;
 }
 
+/* Reply to one stats_summary request. */
+static void
+handle_stats_summary_request(struct lws *wsi, struct per_session_data *pss, json_t *req)
+{
+  json_t *period = json_object_get(req, "period");
+  json_t *count = json_object_get(req, "count");
+  enum summary_period summary_period = SUMMARY_PERIOD_HOUR;
+  size_t max_count = SUMMARY_HOUR_COUNT + 1;
+
+  if (!summary_enabled()) {
+    send_error_response(
+        wsi, pss, "summary_disabled", "Summaries are not enabled on this server", "Summary error response");
+    return;
+  }
+  if (!json_is_object(req) || !json_is_string(period) ||
+      (strcmp(json_string_value(period), "hour") != 0 && strcmp(json_string_value(period), "day") != 0)) {
+    send_error_response(
+        wsi, pss, "invalid_summary_request", "period must be \"hour\" or \"day\"", "Summary error response");
+    return;
+  }
+  if (strcmp(json_string_value(period), "day") == 0) {
+    summary_period = SUMMARY_PERIOD_DAY;
+    max_count = SUMMARY_DAY_COUNT + 1;
+  }
+  if (count && (!json_is_integer(count) || json_integer_value(count) <= 0)) {
+    send_error_response(
+        wsi, pss, "invalid_summary_request", "count must be a positive integer", "Summary error response");
+    return;
+  }
+  if (count && (size_t)json_integer_value(count) < max_count) {
+    max_count = (size_t)json_integer_value(count);
+  }
+
+  bool truncated = false;
+  size_t out_len = build_stats_summary_json(
+      (char *)&pss->list_buf[LWS_PRE], MAX_LIST_JSON_LENGTH, summary_period, max_count, &truncated);
+  if (out_len > 0) {
+    queue_list_buffer_json(wsi, pss, out_len, "Summary response");
+  }
+  if (truncated) {
+    syslog(LOG_INFO, "Summary response truncated");
+  }
+}
+
+/* Restore the subscriptions of a disconnected session and replay what it missed.
+ *
+ * Replayed stats frames are rebuilt from the sample ring without process data
+ * (process values are read live and not kept). The "resumed" reply is queued
+ * last, so everything before it on the socket is replay.
+ */
+static void
+handle_resume_request(struct lws *wsi, struct per_session_data *pss, json_t *req)
+{
+  const struct sys_stats *samples[RESUME_STATS_RING_SIZE];
+  json_t *token = json_object_get(req, "token");
+  json_t *stats_seq = json_object_get(req, "stats_seq");
+  json_t *log_seq = json_object_get(req, "log_seq");
+  struct resume_state state;
+  size_t stats_replayed = 0;
+  size_t log_replayed = 0;
+  bool stats_gap = false;
+  bool log_gap = false;
+  bool truncated = false;
+
+  if (!json_is_object(req) || !json_is_string(token) || !resume_take(json_string_value(token), &state)) {
+    send_error_response(
+        wsi, pss, "resume_failed", "Unknown or expired resume token", "Resume error response");
+    return;
+  }
+
+  if (state.stats_stream) {
+    uint64_t after = json_is_integer(stats_seq) && json_integer_value(stats_seq) > 0
+                         ? (uint64_t)json_integer_value(stats_seq)
+                         : 0;
+    size_t n = resume_samples_since(after, samples, RESUME_STATS_RING_SIZE, &stats_gap);
+    uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+    for (size_t i = 0; i < n; i++) {
+      size_t out_len = build_stats_json((char *)&pss->list_buf[LWS_PRE],
+                                        MAX_LIST_JSON_LENGTH,
+                                        samples[i],
+                                        now_ms,
+                                        proc_get_cpu_core_count(),
+                                        ws_connected_client_count,
+                                        MAX_WS_CONNECTED_CLIENTS,
+                                        pss,
+                                        &truncated);
+      if (out_len > 0 && !truncated) {
+        queue_list_buffer_json(wsi, pss, out_len, "Resume stats replay");
+        stats_replayed++;
+      }
+    }
+  }
+
+  if (state.log_stream) {
+    uint64_t after =
+        json_is_integer(log_seq) && json_integer_value(log_seq) > 0 ? (uint64_t)json_integer_value(log_seq) : 0;
+    log_replayed = log_stream_resume(pss, after, &log_gap);
+  }
+
+  if (state.proc_enabled) {
+    memcpy(pss->proc_name, state.proc_name, sizeof(pss->proc_name));
+    pss->proc_enabled = true;
+  }
+  if (state.stats_stream) {
+    set_stats_stream_enabled(wsi, pss, true);
+  }
+  update_stats_timer();
+  syslog(LOG_INFO, "Client resumed session: %zu stats frames, %zu log lines replayed", stats_replayed, log_replayed);
+
+  size_t out_len = build_resumed_json((char *)&pss->list_buf[LWS_PRE],
+                                      MAX_LIST_JSON_LENGTH,
+                                      &state,
+                                      stats_replayed,
+                                      stats_gap,
+                                      log_replayed,
+                                      log_gap,
+                                      &truncated);
+  if (out_len > 0) {
+    queue_list_buffer_json(wsi, pss, out_len, "Resume response");
+  }
+}
+
 /* Parse and dispatch one complete client JSON message. */
 static void
 handle_client_message(struct lws *wsi, struct per_session_data *pss, const unsigned char *msg, size_t len)
@@ -230,6 +438,18 @@ handle_client_message(struct lws *wsi, struct per_session_data *pss, const unsig
     return;
   }
 
+  /* The larger receive limit is for widget and overlay updates only */
+  if (len > MAX_RECEIVE_MESSAGE_LENGTH && !json_object_get(root, "cgi_update")) {
+    syslog(LOG_WARNING, "WebSocket receive: control message too large (limit %u bytes)", MAX_RECEIVE_MESSAGE_LENGTH);
+    json_decref(root);
+    send_error_response(wsi,
+                        pss,
+                        "control_message_too_large",
+                        "Control message exceeds the configured size limit",
+                        "Oversize control response");
+    return;
+  }
+
   /* One-shot process list request: { "list_processes": true }
    *
    * NOTE:
@@ -252,6 +472,31 @@ handle_client_message(struct lws *wsi, struct per_session_data *pss, const unsig
     return;
   }
 
+  /* One-shot process identity request: { "process_info": "name" } */
+  json_t *process_info = json_object_get(root, "process_info");
+  if (process_info) {
+    const char *name = json_string_value(process_info);
+    if (!name || name[0] == '\0' || strlen(name) >= MAX_PROC_NAME_LENGTH) {
+      send_error_response(wsi,
+                          pss,
+                          "invalid_process_info_request",
+                          "process_info must be a non-empty process name",
+                          "Process info error response");
+    } else {
+      bool truncated = false;
+      size_t out_len =
+          build_process_info_json((char *)&pss->list_buf[LWS_PRE], MAX_LIST_JSON_LENGTH, name, &truncated);
+      if (out_len > 0) {
+        queue_list_buffer_json(wsi, pss, out_len, "Process info response");
+      }
+      if (truncated) {
+        syslog(LOG_INFO, "Process info response truncated to fit %u bytes", MAX_LIST_JSON_LENGTH);
+      }
+    }
+    json_decref(root);
+    return;
+  }
+
   /* One-shot storage info request: { "storage": true } */
   json_t *storage_req = json_object_get(root, "storage");
   if (json_is_true(storage_req)) {
@@ -283,6 +528,38 @@ handle_client_message(struct lws *wsi, struct per_session_data *pss, const unsig
     return;
   }
 
+  /* One-shot server self statistics request: { "self_stats": true } */
+  json_t *self_stats_req = json_object_get(root, "self_stats");
+  if (json_is_true(self_stats_req)) {
+    bool truncated = false;
+    size_t out_len = build_self_stats_json((char *)&pss->list_buf[LWS_PRE], MAX_LIST_JSON_LENGTH, pss, &truncated);
+
+    if (out_len > 0) {
+      queue_list_buffer_json(wsi, pss, out_len, "Self stats response");
+    }
+    if (truncated) {
+      syslog(LOG_INFO, "Self stats response truncated");
+    }
+    json_decref(root);
+    return;
+  }
+
+  /* One-shot percentile summary: { "stats_summary": { "period": "hour", "count": 24 } } */
+  json_t *summary_req = json_object_get(root, "stats_summary");
+  if (summary_req) {
+    handle_stats_summary_request(wsi, pss, summary_req);
+    json_decref(root);
+    return;
+  }
+
+  /* Resume after reconnect: { "resume": { "token": "...", "stats_seq": N, "log_seq": M } } */
+  json_t *resume_req = json_object_get(root, "resume");
+  if (resume_req) {
+    handle_resume_request(wsi, pss, resume_req);
+    json_decref(root);
+    return;
+  }
+
   if (handle_stats_stream_request(wsi, pss, root)) {
     json_decref(root);
     return;
@@ -293,6 +570,45 @@ handle_client_message(struct lws *wsi, struct per_session_data *pss, const unsig
     return;
   }
 
+  /* Downsampled long history: { "history": { "window_ms": N, "columns": W } }, see history.h */
+  if (history_handle_request(wsi, pss, root)) {
+    json_decref(root);
+    return;
+  }
+
+  /* Burst capture: { "burst_capture": { ... } }, see burst.h */
+  if (burst_handle_request(wsi, pss, root)) {
+    update_stats_timer();
+    json_decref(root);
+    return;
+  }
+
+  /* Logical channels: { "open": { ... } }, { "close": id }, { "credit": { ... } }, see channel.h */
+  if (channel_handle_request(wsi, pss, root)) {
+    update_stats_timer();
+    json_decref(root);
+    return;
+  }
+
+  /* Coalesced widget and overlay updates: { "cgi_update": { ... } }, see cgi_proxy.h */
+  if (cgi_proxy_handle_request(wsi, pss, root)) {
+    json_decref(root);
+    return;
+  }
+
+  /* Fleet view: { "fleet": true }, { "fleet_stream": true }, see fleet.h */
+  if (fleet_handle_request(wsi, pss, root)) {
+    json_decref(root);
+    return;
+  }
+
+  /* Alert rules: { "alert": { ... } }, see alerts.h */
+  if (alerts_handle_request(wsi, pss, root)) {
+    update_stats_timer();
+    json_decref(root);
+    return;
+  }
+
   /* Expect JSON: { "monitor": "process_name" } */
   json_t *monitor = json_object_get(root, "monitor");
   if (!monitor) {
@@ -308,6 +624,14 @@ handle_client_message(struct lws *wsi, struct per_session_data *pss, const unsig
     return;
   }
 
+  /* Process data is not relayed; the local processes would be misleading */
+  if (relay_enabled()) {
+    send_error_response(
+        wsi, pss, "relay_unsupported", "Process monitoring is not available in relay mode", "Monitor error response");
+    json_decref(root);
+    return;
+  }
+
   /* Normal start-monitoring command */
   if (json_is_string(monitor)) {
     size_t proc_name_len = json_string_length(monitor);
@@ -319,10 +643,9 @@ handle_client_message(struct lws *wsi, struct per_session_data *pss, const unsig
     memcpy(pss->proc_name, json_string_value(monitor), copy_len);
     pss->proc_name[copy_len] = '\0';
     pss->proc_enabled = true;
-    pss->prev_proc_utime = 0;
-    pss->prev_proc_stime = 0;
-    pss->prev_proc_sample_mono_ms = 0;
-    pss->proc_pid = 0;
+    memset(&pss->proc_baseline, 0, sizeof(pss->proc_baseline));
+    memset(&pss->proc_sample, 0, sizeof(pss->proc_sample));
+    anomaly_reset_process(pss);
     syslog(LOG_INFO, "Client monitoring process: %s", pss->proc_name);
   }
 
@@ -331,32 +654,186 @@ handle_client_message(struct lws *wsi, struct per_session_data *pss, const unsig
 
 /******************************************************************************/
 
+/* True if a session subscribes to nothing, i.e. only does one-shot requests.
+ *
+ * A monitored process, a burst capture or a CGI update waiting to be
+ * forwarded count as subscriptions. Idle sessions are the candidates for
+ * idle-timeout eviction and for preemption when the client limit is reached.
+ */
+static bool
+session_is_idle(struct per_session_data *pss)
+{
+  return !pss->stats_stream_enabled && !(pss->channels && pss->channels->len > 0) &&
+         !(pss->alert_rules && pss->alert_rules->len > 0) && !log_stream_is_subscribed(pss) &&
+         !fleet_is_subscribed(pss) && !pss->proc_enabled && !burst_is_owner(pss) && !cgi_proxy_session_busy(pss);
+}
+
+/* Close a session from the server side.
+ *
+ * The client gets { "event": { "type": "evicted", ... } } after its pending
+ * messages, then a close frame. If the peer does not drain the socket, lws
+ * drops it after WS_EVICT_GRACE_S.
+ */
+static void
+evict_session(struct per_session_data *pss, const char *reason)
+{
+  char json[MAX_SMALL_CONTROL_MESSAGE_LENGTH];
+  bool truncated = false;
+
+  if (!pss || !pss->wsi || pss->evict_reason) {
+    return;
+  }
+
+  size_t len = build_evicted_event_json(json, sizeof(json), reason, &truncated);
+  if (len > 0 && !truncated) {
+    queue_json_message(pss->wsi, pss, json, len, "Eviction event");
+  }
+  pss->evict_reason = reason;
+  ws_evicting_client_count++;
+  lws_set_timeout(pss->wsi, PENDING_TIMEOUT_USER_OK, WS_EVICT_GRACE_S);
+  lws_callback_on_writable(pss->wsi);
+}
+
+/* Return the idle session with the oldest client activity, or NULL.
+ *
+ * Sessions active within WS_PREEMPT_MIN_IDLE_MS are kept, so a client between
+ * two one-shot requests (or one that just connected) is not preempted.
+ */
+static struct per_session_data *
+find_lru_idle_session(void)
+{
+  struct per_session_data *oldest = NULL;
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+  for (GList *l = ws.sessions; l; l = l->next) {
+    struct per_session_data *pss = l->data;
+    if (!pss->local && !pss->evict_reason && session_is_idle(pss) &&
+        now_ms - pss->last_activity_mono_ms >= WS_PREEMPT_MIN_IDLE_MS &&
+        (!oldest || pss->last_activity_mono_ms < oldest->last_activity_mono_ms)) {
+      oldest = pss;
+    }
+  }
+
+  return oldest;
+}
+
+/* Periodic check that closes sessions idle for longer than the idle timeout.
+ *
+ * Local (Unix-domain socket) sessions are kept: they do not hold a TCP slot,
+ * and counting them in ws_evicting_client_count would let extra TCP clients in.
+ */
+static gboolean
+housekeeping_timer_cb(gpointer user_data)
+{
+  uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  uint64_t idle_ms = (uint64_t)ws.idle_timeout_s * 1000;
+  (void)user_data;
+
+  for (GList *l = ws.sessions; l; l = l->next) {
+    struct per_session_data *pss = l->data;
+    if (!pss->local && !pss->evict_reason && session_is_idle(pss) &&
+        now_ms - pss->last_activity_mono_ms >= idle_ms) {
+      syslog(LOG_INFO,
+             "Evicting WebSocket client idle for %llu s",
+             (unsigned long long)(now_ms - pss->last_activity_mono_ms) / 1000);
+      ws.evicted_idle++;
+      evict_session(pss, "idle");
+    }
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/******************************************************************************/
+
 /* Periodic GLib timer callback that updates the system statistics in app_state.
  *
  * This runs in the GLib main loop thread and refreshes app_state::stats.
  * The data is later consumed by the WebSocket write
  * callback when sending updates to connected clients.
  *
- * Returning G_SOURCE_CONTINUE keeps the timer active.
+ * Returning G_SOURCE_CONTINUE keeps the timer active. The timer removes
+ * itself once no consumer needs samples (e.g. a burst trigger fired).
  */
 static gboolean
 stats_timer_cb(gpointer user_data)
 {
   struct app_state *app = user_data;
 
-  stats_update_sys_stats(&app->stats);
+  /* Throttled: sample on every 2^level-th tick only */
+  if (throttle_sample_due()) {
+    stats_update_sys_stats(&app->stats);
+    process_sample(app);
+    throttle_evaluate(&app->stats);
+  }
+
+  if (!stats_sampling_needed()) {
+    ws.stats_timer_id = 0;
+    return G_SOURCE_REMOVE;
+  }
 
   return G_SOURCE_CONTINUE;
 }
 
 /******************************************************************************/
 
+/* Read the monitored process of each session for the new sample and feed
+ * its anomaly baselines. Stats frames format pss->proc_sample. Sessions that
+ * do not stream are only read while anomaly detection is enabled.
+ */
+static void
+sample_session_processes(const struct sys_stats *stats)
+{
+  for (GList *l = ws.sessions; l; l = l->next) {
+    struct per_session_data *pss = l->data;
+    struct proc_sample *s = &pss->proc_sample;
+
+    if (!pss->proc_enabled || (!pss->stats_stream_enabled && !anomaly_enabled())) {
+      continue;
+    }
+    s->found = proc_read_process_stats(
+        pss->proc_name, &pss->proc_baseline, stats->monotonic_ms, &s->cpu, &s->rss_kb, &s->pss_kb, &s->uss_kb, &s->pid);
+    s->valid = true;
+    if (s->found) {
+      anomaly_evaluate_process(pss, s->cpu, s->rss_kb, stats->monotonic_ms);
+    }
+  }
+}
+
+/* Hand the new sample in app->stats to every consumer.
+ *
+ * Only samples passing through here get a new seq, so every seq a client sees
+ * is in the resume ring. Relayed samples keep the upstream seq.
+ */
+static void
+process_sample(struct app_state *app)
+{
+  if (!relay_enabled()) {
+    app->stats.seq++;
+    sample_session_processes(&app->stats);
+  }
+  shm_publish_sample(&app->stats);
+  resume_record_sample(&app->stats);
+  channel_tick(&app->stats);
+  alerts_evaluate(&app->stats);
+  anomaly_evaluate_system(&app->stats);
+  summary_update(&app->stats);
+  history_record(&app->stats);
+  burst_evaluate_trigger(&app->stats);
+}
+
 /*
  * Statistics sampling timer:
  *
- * - The stats timer is started when the first client enables stats_stream.
+ * - The stats timer is started when the first client enables stats_stream,
+ *   opens a channel, adds an alert rule or arms a burst capture trigger. With anomaly
+ *   detection, summaries, the long history or shared-memory publication enabled it
+ *   runs always.
+ * - It also keeps running while a disconnected client can still resume,
+ *   so the replay ring covers the disconnect.
  * - The stats timer is stopped when the last streaming client disables it
- *   or disconnects.
+ *   or disconnects and no alert rules remain.
+ * - In relay mode it never runs: samples arrive from the upstream backend.
  *
  * Rationale:
  * - Avoid unnecessary /proc polling for one-shot-only clients.
@@ -366,7 +843,9 @@ static void
 start_stats_timer(void)
 {
   if (ws.stats_timer_id == 0 && ws.app) {
-    ws.stats_timer_id = g_timeout_add(500, stats_timer_cb, ws.app);
+    /* Higher priority than lws_service: frames due on the same tick carry the new sample */
+    ws.stats_timer_id =
+        loop_monitor_timeout_add_full(G_PRIORITY_DEFAULT - 1, 500, "stats_sample", stats_timer_cb, ws.app);
   }
 }
 
@@ -380,6 +859,45 @@ stop_stats_timer(void)
   }
 }
 
+/* True while any consumer needs regular samples */
+static bool
+stats_sampling_needed(void)
+{
+  if (relay_enabled()) {
+    return false;
+  }
+
+  return ws_streaming_client_count > 0 || channel_active() || alerts_active() || anomaly_enabled() ||
+         summary_enabled() || history_enabled() || burst_armed() || resume_pending() || shm_publish_enabled();
+}
+
+/* Start or stop the sampling timer to match current demand */
+static void
+update_stats_timer(void)
+{
+  if (stats_sampling_needed()) {
+    start_stats_timer();
+  } else {
+    stop_stats_timer();
+  }
+}
+
+/******************************************************************************/
+
+/* Request a writable callback for the next stats frame.
+ *
+ * The first request time is kept until the frame is written, so the queue
+ * latency covers the whole wait for LWS_CALLBACK_SERVER_WRITEABLE.
+ */
+static void
+request_stats_frame(struct lws *wsi, struct per_session_data *pss)
+{
+  if (pss->stats_write_requested_mono_ms == 0) {
+    pss->stats_write_requested_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+  }
+  lws_callback_on_writable(wsi);
+}
+
 /******************************************************************************/
 
 /* Enable or disable periodic stats streaming for one WebSocket client.
@@ -396,11 +914,18 @@ set_stats_stream_enabled(struct lws *wsi, struct per_session_data *pss, bool ena
   }
 
   pss->stats_stream_enabled = enabled;
+  /* The process is read only while streaming; drop the value of the last stream */
+  pss->proc_sample.valid = false;
 
   if (enabled) {
     ws_streaming_client_count++;
-    if (ws_streaming_client_count == 1) {
-      start_stats_timer();
+    update_stats_timer();
+
+    /* Relay mode: frames are pushed as they arrive from the upstream */
+    if (relay_enabled()) {
+      relay_attach_latest(pss);
+      syslog(LOG_INFO, "Client enabled relayed stats streaming (%u active)", ws_streaming_client_count);
+      return;
     }
 
     /* Refresh once immediately so the first subscribed frame is not stale after idle periods */
@@ -409,8 +934,8 @@ set_stats_stream_enabled(struct lws *wsi, struct per_session_data *pss, bool ena
     }
 
     /* Send one snapshot immediately, then continue on the per-client timer */
-    lws_callback_on_writable(wsi);
-    lws_set_timer_usecs(wsi, LWS_USEC_PER_SEC / 2);
+    request_stats_frame(wsi, pss);
+    lws_set_timer_usecs(wsi, loop_monitor_us_to_next_tick(throttle_interval_ms()));
     syslog(LOG_INFO, "Client enabled stats streaming (%u active)", ws_streaming_client_count);
     return;
   }
@@ -421,14 +946,101 @@ set_stats_stream_enabled(struct lws *wsi, struct per_session_data *pss, bool ena
 
   /* Stop future per-client periodic sends once streaming is disabled */
   lws_set_timer_usecs(wsi, LWS_SET_TIMER_USEC_CANCEL);
-  if (ws_streaming_client_count == 0) {
-    stop_stats_timer();
-  }
+  pss->stats_write_requested_mono_ms = 0;
+  relay_session_closed(pss);
+  update_stats_timer();
   syslog(LOG_INFO, "Client disabled stats streaming (%u active)", ws_streaming_client_count);
 }
 
 /******************************************************************************/
 
+/* Record the sample-to-send and queue latency of one stats frame */
+static void
+record_stats_frame_latency(struct per_session_data *pss, const struct app_state *app, uint64_t send_mono_ms)
+{
+  uint64_t sample_mono_ms = app->stats.monotonic_ms;
+  uint64_t requested_mono_ms = pss->stats_write_requested_mono_ms;
+
+  self_stats_record_stats_frame(pss,
+                                send_mono_ms >= sample_mono_ms ? send_mono_ms - sample_mono_ms : 0,
+                                requested_mono_ms != 0 && send_mono_ms >= requested_mono_ms
+                                    ? send_mono_ms - requested_mono_ms
+                                    : 0);
+}
+
+/* Finish the session stream frame, written or dropped.
+ *
+ * A dropped frame is done with as well: the next one measures from its own
+ * request. Channels waiting behind the frame get the next writable callback.
+ */
+static void
+stats_frame_done(struct lws *wsi, struct per_session_data *pss)
+{
+  pss->stats_write_requested_mono_ms = 0;
+  if (channel_next_due(pss)) {
+    lws_callback_on_writable(wsi);
+  }
+}
+
+/* Write the next due channel frame of a session, if any.
+ *
+ * Called from LWS_CALLBACK_SERVER_WRITEABLE, one frame per callback. The frame
+ * is built from the latest sample, so a congested socket skips intermediate
+ * samples instead of queueing them.
+ */
+static void
+write_channel_frame(struct lws *wsi, struct per_session_data *pss, struct app_state *app)
+{
+  struct ws_channel *ch = channel_next_due(pss);
+  bool truncated = false;
+  bool sent = false;
+
+  if (!ch || !app) {
+    return;
+  }
+
+  size_t out_len = build_channel_stats_json((char *)&pss->stream_buf[LWS_PRE],
+                                            MAX_WS_MESSAGE_LENGTH,
+                                            &app->stats,
+                                            util_get_time_ms(CLOCK_MONOTONIC),
+                                            proc_get_cpu_core_count(),
+                                            ws_connected_client_count,
+                                            MAX_WS_CONNECTED_CLIENTS,
+                                            ch,
+                                            &truncated);
+  if (out_len == 0 || truncated) {
+    syslog(LOG_ERR, "Channel %u frame truncated, dropping the frame", ch->id);
+  } else {
+    int written = lws_write(wsi, &pss->stream_buf[LWS_PRE], out_len, LWS_WRITE_TEXT);
+    if (written >= 0 && (size_t)written == out_len) {
+      sent = true;
+    } else {
+      syslog(LOG_WARNING, "Channel %u write failed: %d of %zu", ch->id, written, out_len);
+    }
+  }
+
+  /* Credit is only spent on a frame the client received whole */
+  if (sent ? channel_frame_sent(pss, ch) : channel_frame_failed(pss, ch)) {
+    lws_callback_on_writable(wsi);
+  }
+}
+
+/******************************************************************************/
+
+/* Release the handshake slot reserved in FILTER_PROTOCOL_CONNECTION, if held */
+static void
+release_pending_slot(struct per_session_data *pss)
+{
+  unsigned int *pending = pss->local ? &ws_local_pending_client_count : &ws_pending_client_count;
+
+  if (pss->slot_reserved && *pending > 0) {
+    (*pending)--;
+  }
+  pss->slot_reserved = false;
+}
+
+/******************************************************************************/
+
 /* WebSocket protocol callback
  *
  * - Server sends periodic JSON snapshots only to clients that enabled stats_stream.
@@ -451,16 +1063,34 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
       return -1;
     }
     /* Convert one pending slot to active */
-    if (ws_pending_client_count > 0) {
-      ws_pending_client_count--;
+    release_pending_slot(pss);
+    if (pss->local) {
+      ws_local_client_count++;
+    } else {
+      ws_connected_client_count++;
+      pss->counted = true;
     }
-
-    ws_connected_client_count++;
-    pss->counted = true;
     pss->wsi = wsi;
     pss->pending_tx_queue = NULL;
     pss->stats_stream_enabled = false;
-    syslog(LOG_INFO, "WebSocket client connected (%u/%u)", ws_connected_client_count, MAX_WS_CONNECTED_CLIENTS);
+    pss->evict_reason = NULL;
+    pss->last_activity_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+    ws.sessions = g_list_prepend(ws.sessions, pss);
+    if (pss->local) {
+      syslog(LOG_INFO, "Local client connected (%u/%u)", ws_local_client_count, MAX_WS_LOCAL_CLIENTS);
+    } else {
+      syslog(LOG_INFO, "WebSocket client connected (%u/%u)", ws_connected_client_count, MAX_WS_CONNECTED_CLIENTS);
+    }
+
+    /* Announce the resume token first */
+    if (resume_assign_token(pss)) {
+      bool truncated = false;
+      size_t out_len = build_session_json(
+          (char *)&pss->list_buf[LWS_PRE], MAX_LIST_JSON_LENGTH, pss->resume_token, RESUME_WINDOW_MS, &truncated);
+      if (out_len > 0) {
+        queue_list_buffer_json(wsi, pss, out_len, "Session announcement");
+      }
+    }
     break;
   }
 
@@ -484,9 +1114,9 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
     }
 
     /* Ask lws for a writeable callback */
-    lws_callback_on_writable(wsi);
+    request_stats_frame(wsi, pss);
     /* Rearm timer for next tick */
-    lws_set_timer_usecs(wsi, LWS_USEC_PER_SEC / 2);
+    lws_set_timer_usecs(wsi, loop_monitor_us_to_next_tick(throttle_interval_ms()));
     break;
   }
 
@@ -500,6 +1130,8 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
       break;
     }
 
+    pss->last_activity_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
     if (pss->discard_rx_message) {
       if (lws_is_final_fragment(wsi)) {
         pss->discard_rx_message = false;
@@ -509,7 +1141,7 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
 
     enum receive_append_status append_status = append_receive_fragment(pss, in, len);
     if (append_status == RECEIVE_APPEND_TOO_LARGE) {
-      syslog(LOG_WARNING, "WebSocket receive: control message too large (limit %u bytes)", MAX_RECEIVE_MESSAGE_LENGTH);
+      syslog(LOG_WARNING, "WebSocket receive: control message too large (limit %zu bytes)", receive_limit());
       free_receive_buffer(pss);
       pss->discard_rx_message = !lws_is_final_fragment(wsi);
       send_error_response(wsi,
@@ -547,18 +1179,41 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
     struct per_session_data *pss = user;
 
     if (pss) {
+      /* Keep the subscriptions for a later resume before tearing them down */
+      resume_detach(pss, log_stream_is_subscribed(pss));
       pss->wsi = NULL;
+      ws.sessions = g_list_remove(ws.sessions, pss);
     }
     if (pss && pss->stats_stream_enabled) {
       set_stats_stream_enabled(wsi, pss, false);
     }
     log_stream_unsubscribe(pss);
+    channel_session_closed(pss);
+    fleet_session_closed(pss);
+    relay_session_closed(pss);
+    alerts_session_closed(pss);
+    burst_session_closed(pss);
+    cgi_proxy_session_closed(pss);
+    update_stats_timer();
 
     if (pss && pss->counted) {
       if (ws_connected_client_count > 0) {
         ws_connected_client_count--;
       }
     }
+    if (pss && pss->local) {
+      if (ws_local_client_count > 0) {
+        ws_local_client_count--;
+      }
+      pss->local = false;
+    }
+    if (pss && pss->evict_reason) {
+      if (ws_evicting_client_count > 0) {
+        ws_evicting_client_count--;
+      }
+      syslog(LOG_INFO, "Evicted WebSocket client closed (%s)", pss->evict_reason);
+      pss->evict_reason = NULL;
+    }
     free_pending_tx_queue(pss);
     free_receive_buffer(pss);
     syslog(LOG_INFO, "WebSocket client disconnected (%u/%u)", ws_connected_client_count, MAX_WS_CONNECTED_CLIENTS);
@@ -566,14 +1221,39 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
   }
 
   case LWS_CALLBACK_FILTER_PROTOCOL_CONNECTION: {
-    /* Enforce connection limit across both established and in-progress WebSocket handshakes */
-    if (ws_connected_client_count + ws_pending_client_count >= MAX_WS_CONNECTED_CLIENTS) {
-      syslog(LOG_WARNING, "Rejecting WebSocket connection: client limit (%u) reached", MAX_WS_CONNECTED_CLIENTS);
-      return -1;
+    /* Local socket clients use their own pool */
+    if (ws.local_vhost && lws_get_vhost(wsi) == ws.local_vhost) {
+      if (ws_local_client_count + ws_local_pending_client_count >= MAX_WS_LOCAL_CLIENTS || !user) {
+        syslog(LOG_WARNING, "Rejecting local connection: client limit (%u) reached", MAX_WS_LOCAL_CLIENTS);
+        return -1;
+      }
+      ws_local_pending_client_count++;
+      ((struct per_session_data *)user)->local = true;
+      ((struct per_session_data *)user)->slot_reserved = true;
+      break;
+    }
+
+    /* Enforce connection limit across both established and in-progress WebSocket handshakes.
+     * Slots of sessions being evicted are already free for new connections.
+     */
+    if (ws_connected_client_count + ws_pending_client_count >= MAX_WS_CONNECTED_CLIENTS + ws_evicting_client_count) {
+      /* Preempt the least recently active session that subscribes to nothing */
+      struct per_session_data *victim = find_lru_idle_session();
+      if (!victim) {
+        ws.rejected++;
+        syslog(LOG_WARNING, "Rejecting WebSocket connection: client limit (%u) reached", MAX_WS_CONNECTED_CLIENTS);
+        return -1;
+      }
+      syslog(LOG_INFO, "Client limit reached, evicting the least recently active idle client");
+      ws.evicted_preempted++;
+      evict_session(victim, "preempted");
     }
 
     /* Reserve a slot for this connection attempt */
     ws_pending_client_count++;
+    if (user) {
+      ((struct per_session_data *)user)->slot_reserved = true;
+    }
 
     break;
   }
@@ -601,22 +1281,50 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
         syslog(LOG_WARNING, "Queued response write failed");
       } else if ((size_t)written != pending->len) {
         syslog(LOG_WARNING, "Queued response short write: %d of %zu", written, pending->len);
+      } else {
+        uint64_t now_ms = util_get_time_ms(CLOCK_MONOTONIC);
+        self_stats_record_queued_message(pss,
+                                         now_ms >= pending->enqueue_mono_ms ? now_ms - pending->enqueue_mono_ms : 0);
       }
       g_free(pending);
 
-      if (pss->pending_tx_queue && !g_queue_is_empty(pss->pending_tx_queue)) {
+      /* Keep going while responses, a stats frame or channel frames are waiting */
+      if ((pss->pending_tx_queue && !g_queue_is_empty(pss->pending_tx_queue)) ||
+          (pss->stats_stream_enabled && pss->stats_write_requested_mono_ms != 0) || channel_next_due(pss) ||
+          pss->evict_reason) {
         lws_callback_on_writable(wsi);
       }
       break;
     }
 
-    if (!pss->stats_stream_enabled) {
+    /* Evicted session: queued messages (including the eviction event) are out, close it */
+    if (pss->evict_reason) {
+      lws_close_reason(
+          wsi, LWS_CLOSE_STATUS_GOINGAWAY, (unsigned char *)pss->evict_reason, strlen(pss->evict_reason));
+      return -1;
+    }
+
+    /* Send the session stream frame only when one was requested, otherwise serve the channels */
+    if (!pss->stats_stream_enabled || pss->stats_write_requested_mono_ms == 0) {
+      write_channel_frame(wsi, pss, app);
       break;
     }
 
+    /* Stamp the frame with its send time; the write below follows immediately */
+    uint64_t send_mono_ms = util_get_time_ms(CLOCK_MONOTONIC);
+
+    /* Relay mode: send the shared upstream frame as received */
+    if (relay_enabled()) {
+      if (relay_write_frame(wsi, pss) > 0) {
+        record_stats_frame_latency(pss, app, send_mono_ms);
+      }
+      stats_frame_done(wsi, pss);
+      break;
+    }
     json_len = (int)build_stats_json(json,
                                      sizeof(json),
                                      &app->stats,
+                                     send_mono_ms,
                                      proc_get_cpu_core_count(),
                                      ws_connected_client_count,
                                      MAX_WS_CONNECTED_CLIENTS,
@@ -624,6 +1332,7 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
                                      &truncated);
     if (json_len <= 0 || truncated) {
       syslog(LOG_ERR, "JSON message truncated, dropping the frame");
+      stats_frame_done(wsi, pss);
       break;
     }
 
@@ -634,12 +1343,18 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
     int written = lws_write(wsi, &pss->stream_buf[LWS_PRE], (size_t)json_len, LWS_WRITE_TEXT);
     if (written < 0) {
       syslog(LOG_WARNING, "lws_write failed");
+      stats_frame_done(wsi, pss);
       break;
     }
     if (written != json_len) {
       /* Short write: do not attempt to send the remainder as a new TEXT frame */
       syslog(LOG_WARNING, "short write: %d of %d", written, json_len);
+      stats_frame_done(wsi, pss);
+      break;
     }
+
+    record_stats_frame_latency(pss, app, send_mono_ms);
+    stats_frame_done(wsi, pss);
     break;
   }
 
@@ -654,14 +1369,11 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
      * If this session never reached ESTABLISHED, it still holds a
      * pending slot that must be released here.
      */
-    if (pss && !pss->counted) {
-      if (ws_pending_client_count > 0) {
-        ws_pending_client_count--;
-      }
-    }
     if (pss) {
+      release_pending_slot(pss);
       pss->wsi = NULL;
     }
+    relay_session_closed(pss);
     free_pending_tx_queue(pss);
     free_receive_buffer(pss);
     break;
@@ -684,6 +1396,11 @@ ws_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void
  * The timeout argument (1ms) is the maximum time lws_service() may block
  * while waiting for network activity.
  *
+ * Without sessions, handshakes in progress or upstream connections the
+ * period is stretched to WS_SERVICE_IDLE_INTERVAL_MS, so an idle backend
+ * wakes up 10 instead of 100 times per second. A new connection is then
+ * accepted up to 100 ms later; from its handshake on the short period applies.
+ *
  * Returning G_SOURCE_CONTINUE keeps the timer active.
  */
 gboolean
@@ -694,19 +1411,104 @@ lws_glib_service(gpointer user_data)
   /* Service libwebsockets may block up to 1ms */
   lws_service(context, 1);
 
+  bool idle = !ws.sessions && ws_pending_client_count == 0 && ws_local_pending_client_count == 0 &&
+              !upstream_active() && !cgi_proxy_active();
+  guint interval_ms = idle ? WS_SERVICE_IDLE_INTERVAL_MS : WS_SERVICE_INTERVAL_MS;
+  if (interval_ms != ws.lws_interval_ms) {
+    ws.lws_interval_ms = interval_ms;
+    loop_monitor_timeout_set_interval(ws.lws_timer_id, interval_ms);
+  }
+
   return G_SOURCE_CONTINUE;
 }
 
 /******************************************************************************/
 
-/* Protocol list for this WebSocket server */
+/* Protocol list for this WebSocket server.
+ *
+ * "sysstats" stays first: lws uses the first protocol for WebSocket clients
+ * that request none. The /metrics HTTP mount is bound to METRICS_PROTOCOL_NAME
+ * and client connections to other backends to UPSTREAM_PROTOCOL_NAME, HTTP
+ * client connections to the device CGIs to CGI_PROXY_PROTOCOL_NAME.
+ */
 static const struct lws_protocols protocols[] = { {
                                                       .name = "sysstats",
                                                       .callback = ws_callback,
                                                       .per_session_data_size = sizeof(struct per_session_data),
                                                   },
+                                                  {
+                                                      .name = METRICS_PROTOCOL_NAME,
+                                                      .callback = metrics_http_callback,
+                                                      .per_session_data_size = sizeof(struct metrics_http_session),
+                                                  },
+                                                  {
+                                                      .name = UPSTREAM_PROTOCOL_NAME,
+                                                      .callback = upstream_callback,
+                                                      .per_session_data_size = 0,
+                                                  },
+                                                  {
+                                                      .name = CGI_PROXY_PROTOCOL_NAME,
+                                                      .callback = cgi_proxy_callback,
+                                                      .per_session_data_size = 0,
+                                                  },
                                                   { NULL, NULL, 0, 0, 0, NULL, 0 } };
 
+/* Prometheus scrape endpoint on the WebSocket port, see metrics.h */
+static const struct lws_http_mount metrics_mount = {
+  .mountpoint = METRICS_HTTP_PATH,
+  .mountpoint_len = sizeof(METRICS_HTTP_PATH) - 1,
+  .origin = METRICS_PROTOCOL_NAME,
+  .origin_protocol = LWSMPRO_CALLBACK,
+};
+
+void
+ws_server_set_keepalive(unsigned int ping_s, unsigned int hangup_s)
+{
+  memset(&ws.keepalive, 0, sizeof(ws.keepalive));
+  if (ping_s == 0) {
+    return;
+  }
+
+  /* lws pings after secs_since_valid_ping and hangs up after secs_since_valid_hangup */
+  ws.keepalive.secs_since_valid_ping = (uint16_t)MIN(ping_s, WS_KEEPALIVE_MAX_S);
+  ws.keepalive.secs_since_valid_hangup = (uint16_t)MIN(MAX(hangup_s, ping_s + 1), WS_KEEPALIVE_MAX_S);
+}
+
+void
+ws_server_set_idle_timeout(unsigned int idle_s)
+{
+  ws.idle_timeout_s = idle_s;
+}
+
+void
+ws_server_get_slot_stats(struct ws_slot_stats *out)
+{
+  if (!out) {
+    return;
+  }
+
+  memset(out, 0, sizeof(*out));
+  out->max = MAX_WS_CONNECTED_CLIENTS;
+  out->connected = ws_connected_client_count;
+  out->local = ws_local_client_count;
+  out->pending = ws_pending_client_count;
+  out->streaming = ws_streaming_client_count;
+  for (GList *l = ws.sessions; l; l = l->next) {
+    if (session_is_idle(l->data)) {
+      out->idle++;
+    }
+  }
+  out->evicted_idle = ws.evicted_idle;
+  out->evicted_preempted = ws.evicted_preempted;
+  out->rejected = ws.rejected;
+}
+
+void
+ws_server_set_unix_socket(const char *path)
+{
+  ws.unix_path = path && path[0] != '\0' ? path : NULL;
+}
+
 bool
 ws_server_start(struct app_state *app, int port)
 {
@@ -717,13 +1519,19 @@ ws_server_start(struct app_state *app, int port)
   }
   ws.app = app;
 
-  /* Create WebSocket context */
+  /* Create WebSocket context; the TCP and the optional Unix socket listeners are vhosts of it */
   memset(&info, 0, sizeof(info));
+  info.options = LWS_SERVER_OPTION_EXPLICIT_VHOSTS;
   info.port = port;
   info.protocols = protocols;
+  info.mounts = &metrics_mount;
   info.gid = -1;
   info.uid = -1;
   info.user = app;
+  /* Ping silent peers and drop the ones that do not answer, see ws_server_set_keepalive() */
+  if (ws.keepalive.secs_since_valid_ping > 0) {
+    info.retry_and_idle_policy = &ws.keepalive;
+  }
 
   /* Set log level to error and warning only */
   lws_set_log_level(LLL_ERR | LLL_WARN, NULL);
@@ -733,6 +1541,34 @@ ws_server_start(struct app_state *app, int port)
     syslog(LOG_ERR, "Failed to create libwebsockets context");
     return false;
   }
+  ws.vhost = lws_create_vhost(ws.ctx, &info);
+  if (!ws.vhost) {
+    syslog(LOG_ERR, "Failed to listen on port %d", port);
+    lws_context_destroy(ws.ctx);
+    ws.ctx = NULL;
+    return false;
+  }
+
+  /* Same protocols and mounts on a Unix-domain socket for on-device consumers.
+   * The port is not used for Unix sockets but must not mean "no listener".
+   */
+  if (ws.unix_path) {
+    info.options = LWS_SERVER_OPTION_UNIX_SOCK;
+    info.iface = ws.unix_path;
+    info.vhost_name = "local";
+    ws.local_vhost = lws_create_vhost(ws.ctx, &info);
+    if (!ws.local_vhost) {
+      syslog(LOG_ERR, "Failed to listen on Unix socket %s", ws.unix_path);
+      lws_context_destroy(ws.ctx);
+      ws.ctx = NULL;
+      return false;
+    }
+    syslog(LOG_INFO, "WebSocket server listening on Unix socket %s", ws.unix_path);
+  }
+
+  /* Connect the configured upstream backends (fleet mode) */
+  upstream_start(ws.ctx, ws.vhost);
+  cgi_proxy_start(ws.ctx, ws.vhost);
 
   /* Drive libwebsockets from the GLib main loop.
    *
@@ -740,9 +1576,16 @@ ws_server_start(struct app_state *app, int port)
    *   process network events and invoke protocol callbacks.
    * - ws_server internally starts a statistics timer that periodically
    *   updates app_state::stats while at least one client has enabled
-   *   stats_stream.
+   *   stats_stream, has alert rules, or anomaly detection or summaries
+   *   are enabled.
    */
-  ws.lws_timer_id = g_timeout_add(10, lws_glib_service, ws.ctx);
+  ws.lws_interval_ms = WS_SERVICE_INTERVAL_MS;
+  ws.lws_timer_id = loop_monitor_timeout_add(ws.lws_interval_ms, "lws_service", lws_glib_service, ws.ctx);
+  update_stats_timer();
+  if (ws.idle_timeout_s > 0) {
+    ws.housekeeping_timer_id =
+        loop_monitor_timeout_add(WS_HOUSEKEEPING_INTERVAL_MS, "ws_housekeeping", housekeeping_timer_cb, NULL);
+  }
 
   return true;
 }
@@ -751,10 +1594,26 @@ void
 ws_server_stop(void)
 {
   stop_stats_timer();
+  burst_stop();
+  resume_stop();
   log_stream_stop();
+  metrics_stop();
+  upstream_stop();
+  cgi_proxy_stop();
   ws_pending_client_count = 0;
   ws_connected_client_count = 0;
   ws_streaming_client_count = 0;
+  ws_evicting_client_count = 0;
+  ws_local_client_count = 0;
+  ws_local_pending_client_count = 0;
+  ws.vhost = NULL;
+  ws.local_vhost = NULL;
+  if (ws.housekeeping_timer_id != 0) {
+    g_source_remove(ws.housekeeping_timer_id);
+    ws.housekeeping_timer_id = 0;
+  }
+  g_list_free(ws.sessions);
+  ws.sessions = NULL;
 
   /* Stop the GLib timer that drives libwebsockets servicing */
   if (ws.lws_timer_id != 0) {
@@ -771,3 +1630,85 @@ ws_server_stop(void)
 }
 
 /******************************************************************************/
+
+void
+ws_server_broadcast_json(const char *json, size_t len)
+{
+  for (GList *l = ws.sessions; l; l = l->next) {
+    struct per_session_data *pss = l->data;
+    queue_json_message(pss->wsi, pss, json, len, "Broadcast event");
+  }
+}
+
+void
+ws_server_queue_json(struct per_session_data *pss, const char *json, size_t len)
+{
+  queue_json_message(NULL, pss, json, len, "Session event");
+}
+
+void
+ws_server_send_error(struct per_session_data *pss, const char *type, const char *message)
+{
+  if (pss) {
+    send_error_response(NULL, pss, type, message, "Error response");
+  }
+}
+
+void
+ws_server_queue_bulk_json(struct per_session_data *pss, const char *json, size_t len)
+{
+  struct pending_ws_message *pending = queue_json_message(NULL, pss, json, len, "Bulk reply");
+
+  if (pending) {
+    pending->bulk = true;
+  }
+}
+
+bool
+ws_server_bulk_reply_queued(const struct per_session_data *pss)
+{
+  if (!pss || !pss->pending_tx_queue) {
+    return false;
+  }
+  for (GList *l = pss->pending_tx_queue->head; l; l = l->next) {
+    const struct pending_ws_message *pending = l->data;
+    if (pending->bulk) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+ws_server_request_stats_frame(struct per_session_data *pss)
+{
+  if (pss && pss->wsi) {
+    request_stats_frame(pss->wsi, pss);
+  }
+}
+
+bool
+ws_server_sampling_active(void)
+{
+  return ws.stats_timer_id != 0;
+}
+
+void
+ws_server_ingest_sample(void)
+{
+  if (ws.app) {
+    process_sample(ws.app);
+  }
+}
+
+void
+ws_server_foreach_session(void (*fn)(struct per_session_data *pss, void *user), void *user)
+{
+  if (!fn) {
+    return;
+  }
+
+  for (GList *l = ws.sessions; l; l = l->next) {
+    fn(l->data, user);
+  }
+}
@@ -1,9 +1,52 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "app_state.h"
 
+struct per_session_data;
+
+/* Client slot accounting, see ws_server_get_slot_stats() */
+struct ws_slot_stats {
+  unsigned int max;
+  unsigned int connected;
+  /* Clients of the local Unix-domain socket, not part of max/connected */
+  unsigned int local;
+  unsigned int pending;
+  unsigned int streaming;
+  /* Established sessions subscribed to nothing (eviction candidates) */
+  unsigned int idle;
+  /* Sessions closed by the idle timeout / to admit a new client, and connections refused */
+  uint64_t evicted_idle;
+  uint64_t evicted_preempted;
+  uint64_t rejected;
+};
+
+/* Configure WebSocket ping/pong keepalive; call before ws_server_start().
+ *
+ * An established connection without traffic for ping_s seconds is pinged,
+ * one that stays silent for hangup_s seconds is closed. 0 disables both.
+ */
+void ws_server_set_keepalive(unsigned int ping_s, unsigned int hangup_s);
+
+/* Close sessions that subscribe to nothing after idle_s seconds without a
+ * client message (0 = never). Call before ws_server_start().
+ */
+void ws_server_set_idle_timeout(unsigned int idle_s);
+
+/* Also listen on a Unix-domain socket (same protocol and snapshots).
+ *
+ * A path starting with '@' selects the Linux abstract namespace. Local
+ * clients have their own limit (MAX_WS_LOCAL_CLIENTS) and are never
+ * preempted for TCP clients. NULL disables it. Call before ws_server_start().
+ */
+void ws_server_set_unix_socket(const char *path);
+
+/* Fill in the current slot occupancy and eviction counters. */
+void ws_server_get_slot_stats(struct ws_slot_stats *out);
+
 /* Initialize and start the WebSocket server.
  *
  * Returns true on success, false on failure.
@@ -14,3 +57,37 @@ bool ws_server_start(struct app_state *app, int port);
  * Safe to call multiple times.
  */
 void ws_server_stop(void);
+
+/* Queue one JSON message (e.g. a server event) to every established client.
+ *
+ * The message is copied; delivery happens from each client's writable callback.
+ */
+void ws_server_broadcast_json(const char *json, size_t len);
+
+/* Queue one JSON message (e.g. a reply or a session event) to one client. */
+void ws_server_queue_json(struct per_session_data *pss, const char *json, size_t len);
+
+/* Queue { "error": { "type": type, "message": message } } to one client. */
+void ws_server_send_error(struct per_session_data *pss, const char *type, const char *message);
+
+/* Queue a large one-shot reply (a history window) to one client. It counts
+ * for ws_server_bulk_reply_queued() until it has been written.
+ */
+void ws_server_queue_bulk_json(struct per_session_data *pss, const char *json, size_t len);
+
+/* True while a bulk reply is waiting in the session's queue. */
+bool ws_server_bulk_reply_queued(const struct per_session_data *pss);
+
+/* Request a writable callback for the session's next stats frame. */
+void ws_server_request_stats_frame(struct per_session_data *pss);
+
+/* True while the sampling timer runs and keeps app_state::stats current. */
+bool ws_server_sampling_active(void);
+
+/* Process a sample written to app_state::stats outside the sampling timer
+ * (relay mode): channels, alerts, summaries, history, resume and shm publication.
+ */
+void ws_server_ingest_sample(void);
+
+/* Call fn for every established session (fn must not close sessions). */
+void ws_server_foreach_session(void (*fn)(struct per_session_data *pss, void *user), void *user);
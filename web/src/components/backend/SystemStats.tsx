@@ -78,6 +78,8 @@ const SystemStats: React.FC = () => {
     useState<boolean>(false);
   const [chartCoreListExpanded, setChartCoreListExpanded] =
     useState<boolean>(false);
+  /* System chart window, 0 = live stream history */
+  const [chartWindowMs, setChartWindowMs] = useState<number>(0);
 
   /* Refs */
   const mountMessageShownRef = useRef<boolean>(false);
@@ -100,11 +102,15 @@ const SystemStats: React.FC = () => {
     requestStorageInfo,
     requestSystemInfo,
     clearMonitorInput,
-    logLines,
+    logStore,
+    logVersion,
     logStreaming,
     startLogStream,
     stopLogStream,
-    clearLogLines
+    clearLogLines,
+    historyWindow,
+    historyError,
+    requestHistory
   } = useSystemStatsStream({
     url: WS_ADDRESS
   });
@@ -456,6 +462,11 @@ const SystemStats: React.FC = () => {
                   }
                   sysChartCoreSeries={sysChartCoreSeries}
                   sysChartYAxis={sysChartYAxis}
+                  chartWindowMs={chartWindowMs}
+                  setChartWindowMs={setChartWindowMs}
+                  historyWindow={historyWindow}
+                  historyError={historyError}
+                  requestHistory={requestHistory}
                 />
               )}
 
@@ -513,7 +524,8 @@ const SystemStats: React.FC = () => {
               {/* Log stream view */}
               {viewMode === 'logs' && (
                 <SystemStatsLogView
-                  logLines={logLines}
+                  logStore={logStore}
+                  logVersion={logVersion}
                   logStreaming={logStreaming}
                   startLogStream={startLogStream}
                   stopLogStream={stopLogStream}
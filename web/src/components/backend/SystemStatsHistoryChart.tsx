@@ -0,0 +1,233 @@
+/* System stats history chart
+ * Canvas chart of a long history window from the backend (-H).
+ *
+ * - The backend downsamples the window to the chart width (one group of at
+ *   most four points per device pixel column, M4), so a line through the
+ *   reply looks the same as one through every sample.
+ * - Points are drawn straight from the typed arrays as one canvas path per
+ *   series; no per-point objects or SVG elements.
+ * - The window is re-requested when it or the chart width changes, and
+ *   periodically so it keeps moving with time.
+ */
+import React, { useEffect, useRef, useState } from 'react';
+import { HistorySeries, HistoryWindow } from './systemStatsTypes';
+/* MUI */
+import Box from '@mui/material/Box';
+import Typography from '@mui/material/Typography';
+
+/* Series colors, shared with the live chart */
+export const SYS_CHART_COLORS = {
+  cpu: '#4254FB',
+  mem: '#FFB422'
+};
+
+/* Backend limit for columns per request is 2000 summed over the metrics;
+ * requestHistory asks for two (cpu and mem_used_percent)
+ */
+const MAX_HISTORY_COLUMNS = 1000;
+
+/* Wait for a resize to settle before requesting a new width */
+const RESIZE_SETTLE_MS = 150;
+
+/* Refresh at least this often, at most once per column's worth of time */
+const MIN_REFRESH_MS = 2000;
+
+/* Plot margins in CSS pixels (axis labels) */
+const MARGIN_LEFT_PX = 36;
+const MARGIN_RIGHT_PX = 8;
+const MARGIN_TOP_PX = 16;
+const MARGIN_BOTTOM_PX = 20;
+
+const GRID_COLOR = '#444';
+const LABEL_COLOR = '#fff';
+
+interface SystemStatsHistoryChartProps {
+  windowMs: number;
+  historyWindow: HistoryWindow | null;
+  historyError: string | null;
+  requestHistory: (windowMs: number, columns: number) => void;
+  metrics: {
+    cpu: boolean;
+    mem: boolean;
+  };
+}
+
+const formatTime = (ms: number, windowMs: number): string =>
+  new Date(ms).toLocaleTimeString([], {
+    hour: '2-digit',
+    minute: '2-digit',
+    second: windowMs < 3600000 ? '2-digit' : undefined
+  });
+
+export const SystemStatsHistoryChart: React.FC<
+  SystemStatsHistoryChartProps
+> = ({ windowMs, historyWindow, historyError, requestHistory, metrics }) => {
+  /* Local state */
+  const [size, setSize] = useState<{ width: number; height: number }>({
+    width: 0,
+    height: 0
+  });
+
+  /* Refs */
+  const containerRef = useRef<HTMLDivElement | null>(null);
+  const canvasRef = useRef<HTMLCanvasElement | null>(null);
+  const requestHistoryRef = useRef(requestHistory);
+  requestHistoryRef.current = requestHistory;
+
+  const dpr = window.devicePixelRatio || 1;
+  const columns = Math.min(
+    MAX_HISTORY_COLUMNS,
+    Math.round(
+      Math.max(0, size.width - MARGIN_LEFT_PX - MARGIN_RIGHT_PX) * dpr
+    )
+  );
+
+  /* Track the chart size */
+  useEffect(() => {
+    const container = containerRef.current;
+    if (!container) {
+      return;
+    }
+    const observer = new ResizeObserver(() => {
+      setSize({ width: container.clientWidth, height: container.clientHeight });
+    });
+    observer.observe(container);
+    setSize({ width: container.clientWidth, height: container.clientHeight });
+
+    return () => observer.disconnect();
+  }, []);
+
+  /* Request the window at the plot width and keep it current */
+  useEffect(() => {
+    if (columns <= 0) {
+      return;
+    }
+    const request = () => requestHistoryRef.current(windowMs, columns);
+    const settleTimer = setTimeout(request, RESIZE_SETTLE_MS);
+    const refreshTimer = setInterval(
+      request,
+      Math.max(MIN_REFRESH_MS, windowMs / columns)
+    );
+
+    return () => {
+      clearTimeout(settleTimer);
+      clearInterval(refreshTimer);
+    };
+  }, [windowMs, columns]);
+
+  /* Draw */
+  useEffect(() => {
+    const canvas = canvasRef.current;
+    if (!canvas || size.width === 0 || size.height === 0) {
+      return;
+    }
+    const width = Math.round(size.width * dpr);
+    const height = Math.round(size.height * dpr);
+    if (canvas.width !== width || canvas.height !== height) {
+      canvas.width = width;
+      canvas.height = height;
+    }
+    const ctx = canvas.getContext('2d');
+    if (!ctx) {
+      return;
+    }
+    ctx.clearRect(0, 0, width, height);
+
+    const left = MARGIN_LEFT_PX * dpr;
+    const right = width - MARGIN_RIGHT_PX * dpr;
+    const top = MARGIN_TOP_PX * dpr;
+    const bottom = height - MARGIN_BOTTOM_PX * dpr;
+    if (right <= left || bottom <= top) {
+      return;
+    }
+
+    /* Y grid, 0..100 % */
+    ctx.font = `${10 * dpr}px sans-serif`;
+    ctx.fillStyle = LABEL_COLOR;
+    ctx.strokeStyle = GRID_COLOR;
+    ctx.lineWidth = 1;
+    ctx.textAlign = 'right';
+    ctx.textBaseline = 'middle';
+    for (let percent = 0; percent <= 100; percent += 25) {
+      const y = Math.round(bottom - (percent / 100) * (bottom - top)) + 0.5;
+      ctx.beginPath();
+      ctx.moveTo(left, y);
+      ctx.lineTo(right, y);
+      ctx.stroke();
+      ctx.fillText(`${percent} %`, left - 4 * dpr, y);
+    }
+
+    if (!historyWindow) {
+      return;
+    }
+    const { fromMs, toMs, resolutionMs } = historyWindow;
+    const span = toMs - fromMs;
+
+    /* Time labels at both ends */
+    ctx.textBaseline = 'bottom';
+    ctx.textAlign = 'left';
+    ctx.fillText(formatTime(fromMs, span), left, height);
+    ctx.textAlign = 'right';
+    ctx.fillText(formatTime(toMs, span), right, height);
+
+    /* Wider steps than a few samples (or two columns) are periods without data */
+    const maxGapMs = Math.max(
+      3 * resolutionMs,
+      (2 * span) / Math.max(1, historyWindow.columns)
+    );
+    const drawSeries = (series: HistorySeries | undefined, color: string) => {
+      if (!series) {
+        return;
+      }
+      const { t, v } = series;
+      ctx.beginPath();
+      for (let i = 0; i < t.length; i++) {
+        const x = left + ((t[i] - fromMs) / span) * (right - left);
+        const value = Math.min(100, Math.max(0, v[i]));
+        const y = bottom - (value / 100) * (bottom - top);
+        if (i === 0 || t[i] - t[i - 1] > maxGapMs) {
+          ctx.moveTo(x, y);
+        } else {
+          ctx.lineTo(x, y);
+        }
+      }
+      ctx.strokeStyle = color;
+      ctx.lineWidth = 1.5 * dpr;
+      ctx.lineJoin = 'round';
+      ctx.stroke();
+    };
+
+    if (metrics.cpu) {
+      drawSeries(historyWindow.series.cpu, SYS_CHART_COLORS.cpu);
+    }
+    if (metrics.mem) {
+      drawSeries(historyWindow.series.mem_used_percent, SYS_CHART_COLORS.mem);
+    }
+  }, [historyWindow, size, dpr, metrics.cpu, metrics.mem]);
+
+  return (
+    <Box
+      ref={containerRef}
+      sx={{ position: 'relative', width: '100%', height: '100%' }}
+    >
+      <canvas
+        ref={canvasRef}
+        style={{ display: 'block', width: '100%', height: '100%' }}
+      />
+      {(historyError || !historyWindow) && (
+        <Typography
+          variant="caption"
+          sx={{
+            position: 'absolute',
+            top: 0,
+            left: MARGIN_LEFT_PX,
+            color: '#fff',
+            opacity: 0.7
+          }}
+        >
+          {historyError ?? 'Loading history...'}
+        </Typography>
+      )}
+    </Box>
+  );
+};
@@ -3,9 +3,20 @@
  * Displays live log lines streamed from the backend via the log_stream
  * WebSocket protocol. Lines are client-side filtered by a text input and
  * per-severity toggle chips.
+ *
+ * Only the rows in view are rendered (fixed row height), and the filter
+ * result is updated incrementally as lines arrive, see logStore.ts. Long
+ * lines are cut with an ellipsis; the full text is shown on hover.
  */
-import React, { useEffect, useState, useRef } from 'react';
+import React, {
+  useEffect,
+  useLayoutEffect,
+  useMemo,
+  useState,
+  useRef
+} from 'react';
 import { CustomButton } from '../CustomComponents';
+import { LogFilterIndex, LogPredicate, LogStore } from './logStore';
 import { LogLine } from './systemStatsTypes';
 /* MUI */
 import Alert from '@mui/material/Alert';
@@ -35,8 +46,28 @@ const LEVEL_LABEL: Record<Level, string> = {
   auth: 'AUTH'
 };
 
+/* Height of one rendered log row */
+const ROW_HEIGHT_PX = 16;
+
+/* Rows rendered above and below the visible ones */
+const OVERSCAN_ROWS = 20;
+
+/* Distance from the bottom within which new lines scroll into view */
+const FOLLOW_THRESHOLD_PX = 40;
+
+const makePredicate = (
+  filter: string,
+  enabledLevels: Set<Level>
+): LogPredicate => {
+  const needle = filter.trim() !== '' ? filter.toLowerCase() : '';
+  return (line: LogLine) =>
+    enabledLevels.has(line.level as Level) &&
+    (needle === '' || line.text.toLowerCase().includes(needle));
+};
+
 interface SystemStatsLogViewProps {
-  logLines: LogLine[];
+  logStore: LogStore;
+  logVersion: number;
   logStreaming: boolean;
   startLogStream: () => void;
   stopLogStream: () => void;
@@ -44,7 +75,8 @@ interface SystemStatsLogViewProps {
 }
 
 export const SystemStatsLogView: React.FC<SystemStatsLogViewProps> = ({
-  logLines,
+  logStore,
+  logVersion,
   logStreaming,
   startLogStream,
   stopLogStream,
@@ -57,23 +89,78 @@ export const SystemStatsLogView: React.FC<SystemStatsLogViewProps> = ({
     new Set(LEVELS)
   );
 
+  const [scrollTop, setScrollTop] = useState(0);
+  const [viewportHeight, setViewportHeight] = useState(0);
+
   /* Refs */
-  const bottomRef = useRef<HTMLDivElement | null>(null);
   const containerRef = useRef<HTMLDivElement | null>(null);
+  const filterIndexRef = useRef<LogFilterIndex>(new LogFilterIndex());
+  /* True while the view sticks to the newest line */
+  const followRef = useRef<boolean>(true);
+  const scrollFrameRef = useRef<number | null>(null);
 
-  /* Scroll to bottom when new lines arrive, unless the user scrolled up */
+  const predicate = useMemo(
+    () => makePredicate(filter, enabledLevels),
+    [filter, enabledLevels]
+  );
+
+  /* Rescan on a filter change, otherwise only test the new lines */
+  const filteredCount = useMemo(() => {
+    const index = filterIndexRef.current;
+    if (index.predicate !== predicate) {
+      index.reset(predicate, logStore);
+    } else {
+      index.update(logStore);
+    }
+    return index.length;
+  }, [predicate, logStore, logVersion]);
+
+  /* Track the viewport height */
   useEffect(() => {
     const container = containerRef.current;
     if (!container) {
       return;
     }
-    const atBottom =
+    const observer = new ResizeObserver(() => {
+      setViewportHeight(container.clientHeight);
+    });
+    observer.observe(container);
+    setViewportHeight(container.clientHeight);
+
+    return () => {
+      observer.disconnect();
+      if (scrollFrameRef.current !== null) {
+        cancelAnimationFrame(scrollFrameRef.current);
+      }
+    };
+  }, []);
+
+  /* Scroll to bottom when new lines arrive, unless the user scrolled up */
+  useLayoutEffect(() => {
+    const container = containerRef.current;
+    if (!container || !followRef.current) {
+      return;
+    }
+    container.scrollTop = container.scrollHeight;
+    setScrollTop(container.scrollTop);
+  }, [filteredCount, logVersion]);
+
+  /* Re-render the window at most once per frame while scrolling */
+  const handleScroll = () => {
+    const container = containerRef.current;
+    if (!container) {
+      return;
+    }
+    followRef.current =
       container.scrollHeight - container.scrollTop - container.clientHeight <
-      40;
-    if (atBottom) {
-      bottomRef.current?.scrollIntoView({ block: 'end' });
+      FOLLOW_THRESHOLD_PX;
+    if (scrollFrameRef.current === null) {
+      scrollFrameRef.current = requestAnimationFrame(() => {
+        scrollFrameRef.current = null;
+        setScrollTop(container.scrollTop);
+      });
     }
-  }, [logLines]);
+  };
 
   const toggleLevel = (level: Level) => {
     setEnabledLevels((prev) => {
@@ -87,22 +174,41 @@ export const SystemStatsLogView: React.FC<SystemStatsLogViewProps> = ({
     });
   };
 
-  const filteredLines = logLines.filter((line) => {
-    if (!enabledLevels.has(line.level as Level)) {
-      return false;
-    }
-    if (
-      filter.trim() !== '' &&
-      !line.text.toLowerCase().includes(filter.toLowerCase())
-    ) {
-      return false;
-    }
-    return true;
-  });
-
   const getLineColor = (level: string): string =>
     LEVEL_COLOR[level as Level] ?? '#e8e8e8';
 
+  /* Visible window of the filtered lines */
+  const firstRow = Math.max(
+    0,
+    Math.floor(scrollTop / ROW_HEIGHT_PX) - OVERSCAN_ROWS
+  );
+  const endRow = Math.min(
+    filteredCount,
+    Math.ceil((scrollTop + viewportHeight) / ROW_HEIGHT_PX) + OVERSCAN_ROWS
+  );
+  const rows: React.ReactNode[] = [];
+  for (let i = firstRow; i < endRow; i++) {
+    const lineIndex = filterIndexRef.current.lineIndex(i);
+    const line = logStore.at(lineIndex);
+    if (!line) {
+      continue;
+    }
+    rows.push(
+      <div
+        key={lineIndex}
+        title={line.text}
+        style={{
+          height: ROW_HEIGHT_PX,
+          color: getLineColor(line.level),
+          overflow: 'hidden',
+          textOverflow: 'ellipsis'
+        }}
+      >
+        {line.text}
+      </div>
+    );
+  }
+
   return (
     <Stack spacing={1} sx={{ height: '100%', minHeight: 0 }}>
       {/* Log limits notice */}
@@ -163,7 +269,7 @@ export const SystemStatsLogView: React.FC<SystemStatsLogViewProps> = ({
           size="small"
           variant="outlined"
           onClick={clearLogLines}
-          disabled={logLines.length === 0}
+          disabled={logStore.length === 0}
           sx={{ color: '#fff' }}
         >
           Clear
@@ -190,7 +296,7 @@ export const SystemStatsLogView: React.FC<SystemStatsLogViewProps> = ({
           variant="caption"
           sx={{ opacity: 0.6, whiteSpace: 'nowrap' }}
         >
-          {filteredLines.length}/{logLines.length} lines
+          {filteredCount}/{logStore.length} lines
         </Typography>
       </Box>
 
@@ -226,24 +332,24 @@ export const SystemStatsLogView: React.FC<SystemStatsLogViewProps> = ({
       <Box
         ref={containerRef}
         className="selectable-text"
+        onScroll={handleScroll}
         sx={{
           fontFamily: 'monospace',
           fontSize: '0.72rem',
-          lineHeight: 1.4,
+          lineHeight: `${ROW_HEIGHT_PX}px`,
           backgroundColor: 'rgba(0,0,0,0.45)',
           border: '1px solid rgba(255,255,255,0.1)',
           borderRadius: 1,
-          padding: '6px 8px',
+          padding: '0 8px',
           flex: '1 1 auto',
           minHeight: 0,
           overflowY: 'auto',
-          whiteSpace: 'pre-wrap',
-          wordBreak: 'break-all',
+          whiteSpace: 'pre',
           color: '#e8e8e8',
           cursor: 'text'
         }}
       >
-        {filteredLines.length === 0 ? (
+        {filteredCount === 0 ? (
           <Typography
             variant="caption"
             sx={{ opacity: 0.4, fontFamily: 'monospace' }}
@@ -253,13 +359,25 @@ export const SystemStatsLogView: React.FC<SystemStatsLogViewProps> = ({
               : 'Press Stream to start receiving log lines.'}
           </Typography>
         ) : (
-          filteredLines.map((line, i) => (
-            <div key={i} style={{ color: getLineColor(line.level) }}>
-              {line.text}
+          /* Full-height spacer with the rendered window moved into place */
+          <div
+            style={{
+              height: filteredCount * ROW_HEIGHT_PX,
+              position: 'relative'
+            }}
+          >
+            <div
+              style={{
+                position: 'absolute',
+                top: firstRow * ROW_HEIGHT_PX,
+                left: 0,
+                right: 0
+              }}
+            >
+              {rows}
             </div>
-          ))
+          </div>
         )}
-        <div ref={bottomRef} />
       </Box>
     </Stack>
   );
@@ -1,7 +1,7 @@
 /* System stats overview views
  * Show overview system monitor views:
  * - Bars
- * - Chart
+ * - Chart (live minute or a long history window)
  */
 import React from 'react';
 import { CustomButton } from '../CustomComponents';
@@ -16,7 +16,11 @@ import Tooltip from '@mui/material/Tooltip';
 import Typography from '@mui/material/Typography';
 /* MUI X */
 import { LineChart } from '@mui/x-charts/LineChart';
-import { HistoryPoint, SysStats } from './systemStatsTypes';
+import {
+  SystemStatsHistoryChart,
+  SYS_CHART_COLORS
+} from './SystemStatsHistoryChart';
+import { HistoryPoint, HistoryWindow, SysStats } from './systemStatsTypes';
 
 /* Convert uptime in seconds to a compact human-readable string (e.g. "2d 3h 4m 5s"). */
 const formatUptime = (seconds: number): string => {
@@ -269,6 +273,15 @@ export const SystemStatsBarsView: React.FC<SystemStatsBarsViewProps> = ({
   </Stack>
 );
 
+/* Chart windows, 0 = live stream history */
+export const SYS_CHART_WINDOWS: { label: string; windowMs: number }[] = [
+  { label: 'Live', windowMs: 0 },
+  { label: '15 min', windowMs: 15 * 60 * 1000 },
+  { label: '1 h', windowMs: 60 * 60 * 1000 },
+  { label: '6 h', windowMs: 6 * 60 * 60 * 1000 },
+  { label: '24 h', windowMs: 24 * 60 * 60 * 1000 }
+];
+
 interface SystemStatsChartViewProps {
   stats: SysStats;
   history: HistoryPoint[];
@@ -294,6 +307,11 @@ interface SystemStatsChartViewProps {
   sysChartYAxis: {
     min: number;
   }[];
+  chartWindowMs: number;
+  setChartWindowMs: (windowMs: number) => void;
+  historyWindow: HistoryWindow | null;
+  historyError: string | null;
+  requestHistory: (windowMs: number, columns: number) => void;
 }
 
 /* Overall system stats chart view */
@@ -311,9 +329,41 @@ export const SystemStatsChartView: React.FC<SystemStatsChartViewProps> = ({
   chartCoreListExpanded,
   toggleChartCoreListExpanded,
   sysChartCoreSeries,
-  sysChartYAxis
+  sysChartYAxis,
+  chartWindowMs,
+  setChartWindowMs,
+  historyWindow,
+  historyError,
+  requestHistory
 }) => (
   <Stack spacing={1} sx={{ height: '100%', minHeight: 0 }}>
+    {/* Chart window: live stream or long history from the backend */}
+    <Box
+      sx={{
+        display: 'flex',
+        flexWrap: 'wrap',
+        gap: 1,
+        alignSelf: 'flex-start'
+      }}
+    >
+      {SYS_CHART_WINDOWS.map(({ label, windowMs }) => (
+        <Chip
+          key={`sys-chart-window-${windowMs}`}
+          disableRipple
+          size="small"
+          clickable
+          onClick={() => setChartWindowMs(windowMs)}
+          label={label}
+          sx={{
+            color: '#fff',
+            '& .MuiChip-label': { color: '#fff' },
+            opacity: chartWindowMs === windowMs ? 1 : 0.5,
+            border: chartWindowMs === windowMs ? '1px solid #fff' : undefined
+          }}
+        />
+      ))}
+    </Box>
+
     {/* Toggle system chart metrics */}
     <Box
       sx={{
@@ -356,100 +406,102 @@ export const SystemStatsChartView: React.FC<SystemStatsChartViewProps> = ({
       </Tooltip>
     </Box>
 
-    {/* CPU core info  */}
-    {Array.isArray(stats.cpu_per_core) && stats.cpu_per_core.length > 0 && (
-      <Box
-        sx={{
-          display: 'flex',
-          flexDirection: 'column',
-          gap: 1,
-          width: '100%'
-        }}
-      >
-        <Stack
-          direction="row"
-          spacing={1}
-          alignItems="center"
+    {/* CPU core info (per-core history is live only) */}
+    {chartWindowMs === 0 &&
+      Array.isArray(stats.cpu_per_core) &&
+      stats.cpu_per_core.length > 0 && (
+        <Box
           sx={{
-            flexWrap: 'wrap'
+            display: 'flex',
+            flexDirection: 'column',
+            gap: 1,
+            width: '100%'
           }}
         >
-          <Typography variant="subtitle2">CPU cores</Typography>
-          <Chip
-            size="small"
-            label={`${stats.cpu_per_core.length} cores`}
-            sx={{
-              color: '#fff',
-              '& .MuiChip-label': { color: '#fff' },
-              opacity: 0.7
-            }}
-          />
-          {/* Show all cores button */}
-          <CustomButton
-            size="small"
-            variant="outlined"
-            onClick={toggleAllSysChartCoreMetrics}
-            sx={{
-              color: '#fff',
-              borderColor: '#fff'
-            }}
-          >
-            {allSysChartCoresEnabled ? 'Hide all cores' : 'Show all cores'}
-          </CustomButton>
-          {/* Expand or collapse CPU cores dropdown */}
-          <CustomButton
-            size="small"
-            variant="outlined"
-            onClick={toggleChartCoreListExpanded}
+          <Stack
+            direction="row"
+            spacing={1}
+            alignItems="center"
             sx={{
-              color: '#fff',
-              borderColor: '#fff'
+              flexWrap: 'wrap'
             }}
           >
-            {chartCoreListExpanded ? 'Collapse' : 'Expand'}
-          </CustomButton>
-        </Stack>
+            <Typography variant="subtitle2">CPU cores</Typography>
+            <Chip
+              size="small"
+              label={`${stats.cpu_per_core.length} cores`}
+              sx={{
+                color: '#fff',
+                '& .MuiChip-label': { color: '#fff' },
+                opacity: 0.7
+              }}
+            />
+            {/* Show all cores button */}
+            <CustomButton
+              size="small"
+              variant="outlined"
+              onClick={toggleAllSysChartCoreMetrics}
+              sx={{
+                color: '#fff',
+                borderColor: '#fff'
+              }}
+            >
+              {allSysChartCoresEnabled ? 'Hide all cores' : 'Show all cores'}
+            </CustomButton>
+            {/* Expand or collapse CPU cores dropdown */}
+            <CustomButton
+              size="small"
+              variant="outlined"
+              onClick={toggleChartCoreListExpanded}
+              sx={{
+                color: '#fff',
+                borderColor: '#fff'
+              }}
+            >
+              {chartCoreListExpanded ? 'Collapse' : 'Expand'}
+            </CustomButton>
+          </Stack>
 
-        {/* Per-core info dropdown */}
-        {chartCoreListExpanded && (
-          <Box
-            sx={{
-              maxHeight: '35%',
-              minHeight: 0,
-              width: '100%',
-              overflowY: 'auto',
-              whiteSpace: 'pre-wrap',
-              fontFamily: 'monospace',
-              fontSize: '12px',
-              backgroundColor: '#111',
-              color: '#fff',
-              padding: '8px',
-              border: '1px solid #333'
-            }}
-          >
-            {stats.cpu_per_core.map((coreUsage, index) => (
-              <div
-                key={`sys-chart-core-${index}`}
-                onClick={() => toggleSysChartCoreMetric(index)}
-                style={{
-                  cursor: 'pointer',
-                  padding: '4px 6px',
-                  display: 'flex',
-                  alignItems: 'center',
-                  justifyContent: 'space-between',
-                  backgroundColor: sysChartCoreMetrics[index]
-                    ? '#333'
-                    : 'transparent'
-                }}
-              >
-                <span>{`CPU ${index}`}</span>
-                <span>{`${coreUsage.toFixed(1)} %`}</span>
-              </div>
-            ))}
-          </Box>
-        )}
-      </Box>
-    )}
+          {/* Per-core info dropdown */}
+          {chartCoreListExpanded && (
+            <Box
+              sx={{
+                maxHeight: '35%',
+                minHeight: 0,
+                width: '100%',
+                overflowY: 'auto',
+                whiteSpace: 'pre-wrap',
+                fontFamily: 'monospace',
+                fontSize: '12px',
+                backgroundColor: '#111',
+                color: '#fff',
+                padding: '8px',
+                border: '1px solid #333'
+              }}
+            >
+              {stats.cpu_per_core.map((coreUsage, index) => (
+                <div
+                  key={`sys-chart-core-${index}`}
+                  onClick={() => toggleSysChartCoreMetric(index)}
+                  style={{
+                    cursor: 'pointer',
+                    padding: '4px 6px',
+                    display: 'flex',
+                    alignItems: 'center',
+                    justifyContent: 'space-between',
+                    backgroundColor: sysChartCoreMetrics[index]
+                      ? '#333'
+                      : 'transparent'
+                  }}
+                >
+                  <span>{`CPU ${index}`}</span>
+                  <span>{`${coreUsage.toFixed(1)} %`}</span>
+                </div>
+              ))}
+            </Box>
+          )}
+        </Box>
+      )}
 
     {/* System stats chart using MUI X */}
     <Box
@@ -460,61 +512,73 @@ export const SystemStatsChartView: React.FC<SystemStatsChartViewProps> = ({
         overflowX: 'hidden'
       }}
     >
-      <LineChart
-        skipAnimation
-        hideLegend
-        margin={{ left: 0, right: 8, top: 16, bottom: 8 }}
-        series={[
-          ...(sysChartMetrics.cpu
-            ? [
-                {
-                  data: history.map((h) => h.cpu),
-                  label: 'CPU %',
-                  area: true,
-                  baseline: 'min' as const,
-                  showMark: false,
-                  valueFormatter: (v: number | null) =>
-                    v == null ? '' : `${v.toFixed(1)} %`
-                }
-              ]
-            : []),
+      {chartWindowMs === 0 ? (
+        <LineChart
+          skipAnimation
+          hideLegend
+          margin={{ left: 0, right: 8, top: 16, bottom: 8 }}
+          series={[
+            ...(sysChartMetrics.cpu
+              ? [
+                  {
+                    data: history.map((h) => h.cpu),
+                    label: 'CPU %',
+                    color: SYS_CHART_COLORS.cpu,
+                    area: true,
+                    baseline: 'min' as const,
+                    showMark: false,
+                    valueFormatter: (v: number | null) =>
+                      v == null ? '' : `${v.toFixed(1)} %`
+                  }
+                ]
+              : []),
 
-          ...(sysChartMetrics.mem
-            ? [
-                {
-                  data: history.map((h) => h.mem),
-                  label: 'RAM %',
-                  area: true,
-                  baseline: 'min' as const,
-                  showMark: false,
-                  valueFormatter: (v: number | null) =>
-                    v == null ? '' : `${v.toFixed(1)} %`
-                }
-              ]
-            : []),
+            ...(sysChartMetrics.mem
+              ? [
+                  {
+                    data: history.map((h) => h.mem),
+                    label: 'RAM %',
+                    color: SYS_CHART_COLORS.mem,
+                    area: true,
+                    baseline: 'min' as const,
+                    showMark: false,
+                    valueFormatter: (v: number | null) =>
+                      v == null ? '' : `${v.toFixed(1)} %`
+                  }
+                ]
+              : []),
 
-          ...sysChartCoreSeries
-        ]}
-        yAxis={sysChartYAxis}
-        sx={{
-          height: '100%',
-          '& .MuiAreaElement-root': {
-            fillOpacity: 0.12
-          },
-          '& .MuiChartsAxis-line': {
-            stroke: '#fff !important'
-          },
-          '& .MuiChartsAxis-tick': {
-            stroke: '#fff !important'
-          },
-          '& .MuiChartsAxis-tickLabel': {
-            fill: '#fff !important'
-          },
-          '& .MuiChartsLegend-root': {
-            color: '#fff !important'
-          }
-        }}
-      />
+            ...sysChartCoreSeries
+          ]}
+          yAxis={sysChartYAxis}
+          sx={{
+            height: '100%',
+            '& .MuiAreaElement-root': {
+              fillOpacity: 0.12
+            },
+            '& .MuiChartsAxis-line': {
+              stroke: '#fff !important'
+            },
+            '& .MuiChartsAxis-tick': {
+              stroke: '#fff !important'
+            },
+            '& .MuiChartsAxis-tickLabel': {
+              fill: '#fff !important'
+            },
+            '& .MuiChartsLegend-root': {
+              color: '#fff !important'
+            }
+          }}
+        />
+      ) : (
+        <SystemStatsHistoryChart
+          windowMs={chartWindowMs}
+          historyWindow={historyWindow}
+          historyError={historyError}
+          requestHistory={requestHistory}
+          metrics={sysChartMetrics}
+        />
+      )}
     </Box>
   </Stack>
 );
@@ -0,0 +1,132 @@
+/* Log store
+ * Chunked backing store and incremental filter for long log histories.
+ *
+ * - Lines are kept in fixed-size chunks; appending never copies existing
+ *   lines and the oldest chunk is dropped as a whole once the store is full.
+ * - Lines are addressed by an absolute index that keeps growing across
+ *   evictions and clears, so filter results stay valid while lines stream in.
+ * - LogFilterIndex tests every line once per filter: new lines are tested as
+ *   they arrive, a filter change rescans the store.
+ */
+import { LogLine } from './systemStatsTypes';
+
+const LOG_CHUNK_LINES = 1024;
+
+/* Drop evicted filter matches once this many have accumulated */
+const MIN_COMPACT_MATCHES = 4096;
+
+export class LogStore {
+  private chunks: LogLine[][] = [];
+  private readonly maxLines: number;
+  /* Absolute index of the oldest stored line */
+  first = 0;
+  /* Absolute index after the newest stored line */
+  end = 0;
+
+  constructor(maxLines: number) {
+    this.maxLines = maxLines;
+  }
+
+  get length(): number {
+    return this.end - this.first;
+  }
+
+  append(lines: LogLine[]) {
+    for (const line of lines) {
+      const last = this.chunks[this.chunks.length - 1];
+      if (!last || last.length === LOG_CHUNK_LINES) {
+        this.chunks.push([line]);
+      } else {
+        last.push(line);
+      }
+      this.end++;
+    }
+
+    /* Evict whole chunks while the rest still holds maxLines */
+    while (
+      this.chunks.length > 1 &&
+      this.length - this.chunks[0].length >= this.maxLines
+    ) {
+      this.first += this.chunks[0].length;
+      this.chunks.shift();
+    }
+  }
+
+  clear() {
+    this.chunks = [];
+    this.first = this.end;
+  }
+
+  /* Line at absolute index, undefined if evicted or not yet received.
+   * Every chunk but the newest is full, so the chunk follows from the offset.
+   */
+  at(index: number): LogLine | undefined {
+    if (index < this.first || index >= this.end) {
+      return undefined;
+    }
+    const offset = index - this.first;
+    return this.chunks[Math.floor(offset / LOG_CHUNK_LINES)][
+      offset % LOG_CHUNK_LINES
+    ];
+  }
+}
+
+export type LogPredicate = (line: LogLine) => boolean;
+
+/* Absolute indices of the lines of a LogStore that match a predicate */
+export class LogFilterIndex {
+  private matches: number[] = [];
+  /* Matches before head were evicted from the store */
+  private head = 0;
+  /* Absolute index of the next line to test */
+  private scanned = 0;
+  predicate: LogPredicate | null = null;
+
+  get length(): number {
+    return this.matches.length - this.head;
+  }
+
+  /* Absolute store index of the i-th match */
+  lineIndex(i: number): number {
+    return this.matches[this.head + i];
+  }
+
+  /* Start over with a new predicate */
+  reset(predicate: LogPredicate, store: LogStore) {
+    this.predicate = predicate;
+    this.matches = [];
+    this.head = 0;
+    this.scanned = store.first;
+    this.update(store);
+  }
+
+  /* Follow the store: forget evicted lines and test new ones */
+  update(store: LogStore) {
+    const predicate = this.predicate;
+    if (!predicate) {
+      return;
+    }
+
+    while (
+      this.head < this.matches.length &&
+      this.matches[this.head] < store.first
+    ) {
+      this.head++;
+    }
+    if (
+      this.head >= MIN_COMPACT_MATCHES &&
+      this.head * 2 >= this.matches.length
+    ) {
+      this.matches = this.matches.slice(this.head);
+      this.head = 0;
+    }
+
+    for (let i = Math.max(this.scanned, store.first); i < store.end; i++) {
+      const line = store.at(i);
+      if (line && predicate(line)) {
+        this.matches.push(i);
+      }
+    }
+    this.scanned = store.end;
+  }
+}
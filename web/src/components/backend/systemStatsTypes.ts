@@ -16,6 +16,8 @@ export interface SystemInfo {
 
   machine: string;
   cpu_cores: number;
+  /* CPU clusters (cores sharing a clock), ordered as SysStats.cpu_clusters */
+  cpu_clusters?: { cpus: string; cores: number; max_freq_khz?: number }[];
 
   os_name?: string;
   os_version?: string;
@@ -40,26 +42,44 @@ export interface ProcStats {
   rss_kb: number;
   pss_kb: number;
   uss_kb: number;
+  cmdline?: string;
+  exe?: string;
+  uid?: number;
+  cgroup?: string;
 }
 
 export interface SysStats {
   ts: number;
   mono_ms: number;
+  /* Global sample sequence number, used to resume after a reconnect */
+  seq?: number;
+  send_mono_ms?: number;
   delta_ms: number;
   cpu: number;
   cpu_cores: number;
   cpu_per_core?: number[];
+  /* Hot-unplugged core indices below the highest online core */
+  cpu_offline?: number[];
+  /* Mean usage per cluster on multi-cluster SoCs */
+  cpu_clusters?: number[];
   mem_total_kb: number;
   mem_available_kb: number;
   uptime_s: number;
   load1: number;
   load5: number;
   load15: number;
+  /* Present while the backend throttles its sampling (-B), 1..3 */
+  throttle_level?: number;
   clients: {
     connected: number;
     max: number;
   };
   proc?: ProcStats;
+  /* Set while the monitored process is not found */
+  error?: {
+    type: string;
+    message: string;
+  };
 }
 
 export interface HistoryPoint {
@@ -69,8 +89,35 @@ export interface HistoryPoint {
   cpuPerCore: number[];
 }
 
+/* Metrics of the backend long history (-H) */
+export type HistoryMetric = 'cpu' | 'mem_used_percent' | 'load1';
+
+/* One downsampled series, times in ms since epoch */
+export interface HistorySeries {
+  t: Float64Array;
+  v: Float64Array;
+}
+
+/* Reply to a history request: min/max-preserving points (M4), at most four
+ * per requested pixel column. resolutionMs is the sample interval of the
+ * data used, larger gaps between points have no samples.
+ */
+export interface HistoryWindow {
+  fromMs: number;
+  toMs: number;
+  columns: number;
+  resolutionMs: number;
+  series: Partial<Record<HistoryMetric, HistorySeries>>;
+}
+
 /* A single streamed log line with its source severity level. */
 export interface LogLine {
   text: string;
   level: string;
 }
+
+/* Resume token announced by the server on every new connection. */
+export interface SessionInfo {
+  token: string;
+  resume_ms: number;
+}
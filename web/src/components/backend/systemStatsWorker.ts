@@ -0,0 +1,458 @@
+/* System stats worker
+ * Decodes backend system monitor messages off the UI thread.
+ *
+ * Handles:
+ * - JSON.parse of every stats frame and log line
+ * - History ring buffers (one Float64Array per metric) for system and process stats
+ * - Dropping frames and log lines already seen before a resume
+ * - Batching: the latest stats, history and new log lines are posted at most
+ *   once per display frame, history as transferable typed arrays
+ * - Long history windows (replies to history requests), also as typed arrays
+ *
+ * Other messages (one-shot responses, session and resume replies) are posted
+ * as parsed objects, in arrival order, for useSystemStatsStream to handle.
+ *
+ * NOTE: Only types may be imported from this module, importing values would
+ * run the worker message handler on the UI thread.
+ */
+import type {
+  HistoryMetric,
+  HistorySeries,
+  HistoryWindow,
+  LogLine,
+  ProcStats,
+  SysStats
+} from './systemStatsTypes';
+
+const MAX_HISTORY_POINTS = 60;
+/* Log lines kept per batch; the history itself lives in the hook's LogStore */
+const MAX_LOG_BATCH_LINES = 10000;
+
+/* Post at most one batch per display frame (60 Hz) */
+const FLUSH_INTERVAL_MS = 16;
+
+/* System history, oldest first */
+export interface HistoryBatch {
+  length: number;
+  ts: Float64Array;
+  cpu: Float64Array;
+  mem: Float64Array;
+  /* Per-core usage, sample-major: cores[i * coreWidth + core] */
+  cores: Float64Array;
+  coreWidth: number;
+  /* Number of valid cores of each sample */
+  coreCounts: Float64Array;
+}
+
+/* Process history of the monitored process, oldest first */
+export interface ProcHistoryBatch {
+  length: number;
+  ts: Float64Array;
+  cpu: Float64Array;
+  rss: Float64Array;
+  pss: Float64Array;
+  uss: Float64Array;
+  pid: Float64Array;
+}
+
+export interface WorkerUpdate {
+  type: 'update';
+  /* Latest stats frame of the batch, absent if none arrived */
+  stats?: SysStats;
+  history?: HistoryBatch;
+  procHistory?: ProcHistoryBatch;
+  /* Log lines that arrived since the previous batch */
+  logLines?: LogLine[];
+  /* Resume positions after this batch */
+  statsSeq: number;
+  logSeq: number;
+}
+
+export type WorkerResponse =
+  | WorkerUpdate
+  | { type: 'history'; window: HistoryWindow }
+  /* Any message that is not a stats frame or log line */
+  | { type: 'message'; data: any };
+
+export type WorkerRequest =
+  /* Raw WebSocket text frame */
+  | { type: 'message'; data: string }
+  /* Drop history (system and process), process history or resume positions */
+  | { type: 'clear'; history?: boolean; procHistory?: boolean; seq?: boolean };
+
+/* Fixed capacity ring of rows with one Float64Array per column */
+class SeriesRing {
+  private readonly capacity: number;
+  private columns: Float64Array[];
+  private start = 0;
+  length = 0;
+
+  constructor(capacity: number, columnCount: number) {
+    this.capacity = capacity;
+    this.columns = Array.from(
+      { length: columnCount },
+      () => new Float64Array(capacity)
+    );
+  }
+
+  get width(): number {
+    return this.columns.length;
+  }
+
+  /* Add columns (filled with NaN) so rows of up to width values fit */
+  widen(width: number) {
+    while (this.columns.length < width) {
+      this.columns.push(new Float64Array(this.capacity).fill(NaN));
+    }
+  }
+
+  push(values: ArrayLike<number>) {
+    const index = (this.start + this.length) % this.capacity;
+    if (this.length < this.capacity) {
+      this.length++;
+    } else {
+      this.start = (this.start + 1) % this.capacity;
+    }
+    for (let c = 0; c < this.columns.length; c++) {
+      this.columns[c][index] = c < values.length ? values[c] : NaN;
+    }
+  }
+
+  clear() {
+    this.start = 0;
+    this.length = 0;
+  }
+
+  /* Newest value of column c (the ring must not be empty) */
+  last(c: number): number {
+    return this.columns[c][(this.start + this.length - 1) % this.capacity];
+  }
+
+  /* Copy one column, oldest first, into a new (transferable) array */
+  column(c: number): Float64Array {
+    const out = new Float64Array(this.length);
+    const col = this.columns[c];
+    for (let i = 0; i < this.length; i++) {
+      out[i] = col[(this.start + i) % this.capacity];
+    }
+    return out;
+  }
+
+  /* Copy all columns row by row (sample-major) into a new array */
+  rows(): Float64Array {
+    const width = this.columns.length;
+    const out = new Float64Array(this.length * width);
+    for (let i = 0; i < this.length; i++) {
+      const index = (this.start + i) % this.capacity;
+      for (let c = 0; c < width; c++) {
+        out[i * width + c] = this.columns[c][index];
+      }
+    }
+    return out;
+  }
+}
+
+/* Worker state */
+const history = new SeriesRing(MAX_HISTORY_POINTS, 4); /* ts, cpu, mem, core count */
+const coreHistory = new SeriesRing(MAX_HISTORY_POINTS, 0);
+const procHistory = new SeriesRing(MAX_HISTORY_POINTS, 6); /* ts, cpu, rss, pss, uss, pid */
+let lastStatsSeq = 0;
+let lastLogSeq = 0;
+
+/* Pending batch */
+let pendingStats: SysStats | undefined;
+let historyDirty = false;
+let procHistoryDirty = false;
+let pendingLogLines: LogLine[] = [];
+let flushTimer: ReturnType<typeof setTimeout> | null = null;
+
+const historyBatch = (): HistoryBatch => ({
+  length: history.length,
+  ts: history.column(0),
+  cpu: history.column(1),
+  mem: history.column(2),
+  coreCounts: history.column(3),
+  cores: coreHistory.rows(),
+  coreWidth: coreHistory.width
+});
+
+const procHistoryBatch = (): ProcHistoryBatch => ({
+  length: procHistory.length,
+  ts: procHistory.column(0),
+  cpu: procHistory.column(1),
+  rss: procHistory.column(2),
+  pss: procHistory.column(3),
+  uss: procHistory.column(4),
+  pid: procHistory.column(5)
+});
+
+const buffersOf = (...arrays: Float64Array[]) =>
+  arrays.map((array) => array.buffer as ArrayBuffer);
+
+const flush = () => {
+  if (flushTimer !== null) {
+    clearTimeout(flushTimer);
+    flushTimer = null;
+  }
+  if (
+    !pendingStats &&
+    !historyDirty &&
+    !procHistoryDirty &&
+    pendingLogLines.length === 0
+  ) {
+    return;
+  }
+
+  const update: WorkerUpdate = {
+    type: 'update',
+    statsSeq: lastStatsSeq,
+    logSeq: lastLogSeq
+  };
+  const transfer: ArrayBuffer[] = [];
+  if (pendingStats) {
+    update.stats = pendingStats;
+  }
+  if (historyDirty) {
+    const batch = historyBatch();
+    update.history = batch;
+    transfer.push(
+      ...buffersOf(
+        batch.ts,
+        batch.cpu,
+        batch.mem,
+        batch.cores,
+        batch.coreCounts
+      )
+    );
+  }
+  if (procHistoryDirty) {
+    const batch = procHistoryBatch();
+    update.procHistory = batch;
+    transfer.push(
+      ...buffersOf(
+        batch.ts,
+        batch.cpu,
+        batch.rss,
+        batch.pss,
+        batch.uss,
+        batch.pid
+      )
+    );
+  }
+  if (pendingLogLines.length > 0) {
+    update.logLines = pendingLogLines;
+  }
+
+  pendingStats = undefined;
+  historyDirty = false;
+  procHistoryDirty = false;
+  pendingLogLines = [];
+  self.postMessage(update, { transfer });
+};
+
+const scheduleFlush = () => {
+  if (flushTimer === null) {
+    flushTimer = setTimeout(flush, FLUSH_INTERVAL_MS);
+  }
+};
+
+/* Forward a message the hook handles itself, after everything received before it */
+const postMessageData = (data: any) => {
+  flush();
+  const response: WorkerResponse = { type: 'message', data };
+  self.postMessage(response);
+};
+
+/* Decode a history reply; times are sent as offsets from from_ms */
+const postHistoryWindow = (reply: any) => {
+  const fromMs = Number(reply.from_ms);
+  const series: Partial<Record<HistoryMetric, HistorySeries>> = {};
+  const transfer: ArrayBuffer[] = [];
+
+  for (const [metric, data] of Object.entries<any>(reply.series ?? {})) {
+    if (!data || !Array.isArray(data.t) || !Array.isArray(data.v)) {
+      continue;
+    }
+    const length = Math.min(data.t.length, data.v.length);
+    const t = new Float64Array(length);
+    const v = new Float64Array(length);
+    for (let i = 0; i < length; i++) {
+      t[i] = fromMs + data.t[i];
+      v[i] = data.v[i];
+    }
+    series[metric as HistoryMetric] = { t, v };
+    transfer.push(...buffersOf(t, v));
+  }
+
+  flush();
+  const response: WorkerResponse = {
+    type: 'history',
+    window: {
+      fromMs,
+      toMs: Number(reply.to_ms),
+      columns: Number(reply.columns),
+      resolutionMs: Number(reply.resolution_ms),
+      series
+    }
+  };
+  self.postMessage(response, { transfer });
+};
+
+const clearHistory = () => {
+  history.clear();
+  coreHistory.clear();
+  historyDirty = true;
+};
+
+const clearProcHistory = () => {
+  procHistory.clear();
+  procHistoryDirty = true;
+};
+
+const addProcSample = (ts: number, proc: ProcStats) => {
+  /* If the monitored process PID changed (process restarted or replaced),
+   * reset the history to avoid mixing different processes into one graph.
+   */
+  if (procHistory.length > 0 && procHistory.last(5) !== proc.pid) {
+    procHistory.clear();
+  }
+  procHistory.push([
+    ts,
+    proc.cpu,
+    proc.rss_kb / 1024,
+    proc.pss_kb / 1024,
+    proc.uss_kb / 1024,
+    proc.pid
+  ]);
+  procHistoryDirty = true;
+};
+
+const handleFrame = (text: string) => {
+  let data: any;
+  try {
+    data = JSON.parse(text);
+  } catch {
+    /* Ignore invalid JSON frames */
+    return;
+  }
+  if (!data || typeof data !== 'object') {
+    return;
+  }
+
+  /* Resume refused (server restarted or token expired): start over */
+  if (data.error && data.error.type === 'resume_failed') {
+    lastStatsSeq = 0;
+    lastLogSeq = 0;
+    clearHistory();
+    clearProcHistory();
+    postMessageData(data);
+    return;
+  }
+
+  /* Streamed log line from the backend log monitor */
+  if (typeof data.log === 'string') {
+    /* Drop lines already seen before a resume */
+    if (typeof data.seq === 'number') {
+      if (data.seq <= lastLogSeq) {
+        return;
+      }
+      lastLogSeq = data.seq;
+    }
+    pendingLogLines.push({
+      text: data.log,
+      level: typeof data.level === 'string' ? data.level : 'debug'
+    });
+    if (pendingLogLines.length > MAX_LOG_BATCH_LINES) {
+      pendingLogLines = pendingLogLines.slice(-MAX_LOG_BATCH_LINES);
+    }
+    scheduleFlush();
+    return;
+  }
+
+  /* Downsampled long history window */
+  if (data.history && typeof data.history === 'object') {
+    postHistoryWindow(data.history);
+    return;
+  }
+
+  /* Session, one-shot responses, server push events and replies to other commands */
+  if (
+    data.session ||
+    data.resumed ||
+    Array.isArray(data.processes) ||
+    Array.isArray(data.storage) ||
+    data.system ||
+    data.process_info ||
+    data.cgi_update_result ||
+    data.event ||
+    data.alert_rule ||
+    data.stats_summary ||
+    data.burst_capture ||
+    data.burst ||
+    data.opened ||
+    data.closed ||
+    typeof data.ch === 'number' ||
+    typeof data.cpu !== 'number'
+  ) {
+    postMessageData(data);
+    return;
+  }
+
+  /* Drop stats frames already seen before a resume */
+  if (typeof data.seq === 'number') {
+    if (data.seq <= lastStatsSeq) {
+      return;
+    }
+    lastStatsSeq = data.seq;
+  }
+
+  const stats = data as SysStats;
+  const cpuPerCore = Array.isArray(stats.cpu_per_core)
+    ? stats.cpu_per_core
+    : [];
+  const memUsedKb = stats.mem_total_kb - stats.mem_available_kb;
+  history.push([
+    stats.ts,
+    stats.cpu,
+    (memUsedKb / stats.mem_total_kb) * 100,
+    cpuPerCore.length
+  ]);
+  coreHistory.widen(cpuPerCore.length);
+  coreHistory.push(cpuPerCore);
+  historyDirty = true;
+
+  if (stats.proc && !(stats.error && stats.error.type === 'process_not_found')) {
+    addProcSample(stats.ts, stats.proc);
+  }
+
+  pendingStats = stats;
+  scheduleFlush();
+};
+
+self.onmessage = (event: MessageEvent<WorkerRequest>) => {
+  const request = event.data;
+
+  if (request.type === 'message') {
+    handleFrame(request.data);
+    return;
+  }
+
+  /* The cleared state itself is not posted, the hook already reset its copy */
+  if (request.type === 'clear') {
+    if (request.history) {
+      history.clear();
+      coreHistory.clear();
+      historyDirty = false;
+      pendingStats = undefined;
+      pendingLogLines = [];
+    }
+    if (request.history || request.procHistory) {
+      procHistory.clear();
+      procHistoryDirty = false;
+    }
+    if (request.seq) {
+      lastStatsSeq = 0;
+      lastLogSeq = 0;
+    }
+  }
+};
@@ -6,22 +6,68 @@
  * - Process monitor snapshots and errors
  * - One-shot process list, storage, and system info responses
  * - Live log line streaming
+ * - Downsampled long history windows for the charts (backend -H)
+ * - Resuming the previous session after a reconnect (replay of missed frames)
  * - Request helpers for the system monitor backend
+ *
+ * Frames are decoded and history is kept in systemStatsWorker.ts; the hook
+ * only applies its batched updates, at most once per display frame.
  */
 import { useEffect, useRef, useState } from 'react';
 import { useReconnectableWebSocket } from './useReconnectableWebSocket';
 import {
   HistoryPoint,
-  LogLine,
+  HistoryWindow,
   ProcHistoryPoint,
+  SessionInfo,
   ProcStats,
   StorageInfo,
   SystemInfo,
   SysStats
 } from './systemStatsTypes';
+import { LogStore } from './logStore';
+import type {
+  HistoryBatch,
+  ProcHistoryBatch,
+  WorkerRequest,
+  WorkerResponse,
+  WorkerUpdate
+} from './systemStatsWorker';
+
+/* Log history depth, see logStore.ts */
+const MAX_LOG_LINES = 100000;
+
+/* Convert worker history arrays to the points consumed by the charts */
+const toHistoryPoints = (batch: HistoryBatch): HistoryPoint[] => {
+  const points: HistoryPoint[] = new Array(batch.length);
+  for (let i = 0; i < batch.length; i++) {
+    const offset = i * batch.coreWidth;
+    points[i] = {
+      ts: batch.ts[i],
+      cpu: batch.cpu[i],
+      mem: batch.mem[i],
+      cpuPerCore: Array.from(
+        batch.cores.subarray(offset, offset + batch.coreCounts[i])
+      )
+    };
+  }
+  return points;
+};
 
-const MAX_HISTORY_POINTS = 60;
-const MAX_LOG_LINES = 500;
+const toProcHistoryPoints = (batch: ProcHistoryBatch): ProcHistoryPoint[] => {
+  const points: ProcHistoryPoint[] = new Array(batch.length);
+  for (let i = 0; i < batch.length; i++) {
+    points[i] = {
+      ts: batch.ts[i],
+      cpu: batch.cpu[i],
+      rss: batch.rss[i],
+      pss: batch.pss[i],
+      uss: batch.uss[i],
+      pid: batch.pid[i]
+    };
+  }
+  return points;
+};
 
 interface UseSystemStatsStreamOptions {
   url: string;
@@ -41,8 +87,13 @@ interface UseSystemStatsStreamResult {
   processList: string[];
   storageInfo: StorageInfo[];
   systemInfo: SystemInfo | null;
-  logLines: LogLine[];
+  /* Log history; logVersion changes whenever its content does */
+  logStore: LogStore;
+  logVersion: number;
   logStreaming: boolean;
+  /* Latest long history window, see requestHistory */
+  historyWindow: HistoryWindow | null;
+  historyError: string | null;
   sendMonitorRequest: () => void;
   requestProcessList: () => void;
   requestStorageInfo: () => void;
@@ -51,6 +102,8 @@ interface UseSystemStatsStreamResult {
   startLogStream: () => void;
   stopLogStream: () => void;
   clearLogLines: () => void;
+  /* Request the last windowMs of system CPU and RAM at columns points per series */
+  requestHistory: (windowMs: number, columns: number) => void;
 }
 
 export const useSystemStatsStream = ({
@@ -68,14 +121,44 @@ export const useSystemStatsStream = ({
   const [processList, setProcessList] = useState<string[]>([]);
   const [storageInfo, setStorageInfo] = useState<StorageInfo[]>([]);
   const [systemInfo, setSystemInfo] = useState<SystemInfo | null>(null);
-  const [logLines, setLogLines] = useState<LogLine[]>([]);
+  const [logStore] = useState<LogStore>(() => new LogStore(MAX_LOG_LINES));
+  const [logVersion, setLogVersion] = useState<number>(0);
   const [logStreaming, setLogStreaming] = useState<boolean>(false);
+  const [historyWindow, setHistoryWindow] = useState<HistoryWindow | null>(
+    null
+  );
+  const [historyError, setHistoryError] = useState<string | null>(null);
 
   /* Refs */
   const procNameRef = useRef<string>(procName);
   procNameRef.current = procName;
+  const logStreamingRef = useRef<boolean>(logStreaming);
+  logStreamingRef.current = logStreaming;
+
+  /* Resume state of the previous connection */
+  const sessionRef = useRef<SessionInfo | null>(null);
+  const lastStatsSeqRef = useRef<number>(0);
+  const lastLogSeqRef = useRef<number>(0);
+
+  /* Window of the latest history request, older replies are dropped */
+  const historyWindowMsRef = useRef<number>(0);
+
+  /* Decoder worker, see systemStatsWorker.ts */
+  const workerRef = useRef<Worker | null>(null);
+
+  const postToWorker = (request: WorkerRequest) => {
+    workerRef.current?.postMessage(request);
+  };
+
+  const resetResumeState = () => {
+    sessionRef.current = null;
+    lastStatsSeqRef.current = 0;
+    lastLogSeqRef.current = 0;
+    postToWorker({ type: 'clear', seq: true });
+  };
 
   const resetStreamData = () => {
+    postToWorker({ type: 'clear', history: true });
     setStats(null);
     setHistory([]);
     setProcHistory([]);
@@ -84,143 +167,194 @@ export const useSystemStatsStream = ({
     setProcessList([]);
     setStorageInfo([]);
     setSystemInfo(null);
-    setLogLines([]);
+    logStore.clear();
+    setLogVersion((v) => v + 1);
     setLogStreaming(false);
+    setHistoryWindow(null);
+    setHistoryError(null);
   };
 
   useEffect(() => {
     setConnected(false);
     setError(null);
     resetStreamData();
+    resetResumeState();
   }, [url]);
 
-  const { sendJson } = useReconnectableWebSocket({
-    url,
-    onOpen: (socket) => {
-      resetStreamData();
-      setConnected(false);
-      setError(null);
-      /* NOTE: Enable stats streaming for this connection */
-      socket.send(JSON.stringify({ stats_stream: true }));
-    },
-    onMessage: (event) => {
-      /* Server sends JSON snapshots and one-shot responses */
-      try {
-        const data = JSON.parse(event.data);
-
-        /* One-shot process list */
-        if (Array.isArray(data.processes)) {
-          setProcessList(data.processes);
-          return;
-        }
+  /* Subscribe from scratch, used on first connect and when a resume is refused */
+  const subscribeFresh = (send: (data: unknown) => void, restore: boolean) => {
+    send({ stats_stream: true });
+    if (!restore) {
+      return;
+    }
+    if (procNameRef.current.trim() !== '') {
+      send({ monitor: procNameRef.current.trim() });
+    }
+    if (logStreamingRef.current) {
+      send({ log_stream: true });
+    }
+  };
 
-        /* One-shot storage list */
-        if (Array.isArray(data.storage)) {
-          setStorageInfo(data.storage);
-          return;
-        }
+  /* Apply one batch of decoded stats frames and log lines */
+  const applyUpdate = (update: WorkerUpdate) => {
+    lastStatsSeqRef.current = update.statsSeq;
+    lastLogSeqRef.current = update.logSeq;
 
-        /* One-shot system info */
-        if (data.system && typeof data.system === 'object') {
-          setSystemInfo(data.system);
-          return;
-        }
+    if (update.history) {
+      setHistory(toHistoryPoints(update.history));
+    }
+    if (update.procHistory) {
+      setProcHistory(toProcHistoryPoints(update.procHistory));
+    }
+    if (update.logLines) {
+      logStore.append(update.logLines);
+      setLogVersion((v) => v + 1);
+    }
 
-        /* Streamed log line from the backend log monitor */
-        if (typeof data.log === 'string') {
-          setLogLines((prev) => {
-            const next: LogLine[] = [
-              ...prev,
-              {
-                text: data.log,
-                level: typeof data.level === 'string' ? data.level : 'debug'
-              }
-            ];
-            return next.length > MAX_LOG_LINES
-              ? next.slice(-MAX_LOG_LINES)
-              : next;
-          });
-          return;
-        }
+    const data = update.stats;
+    if (!data) {
+      return;
+    }
+    setConnected(true);
+    setStats(data);
+
+    /* Optional per-process stats */
+    if (data.error && data.error.type === 'process_not_found') {
+      setProcError(data.error.message);
+
+      /* Only clear process state if we are actually monitoring something */
+      if (procNameRef.current.trim() !== '') {
+        setProcStats(null);
+      }
+    } else if (data.proc) {
+      setProcStats(data.proc);
+      setProcError(null);
+    }
+  };
+
+  /* Handle a message that is not a stats frame or log line */
+  const handleMessage = (data: any) => {
+    /* Resume token of this connection (the previous one is no longer valid) */
+    if (data.session && typeof data.session.token === 'string') {
+      /* A resume request for the old token was already sent from onOpen */
+      sessionRef.current = data.session;
+      return;
+    }
+
+    /* Resume refused (server restarted or token expired): start over.
+     * The worker already dropped its history and resume positions.
+     */
+    if (data.error && data.error.type === 'resume_failed') {
+      lastStatsSeqRef.current = 0;
+      lastLogSeqRef.current = 0;
+      subscribeFresh(sendJson, true);
+      return;
+    }
+
+    /* The previous reply is still on its way; the next refresh asks again */
+    if (data.error && data.error.type === 'history_busy') {
+      return;
+    }
+
+    /* History requests refused (backend started without -H) */
+    if (
+      data.error &&
+      (data.error.type === 'history_disabled' ||
+        data.error.type === 'invalid_history_request' ||
+        data.error.type === 'history_too_large')
+    ) {
+      setHistoryError(data.error.message);
+      return;
+    }
+
+    /* One-shot process list */
+    if (Array.isArray(data.processes)) {
+      setProcessList(data.processes);
+      return;
+    }
+
+    /* One-shot storage list */
+    if (Array.isArray(data.storage)) {
+      setStorageInfo(data.storage);
+      return;
+    }
+
+    /* One-shot system info */
+    if (data.system && typeof data.system === 'object') {
+      setSystemInfo(data.system);
+    }
+
+    /* Server push events (e.g. loop_lag, alert), the end of a resume replay
+     * and replies to other commands are not used here.
+     */
+  };
 
-        setConnected(true);
-        setStats(data);
+  const handleMessageRef = useRef(handleMessage);
+  handleMessageRef.current = handleMessage;
+  const applyUpdateRef = useRef(applyUpdate);
+  applyUpdateRef.current = applyUpdate;
 
-        /* Set local proc stats state */
-        if (data.proc) {
-          setProcStats(data.proc);
+  /* Start the decoder worker before the socket connects */
+  useEffect(() => {
+    const worker = new Worker(
+      new URL('./systemStatsWorker.ts', import.meta.url),
+      { type: 'module' }
+    );
+    worker.onmessage = (event: MessageEvent<WorkerResponse>) => {
+      const response = event.data;
+      if (response.type === 'update') {
+        applyUpdateRef.current(response);
+      } else if (response.type === 'history') {
+        /* The span is exactly the requested window_ms */
+        const reply = response.window;
+        if (reply.toMs - reply.fromMs === historyWindowMsRef.current) {
+          setHistoryWindow(reply);
+          setHistoryError(null);
         }
+      } else {
+        handleMessageRef.current(response.data);
+      }
+    };
+    workerRef.current = worker;
 
-        const memUsedKb = data.mem_total_kb - data.mem_available_kb;
-        const memPercent = (memUsedKb / data.mem_total_kb) * 100;
-        setHistory((prev) => {
-          const next = [
-            ...prev,
-            {
-              ts: data.ts,
-              cpu: data.cpu,
-              mem: memPercent,
-              cpuPerCore: Array.isArray(data.cpu_per_core)
-                ? [...data.cpu_per_core]
-                : []
-            }
-          ];
-          return next.length > MAX_HISTORY_POINTS
-            ? next.slice(-MAX_HISTORY_POINTS)
-            : next;
-        });
-
-        /* Optional per-process stats */
-        if (data.error && data.error.type === 'process_not_found') {
-          setProcError(data.error.message);
-
-          /* Only clear process state if we are actually monitoring something */
-          if (procNameRef.current.trim() !== '') {
-            setProcStats(null);
-          }
-        } else if (data.proc) {
-          setProcError(null);
-          setProcHistory((prev) => {
-            /* If the monitored process PID changed (process restarted or replaced),
-             * reset the history to avoid mixing different processes into one graph.
-             *
-             * We must compare against the last recorded PID, not React state,
-             * because setStats() is async and stats.proc may be stale here.
-             */
-            if (prev.length > 0) {
-              const last = prev[prev.length - 1];
-              if (last.pid !== undefined && last.pid !== data.proc.pid) {
-                return [
-                  {
-                    ts: data.ts,
-                    cpu: data.proc.cpu,
-                    rss: data.proc.rss_kb / 1024,
-                    pss: data.proc.pss_kb / 1024,
-                    uss: data.proc.uss_kb / 1024,
-                    pid: data.proc.pid
-                  }
-                ];
-              }
+    return () => {
+      worker.terminate();
+      workerRef.current = null;
+    };
+  }, []);
+
+  const { sendJson } = useReconnectableWebSocket({
+    url,
+    onOpen: (socket) => {
+      setConnected(false);
+      setError(null);
+
+      /* Reconnect: ask the server to restore the previous session and
+       * replay what was missed, keeping the local history.
+       */
+      const session = sessionRef.current;
+      if (session) {
+        socket.send(
+          JSON.stringify({
+            resume: {
+              token: session.token,
+              stats_seq: lastStatsSeqRef.current,
+              log_seq: lastLogSeqRef.current
             }
+          })
+        );
+        return;
+      }
 
-            const next = [
-              ...prev,
-              {
-                ts: data.ts,
-                cpu: data.proc.cpu,
-                rss: data.proc.rss_kb / 1024,
-                pss: data.proc.pss_kb / 1024,
-                uss: data.proc.uss_kb / 1024,
-                pid: data.proc.pid
-              }
-            ];
-            return next.length > MAX_HISTORY_POINTS
-              ? next.slice(-MAX_HISTORY_POINTS)
-              : next;
-          });
-        }
-      } catch {
-        /* Ignore invalid JSON frames */
+      resetStreamData();
+      resetResumeState();
+      /* NOTE: Enable stats streaming for this connection */
+      subscribeFresh((data) => socket.send(JSON.stringify(data)), false);
+    },
+    onMessage: (event) => {
+      /* Server sends JSON text frames, decoded by the worker */
+      if (typeof event.data === 'string') {
+        postToWorker({ type: 'message', data: event.data });
       }
     },
     onError: () => {
@@ -241,6 +375,7 @@ export const useSystemStatsStream = ({
 
     setProcError(null);
     setProcHistory([]);
+    postToWorker({ type: 'clear', procHistory: true });
   };
 
   /* Request a one-shot process list */
@@ -273,7 +408,23 @@ export const useSystemStatsStream = ({
 
   /* Clear log lines from local state (does not affect backend subscription) */
   const clearLogLines = () => {
-    setLogLines([]);
+    logStore.clear();
+    setLogVersion((v) => v + 1);
+  };
+
+  /* Request a downsampled history window, one point group per pixel column */
+  const requestHistory = (windowMs: number, columns: number) => {
+    if (historyWindowMsRef.current !== windowMs) {
+      setHistoryWindow(null);
+    }
+    historyWindowMsRef.current = windowMs;
+    sendJson({
+      history: {
+        window_ms: windowMs,
+        columns,
+        metrics: ['cpu', 'mem_used_percent']
+      }
+    });
   };
 
   const clearMonitorInput = () => {
@@ -282,6 +433,7 @@ export const useSystemStatsStream = ({
     setProcError(null);
     setProcHistory([]);
     setProcStats(null);
+    postToWorker({ type: 'clear', procHistory: true });
 
     /* Tell backend to stop monitoring */
     sendJson({ monitor: '' });
@@ -305,10 +457,14 @@ export const useSystemStatsStream = ({
     requestStorageInfo,
     requestSystemInfo,
     clearMonitorInput,
-    logLines,
+    logStore,
+    logVersion,
     logStreaming,
     startLogStream,
     stopLogStream,
-    clearLogLines
+    clearLogLines,
+    historyWindow,
+    historyError,
+    requestHistory
   };
 };